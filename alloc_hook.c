@@ -0,0 +1,35 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "alloc_hook.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static _Thread_local uint64_t heap_calls;
+
+void *__wrap_malloc(size_t size) {
+    heap_calls++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    heap_calls++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    heap_calls++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr)
+        heap_calls++;
+    __real_free(ptr);
+}
+
+uint64_t alloc_hook_count(void) {
+    return heap_calls;
+}
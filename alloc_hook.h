@@ -0,0 +1,13 @@
+#ifndef RMS_ALLOC_HOOK_H
+#define RMS_ALLOC_HOOK_H
+#include <stdint.h>
+
+/*
+ * Allocation counting for tests, built in only by `make ALLOC_HOOK=1`
+ * (from a clean tree). The linker then routes malloc, calloc, realloc and
+ * free through the wrappers in alloc_hook.c, and every thread counts its
+ * own calls, so a caller can diff the count around a piece of work.
+ */
+uint64_t alloc_hook_count(void);
+
+#endif //RMS_ALLOC_HOOK_H
@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include "arena.h"
+
+struct arena {
+    uint8_t *base;
+    size_t used;
+};
+
+static _Thread_local struct arena arena;
+
+void *arena_alloc(size_t size) {
+    if (!arena.base && !(arena.base = malloc(ARENA_SIZE)))
+        return NULL;
+
+    size_t start = (arena.used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size > ARENA_SIZE - start)
+        return NULL;
+    arena.used = start + size;
+    return arena.base + start;
+}
+
+size_t arena_mark(void) {
+    return arena.used;
+}
+
+void arena_release(size_t mark) {
+    if (mark < arena.used)
+        arena.used = mark;
+}
+
+void arena_reset(void) {
+    arena.used = 0;
+}
+
+// a freed block's first word links it into the list
+void *pool_get(struct pool *p) {
+    pthread_mutex_lock(&p->lock);
+    void *block = p->free;
+    if (block) {
+        p->free = *(void **)block;
+        p->spare--;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return block ? block : malloc(p->size < sizeof(void *) ? sizeof(void *) : p->size);
+}
+
+void pool_put(struct pool *p, void *block) {
+    if (!block)
+        return;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->spare < p->keep) {
+        *(void **)block = p->free;
+        p->free = block;
+        p->spare++;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&p->lock);
+    free(block);
+}
@@ -0,0 +1,45 @@
+#ifndef RMS_ARENA_H
+#define RMS_ARENA_H
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define ARENA_SIZE (256 * 1024) // per thread; a channel file encode is the largest user
+#define ARENA_ALIGN 16
+
+/*
+ * Per-thread bump arena for scratch memory on the packet path. Its block is
+ * allocated on a thread's first use and kept for good, so steady-state
+ * allocation is a pointer bump. process_packet resets it after every
+ * packet; code that may run on other threads brackets its use with
+ * arena_mark/arena_release instead.
+ *
+ * arena_alloc returns NULL once the arena is exhausted. Callers fall back
+ * to failing the operation, never to malloc.
+ */
+void *arena_alloc(size_t size);
+size_t arena_mark(void);
+void arena_release(size_t mark);
+void arena_reset(void);
+
+/*
+ * Recycling free list of fixed-size blocks for objects that are allocated
+ * on one thread and released on another (jobs, tasks, index entries).
+ * Blocks come from malloc until `keep` spares are on the list; after that
+ * every get is served from the list.
+ */
+struct pool {
+    pthread_mutex_t lock;
+    void *free;
+    size_t size;
+    int spare;
+    int keep;
+};
+
+#define POOL_INITIALIZER(block_size, max_spare) \
+    { PTHREAD_MUTEX_INITIALIZER, NULL, (block_size), 0, (max_spare) }
+
+void *pool_get(struct pool *p);
+void pool_put(struct pool *p, void *block);
+
+#endif //RMS_ARENA_H
@@ -0,0 +1,151 @@
+#include <string.h>
+#include "bitpack.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BITPACK_AVX2 1
+#endif
+
+unsigned bitpack_width(long n) {
+    if (n < 2)
+        return 0;
+
+    unsigned width = 64 - (unsigned)__builtin_clzl((unsigned long)(n - 1));
+    return width <= BITPACK_MAX_WIDTH ? width : 0;
+}
+
+size_t bitpack_bytes(size_t count, unsigned width) {
+    return (count * width + 7) / 8;
+}
+
+static void pack_scalar(const long *in, size_t count, unsigned width, uint8_t *out) {
+    uint64_t mask = (1ull << width) - 1;
+    uint64_t acc = 0;
+    unsigned bits = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        acc |= ((uint64_t)in[i] & mask) << bits;
+        for (bits += width; bits >= 8; bits -= 8) {
+            *out++ = (uint8_t)acc;
+            acc >>= 8;
+        }
+    }
+    if (bits)
+        *out = (uint8_t)acc;
+}
+
+static void unpack_scalar(const uint8_t *in, size_t count, unsigned width, long *out) {
+    uint64_t mask = (1ull << width) - 1;
+    uint64_t acc = 0;
+    unsigned bits = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        for (; bits < width; bits += 8)
+            acc |= (uint64_t)*in++ << bits;
+        out[i] = (long)(acc & mask);
+        acc >>= width;
+        bits -= width;
+    }
+}
+
+#ifdef BITPACK_AVX2
+/*
+ * A group of eight symbols spans at most four 64-bit words. Symbol i
+ * starts at bit i * width, so its share of word j is the symbol shifted
+ * left by i * width - 64 * j when that is non-negative, and right by the
+ * negation otherwise. Variable shifts by 64 or more give zero, which takes
+ * care of words the symbol does not reach.
+ */
+__attribute__((target("avx2")))
+static size_t pack_avx2(const long *in, size_t count, unsigned width, uint8_t *out) {
+    __m256i lsh[8], rsh[8];
+    for (int i = 0; i < 8; i++) {
+        long long c[4];
+        for (int j = 0; j < 4; j++)
+            c[j] = (long long)(i * width) - 64 * j;
+        lsh[i] = _mm256_setr_epi64x(c[0] >= 0 ? c[0] : 64, c[1] >= 0 ? c[1] : 64,
+                                    c[2] >= 0 ? c[2] : 64, c[3] >= 0 ? c[3] : 64);
+        rsh[i] = _mm256_setr_epi64x(c[0] < 0 ? -c[0] : 64, c[1] < 0 ? -c[1] : 64,
+                                    c[2] < 0 ? -c[2] : 64, c[3] < 0 ? -c[3] : 64);
+    }
+
+    uint64_t mask = (1ull << width) - 1;
+    size_t groups = count / 8;
+    for (size_t g = 0; g < groups; g++, in += 8, out += width) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int i = 0; i < 8; i++) {
+            __m256i s = _mm256_set1_epi64x((long long)((uint64_t)in[i] & mask));
+            acc = _mm256_or_si256(acc, _mm256_sllv_epi64(s, lsh[i]));
+            acc = _mm256_or_si256(acc, _mm256_srlv_epi64(s, rsh[i]));
+        }
+
+        uint64_t words[4];
+        _mm256_storeu_si256((__m256i *)words, acc);
+        memcpy(out, words, width);
+    }
+    return groups * 8;
+}
+
+/*
+ * The inverse: each lane picks the word its symbol starts in and the one
+ * after (a 32-bit permute of word index pairs), shifts both into place and
+ * masks. A symbol that starts on a word boundary shifts the next word out
+ * by 64.
+ */
+__attribute__((target("avx2")))
+static size_t unpack_avx2(const uint8_t *in, size_t count, unsigned width, long *out) {
+    __m256i lo_idx[2], hi_idx[2], rsh[2], lsh[2];
+    for (int h = 0; h < 2; h++) {
+        int lo[8], hi[8];
+        long long r[4], l[4];
+        for (int k = 0; k < 4; k++) {
+            unsigned bit = (unsigned)(4 * h + k) * width;
+            int j = (int)(bit / 64), next = j < 3 ? j + 1 : 3;
+            lo[2 * k] = 2 * j;
+            lo[2 * k + 1] = 2 * j + 1;
+            hi[2 * k] = 2 * next;
+            hi[2 * k + 1] = 2 * next + 1;
+            r[k] = bit % 64;
+            l[k] = bit % 64 ? 64 - bit % 64 : 64;
+        }
+        lo_idx[h] = _mm256_setr_epi32(lo[0], lo[1], lo[2], lo[3], lo[4], lo[5], lo[6], lo[7]);
+        hi_idx[h] = _mm256_setr_epi32(hi[0], hi[1], hi[2], hi[3], hi[4], hi[5], hi[6], hi[7]);
+        rsh[h] = _mm256_setr_epi64x(r[0], r[1], r[2], r[3]);
+        lsh[h] = _mm256_setr_epi64x(l[0], l[1], l[2], l[3]);
+    }
+
+    __m256i mask = _mm256_set1_epi64x((long long)((1ull << width) - 1));
+    size_t groups = count / 8;
+    for (size_t g = 0; g < groups; g++, in += width, out += 8) {
+        uint64_t words[4] = {0};
+        memcpy(words, in, width);
+        __m256i v = _mm256_loadu_si256((const __m256i *)words);
+
+        for (int h = 0; h < 2; h++) {
+            __m256i lo = _mm256_permutevar8x32_epi32(v, lo_idx[h]);
+            __m256i hi = _mm256_permutevar8x32_epi32(v, hi_idx[h]);
+            __m256i s = _mm256_or_si256(_mm256_srlv_epi64(lo, rsh[h]), _mm256_sllv_epi64(hi, lsh[h]));
+            _mm256_storeu_si256((__m256i *)(out + 4 * h), _mm256_and_si256(s, mask));
+        }
+    }
+    return groups * 8;
+}
+#endif
+
+void bitpack_pack(const long *in, size_t count, unsigned width, uint8_t *out) {
+    size_t done = 0;
+#ifdef BITPACK_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        done = pack_avx2(in, count, width, out);
+#endif
+    pack_scalar(in + done, count - done, width, out + bitpack_bytes(done, width));
+}
+
+void bitpack_unpack(const uint8_t *in, size_t count, unsigned width, long *out) {
+    size_t done = 0;
+#ifdef BITPACK_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        done = unpack_avx2(in, count, width, out);
+#endif
+    unpack_scalar(in + bitpack_bytes(done, width), count - done, width, out + done);
+}
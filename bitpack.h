@@ -0,0 +1,28 @@
+#ifndef RMS_BITPACK_H
+#define RMS_BITPACK_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define BITPACK_MAX_WIDTH 32
+
+/*
+ * Fixed-width bit packing for RSA symbols. Every ciphertext symbol is below
+ * the modulus n, so it fits in bitpack_width(n) bits; symbols are laid out
+ * back to back, least significant bit first. Eight symbols always fill
+ * exactly `width` bytes, so a run whose length is a multiple of 8 ends on a
+ * byte boundary and can be continued at bitpack_bytes(count, width).
+ *
+ * On x86-64 CPUs with AVX2 whole groups of eight go through a vector
+ * kernel; the tail and other CPUs use the scalar loop. Both produce the
+ * same bytes.
+ */
+
+// bits needed for any value below n, or 0 if n < 2 or needs more than BITPACK_MAX_WIDTH
+unsigned bitpack_width(long n);
+size_t bitpack_bytes(size_t count, unsigned width);
+
+// out must hold bitpack_bytes(count, width); values are masked to width bits
+void bitpack_pack(const long *in, size_t count, unsigned width, uint8_t *out);
+void bitpack_unpack(const uint8_t *in, size_t count, unsigned width, long *out);
+
+#endif //RMS_BITPACK_H
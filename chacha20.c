@@ -0,0 +1,64 @@
+#include <stdint.h>
+#include <string.h>
+#include "chacha20.h"
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d)                      \
+    do {                                              \
+        a += b; d ^= a; d = ROTL32(d, 16);            \
+        c += d; b ^= c; b = ROTL32(b, 12);            \
+        a += b; d ^= a; d = ROTL32(d, 8);             \
+        c += d; b ^= c; b = ROTL32(b, 7);             \
+    } while (0)
+
+static uint32_t load_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void chacha20_block(const uint32_t in[16], uint8_t out[64]) {
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+
+    for (int i = 0; i < 10; i++) {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        uint32_t v = x[i] + in[i];
+        out[4 * i + 0] = (uint8_t)v;
+        out[4 * i + 1] = (uint8_t)(v >> 8);
+        out[4 * i + 2] = (uint8_t)(v >> 16);
+        out[4 * i + 3] = (uint8_t)(v >> 24);
+    }
+}
+
+void chacha20_xor(const uint8_t key[CHACHA20_KEY_SIZE], const uint8_t nonce[CHACHA20_NONCE_SIZE],
+                  uint32_t counter, uint8_t *buf, size_t len) {
+    uint32_t state[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+    };
+    for (int i = 0; i < 8; i++)
+        state[4 + i] = load_le32(key + 4 * i);
+    state[12] = counter;
+    for (int i = 0; i < 3; i++)
+        state[13 + i] = load_le32(nonce + 4 * i);
+
+    uint8_t block[64];
+    while (len > 0) {
+        chacha20_block(state, block);
+        size_t n = len < sizeof(block) ? len : sizeof(block);
+        for (size_t i = 0; i < n; i++)
+            buf[i] ^= block[i];
+        buf += n;
+        len -= n;
+        state[12]++;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef RMS_CHACHA20_H
+#define RMS_CHACHA20_H
+#include <stdint.h>
+#include <stddef.h>
+
+#define CHACHA20_KEY_SIZE 32
+#define CHACHA20_NONCE_SIZE 12
+
+/*
+ * ChaCha20 stream cipher (RFC 8439). Encryption and decryption are the same
+ * operation: buf is XORed in place with the keystream.
+ */
+void chacha20_xor(const uint8_t key[CHACHA20_KEY_SIZE], const uint8_t nonce[CHACHA20_NONCE_SIZE],
+                  uint32_t counter, uint8_t *buf, size_t len);
+
+#endif //RMS_CHACHA20_H
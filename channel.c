@@ -1,32 +1,119 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "utility.h"
 #include "channel.h"
+#include "io_backend.h"
+#include "history.h"
+#include "search.h"
+#include "rcu.h"
+#include "replica.h"
+#include "arena.h"
+#include "lockprof.h"
+
+static void channel_publish(struct channel_manager *cm);
+static int channel_page_in(struct channel_manager *cm, struct channel *ch);
+static void channel_evict(struct channel_manager *cm, struct channel *ch);
 
 void channel_manager_init(struct channel_manager *cm){
     memset(cm, 0, sizeof(struct channel_manager));
     pthread_mutex_init(&cm->lock, NULL);
+    channel_publish(cm);
+}
+
+/*
+ * Rebuilds the listing snapshot from the live tables and swaps it in.
+ * Called with cm->lock held, after any change to channels or members.
+ */
+static void channel_publish(struct channel_manager *cm){
+    struct channel_snapshot *s = malloc(sizeof(*s) + (size_t)cm->channel_count * sizeof(s->channels[0]));
+    if (!s)
+        return;
+
+    struct channel_snapshot *old = atomic_load(&cm->snapshot);
+    s->version = old ? old->version + 1 : 1;
+    s->channel_count = cm->channel_count;
+
+    for (int i = 0; i < cm->channel_count; i++){
+        struct channel *ch = &cm->channels[i];
+        struct channel_view *v = &s->channels[i];
+        memset(v, 0, sizeof(*v));
+        v->channel_id = ch->channel_id;
+        memcpy(v->channel_name, ch->channel_name, CHANNEL_NAME_SIZE);
+        v->channel_name[CHANNEL_NAME_SIZE - 1] = '\0';
+        v->participant_count = ch->participant_count;
+        memcpy(v->participant_ids, ch->participant_ids, sizeof(v->participant_ids));
+    }
+
+    for (int i = 0; i < cm->subscription_count; i++){
+        struct channel_subscription *sub = &cm->subscriptions[i];
+        for (int c = 0; c < s->channel_count; c++){
+            struct channel_view *v = &s->channels[c];
+            if (v->channel_id != sub->channel_id)
+                continue;
+            for (int p = 0; p < v->participant_count; p++){
+                if (v->participant_ids[p] == sub->user_id)
+                    v->joined_at[p] = sub->joined_at;
+            }
+            break;
+        }
+    }
+
+    atomic_store(&cm->snapshot, s);
+    if (old)
+        rcu_retire(old, free);
+}
+
+const struct channel_snapshot *channel_snapshot_begin(struct channel_manager *cm){
+    rcu_read_lock();
+    return atomic_load(&cm->snapshot);
 }
 
-int channel_create(struct channel_manager *cm, const char *name, 
+void channel_snapshot_end(void){
+    rcu_read_unlock();
+}
+
+const struct channel_view *channel_view_find(const struct channel_snapshot *s, const char *id_or_name){
+    char *endptr;
+    uint64_t channel_id = strtoull(id_or_name, &endptr, 10);
+    int by_id = *id_or_name != '\0' && *endptr == '\0';
+
+    for (int i = 0; i < s->channel_count; i++){
+        const struct channel_view *v = &s->channels[i];
+        if (by_id ? v->channel_id == channel_id : strcmp(v->channel_name, id_or_name) == 0)
+            return v;
+    }
+    return NULL;
+}
+
+uint64_t channel_create(struct channel_manager *cm, const char *name, 
                        uint64_t creator_id){
-    pthread_mutex_lock(&cm->lock);
+    return channel_create_with_id(cm, generate_id(), name, creator_id);
+}
+
+uint64_t channel_create_with_id(struct channel_manager *cm, uint64_t channel_id, const char *name,
+                                uint64_t creator_id){
+    lockprof_lock(&cm->lock);
     
     if (cm->channel_count >= MAX_CHANNELS){
-        pthread_mutex_unlock(&cm->lock);
+        lockprof_unlock(&cm->lock);
         return 0;
     }
     
-    uint64_t channel_id = generate_uuid(8);
-    
     struct channel *new_channel = &cm->channels[cm->channel_count];
+    memset(new_channel, 0, sizeof(*new_channel));
     new_channel->channel_id = channel_id;
     strncpy(new_channel->channel_name, name, CHANNEL_NAME_SIZE - 1);
     new_channel->participant_ids[0] = creator_id;
@@ -39,11 +126,46 @@ int channel_create(struct channel_manager *cm, const char *name,
     cm->subscription_count++; 
     cm->channel_count++;
     
+    if (channel_page_in(cm, new_channel) < 0){
+        cm->channel_count--;
+        cm->subscription_count--;
+        lockprof_unlock(&cm->lock);
+        return 0;
+    }
     channel_save_to_file(cm, channel_id);
-    pthread_mutex_unlock(&cm->lock);
+    replica_log_create(channel_id, new_channel->channel_name, creator_id);
+    channel_publish(cm);
+    lockprof_unlock(&cm->lock);
     return channel_id;
 }
 
+int channel_mirror(struct channel_manager *cm, uint64_t channel_id, const char *name, int home,
+                   const uint64_t *members, int member_count){
+    lockprof_lock(&cm->lock);
+    struct channel *ch = channel_find(cm, channel_id);
+    if (!ch){
+        if (cm->channel_count >= MAX_CHANNELS){
+            lockprof_unlock(&cm->lock);
+            return -1;
+        }
+        ch = &cm->channels[cm->channel_count++];
+        memset(ch, 0, sizeof(*ch));
+        ch->channel_id = channel_id;
+        ch->remote = 1;
+    } else if (!ch->remote){
+        lockprof_unlock(&cm->lock);
+        return -1; // we own it; the owner's copy is the only one that changes
+    }
+
+    strncpy(ch->channel_name, name, CHANNEL_NAME_SIZE - 1);
+    ch->home = home;
+    ch->participant_count = member_count < MAX_PARTICIPANTS ? member_count : MAX_PARTICIPANTS;
+    memcpy(ch->participant_ids, members, (size_t)ch->participant_count * sizeof(members[0]));
+    channel_publish(cm);
+    lockprof_unlock(&cm->lock);
+    return 0;
+}
+
 struct channel *channel_find(struct channel_manager *cm, uint64_t channel_id){
     for (int i = 0; i < cm->channel_count; i++){
         if (cm->channels[i].channel_id == channel_id){
@@ -62,33 +184,48 @@ struct channel *channel_find_by_name(struct channel_manager *cm, const char *nam
     return NULL;
 }
 
+// called with cm->lock held
+static void channel_add_member(struct channel_manager *cm, struct channel *ch, uint64_t user_id){
+    ch->participant_ids[ch->participant_count] = user_id;
+    ch->participant_count++;
+
+    cm->subscriptions[cm->subscription_count].channel_id = ch->channel_id;
+    cm->subscriptions[cm->subscription_count].user_id = user_id;
+    cm->subscriptions[cm->subscription_count].joined_at = time(NULL);
+    cm->subscription_count++;
+}
+
 int channel_join(struct channel_manager *cm, uint64_t channel_id, uint64_t user_id){
     
-    pthread_mutex_lock(&cm->lock);
+    lockprof_lock(&cm->lock);
     struct channel *ch = channel_find(cm, channel_id);
 
     if (!ch){
-        pthread_mutex_unlock(&cm->lock);
+        lockprof_unlock(&cm->lock);
         return -1;
     }
     
     for (int i = 0; i < ch->participant_count; i++){
         if (ch->participant_ids[i] == user_id) {
-            pthread_mutex_unlock(&cm->lock);
+            lockprof_unlock(&cm->lock);
             return -3;
         }
     }
     
-    ch->participant_ids[ch->participant_count] = user_id;
-    ch->participant_count++;
-    
-    cm->subscriptions[cm->subscription_count].channel_id = channel_id;
-    cm->subscriptions[cm->subscription_count].user_id = user_id;
-    cm->subscriptions[cm->subscription_count].joined_at = time(NULL);
-    cm->subscription_count++;
-    
+    channel_add_member(cm, ch, user_id);
     channel_save_to_file(cm, channel_id);
-    pthread_mutex_unlock(&cm->lock);
+    replica_log_join(channel_id, user_id);
+    channel_publish(cm);
+    lockprof_unlock(&cm->lock);
+    return 0;
+}
+
+static int channel_is_participant(const struct channel *ch, uint64_t user_id){
+    for (int i = 0; i < ch->participant_count; i++){
+        if (ch->participant_ids[i] == user_id)
+            return 1;
+    }
+
     return 0;
 }
 
@@ -98,35 +235,259 @@ int channel_is_member(struct channel_manager *cm, uint64_t channel_id, uint64_t
     if (!ch)
         return 0;
     
+    return channel_is_participant(ch, user_id);
+}
+
+// record payloads of the channel file (see channel.h)
+struct channel_rec_info {
+    char channel_name[CHANNEL_NAME_SIZE];
+    int32_t message_count;      // ever posted; the file holds the last MSG_BUFFER_LIMIT
+    int32_t participant_count;
+};
+
+struct channel_rec_member {
+    uint64_t user_id;
+    int64_t joined_at;
+};
+
+struct channel_rec_message {
+    uint64_t msg_id;
+    uint64_t sender_id;
+    uint32_t timestamp;
+    uint16_t msg_type;
+    uint16_t len;               // content bytes that follow
+};
+
+#define CHANNEL_REC_PAD(n) (((n) + 7) & ~(size_t)7)
+#define CHANNEL_FILE_MAX_SIZE                                                                        \
+    (sizeof(struct channel_file_header) +                                                           \
+     sizeof(struct channel_file_record) + CHANNEL_REC_PAD(sizeof(struct channel_rec_info)) +        \
+     MAX_PARTICIPANTS * (sizeof(struct channel_file_record) + sizeof(struct channel_rec_member)) +  \
+     MSG_BUFFER_LIMIT * (sizeof(struct channel_file_record) +                                       \
+                         CHANNEL_REC_PAD(sizeof(struct channel_rec_message) + sizeof(((struct msg *)0)->content))))
+
+// layout of the raw struct dumps written before CHANNEL_FILE_VERSION 1
+struct channel_dump {
+    uint64_t channel_id;
+    char channel_name[CHANNEL_NAME_SIZE];
+    uint64_t participant_ids[MAX_PARTICIPANTS];
+    int participant_count;
+    int message_count;
+    struct msg messages[MSG_BUFFER_LIMIT];
+};
+
+enum { LOAD_OK, LOAD_LEGACY, LOAD_REPAIRED, LOAD_DAMAGED, LOAD_FULL };
+
+static void channel_file_path(char *buf, size_t size, uint64_t channel_id){
+    snprintf(buf, size, "%s%" PRIu64 ".dat", "channel_", channel_id);
+}
+
+// payload is a then b, so a message header and its content need no staging copy
+static uint8_t *put_record(uint8_t *p, uint16_t type, const void *a, size_t alen, const void *b, size_t blen){
+    struct channel_file_record rec = {0};
+    rec.type = type;
+    rec.len = (uint32_t)(alen + blen);
+    rec.crc = crc32c(crc32c(0, a, alen), b, blen);
+
+    memcpy(p, &rec, sizeof(rec));
+    p += sizeof(rec);
+    memcpy(p, a, alen);
+    if (blen)
+        memcpy(p + alen, b, blen);
+    memset(p + rec.len, 0, CHANNEL_REC_PAD(rec.len) - rec.len);
+    return p + CHANNEL_REC_PAD(rec.len);
+}
+
+// called with cm->lock held; returns the encoded size
+static size_t channel_encode(struct channel_manager *cm, const struct channel *ch, uint8_t *buf){
+    struct channel_file_header *h = (struct channel_file_header *)buf;
+    uint8_t *p = buf + sizeof(*h);
+    uint32_t records = 0;
+
+    struct channel_rec_info info = {0};
+    memcpy(info.channel_name, ch->channel_name, CHANNEL_NAME_SIZE);
+    info.message_count = ch->message_count;
+    info.participant_count = ch->participant_count;
+    p = put_record(p, CHANNEL_REC_INFO, &info, sizeof(info), NULL, 0);
+    records++;
+
     for (int i = 0; i < ch->participant_count; i++){
-        if (ch->participant_ids[i] == user_id)
-            return 1;
+        struct channel_rec_member m = { .user_id = ch->participant_ids[i] };
+        for (int s = 0; s < cm->subscription_count; s++){
+            if (cm->subscriptions[s].channel_id == ch->channel_id && cm->subscriptions[s].user_id == m.user_id){
+                m.joined_at = cm->subscriptions[s].joined_at;
+                break;
+            }
+        }
+        p = put_record(p, CHANNEL_REC_MEMBER, &m, sizeof(m), NULL, 0);
+        records++;
     }
 
-    return 0;
+    int buffered = ch->message_count < MSG_BUFFER_LIMIT ? ch->message_count : MSG_BUFFER_LIMIT;
+    for (int i = ch->message_count - buffered; i < ch->message_count; i++){
+        const struct msg *msg = &ch->messages[i % MSG_BUFFER_LIMIT];
+        struct channel_rec_message m = {
+            .msg_id = msg->msg_id,
+            .sender_id = msg->sender_id,
+            .timestamp = msg->timestamp,
+            .msg_type = (uint16_t)msg->msg_type,
+            .len = (uint16_t)strnlen(msg->content, sizeof(msg->content) - 1),
+        };
+        p = put_record(p, CHANNEL_REC_MESSAGE, &m, sizeof(m), msg->content, m.len);
+        records++;
+    }
+
+    memset(h, 0, sizeof(*h));
+    h->magic = CHANNEL_FILE_MAGIC;
+    h->version = CHANNEL_FILE_VERSION;
+    h->header_size = sizeof(*h);
+    h->channel_id = ch->channel_id;
+    h->record_count = records;
+    h->crc = crc32c(0, h, offsetof(struct channel_file_header, crc));
+    return (size_t)(p - buf);
 }
 
 void channel_save_to_file(struct channel_manager *cm, uint64_t channel_id){
     struct channel *ch = channel_find(cm, channel_id);
-    if (!ch) return;
+    // an evicted ring is only on disk; writing without it would drop the messages
+    if (!ch || ch->remote || channel_page_in(cm, ch) < 0) return;
     
     char filename[256];
-    snprintf(filename, sizeof(filename), "%s%" PRIu64 ".dat", "channel_", channel_id);
-    
-    FILE *file = fopen(filename, "wb");
-    if (!file) return;
-    
-    fwrite(ch, sizeof(struct channel), 1, file);
-    fclose(file);
+    channel_file_path(filename, sizeof(filename), channel_id);
+
+    size_t mark = arena_mark();
+    uint8_t *buf = arena_alloc(CHANNEL_FILE_MAX_SIZE);
+    if (buf)
+        io_write_file(filename, buf, channel_encode(cm, ch, buf));
+    arena_release(mark);
+}
+
+/*
+ * Decodes a mapped channel file into ch, its messages into the ring at
+ * ch->messages and its memberships into subs (MAX_PARTICIPANTS entries).
+ * Stops at the first record that is cut short or fails its checksum.
+ */
+static int channel_decode(const uint8_t *data, size_t size, uint64_t channel_id,
+                          struct channel *ch, struct channel_subscription *subs){
+    const struct channel_file_header *h = (const void *)data;
+    struct msg *ring = ch->messages;
+    memset(ch, 0, sizeof(*ch));
+    ch->messages = ring;
+
+    if (size < sizeof(*h) || h->magic != CHANNEL_FILE_MAGIC){
+        const struct channel_dump *dump = (const void *)data;
+        if (size != sizeof(*dump) || dump->channel_id != channel_id || dump->participant_count < 0 ||
+            dump->participant_count > MAX_PARTICIPANTS || dump->message_count < 0)
+            return LOAD_DAMAGED;
+        ch->channel_id = channel_id;
+        memcpy(ch->channel_name, dump->channel_name, CHANNEL_NAME_SIZE);
+        ch->channel_name[CHANNEL_NAME_SIZE - 1] = '\0';
+        memcpy(ch->participant_ids, dump->participant_ids, sizeof(ch->participant_ids));
+        ch->participant_count = dump->participant_count;
+        ch->message_count = dump->message_count;
+        memcpy(ch->messages, dump->messages, sizeof(dump->messages));
+        for (int i = 0; i < ch->participant_count; i++)
+            subs[i] = (struct channel_subscription){ channel_id, ch->participant_ids[i], 0 };
+        return LOAD_LEGACY;
+    }
+
+    if (h->crc != crc32c(0, h, offsetof(struct channel_file_header, crc)))
+        return LOAD_DAMAGED;
+    if (h->version != CHANNEL_FILE_VERSION || h->header_size < sizeof(*h) || h->header_size > size){
+        printf("[ERROR] channel_%" PRIu64 ".dat: unsupported format version %u\n", channel_id, h->version);
+        return LOAD_DAMAGED;
+    }
+    if (h->channel_id != channel_id)
+        return LOAD_DAMAGED;
+
+    ch->channel_id = channel_id;
+    int32_t total = -1;
+    int first = 0;
+    int kept = 0;
+    uint32_t good = 0;
+
+    size_t off = h->header_size;
+    while (good < h->record_count && off + sizeof(struct channel_file_record) <= size){
+        const struct channel_file_record *rec = (const void *)(data + off);
+        const uint8_t *payload = data + off + sizeof(*rec);
+        if (rec->len > size - off - sizeof(*rec) || crc32c(0, payload, rec->len) != rec->crc)
+            break;
+
+        if (rec->type == CHANNEL_REC_INFO && rec->len >= sizeof(struct channel_rec_info) && total < 0){
+            const struct channel_rec_info *info = (const void *)payload;
+            memcpy(ch->channel_name, info->channel_name, CHANNEL_NAME_SIZE);
+            ch->channel_name[CHANNEL_NAME_SIZE - 1] = '\0';
+            total = info->message_count < 0 ? 0 : info->message_count;
+            first = total > MSG_BUFFER_LIMIT ? total - MSG_BUFFER_LIMIT : 0;
+        } else if (total < 0){
+            return LOAD_DAMAGED; // nothing is usable without the info record
+        } else if (rec->type == CHANNEL_REC_MEMBER && rec->len >= sizeof(struct channel_rec_member)){
+            const struct channel_rec_member *m = (const void *)payload;
+            if (ch->participant_count < MAX_PARTICIPANTS){
+                subs[ch->participant_count] = (struct channel_subscription){ channel_id, m->user_id, (time_t)m->joined_at };
+                ch->participant_ids[ch->participant_count++] = m->user_id;
+            }
+        } else if (rec->type == CHANNEL_REC_MESSAGE && rec->len >= sizeof(struct channel_rec_message)){
+            const struct channel_rec_message *m = (const void *)payload;
+            if (kept < MSG_BUFFER_LIMIT && m->len <= rec->len - sizeof(*m)){
+                struct msg *out = &ch->messages[(first + kept) % MSG_BUFFER_LIMIT];
+                out->msg_id = m->msg_id;
+                out->sender_id = m->sender_id;
+                out->timestamp = m->timestamp;
+                out->msg_type = m->msg_type;
+                size_t n = m->len < sizeof(out->content) - 1 ? m->len : sizeof(out->content) - 1;
+                memcpy(out->content, payload + sizeof(*m), n);
+                kept++;
+            }
+        }
+        // unknown record types are skipped, so a version can grow new ones
+
+        off += sizeof(*rec) + CHANNEL_REC_PAD(rec->len);
+        good++;
+    }
+
+    if (total < 0)
+        return LOAD_DAMAGED;
+    ch->message_count = first + kept;
+    return good < h->record_count ? LOAD_REPAIRED : LOAD_OK;
+}
+
+// ids double as a per-channel time index, so never let them go backwards
+static uint64_t channel_next_id(const struct channel *ch){
+    uint64_t msg_id = generate_id();
+    if (ch->message_count > 0) {
+        uint64_t last_id = ch->messages[(ch->message_count - 1) % MSG_BUFFER_LIMIT].msg_id;
+        if (msg_id <= last_id)
+            msg_id = last_id + 1;
+    }
+    return msg_id;
+}
+
+static struct msg *channel_ring_put(struct channel *ch, const struct msg *m){
+    struct msg *slot = &ch->messages[ch->message_count % MSG_BUFFER_LIMIT];
+    *slot = *m;
+    ch->message_count++;
+    return slot;
+}
+
+// appends to the ring, the channel file and the history; called with cm->lock held
+static void channel_store(struct channel_manager *cm, struct channel *ch, const struct msg *m){
+    channel_ring_put(ch, m);
+
+    channel_save_to_file(cm, ch->channel_id);
+    if (history_append(ch->channel_id, m) < 0)
+        printf("[ERROR] Failed to append message to history of channel %" PRIu64 "\n", ch->channel_id);
+    search_submit(ch->channel_id, m);
+    replica_log_message(ch->channel_id, m);
 }
 
 int channel_add_message(struct channel_manager *cm, uint64_t channel_id, 
-                       uint64_t sender_id, const char *content, int msg_type){
+                       uint64_t sender_id, const char *content, int msg_type, uint64_t *msg_id_out){
 
-    pthread_mutex_lock(&cm->lock); 
+    lockprof_lock(&cm->lock); 
     struct channel *ch = channel_find(cm, channel_id);
     if (!ch) {
-        pthread_mutex_unlock(&cm->lock);
+        lockprof_unlock(&cm->lock);
         return -1;
     }
     
@@ -139,54 +500,427 @@ int channel_add_message(struct channel_manager *cm, uint64_t channel_id,
     }
     
     if (!is_member){
-        pthread_mutex_unlock(&cm->lock);
+        lockprof_unlock(&cm->lock);
         return -2;
     }
+
+    if (ch->remote){
+        lockprof_unlock(&cm->lock);
+        return -1;
+    }
+
+    if (channel_page_in(cm, ch) < 0){
+        lockprof_unlock(&cm->lock);
+        return -1;
+    }
     
-    int msg_index = ch->message_count % MSG_BUFFER_LIMIT; 
-    ch->messages[msg_index].msg_id = generate_uuid(8);
-    ch->messages[msg_index].sender_id = sender_id;
-    ch->messages[msg_index].timestamp = (uint32_t)time(NULL);
-    ch->messages[msg_index].msg_type = msg_type;
+    uint64_t msg_id = channel_next_id(ch);
+
+    struct msg m = {0};
+    m.msg_id = msg_id;
+    m.sender_id = sender_id;
+    m.timestamp = (uint32_t)time(NULL);
+    m.msg_type = msg_type;
     if (content){
-        strncpy(ch->messages[msg_index].content, content, 
-                sizeof(ch->messages[msg_index].content) - 1);
+        strncpy(m.content, content, sizeof(m.content) - 1);
     }
+    channel_store(cm, ch, &m);
     
-    ch->message_count++;
-    channel_save_to_file(cm, channel_id);
-    
-    pthread_mutex_unlock(&cm->lock);
+    lockprof_unlock(&cm->lock);
+    if (msg_id_out)
+        *msg_id_out = msg_id;
     return 0;
 }
 
-void channel_load_from_file(struct channel_manager *cm, uint64_t channel_id){
+int channel_apply(struct channel_manager *cm, uint64_t channel_id, struct channel_op *ops, int count){
+    if (count > CHANNEL_BATCH_MAX)
+        count = CHANNEL_BATCH_MAX;
+
+    lockprof_lock(&cm->lock);
+    struct channel *ch = channel_find(cm, channel_id);
+    if (!ch || ch->remote || channel_page_in(cm, ch) < 0){
+        lockprof_unlock(&cm->lock);
+        return -1;
+    }
+
+    const struct msg *stored[CHANNEL_BATCH_MAX];
+    int applied = 0, stored_count = 0, joined = 0;
+    for (int i = 0; i < count; i++){
+        struct channel_op *op = &ops[i];
+        int member = channel_is_participant(ch, op->user_id);
+        op->msg_id = 0;
+
+        if (op->type == CHANNEL_OP_JOIN && member)
+            op->status = -3;
+        else if (op->type == CHANNEL_OP_JOIN && (ch->participant_count >= MAX_PARTICIPANTS ||
+                                                 cm->subscription_count >= MAX_CHANNELS * MAX_CHANNEL_MEMBERS))
+            op->status = -4;
+        else if (op->type == CHANNEL_OP_POST && !member)
+            op->status = -2;
+        else if (op->type != CHANNEL_OP_JOIN && op->type != CHANNEL_OP_POST)
+            op->status = -1;
+        else
+            op->status = 0;
+        if (op->status != 0)
+            continue;
+
+        if (op->type == CHANNEL_OP_JOIN){
+            channel_add_member(cm, ch, op->user_id);
+            replica_log_join(channel_id, op->user_id);
+            joined = 1;
+        }
+
+        if (op->content){
+            struct msg m = {0};
+            m.msg_id = channel_next_id(ch);
+            m.sender_id = op->user_id;
+            m.timestamp = (uint32_t)time(NULL);
+            m.msg_type = op->msg_type;
+            strncpy(m.content, op->content, sizeof(m.content) - 1);
+
+            stored[stored_count++] = channel_ring_put(ch, &m);
+            search_submit(channel_id, &m);
+            replica_log_message(channel_id, &m);
+            op->msg_id = m.msg_id;
+        }
+        applied++;
+    }
+
+    // the whole batch reaches disk as one file rewrite and one history write
+    if (applied > 0)
+        channel_save_to_file(cm, channel_id);
+    if (history_append_many(channel_id, stored, stored_count) < 0)
+        printf("[ERROR] Failed to append %d message(s) to history of channel %" PRIu64 "\n", stored_count, channel_id);
+    if (joined)
+        channel_publish(cm);
+    lockprof_unlock(&cm->lock);
+    return applied;
+}
+
+int channel_apply_message(struct channel_manager *cm, uint64_t channel_id, const struct msg *m){
+    lockprof_lock(&cm->lock);
+    struct channel *ch = channel_find(cm, channel_id);
+    if (!ch || channel_page_in(cm, ch) < 0){
+        lockprof_unlock(&cm->lock);
+        return -1;
+    }
+
+    // ids only grow within a channel, so anything not newer is already here
+    if (ch->message_count > 0 &&
+        m->msg_id <= ch->messages[(ch->message_count - 1) % MSG_BUFFER_LIMIT].msg_id){
+        lockprof_unlock(&cm->lock);
+        return 1;
+    }
+
+    channel_store(cm, ch, m);
+    lockprof_unlock(&cm->lock);
+    return 0;
+}
+
+/*
+ * Copies the buffered messages with an id greater than after_id into out,
+ * oldest first, up to max of them. *gap is set when messages newer than
+ * after_id have already rotated out of the ring buffer.
+ */
+int channel_messages_since(struct channel_manager *cm, uint64_t channel_id, uint64_t after_id,
+                           struct msg *out, int max, int *gap){
+    lockprof_lock(&cm->lock);
+    struct channel *ch = channel_find(cm, channel_id);
+    if (!ch || channel_page_in(cm, ch) < 0){
+        lockprof_unlock(&cm->lock);
+        return -1;
+    }
+
+    int buffered = ch->message_count < MSG_BUFFER_LIMIT ? ch->message_count : MSG_BUFFER_LIMIT;
+    int first = ch->message_count - buffered;
+
+    if (gap){
+        *gap = 0;
+        if (first > 0 && ch->messages[first % MSG_BUFFER_LIMIT].msg_id > after_id + 1)
+            *gap = 1;
+    }
+
+    int n = 0;
+    for (int i = first; i < ch->message_count && n < max; i++){
+        struct msg *m = &ch->messages[i % MSG_BUFFER_LIMIT];
+        if (m->msg_id > after_id)
+            out[n++] = *m;
+    }
+
+    lockprof_unlock(&cm->lock);
+    return n;
+}
+
+// maps and decodes one channel file into ch (whose ring must be allocated)
+static int channel_read(uint64_t channel_id, struct channel *ch, struct channel_subscription *subs){
     char filename[256];
-    snprintf(filename, sizeof(filename), "%s%lu.dat", 
-             "channel_", channel_id);
-    
-    FILE *file = fopen(filename, "rb");
-    if (!file) return;
-    
+    channel_file_path(filename, sizeof(filename), channel_id);
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return LOAD_DAMAGED;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0){
+        close(fd);
+        return LOAD_DAMAGED;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return LOAD_DAMAGED;
+
+    int status = channel_decode(data, (size_t)st.st_size, channel_id, ch, subs);
+    munmap(data, (size_t)st.st_size);
+    return status;
+}
+
+/*
+ * Validates and inserts one channel file; ch and subs are the caller's
+ * scratch space. Only metadata stays resident, the ring is paged in when
+ * the channel is next used. Files loaded from an old or torn copy are
+ * rewritten so the damage doesn't outlive this start-up. Returns a LOAD_*
+ * code.
+ */
+static int channel_load(struct channel_manager *cm, uint64_t channel_id, int publish,
+                        struct channel *ch, struct channel_subscription *subs){
+    int status = channel_read(channel_id, ch, subs);
+    if (status == LOAD_DAMAGED)
+        return status;
+
+    lockprof_lock(&cm->lock);
+    if (channel_find(cm, channel_id)){
+        lockprof_unlock(&cm->lock);
+        return status;
+    }
+    if (cm->channel_count >= MAX_CHANNELS){
+        lockprof_unlock(&cm->lock);
+        return LOAD_FULL;
+    }
+
+    struct channel *slot = &cm->channels[cm->channel_count++];
+    *slot = *ch;
+    slot->messages = NULL;
+    for (int i = 0; i < ch->participant_count; i++)
+        cm->subscriptions[cm->subscription_count++] = subs[i];
+    if (status != LOAD_OK){
+        // rewrite from what was decoded, not from the damaged file
+        slot->messages = malloc(MSG_BUFFER_LIMIT * sizeof(struct msg));
+        if (slot->messages){
+            memcpy(slot->messages, ch->messages, MSG_BUFFER_LIMIT * sizeof(struct msg));
+            slot->last_active = time(NULL);
+            cm->resident_count++;
+            channel_save_to_file(cm, channel_id);
+            // like every other loaded channel, it is paged in on first use
+            channel_evict(cm, slot);
+        }
+    }
+    if (publish)
+        channel_publish(cm);
+    lockprof_unlock(&cm->lock);
+    return status;
+}
+
+void channel_load_from_file(struct channel_manager *cm, uint64_t channel_id){
     struct channel ch;
-    if (fread(&ch, sizeof(struct channel), 1, file) == 1){
-        pthread_mutex_lock(&cm->lock);
-        
-        int exists = 0;
-        for (int i = 0; i < cm->channel_count; i++){
-            if (cm->channels[i].channel_id == channel_id){
-                exists = 1;
-                break;
+    struct channel_subscription subs[MAX_PARTICIPANTS];
+    ch.messages = malloc(MSG_BUFFER_LIMIT * sizeof(struct msg));
+    if (!ch.messages) return;
+
+    if (channel_load(cm, channel_id, 1, &ch, subs) == LOAD_DAMAGED)
+        printf("[ERROR] Could not load channel %" PRIu64 "\n", channel_id);
+    free(ch.messages);
+}
+
+struct recovery_job {
+    struct channel_manager *cm;
+    const uint64_t *ids;
+    int count;
+    atomic_int next;
+    atomic_int counts[LOAD_FULL + 1];
+};
+
+static void *recovery_thread(void *arg){
+    struct recovery_job *job = arg;
+    struct channel ch;
+    struct channel_subscription subs[MAX_PARTICIPANTS];
+    ch.messages = malloc(MSG_BUFFER_LIMIT * sizeof(struct msg));
+    if (!ch.messages)
+        return NULL;
+
+    // files are claimed one at a time so a few large ones don't leave threads idle
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count){
+        int status = channel_load(job->cm, job->ids[i], 0, &ch, subs);
+        if (status == LOAD_DAMAGED)
+            printf("[ERROR] channel_%" PRIu64 ".dat is damaged, skipped\n", job->ids[i]);
+        atomic_fetch_add(&job->counts[status], 1);
+    }
+
+    free(ch.messages);
+    return NULL;
+}
+
+static int cmp_channel_id(const void *a, const void *b){
+    uint64_t x = ((const struct channel *)a)->channel_id;
+    uint64_t y = ((const struct channel *)b)->channel_id;
+    return (x > y) - (x < y);
+}
+
+int channel_recover(struct channel_manager *cm, int threads, struct channel_recovery *r){
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(r, 0, sizeof(*r));
+
+    DIR *d = opendir(".");
+    if (!d)
+        return -1;
+
+    uint64_t *ids = NULL;
+    int cap = 0;
+    struct dirent *e;
+    while ((e = readdir(d))){
+        uint64_t id;
+        int end_pos = 0;
+        if (sscanf(e->d_name, "channel_%" SCNu64 ".dat%n", &id, &end_pos) != 1 || e->d_name[end_pos] != '\0' || end_pos == 0)
+            continue;
+        if (r->files == cap){
+            cap = cap ? cap * 2 : 64;
+            uint64_t *grown = realloc(ids, (size_t)cap * sizeof(*ids));
+            if (!grown){
+                closedir(d);
+                free(ids);
+                return -1;
             }
+            ids = grown;
+        }
+        ids[r->files++] = id;
+    }
+    closedir(d);
+
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > r->files)
+        threads = r->files;
+    if (threads < 1)
+        threads = 1;
+
+    struct recovery_job job = { .cm = cm, .ids = ids, .count = r->files };
+    pthread_t *tids = calloc((size_t)threads, sizeof(*tids));
+    int started = 0;
+    for (int i = 0; tids && i < threads; i++){
+        if (pthread_create(&tids[i], NULL, recovery_thread, &job) != 0)
+            break;
+        started++;
+    }
+    if (started == 0)
+        recovery_thread(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    free(tids);
+    free(ids);
+
+    // threads finish in any order; ids are time-ordered, so sorting restores creation order
+    lockprof_lock(&cm->lock);
+    qsort(cm->channels, (size_t)cm->channel_count, sizeof(cm->channels[0]), cmp_channel_id);
+    channel_publish(cm);
+    lockprof_unlock(&cm->lock);
+
+    r->legacy = atomic_load(&job.counts[LOAD_LEGACY]);
+    r->repaired = atomic_load(&job.counts[LOAD_REPAIRED]);
+    r->damaged = atomic_load(&job.counts[LOAD_DAMAGED]);
+    r->skipped = atomic_load(&job.counts[LOAD_FULL]);
+    r->loaded = atomic_load(&job.counts[LOAD_OK]) + r->legacy + r->repaired;
+    r->threads = started ? started : 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    r->elapsed_ms = (double)(end.tv_sec - start.tv_sec) * 1e3 + (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+    return r->loaded;
+}
+static void channel_evict(struct channel_manager *cm, struct channel *ch){
+    free(ch->messages);
+    ch->messages = NULL;
+    cm->resident_count--;
+}
+
+/*
+ * Makes sure ch has its message ring in memory and marks it as just used.
+ * Called with cm->lock held. Every change is written through to the
+ * channel file, so the file always holds what an evicted ring held; if it
+ * no longer reads back whole the channel stays evicted and this fails.
+ * Going over the budget evicts the least recently used other ring.
+ */
+static int channel_page_in(struct channel_manager *cm, struct channel *ch){
+    if (ch->remote)
+        return -1;
+    ch->last_active = time(NULL);
+    if (ch->messages)
+        return 0;
+
+    struct msg *ring = calloc(MSG_BUFFER_LIMIT, sizeof(*ring));
+    if (!ring)
+        return -1;
+
+    if (ch->message_count > 0){
+        struct channel tmp = { .messages = ring };
+        struct channel_subscription subs[MAX_PARTICIPANTS];
+        // installing a partial ring would show readers blank slots and let the next save clobber the file
+        if (channel_read(ch->channel_id, &tmp, subs) == LOAD_DAMAGED || tmp.message_count != ch->message_count){
+            printf("[ERROR] Channel %" PRIu64 " file no longer matches its history; leaving it on disk\n",
+                   ch->channel_id);
+            free(ring);
+            return -1;
         }
-        
-        if (!exists && cm->channel_count < MAX_CHANNELS){
-            cm->channels[cm->channel_count] = ch;
-            cm->channel_count++;
+    }
+
+    ch->messages = ring;
+    cm->resident_count++;
+
+    while (cm->resident_limit > 0 && cm->resident_count > cm->resident_limit){
+        struct channel *lru = NULL;
+        for (int i = 0; i < cm->channel_count; i++){
+            struct channel *c = &cm->channels[i];
+            if (c->messages && c != ch && (!lru || c->last_active < lru->last_active))
+                lru = c;
         }
-        
-        pthread_mutex_unlock(&cm->lock);
+        if (!lru)
+            break;
+        channel_evict(cm, lru);
     }
-    
-    fclose(file);
-}
\ No newline at end of file
+    return 0;
+}
+
+static void *channel_sweeper(void *arg){
+    struct channel_manager *cm = arg;
+
+    for (;;){
+        int interval = cm->idle_seconds / 4;
+        sleep(interval < 1 ? 1 : interval > 60 ? 60 : interval);
+
+        lockprof_lock(&cm->lock);
+        time_t cutoff = time(NULL) - cm->idle_seconds;
+        for (int i = 0; i < cm->channel_count; i++){
+            struct channel *ch = &cm->channels[i];
+            if (ch->messages && ch->last_active <= cutoff)
+                channel_evict(cm, ch);
+        }
+        lockprof_unlock(&cm->lock);
+    }
+    return NULL;
+}
+
+int channel_set_residency(struct channel_manager *cm, int resident_limit, int idle_seconds){
+    lockprof_lock(&cm->lock);
+    cm->resident_limit = resident_limit;
+    cm->idle_seconds = idle_seconds;
+    lockprof_unlock(&cm->lock);
+
+    if (idle_seconds <= 0)
+        return 0;
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, channel_sweeper, cm) != 0)
+        return -1;
+    pthread_detach(t);
+    return 0;
+}
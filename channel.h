@@ -1,6 +1,8 @@
 #pragma once
 #include <stdint.h>
+#include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 #ifndef RMS_CHANNEL_H
 #define RMS_CHANNEL_H
@@ -11,6 +13,8 @@
 #define MAX_CHANNEL_MEMBERS 25
 
 #define MSG_BUFFER_LIMIT 100
+#define MSG_CONTENT_MAX 511  // longest post kept whole everywhere it is stored; longer ones are refused
+#define CHANNEL_BATCH_MAX 64 // ops per channel_apply; below MSG_BUFFER_LIMIT so they all stay in the ring
 #define MAX_MEDIA_SIZE (10 * 1024 * 1024) // 10MB max file size
 
 // Message types
@@ -21,16 +25,42 @@
 #define MSG_TYPE_VIDEO 4
 
 /*
- * channel file structure:
- * channel_name
- * participant_ids_1
- * participant_ids_2
- * ...
- * participant_ids_25
- * message_id_1 sender_id_1 timestamp_1 type_1 payload_1
- * message_id_2 sender_id_2 timestamp_2 type_2 payload_2
- * ...
+ * channel_<id>.dat layout (CHANNEL_FILE_VERSION 1, little-endian):
+ *
+ * channel_file_header                  magic, version, id, CRC of the header
+ * channel_file_record + CHANNEL_REC_INFO     name, message and member counts
+ * channel_file_record + CHANNEL_REC_MEMBER   one per participant
+ * channel_file_record + CHANNEL_REC_MESSAGE  one per buffered message, oldest first
+ *
+ * Every record carries a CRC-32C of its payload and is padded to 8 bytes.
+ * A file torn mid-write loads up to the last intact record. Files without
+ * the magic that have the size of the old in-memory struct are
+ * pre-versioning raw dumps; they are imported once and rewritten in this
+ * format.
  */
+#define CHANNEL_FILE_MAGIC 0x4e484352u // "RCHN"
+#define CHANNEL_FILE_VERSION 1
+
+#define CHANNEL_REC_INFO 1
+#define CHANNEL_REC_MEMBER 2
+#define CHANNEL_REC_MESSAGE 3
+
+struct channel_file_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t channel_id;
+    uint32_t record_count;
+    uint32_t crc;           // over the bytes before this field
+};
+
+struct channel_file_record {
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t len;           // payload bytes, not counting padding
+    uint32_t crc;           // of the payload
+    uint32_t pad;
+};
 
  struct media_info {
     char file_name[256];
@@ -44,17 +74,43 @@ struct msg {
     uint64_t sender_id;
     uint32_t timestamp;
     int msg_type;
-    char content[512];
+    char content[MSG_CONTENT_MAX + 1];
     struct media_info media;
 };
 
+/*
+ * Name, members and counters are always resident. The message ring is
+ * allocated on first use and evicted again once the channel goes idle or
+ * falls out of the resident budget; its contents live on in the channel
+ * file, so channel_add_message and channel_messages_since page it back in
+ * transparently. Only those two (and the file code) touch messages.
+ */
 struct channel {
     uint64_t channel_id;
     char channel_name[CHANNEL_NAME_SIZE];
     uint64_t participant_ids[MAX_PARTICIPANTS];
     int participant_count;
     int message_count;
-    struct msg messages[MSG_BUFFER_LIMIT];
+    struct msg *messages;   // MSG_BUFFER_LIMIT entries, NULL while evicted
+    time_t last_active;
+    int remote;             // stub of a channel another node owns: no messages, not saved
+    int home;               // the owning node, for stubs
+};
+
+#define CHANNEL_OP_JOIN 1
+#define CHANNEL_OP_POST 2
+
+/*
+ * One step of a channel_apply batch. A join with content also posts that
+ * text as the new member once the join has succeeded.
+ */
+struct channel_op {
+    int type;
+    uint64_t user_id;
+    const char *content;
+    int msg_type;
+    int status;         // out: 0, or what channel_join / channel_add_message would return (-4: channel full)
+    uint64_t msg_id;    // out: id of the message stored for this op, 0 if none
 };
 
 struct channel_subscription {
@@ -63,22 +119,84 @@ struct channel_subscription {
     time_t joined_at;
 };
 
+/*
+ * Read-only copy of the channel directory for listings. Writers rebuild
+ * and republish it under cm->lock whenever channels or memberships change;
+ * readers never take cm->lock (see channel_snapshot_begin).
+ */
+struct channel_view {
+    uint64_t channel_id;
+    char channel_name[CHANNEL_NAME_SIZE];
+    int participant_count;
+    uint64_t participant_ids[MAX_PARTICIPANTS];
+    time_t joined_at[MAX_PARTICIPANTS];
+};
+
+struct channel_snapshot {
+    uint64_t version;
+    int channel_count;
+    struct channel_view channels[];
+};
+
 struct channel_manager {
     struct channel channels[MAX_CHANNELS];
     struct channel_subscription subscriptions[MAX_CHANNELS * MAX_CHANNEL_MEMBERS];
     int channel_count;
     int subscription_count;
+    int resident_count;     // channels with their message ring in memory
+    int resident_limit;     // LRU-evict past this many, 0 = no limit
+    int idle_seconds;       // evict rings untouched this long, 0 = never
     pthread_mutex_t lock;
+    _Atomic(struct channel_snapshot *) snapshot;
 };
 
 void channel_manager_init(struct channel_manager *cm);
-int channel_create(struct channel_manager *cm, const char *name, uint64_t creator_id);
+uint64_t channel_create(struct channel_manager *cm, const char *name, uint64_t creator_id);
+uint64_t channel_create_with_id(struct channel_manager *cm, uint64_t channel_id, const char *name, uint64_t creator_id);
+// creates or refreshes the stub of a channel owned by another node
+int channel_mirror(struct channel_manager *cm, uint64_t channel_id, const char *name, int home,
+                   const uint64_t *members, int member_count);
 int channel_join(struct channel_manager *cm, uint64_t channel_id, uint64_t user_id);
-int channel_add_message(struct channel_manager * cm, uint64_t channel_id, uint64_t sender_id, const char * content, int msg_type);
+int channel_add_message(struct channel_manager * cm, uint64_t channel_id, uint64_t sender_id, const char * content, int msg_type, uint64_t *msg_id);
+/*
+ * Runs up to CHANNEL_BATCH_MAX ops against one channel, in order, under a
+ * single cm->lock acquisition, then persists them together: one channel
+ * file write and one history append. Returns how many ops succeeded, or
+ * -1 if the channel is not stored here.
+ */
+int channel_apply(struct channel_manager *cm, uint64_t channel_id, struct channel_op *ops, int count);
+// stores a message as-is (id and time kept); returns 1 if the channel already has it
+int channel_apply_message(struct channel_manager *cm, uint64_t channel_id, const struct msg *m);
+int channel_messages_since(struct channel_manager *cm, uint64_t channel_id, uint64_t after_id, struct msg *out, int max, int *gap);
 struct channel *channel_find(struct channel_manager *cm, uint64_t channel_id);
 struct channel *channel_find_by_name(struct channel_manager *cm, const char *name);
 void channel_save_to_file(struct channel_manager *cm, uint64_t channel_id);
 void channel_load_from_file(struct channel_manager *cm, uint64_t channel_id);
+
+struct channel_recovery {
+    int files;      // channel_*.dat files found
+    int loaded;
+    int legacy;     // raw dumps converted to the current format
+    int repaired;   // torn files loaded up to the last good record
+    int damaged;    // rejected: bad header, unknown version, unreadable
+    int skipped;    // valid but over MAX_CHANNELS
+    int threads;
+    double elapsed_ms;
+};
+
+/*
+ * Loads every channel_*.dat in the working directory, spreading the files
+ * over `threads` loader threads (0 = one per online CPU).
+ */
+int channel_recover(struct channel_manager *cm, int threads, struct channel_recovery *r);
 int channel_is_member(struct channel_manager *cm, uint64_t channel_id, uint64_t user_id);
 
+// sets the resident budget and starts the idle sweeper (if idle_seconds > 0)
+int channel_set_residency(struct channel_manager *cm, int resident_limit, int idle_seconds);
+
+// valid until the matching channel_snapshot_end(); never NULL
+const struct channel_snapshot *channel_snapshot_begin(struct channel_manager *cm);
+void channel_snapshot_end(void);
+const struct channel_view *channel_view_find(const struct channel_snapshot *s, const char *id_or_name);
+
 #endif //RMS_CHANNEL_H
\ No newline at end of file
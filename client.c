@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <inttypes.h>
 #include <stdlib.h>
@@ -6,63 +7,232 @@
 #include <pthread.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "utility.h"
 #include "rsa.h"
 #include "encrypted_packet.h"
 #include "channel.h"
+#include "session.h"
+#include "chacha20.h"
+#include "group_key.h"
+#include "wire.h"
+#include "bitpack.h"
+#include "lz.h"
+#include "msg_cache.h"
+#include "shm_ring.h"
+
+#define SESSION_FILE "session_ticket"
+#define RECONNECT_BASE_MS 500
+#define RECONNECT_MAX_MS 30000
+#define CACHE_SHOW_LINES 10 // cached lines of the active channel shown at start-up
 
 // Client Information
 uint64_t user_id = -1;
 
+// kept for logging in again after a reconnect the server wouldn't resume
+char username[32];
+char password[32];
+
 // Server File Descriptor
 int server_fd = -1;
+// rings shared with a server on this host, once it agreed to them (SESSION_FEATURE_SHM)
+struct shm_link server_shm;
 
 // Channel Information
 uint64_t current_channel_id = 0;
 
+/*
+ * Last message id seen per channel. Sent back with CMD_SYNC so the server
+ * only replays what was missed.
+ */
+struct sync_cursor {
+    uint64_t channel_id;
+    uint64_t last_id;
+};
+
+struct sync_cursor cursors[MAX_CHANNELS];
+int cursor_count = 0;
+pthread_mutex_t cursor_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Group keys per channel. The previous epoch is kept so frames sealed just
+ * before a rotation still decrypt.
+ */
+struct channel_keys {
+    uint64_t channel_id;
+    struct group_key keys[2];
+};
+
+struct channel_keys group_keys[MAX_CHANNELS];
+int group_key_count = 0;
+pthread_mutex_t group_key_lock = PTHREAD_MUTEX_INITIALIZER;
+
 // RSA Keys
 long s_n, s_e;
 long c_n, c_e, c_d;
 
-void rsa_handshake(int fd) {
-    recv(fd, &s_n, sizeof(long), 0);
-    recv(fd, &s_e, sizeof(long), 0);
+/*
+ * Saved resumption state. The ticket is bound to our public key, so the
+ * key pair is stored alongside it and reused on the next launch; the
+ * ticket's secret is what proves on resuming that the ticket is ours.
+ */
+struct client_session {
+    char ip[32];
+    int port;
+    char username[32];  // a resumed login sends none, but the cache is kept per user
+    long n, e, d;
+    struct session_ticket ticket;
+    uint8_t secret[SESSION_SECRET_SIZE];
+};
+
+struct client_session session;
+int have_session = 0;
+
+// SESSION_FEATURE_* the server agreed to in its reply
+uint32_t session_features = 0;
+
+int session_load(const char *ip, int port) {
+    FILE *file = fopen(SESSION_FILE, "rb");
+    if (!file)
+        return -1;
+
+    struct client_session s;
+    size_t r = fread(&s, sizeof(s), 1, file);
+    fclose(file);
+
+    if (r != 1 || strcmp(s.ip, ip) != 0 || s.port != port)
+        return -1;
+    if ((uint64_t)time(NULL) >= s.ticket.expires_at)
+        return -1;
+
+    session = s;
+    c_n = s.n;
+    c_e = s.e;
+    c_d = s.d;
+    have_session = 1;
+    return 0;
+}
+
+void session_store(const struct session_ticket *ticket, const uint8_t secret[SESSION_SECRET_SIZE]) {
+    session.n = c_n;
+    session.e = c_e;
+    session.d = c_d;
+    session.ticket = *ticket;
+    memcpy(session.secret, secret, SESSION_SECRET_SIZE);
+    have_session = 1;
+
+    int fd = open(SESSION_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return;
+
+    if (write(fd, &session, sizeof(session)) != (ssize_t)sizeof(session))
+        printf("[ERROR] Failed to save session ticket\n");
+    close(fd);
+}
+
+/*
+ * Returns 1 if the server accepted our ticket (user_id is then known and
+ * no credentials are needed), 0 if a full login must follow, -1 on error.
+ */
+int rsa_handshake(int fd, int local) {
+    struct session_hello hello = {0};
+    hello.magic = SESSION_MAGIC;
+    hello.mode = have_session ? SESSION_MODE_RESUME : SESSION_MODE_FULL;
+    hello.features = SESSION_FEATURE_LZ | (local ? SESSION_FEATURE_SHM : 0);
+    if (have_session) {
+        hello.ticket = session.ticket;
+        if (session_resume_sign(&hello, session.secret) < 0)
+            hello.mode = SESSION_MODE_FULL;
+    }
+
+    send(fd, &hello, sizeof(hello), 0);
+    // the server reads the offer whatever it answers, so it goes out right behind the hello
+    if (local && shm_link_offer(&server_shm, fd) < 0)
+        return -1;
+
+    struct session_reply reply = {0};
+    if (recv(fd, &reply, sizeof(reply), MSG_WAITALL) != (ssize_t)sizeof(reply))
+        return -1;
+
+    // every later packet_encrypt relies on this check
+    if (bitpack_width(reply.server_n) == 0) {
+        printf("[ERROR] Server sent an unusable public key (n = %ld)\n", reply.server_n);
+        return -1;
+    }
+    s_n = reply.server_n;
+    s_e = reply.server_e;
+    session_features = reply.features;
+    if (!(reply.features & SESSION_FEATURE_SHM))
+        shm_link_close(&server_shm);
+
+    if (reply.status == SESSION_STATUS_RESUMED) {
+        user_id = reply.user_id;
+        if (!username[0])
+            snprintf(username, sizeof(username), "%s", session.username);
+        uint8_t secret[SESSION_SECRET_SIZE];
+        session_secret_seal(session.secret, hello.client_nonce, reply.secret_box, secret);
+        session_store(&reply.ticket, secret);
+        printf("\n• Session resumed | Public Key (n, e): (%ld, %ld)\n", s_n, s_e);
+        return 1;
+    }
 
     send(fd, &c_n, sizeof(long), 0);
     send(fd, &c_e, sizeof(long), 0);
 
     printf("\n• RSA Handshake | Public Key (n, e): (%ld, %ld)\n", s_n, s_e);
+    return 0;
+}
+
+// decrypts an RSA payload into a fresh string, or NULL if it is malformed
+char *packet_text(const struct encrypted_packet *p, long d, long n) {
+    char *plaintext = malloc(p->len + 1);
+    if (plaintext && packet_decrypt(p, d, n, plaintext, p->len + 1) < 0) {
+        free(plaintext);
+        return NULL;
+    }
+    return plaintext;
 }
 
 void send_encrypted(int fd, char *payload, long e, long n) {
-    size_t enc_len;
-    long *cipher = encrypt(payload, e, n, &enc_len);
-    if (!cipher)
-        return;
+    struct encrypted_packet p = {0};
+    if (packet_encrypt(&p, payload, e, n) >= 0)
+        packet_send(fd, &p);
+}
 
-    if (enc_len > MAX_ENCRYPTED_PAYLOAD)
-        enc_len = MAX_ENCRYPTED_PAYLOAD;
+// everything after login goes through here, so it takes the rings when there are any
+ssize_t server_send(const struct encrypted_packet *p) {
+    if (!server_shm.region)
+        return packet_send(server_fd, p);
+    size_t len = packet_wire_size(p);
+    return shm_send(&server_shm, p, len) == 0 ? (ssize_t)len : -1;
+}
 
-    struct encrypted_packet p = {0};
-    for (size_t i = 0; i < enc_len; i++)
-        p.encrypted_payload[i] = cipher[i];
+ssize_t server_recv(void *buf, size_t len) {
+    if (server_shm.region)
+        return shm_recv(&server_shm, buf, len);
+    return recv(server_fd, buf, len, MSG_WAITALL);
+}
 
-    p.len = enc_len;
-    send(fd, &p, sizeof(p), 0);
-    free(cipher);
+void server_close(void) {
+    shm_link_close(&server_shm);
+    close(server_fd);
+    server_fd = -1;
 }
 
 char *recv_decrypted(int fd, long d, long n) {
     struct encrypted_packet p = {0};
 
-    ssize_t r = recv(fd, &p, sizeof(p), 0);
+    ssize_t r = server_shm.region ? shm_packet_recv(&server_shm, &p) : packet_recv(fd, &p);
     if (r <= 0 || p.len == 0 || p.len > MAX_ENCRYPTED_PAYLOAD)
         return NULL;
 
-    char *plaintext = decrypt(p.encrypted_payload, p.len, d, n);
-    return plaintext;
+    return packet_text(&p, d, n);
 }
 
 void send_file(const char *filepath, uint64_t channel_id){
@@ -73,8 +243,8 @@ void send_file(const char *filepath, uint64_t channel_id){
     }
     
     // Get file size
-    long file_size = ftell(file);
     fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
     fseek(file, 0, SEEK_SET);
     
     if (file_size > MAX_MEDIA_SIZE){
@@ -97,6 +267,9 @@ void send_file(const char *filepath, uint64_t channel_id){
     uint32_t total_chunks = (file_size + chunk_size - 1) / chunk_size; 
     uint8_t buffer[4096];
     uint32_t chunk_index = 0;
+
+    // JPEGs and friends don't shrink, don't spend time trying
+    int compress = (session_features & SESSION_FEATURE_LZ) != 0;
     
     while (!feof(file)) {
         size_t bytes_read = fread(buffer, 1, chunk_size, file);
@@ -105,7 +278,7 @@ void send_file(const char *filepath, uint64_t channel_id){
         struct encrypted_packet p = {0};
         p.sender_id = user_id;
         p.channel_id = channel_id;
-        p.msg_id = generate_uuid(10);
+        p.msg_id = generate_id();
         p.timestamp = (uint32_t)time(NULL);
         p.command_type = CMD_FILE_TRANSFER;
         p.is_file = 1;
@@ -115,27 +288,19 @@ void send_file(const char *filepath, uint64_t channel_id){
         p.chunk_index = chunk_index;
         p.total_chunks = total_chunks;
         
-        char metadata[256];
-        snprintf(metadata, sizeof(metadata), "FILE:%s:%lu:%u:%u", 
-                filename, file_size, chunk_index, total_chunks);
-        
-        size_t enc_len;
-        long *cipher = encrypt(metadata, s_e, s_n, &enc_len);
-        
-        if (cipher){
-            p.len = (uint32_t)enc_len;
-
-            for (size_t i = 0; i < enc_len && i < MAX_ENCRYPTED_PAYLOAD; i++){
-                p.encrypted_payload[i] = cipher[i];
-            }
-
-            free(cipher);
+        if (chunk_index == 0 && lz_is_compressed_media(buffer, bytes_read))
+            compress = 0;
+
+        size_t packed = compress ? lz_compress(buffer, bytes_read, p.file_data, sizeof(p.file_data)) : 0;
+        if (packed) {
+            p.codec = PACKET_CODEC_LZ;
+            p.len = (uint32_t)packed;
+        } else {
+            memcpy(p.file_data, buffer, bytes_read);
+            p.len = bytes_read;
         }
         
-        memcpy(p.file_data, buffer, bytes_read);
-        p.len = bytes_read; 
-        
-        send(server_fd, &p, sizeof(p), 0);
+        server_send(&p);
         chunk_index++;
         
         printf("Sent chunk %u/%u\r", chunk_index, total_chunks);
@@ -146,6 +311,12 @@ void send_file(const char *filepath, uint64_t channel_id){
     printf("\nFile sent: %s\n", filename);
 }
 
+/*
+ * A file offer asks a y/n question. Input arrives through the event loop,
+ * so the answer is simply the next line typed (see handle_input).
+ */
+char pending_file[256];
+
 void handle_incoming_file(struct encrypted_packet *p){
     if (!p->is_file) return;
     
@@ -154,266 +325,756 @@ void handle_incoming_file(struct encrypted_packet *p){
     
     printf("Do you want to download it? (y/n): ");
     fflush(stdout);
-    
-    char response[16];
-    fgets(response, sizeof(response), stdin);
-    
-    if (response[0] == 'y' || response[0] == 'Y') {
-        printf("Downloading to: downloads/\n");
-        mkdir("downloads", 0755);
-        
-        char filepath[512];
-        snprintf(filepath, sizeof(filepath), "downloads/%s", p->file_name);
-        printf("File info received. Use /getfile %s to download.\n", p->file_name);
+
+    strncpy(pending_file, p->file_name, sizeof(pending_file) - 1);
+    pending_file[sizeof(pending_file) - 1] = '\0';
+}
+
+void cursor_advance(uint64_t channel_id, uint64_t msg_id) {
+    if (channel_id == 0)
+        return;
+
+    pthread_mutex_lock(&cursor_lock);
+    struct sync_cursor *c = NULL;
+    for (int i = 0; i < cursor_count; i++) {
+        if (cursors[i].channel_id == channel_id) {
+            c = &cursors[i];
+            break;
+        }
     }
+    if (!c && cursor_count < MAX_CHANNELS) {
+        c = &cursors[cursor_count++];
+        c->channel_id = channel_id;
+        c->last_id = 0;
+    }
+    if (c && msg_id > c->last_id)
+        c->last_id = msg_id;
+    pthread_mutex_unlock(&cursor_lock);
+
+    cache_set_cursor(channel_id, msg_id);
 }
 
-int c_init(const char *ip, int port) {
-    struct sockaddr_in serv = {0};
+uint32_t packet_time(const struct encrypted_packet *p) {
+    return p->timestamp ? p->timestamp : (uint32_t)time(NULL);
+}
+
+// batched replies carry many display lines; only the last one's id is known
+void cache_lines(const struct encrypted_packet *p, const char *text) {
+    const char *line = text;
+    while (*line) {
+        const char *end = strchr(line, '\n');
+        size_t len = end ? (size_t)(end - line) : strlen(line);
+
+        char buf[CACHE_TEXT_SIZE];
+        if (len >= sizeof(buf))
+            len = sizeof(buf) - 1;
+        memcpy(buf, line, len);
+        buf[len] = '\0';
+        // our own lines were cached when sent; the server replays them without marking them
+        if (strncmp(buf, "[sync]", 6) != 0 && !cache_has_own_line(p->channel_id, buf))
+            cache_append(p->channel_id, end ? 0 : p->msg_id, packet_time(p), buf);
+
+        if (!end)
+            break;
+        line = end + 1;
+    }
+}
+
+void request_sync(void) {
+    struct sync_cursor snapshot[MAX_CHANNELS];
+
+    pthread_mutex_lock(&cursor_lock);
+    int n = cursor_count;
+    memcpy(snapshot, cursors, n * sizeof(*snapshot));
+    pthread_mutex_unlock(&cursor_lock);
+
+    for (int i = 0; i < n; i++) {
+        struct encrypted_packet p = {0};
+        p.command_type = CMD_SYNC;
+        p.sender_id = user_id;
+        p.channel_id = snapshot[i].channel_id;
+        p.msg_id = snapshot[i].last_id;
+        packet_encrypt(&p, "SYNC", s_e, s_n);
+
+        server_send(&p);
+    }
+
+    if (n == 0)
+        printf("No channels to sync yet.\n");
+}
 
-    serv.sin_family = AF_INET;
-    serv.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &serv.sin_addr);
+void group_key_store(uint64_t channel_id, uint32_t epoch, const uint8_t key[CHACHA20_KEY_SIZE]) {
+    pthread_mutex_lock(&group_key_lock);
+    struct channel_keys *ck = NULL;
+    for (int i = 0; i < group_key_count; i++) {
+        if (group_keys[i].channel_id == channel_id) {
+            ck = &group_keys[i];
+            break;
+        }
+    }
+    if (!ck && group_key_count < MAX_CHANNELS) {
+        ck = &group_keys[group_key_count++];
+        memset(ck, 0, sizeof(*ck));
+        ck->channel_id = channel_id;
+    }
+    if (ck && epoch > ck->keys[0].epoch) {
+        ck->keys[1] = ck->keys[0];
+        ck->keys[0].channel_id = channel_id;
+        ck->keys[0].epoch = epoch;
+        memcpy(ck->keys[0].key, key, CHACHA20_KEY_SIZE);
+    }
+    pthread_mutex_unlock(&group_key_lock);
+}
+
+int group_key_lookup(uint64_t channel_id, uint32_t epoch, struct group_key *out) {
+    int found = -1;
+    pthread_mutex_lock(&group_key_lock);
+    for (int i = 0; i < group_key_count && found < 0; i++) {
+        if (group_keys[i].channel_id != channel_id)
+            continue;
+        for (int j = 0; j < 2; j++) {
+            if (group_keys[i].keys[j].epoch == epoch) {
+                *out = group_keys[i].keys[j];
+                found = 0;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&group_key_lock);
+    return found;
+}
+
+void request_group_key(uint64_t channel_id) {
+    struct encrypted_packet p = {0};
+    p.command_type = CMD_GROUP_KEY;
+    p.sender_id = user_id;
+    p.channel_id = channel_id;
+    packet_encrypt(&p, "KEY", s_e, s_n);
+
+    server_send(&p);
+}
 
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+// the server checks on connections that have gone quiet; sending it back is the whole answer
+void answer_heartbeat(void) {
+    struct encrypted_packet p = {0};
+    p.command_type = CMD_HEARTBEAT;
+    p.sender_id = user_id;
+    packet_encrypt(&p, "", s_e, s_n);
+
+    server_send(&p);
+}
+
+// decrypts a group-sealed broadcast, or returns NULL if we lack its key or it does not decode
+char *open_sealed(struct encrypted_packet *p) {
+    struct group_key key;
+    if (p->len > sizeof(p->sealed_payload) || group_key_lookup(p->channel_id, p->key_epoch, &key) < 0)
+        return NULL;
+
+    uint8_t nonce[CHACHA20_NONCE_SIZE];
+    group_key_nonce(p->nonce, p->key_epoch, nonce);
+    chacha20_xor(key.key, nonce, 0, p->sealed_payload, p->len);
+    memset(&key, 0, sizeof(key));
+
+    size_t cap = p->codec == PACKET_CODEC_LZ ? sizeof(p->sealed_payload) : p->len;
+    char *plaintext = malloc(cap + 1);
+    if (!plaintext)
+        return NULL;
+
+    long n = p->len;
+    if (p->codec == PACKET_CODEC_LZ)
+        n = lz_decompress(p->sealed_payload, p->len, (uint8_t *)plaintext, cap);
+    else
+        memcpy(plaintext, p->sealed_payload, p->len);
+
+    if (n < 0) {
+        free(plaintext);
+        return NULL;
+    }
+    plaintext[n] = '\0';
+    return plaintext;
+}
+
+// a path instead of an address is the server's Unix socket (RMS_UNIX_SOCKET), where shared memory is offered
+int c_init(const char *ip, int port) {
+    int local = ip[0] == '/';
+    struct sockaddr_storage addr = {0};
+    socklen_t addr_len;
+
+    if (local) {
+        struct sockaddr_un *un = (struct sockaddr_un *)&addr;
+        un->sun_family = AF_UNIX;
+        strncpy(un->sun_path, ip, sizeof(un->sun_path) - 1);
+        addr_len = sizeof(*un);
+    } else {
+        struct sockaddr_in *serv = (struct sockaddr_in *)&addr;
+        serv->sin_family = AF_INET;
+        serv->sin_port = htons(port);
+        inet_pton(AF_INET, ip, &serv->sin_addr);
+        addr_len = sizeof(*serv);
+    }
+
+    int fd = socket(local ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
     if (fd < 0)
         return -1;
 
-    if (connect(fd, (struct sockaddr *)&serv, sizeof(serv)) < 0)
+    if (connect(fd, (struct sockaddr *)&addr, addr_len) < 0) {
+        close(fd);
         return -1;
+    }
 
-    rsa_handshake(fd);
+    int resumed = rsa_handshake(fd, local);
+    if (resumed < 0) {
+        shm_link_close(&server_shm);
+        close(fd);
+        return -1;
+    }
 
     server_fd = fd;
-    return 0;
+    if (server_shm.region)
+        printf("• Talking to the server through shared memory.\n");
+    return resumed;
 }
 
-void *message_bar_thread() {
-    char input[512];
-
-    printf("Available commands:\n");
+void print_help(void) {
     printf("  /create <name> - Create new channel\n");
     printf("  /join <id_or_name>       - Join a channel\n");
     printf("  /msg <id_or_name> <message>      - Send to specific channel\n");
     printf("  /file <path> [channel]   - Send file\n");
+    printf("  /batch <path>            - Send the /msg and /join lines of a file in bulk\n");
+    printf("  /sync                    - Fetch messages missed while away\n");
+    printf("  /history <channel> [before] [limit] - Show older messages\n");
+    printf("  /search <channel> <terms> - Find messages containing all terms\n");
+    printf("  /channels [page]         - List channels\n");
+    printf("  /members <channel> [page] - List a channel's members\n");
+    printf("  /info <channel>          - Show channel details\n");
     printf("  /help                    - Show this help\n");
-    for (;;) {
-        printf("> ");
-        fflush(stdout);
+}
 
-        if (!fgets(input, sizeof(input), stdin))
-            continue;
+// the server doesn't echo our own messages, so they are cached as they are sent
+void cache_own(uint64_t channel_id, const char *text) {
+    if (channel_id == 0)
+        return;
 
-        input[strcspn(input, "\n")] = 0;
+    char line[CACHE_TEXT_SIZE];
+    snprintf(line, sizeof(line), "[%s] %s", username[0] ? username : "me", text);
+    cache_append(channel_id, 0, (uint32_t)time(NULL), line);
+}
 
-        if (strlen(input) == 0)
-            continue;
-        
-        if (strncmp(input, "/file ", 6) == 0){
-            char *filepath = input + 6;
-            uint64_t channel_id = 1; 
-            
-            char *space = strchr(filepath, ' ');
-            if (space) {
-                *space = '\0';
-                channel_id = strtoull(space + 1, NULL, 10);
-            }
-            
-            send_file(filepath, channel_id);
-            continue;
-        } else if(strncmp(input, "/create ", 8) == 0){
-            struct encrypted_packet p = {0};
-            p.command_type = CMD_CHANNEL_CREATE;
-            p.sender_id = user_id;
-            p.channel_id = generate_uuid(8);
-            
-            size_t enc_len;
-            long *cipher = encrypt(input + 8, s_e, s_n, &enc_len);        
-            if (cipher){
-
-                p.len = (uint32_t)enc_len;
-
-                for (size_t i = 0; i < enc_len && i < MAX_ENCRYPTED_PAYLOAD; i++) {
-                    p.encrypted_payload[i] = cipher[i];
-                }
-
-                free(cipher);
-            }
-            
-            send(server_fd, &p, sizeof(p), 0);
-            continue;
-        } else if (strncmp(input, "/join ", 6) == 0){
-            char *arg = input + 6;
-            struct encrypted_packet p = {0};
+static void batch_flush(char *text, size_t *used, int *items, int *frames) {
+    if (*items == 0)
+        return;
 
-            p.command_type = CMD_CHANNEL_JOIN;
-            p.sender_id = user_id;
+    struct encrypted_packet p = {0};
+    p.command_type = CMD_BATCH;
+    p.sender_id = user_id;
+    p.msg_id = generate_id();
+    p.timestamp = (uint32_t)time(NULL);
+    packet_encrypt(&p, text, s_e, s_n);
+    server_send(&p);
+
+    (*frames)++;
+    *used = 0;
+    *items = 0;
+    text[0] = '\0';
+}
+
+/*
+ * Bulk import: the /msg and /join lines of a file go out as batch frames,
+ * as many per frame as fit, which the server applies a channel at a time.
+ */
+void send_batch(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("Cannot open file: %s\n", path);
+        return;
+    }
 
+    char text[MAX_ENCRYPTED_PAYLOAD + 1] = "";
+    size_t used = 0;
+    int items = 0, frames = 0, sent = 0, skipped = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        char item[MAX_ENCRYPTED_PAYLOAD];
+        char *space = strncmp(line, "/msg ", 5) == 0 ? strchr(line + 5, ' ') : NULL;
+        if (space && space[1]) {
+            snprintf(item, sizeof(item), "M %s", line + 5);
+            *space = '\0';
             char *endptr;
-            uint64_t cid = strtoull(arg, &endptr, 10);
+            uint64_t channel_id = strtoull(line + 5, &endptr, 10);
+            cache_own(*endptr == '\0' ? channel_id : cache_find_channel(line + 5), space + 1);
+        } else if (strncmp(line, "/join ", 6) == 0 && line[6]) {
+            snprintf(item, sizeof(item), "J %s", line + 6);
+        } else {
+            skipped += line[0] != '\0';
+            continue;
+        }
 
-            if (*endptr == '\0')
-                p.channel_id = cid;   
-            else
-                p.channel_id = 0;     
+        size_t len = strlen(item);
+        if (len + 1 > MAX_ENCRYPTED_PAYLOAD) {
+            skipped++;
+            continue;
+        }
+        if (items == CHANNEL_BATCH_MAX || used + len + 1 > MAX_ENCRYPTED_PAYLOAD)
+            batch_flush(text, &used, &items, &frames);
+
+        if (used > 0)
+            text[used++] = '\n';
+        memcpy(text + used, item, len + 1);
+        used += len;
+        items++;
+        sent++;
+    }
+    batch_flush(text, &used, &items, &frames);
+    fclose(f);
 
-            size_t enc_len;
-            long *cipher = encrypt(arg, s_e, s_n, &enc_len);
+    printf("Sent %d command(s) in %d batch frame(s)", sent, frames);
+    if (skipped)
+        printf(", skipped %d line(s) that are not /msg or /join", skipped);
+    printf(".\n");
+}
 
-            p.len = enc_len;
-            for (size_t i = 0; i < enc_len && i < MAX_ENCRYPTED_PAYLOAD; i++)
-                p.encrypted_payload[i] = cipher[i];
+void handle_input(char *input) {
+    input[strcspn(input, "\n")] = 0;
 
-            free(cipher);
-            send(server_fd, &p, sizeof(p), 0);
-            continue;
-        } else if(strncmp(input, "/info ", 6) == 0){
-
-            struct encrypted_packet p = {0};
-            p.command_type = CMD_CHANNEL_INFO;
-            p.sender_id = user_id;
-            
-            size_t enc_len;
-            long *cipher = encrypt(input + 6, s_e, s_n, &enc_len);
-            
-            if (cipher) {
-                p.len = (uint32_t)enc_len;
-                for (size_t i = 0; i < enc_len && i < MAX_ENCRYPTED_PAYLOAD; i++) {
-                    p.encrypted_payload[i] = cipher[i];
-                }
-                free(cipher);
-            }
-            
-            send(server_fd, &p, sizeof(p), 0);
-            continue;
-        } else if (strncmp(input, "/msg ", 5) == 0){
-            char *channel_identifier = input + 5;
-            
-            char *space_pos = strchr(channel_identifier, ' ');
-            if (!space_pos) {
-                printf("Usage: /msg <id_or_name> <message>\n");
-                continue;
-            }
-            
-            int channel_len = space_pos - channel_identifier;
-            char channel_str[64] = {0};
-            strncpy(channel_str, channel_identifier, channel_len);
-            channel_str[channel_len] = '\0';
-            
-            char *message = space_pos + 1;
-            char *endptr;
-            uint64_t channel_id = strtoull(channel_str, &endptr, 10);
-            
-            char full_message[1024];
-            if (*endptr == '\0'){
-                snprintf(full_message, sizeof(full_message), "ID:%" PRIu64 ":%s", channel_id, message);
-            } else{
-                snprintf(full_message, sizeof(full_message), "NAME:%s:%s", channel_str, message);
-            }
+    if (strlen(input) == 0)
+        return;
 
-            size_t enc_len = 0;
-            long *cipher = encrypt(full_message, s_e, s_n, &enc_len);     
-            if (!cipher) {
-                printf("[ERROR] Failed to encrypt message\n");
-                continue;
-            }
-            
-            struct encrypted_packet p = {0};
-            p.sender_id = user_id;
-            p.channel_id = 0; 
-            p.msg_id = generate_uuid(8);
-            p.timestamp = (uint32_t)time(NULL);
-            p.command_type = CMD_MESSAGE;
-            p.len = (uint32_t)enc_len;
-            
-            if (enc_len > MAX_ENCRYPTED_PAYLOAD)
-                enc_len = MAX_ENCRYPTED_PAYLOAD;
-            
-            for (size_t i = 0; i < enc_len; i++)
-                p.encrypted_payload[i] = cipher[i];
-            
-            send(server_fd, &p, sizeof(p), 0);
-            free(cipher);
-            continue;
-        } else if (input[0] == '/'){
-            printf("Unknown command. Available commands:\n");
-            printf("  /create <name> - Create new channel\n");
-            printf("  /join <id_or_name>       - Join a channel\n");
-            printf("  /msg <id_or_name> <message>      - Send to specific channel\n");
-            printf("  /file <path> [channel]   - Send file\n");
-            printf("  /help                    - Show this help\n");
-            continue;
+    if (pending_file[0]) {
+        if (input[0] == 'y' || input[0] == 'Y') {
+            printf("Downloading to: downloads/\n");
+            mkdir("downloads", 0755);
+            printf("File info received. Use /getfile %s to download.\n", pending_file);
+        }
+        pending_file[0] = '\0';
+        return;
+    }
+
+    if (strcmp(input, "/help") == 0) {
+        print_help();
+        return;
+    }
+
+    if (server_fd < 0) {
+        printf("Not connected, waiting to reconnect.\n");
+        return;
+    }
+    
+    if (strcmp(input, "/sync") == 0){
+        request_sync();
+        return;
+    } else if (strncmp(input, "/batch ", 7) == 0){
+        send_batch(input + 7);
+        return;
+    } else if (strncmp(input, "/file ", 6) == 0){
+        char *filepath = input + 6;
+        uint64_t channel_id = 1; 
+        
+        char *space = strchr(filepath, ' ');
+        if (space) {
+            *space = '\0';
+            channel_id = strtoull(space + 1, NULL, 10);
         }
+        
+        send_file(filepath, channel_id);
+        return;
+    } else if(strncmp(input, "/create ", 8) == 0){
+        struct encrypted_packet p = {0};
+        p.command_type = CMD_CHANNEL_CREATE;
+        p.sender_id = user_id;
+        p.channel_id = generate_id();
+        packet_encrypt(&p, input + 8, s_e, s_n);
+        
+        server_send(&p);
+        return;
+    } else if (strncmp(input, "/join ", 6) == 0){
+        char *arg = input + 6;
+        struct encrypted_packet p = {0};
 
-        size_t enc_len = 0;
-        long *cipher = encrypt(input, s_e, s_n, &enc_len);
+        p.command_type = CMD_CHANNEL_JOIN;
+        p.sender_id = user_id;
 
-        if (!cipher) 
-            continue;
+        char *endptr;
+        uint64_t cid = strtoull(arg, &endptr, 10);
+
+        if (*endptr == '\0')
+            p.channel_id = cid;   
+        else
+            p.channel_id = 0;     
 
+        packet_encrypt(&p, arg, s_e, s_n);
+        server_send(&p);
+        return;
+    } else if (strncmp(input, "/history ", 9) == 0){
         struct encrypted_packet p = {0};
-        p.sender_id  = user_id;
-        p.channel_id = current_channel_id;
-        p.msg_id     = generate_uuid(10);
-        p.timestamp  = (uint32_t)time(NULL);
-        p.command_type = CMD_MESSAGE;
-        p.len        = (uint32_t)enc_len;
+        p.command_type = CMD_HISTORY;
+        p.sender_id = user_id;
 
-        if (enc_len > MAX_ENCRYPTED_PAYLOAD)
-            enc_len = MAX_ENCRYPTED_PAYLOAD;
+        packet_encrypt(&p, input + 9, s_e, s_n);
 
-        for (size_t i = 0; i < enc_len; i++)
-            p.encrypted_payload[i] = cipher[i];
+        server_send(&p);
+        return;
+    } else if (strncmp(input, "/search ", 8) == 0){
+        struct encrypted_packet p = {0};
+        p.command_type = CMD_SEARCH;
+        p.sender_id = user_id;
 
-        send(server_fd, &p, sizeof(p), 0);
-        free(cipher);
-    }
-}
+        packet_encrypt(&p, input + 8, s_e, s_n);
 
-void *payload_receiver_thread() {
-    for (;;) {
+        server_send(&p);
+        return;
+    } else if (strncmp(input, "/channels", 9) == 0 || strncmp(input, "/members ", 9) == 0){
         struct encrypted_packet p = {0};
+        p.command_type = input[1] == 'c' ? CMD_LIST_CHANNELS : CMD_LIST_MEMBERS;
+        p.sender_id = user_id;
 
-        ssize_t received = recv(server_fd, &p, sizeof(p), 0);
-        if (received <= 0)
-            continue;
+        // both commands are 9 characters; the page number (if any) follows
+        packet_encrypt(&p, input + 9, s_e, s_n);
+
+        server_send(&p);
+        return;
+    } else if(strncmp(input, "/info ", 6) == 0){
+
+        struct encrypted_packet p = {0};
+        p.command_type = CMD_CHANNEL_INFO;
+        p.sender_id = user_id;
+        
+        packet_encrypt(&p, input + 6, s_e, s_n);
+        
+        server_send(&p);
+        return;
+    } else if (strncmp(input, "/msg ", 5) == 0){
+        char *channel_identifier = input + 5;
+        
+        char *space_pos = strchr(channel_identifier, ' ');
+        if (!space_pos) {
+            printf("Usage: /msg <id_or_name> <message>\n");
+            return;
+        }
+        
+        int channel_len = space_pos - channel_identifier;
+        char channel_str[64] = {0};
+        strncpy(channel_str, channel_identifier, channel_len);
+        channel_str[channel_len] = '\0';
+        
+        char *message = space_pos + 1;
+        if (strlen(message) > MSG_CONTENT_MAX) {
+            printf("Message too long (%zu characters, at most %d), not sent\n", strlen(message), MSG_CONTENT_MAX);
+            return;
+        }
+        char *endptr;
+        uint64_t channel_id = strtoull(channel_str, &endptr, 10);
         
-        char *plaintext = decrypt(p.encrypted_payload, p.len, c_d, c_n);
+        char full_message[1024];
+        if (*endptr == '\0'){
+            snprintf(full_message, sizeof(full_message), "ID:%" PRIu64 ":%s", channel_id, message);
+        } else{
+            snprintf(full_message, sizeof(full_message), "NAME:%s:%s", channel_str, message);
+        }
+
+        struct encrypted_packet p = {0};
+        p.sender_id = user_id;
+        p.channel_id = 0; 
+        p.msg_id = generate_id();
+        p.timestamp = (uint32_t)time(NULL);
+        p.command_type = CMD_MESSAGE;
+        packet_encrypt(&p, full_message, s_e, s_n);
         
-        uint64_t new_id = 0;
-        if (sscanf(plaintext, "Successfully joined channel '%*[^']' (ID: %lu)", &new_id) == 1 ||
-            sscanf(plaintext, "Successfully joined channel ID: %lu", &new_id) == 1 ){
+        server_send(&p);
+        cache_own(*endptr == '\0' ? channel_id : cache_find_channel(channel_str), message);
+        return;
+    } else if (input[0] == '/'){
+        printf("Unknown command. Available commands:\n");
+        print_help();
+        return;
+    } else if (strlen(input) > MSG_CONTENT_MAX) {
+        printf("Message too long (%zu characters, at most %d), not sent\n", strlen(input), MSG_CONTENT_MAX);
+        return;
+    }
 
-            current_channel_id = new_id;
-            printf("Active channel set to %" PRIu64 "\n> ", current_channel_id);
+    struct encrypted_packet p = {0};
+    p.sender_id  = user_id;
+    p.channel_id = current_channel_id;
+    p.msg_id     = generate_id();
+    p.timestamp  = (uint32_t)time(NULL);
+    p.command_type = CMD_MESSAGE;
+    packet_encrypt(&p, input, s_e, s_n);
+
+    server_send(&p);
+    cache_own(current_channel_id, input);
+}
+
+void handle_packet(struct encrypted_packet *p) {
+    if (p->command_type == CMD_HEARTBEAT) {
+        answer_heartbeat();
+        return;
+    }
+
+    if (packet_is_sealed(p)) {
+        char *plaintext = open_sealed(p);
+        if (!plaintext) {
+            printf("[missed message in channel %" PRIu64 ", fetching key; /sync to catch up]\n> ", p->channel_id);
+            fflush(stdout);
+            request_group_key(p->channel_id);
+            return;
         }
 
-        if (p.is_file){
-            handle_incoming_file(&p);
+        if (!p->is_file) {
+            char line[CACHE_TEXT_SIZE];
+            snprintf(line, sizeof(line), "[%s] %s", p->username, plaintext);
+            cache_append(p->channel_id, p->msg_id, packet_time(p), line);
+        }
+
+        cursor_advance(p->channel_id, p->msg_id);
+        if (p->is_file)
+            handle_incoming_file(p);
+        else
+            printf("[%s] %s\n> ", p->username, plaintext);
+        fflush(stdout);
+        free(plaintext);
+        return;
+    }
 
-            if (plaintext) 
-                free(plaintext);
+    char *plaintext = packet_text(p, c_d, c_n);
 
-            continue;
+    if (p->command_type == CMD_GROUP_KEY) {
+        uint8_t key[CHACHA20_KEY_SIZE];
+        if (plaintext && group_key_parse_hex(plaintext, key) == 0)
+            group_key_store(p->channel_id, p->key_epoch, key);
+        memset(key, 0, sizeof(key));
+        free(plaintext);
+        return;
+    }
+
+    uint64_t new_id = 0;
+    char name[CHANNEL_NAME_SIZE] = "";
+    if (plaintext && (sscanf(plaintext, "Successfully joined channel '%31[^']' (ID: %lu)", name, &new_id) == 2 ||
+                      sscanf(plaintext, "Successfully joined channel ID: %lu", &new_id) == 1)){
+
+        current_channel_id = new_id;
+        cache_set_active_channel(new_id);
+        cursor_advance(new_id, 0);
+        if (name[0])
+            cache_set_name(new_id, name);
+        printf("Active channel set to %" PRIu64 "\n> ", current_channel_id);
+    } else if (plaintext && sscanf(plaintext, "Channel '%31[^']' created successfully! ID: %lu", name, &new_id) == 2) {
+        cursor_advance(new_id, 0);
+        cache_set_name(new_id, name);
+    }
+
+    if (plaintext && p->command_type == CMD_SYNC)
+        cache_lines(p, plaintext);
+
+    cursor_advance(p->channel_id, p->msg_id);
+
+    if (p->is_file){
+        handle_incoming_file(p);
+
+        if (plaintext) 
+            free(plaintext);
+
+        return;
+    }
+    
+    if (!plaintext)
+        return;
+    
+    if (p->command_type == CMD_SYNC || p->command_type == CMD_HISTORY || p->command_type == CMD_SEARCH ||
+        p->command_type == CMD_LIST_CHANNELS || p->command_type == CMD_LIST_MEMBERS || p->command_type == CMD_CHANNEL_INFO ||
+        p->command_type == CMD_BATCH)
+        printf("%s\n> ", plaintext);
+    else
+        printf("[%s] %s\n> ", p->username, plaintext);
+    fflush(stdout);     
+    free(plaintext);
+}
+
+int login() {
+    if (!username[0]) {
+        printf("\n• Enter username:\n> ");
+        fgets(username, sizeof(username), stdin);
+        username[strcspn(username, "\n")] = 0;
+
+        printf("• Enter password:\n> ");
+        fgets(password, sizeof(password), stdin);
+        password[strcspn(password, "\n")] = 0;
+    }
+
+    send_encrypted(server_fd, username, s_e, s_n);
+    send_encrypted(server_fd, password, s_e, s_n);
+    snprintf(session.username, sizeof(session.username), "%s", username);
+
+    char *uid_s = recv_decrypted(server_fd, c_d, c_n);
+    if (uid_s){
+        user_id = strtoull(uid_s, NULL, 10);
+        free(uid_s);
+    } else {
+        fprintf(stderr, "Failed to receive user id from server\n");
+        return -1;
+    }
+
+    // a ticket is only kept along with its secret; without one the next start logs in again
+    struct session_ticket ticket;
+    uint8_t secret[SESSION_SECRET_SIZE];
+    if (server_recv(&ticket, sizeof(ticket)) == (ssize_t)sizeof(ticket)) {
+        char *secret_text = recv_decrypted(server_fd, c_d, c_n);
+        if (secret_text && session_secret_parse(secret_text, secret) == 0)
+            session_store(&ticket, secret);
+        free(secret_text);
+    }
+
+    return 0;
+}
+
+int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Reconnect delay: exponential backoff with full jitter, so clients that
+ * lost the same server spread their retries out instead of all arriving
+ * the moment it comes back.
+ */
+int reconnect_delay_ms(int attempt) {
+    int cap = RECONNECT_BASE_MS << (attempt < 6 ? attempt : 6);
+    if (cap > RECONNECT_MAX_MS)
+        cap = RECONNECT_MAX_MS;
+    return RECONNECT_BASE_MS / 2 + rand() % cap;
+}
+
+int reconnect(const char *ip, int port) {
+    int resumed = c_init(ip, port);
+    if (resumed < 0)
+        return -1;
+    if (!resumed && login() < 0) {
+        server_close();
+        return -1;
+    }
+
+    printf("\n• Reconnected.\n> ");
+    fflush(stdout);
+    request_sync();
+    return 0;
+}
+
+/*
+ * One poll loop for the terminal and the server socket. It sleeps in
+ * poll() while nothing happens; after a disconnect the same loop times
+ * out to retry the connection while still accepting input. On shared
+ * memory it sleeps on the ring's eventfd instead, and the socket only
+ * tells it the server went away.
+ */
+void event_loop(const char *ip, int port) {
+    struct packet_reader *reader = malloc(sizeof(*reader));
+    if (!reader)
+        return;
+    packet_reader_reset(reader);
+
+    int stdin_open = 1;
+    int attempt = 0;
+    int64_t retry_at = 0;
+
+    printf("> ");
+    fflush(stdout);
+
+    for (;;) {
+        int shm = server_shm.region != NULL;
+        struct pollfd fds[3] = {
+            { .fd = stdin_open ? STDIN_FILENO : -1, .events = POLLIN },
+            { .fd = server_fd, .events = POLLIN },
+            { .fd = shm ? server_shm.rx_event : -1, .events = POLLIN },
+        };
+
+        int timeout = -1;
+        if (server_fd < 0) {
+            int64_t wait = retry_at - monotonic_ms();
+            timeout = wait > 0 ? (int)wait : 0;
+        } else if (shm && shm_wait_begin(&server_shm)) {
+            timeout = 0;
         }
-        
-        if (!plaintext)
+
+        int n = poll(fds, 3, timeout);
+        if (shm)
+            shm_wait_end(&server_shm);
+        if (n < 0 && errno != EINTR)
+            break;
+
+        if (server_fd < 0 && monotonic_ms() >= retry_at) {
+            if (reconnect(ip, port) == 0) {
+                attempt = 0;
+                packet_reader_reset(reader);
+            } else {
+                int delay = reconnect_delay_ms(attempt++);
+                retry_at = monotonic_ms() + delay;
+                printf("\n• Reconnect failed, retrying in %.1fs.\n> ", delay / 1000.0);
+                fflush(stdout);
+            }
             continue;
-        
-        printf("[%s] %s\n> ", p.username, plaintext);
-        fflush(stdout);     
-        free(plaintext);
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            char input[512];
+            // stdin is unbuffered, so poll() sees every byte fgets hasn't taken
+            if (fgets(input, sizeof(input), stdin)) {
+                handle_input(input);
+                printf("> ");
+                fflush(stdout);
+            } else {
+                stdin_open = 0; // keep receiving, just stop reading input
+            }
+        }
+
+        int lost = 0;
+        if (shm && server_fd >= 0) {
+            int r;
+            while ((r = shm_packet_poll(&server_shm, &reader->p)) == 1)
+                handle_packet(&reader->p);
+            lost = r < 0 || fds[1].revents;
+        } else if (server_fd >= 0 && fds[1].revents) {
+            int r;
+            while ((r = packet_reader_fill(reader, server_fd)) == 1)
+                handle_packet(&reader->p);
+            lost = r < 0;
+        }
+
+        if (lost) {
+            server_close();
+            int delay = reconnect_delay_ms(attempt++);
+            retry_at = monotonic_ms() + delay;
+            printf("\n• Disconnected from server, reconnecting in %.1fs.\n> ", delay / 1000.0);
+            fflush(stdout);
+        }
     }
+
+    free(reader);
+}
+
+void restore_cursor(uint64_t channel_id, uint64_t last_id, uint64_t lines, void *arg) {
+    (void)lines;
+    (void)arg;
+    cursor_advance(channel_id, last_id);
+}
+
+void print_cached(const struct cache_entry *e, void *arg) {
+    (void)arg;
+    time_t t = e->timestamp;
+    struct tm tm;
+    char when[16];
+    localtime_r(&t, &tm);
+    strftime(when, sizeof(when), "%H:%M", &tm);
+    printf("  %s %s\n", when, e->text);
 }
 
 int main() {
-    srand(time(NULL));
-    generate_rsa_keys(&c_n, &c_e, &c_d);
+    srand(time(NULL) ^ getpid());
+    setvbuf(stdin, NULL, _IONBF, 0);
 
     char ip[32];
     int port = 8080;
 
-    printf("• What is the server IP?\n> ");
+    printf("• What is the server IP (or the path of its Unix socket)?\n> ");
     fgets(ip, sizeof(ip), stdin);
     ip[strcspn(ip, "\n")] = 0;
 
@@ -421,41 +1082,38 @@ int main() {
     scanf("%d", &port);
     flush_buffer();
 
-    if (c_init(ip, port) < 0) {
+    if (session_load(ip, port) < 0)
+        generate_rsa_keys(&c_n, &c_e, &c_d);
+    snprintf(session.ip, sizeof(session.ip), "%s", ip);
+    session.port = port;
+
+    int resumed = c_init(ip, port);
+    if (resumed < 0) {
         printf("• Connection failed.\n");
         return 1;
     }
 
-    printf("\n• Enter username:\n> ");
-    char username[32];
-    fgets(username, sizeof(username), stdin);
-    username[strcspn(username, "\n")] = 0;
-
-    printf("• Enter password:\n> ");
-    char password[32];
-    fgets(password, sizeof(password), stdin);
-    password[strcspn(password, "\n")] = 0;
-
-    send_encrypted(server_fd, username, s_e, s_n);
-    send_encrypted(server_fd, password, s_e, s_n);
-
-    char *uid_s = recv_decrypted(server_fd, c_d, c_n);
-    if (uid_s){
-        user_id = strtoull(uid_s, NULL, 10);
-        free(uid_s);
-    } else {
-        fprintf(stderr, "Failed to receive user id from server\n");
+    if (!resumed && login() < 0)
         return 1;
+
+    // the cache belongs to this server and account, so it is only known once logged in
+    cache_set_owner(ip, port, username);
+    int cached = cache_open_all(restore_cursor, NULL);
+    current_channel_id = cache_active_channel();
+    if (cached > 0) {
+        const char *name = cache_name(current_channel_id);
+        printf("• %d cached channel(s)%s%s\n", cached, name ? ", active: " : "", name ? name : "");
+        cache_tail(current_channel_id, CACHE_SHOW_LINES, print_cached, NULL);
     }
 
     printf("\n");
+    printf("Available commands:\n");
+    print_help();
 
-    pthread_t t_send, t_recv;
-    pthread_create(&t_send, NULL, message_bar_thread, NULL);
-    pthread_create(&t_recv, NULL, payload_receiver_thread, NULL);
-
-    pthread_join(t_send, NULL);
-    pthread_join(t_recv, NULL);
+    // only what arrived since the cached cursors
+    if (cached > 0)
+        request_sync();
 
+    event_loop(ip, port);
     return 0;
-}
\ No newline at end of file
+}
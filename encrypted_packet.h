@@ -1,43 +1,71 @@
-#pragma once
-#include "client_info.h"
-#include <stdint.h>
-
-#ifndef ENCRYPTED_PACKET_H
-#define ENCRYPTED_PACKET_H
-
-#define MAX_ENCRYPTED_PAYLOAD 256
-#define USERNAME_SIZE 32
-#define PASSWORD_SIZE 32
-
-#define CMD_MESSAGE 0
-#define CMD_FILE_TRANSFER 1
-#define CMD_CHANNEL_CREATE 2
-#define CMD_CHANNEL_JOIN 3
-#define CMD_CHANNEL_LEAVE 4
-#define CMD_LIST_CHANNELS 5
-#define CMD_LIST_MEMBERS 6
-#define CMD_CHANNEL_INFO 7
-#define CMD_INVITE_USER 8
-
-struct encrypted_packet {
-    uint64_t sender_id;          
-    uint64_t channel_id;
-    uint64_t msg_id;
-
-    uint32_t timestamp;
-    uint32_t len;
-    uint32_t command_type;
-
-    char username[USERNAME_SIZE];
-    int64_t encrypted_payload[MAX_ENCRYPTED_PAYLOAD];
-
-    uint8_t is_file;
-    char file_name[256];
-    uint64_t file_size;
-    uint32_t chunk_index;
-    uint32_t total_chunks;
-
-    uint8_t file_data[4096];
-};
-
-#endif
+#pragma once
+#include "client_info.h"
+#include <stdint.h>
+
+#ifndef ENCRYPTED_PACKET_H
+#define ENCRYPTED_PACKET_H
+
+#define MAX_ENCRYPTED_PAYLOAD 1024 // characters per RSA packet
+#define MAX_SEALED_PAYLOAD 2048
+#define USERNAME_SIZE 32
+#define PASSWORD_SIZE 32
+
+#define CMD_MESSAGE 0
+#define CMD_FILE_TRANSFER 1
+#define CMD_CHANNEL_CREATE 2
+#define CMD_CHANNEL_JOIN 3
+#define CMD_CHANNEL_LEAVE 4
+#define CMD_LIST_CHANNELS 5
+#define CMD_LIST_MEMBERS 6
+#define CMD_CHANNEL_INFO 7
+#define CMD_INVITE_USER 8
+#define CMD_SYNC 9
+#define CMD_HISTORY 10
+#define CMD_GROUP_KEY 11
+#define CMD_SEARCH 12
+#define CMD_BATCH 13    // one sub-command per line: "M <channel> <text>" or "J <channel>"
+#define CMD_PING 14     // answered with an empty CMD_PING of the same msg_id once the commands before it are done
+#define CMD_HEARTBEAT 15 // sent to a quiet client, which sends it straight back
+
+// codec: how the payload bytes were transformed before encryption
+#define PACKET_CODEC_NONE 0
+#define PACKET_CODEC_LZ 1
+
+/*
+ * Everything up to the payload union is the fixed header; only the bytes of
+ * the union that are in use follow it on the wire (see packet_wire_size).
+ */
+struct encrypted_packet {
+    uint64_t sender_id;          
+    uint64_t channel_id;
+    uint64_t msg_id;
+
+    uint32_t timestamp;
+    uint32_t len;
+    uint32_t command_type;
+
+    // key_epoch == 0: encrypted_payload holds len RSA symbols for this recipient,
+    //                 bit-packed at symbol_bits each (see packet_encrypt)
+    // key_epoch != 0: sealed_payload holds len bytes under that channel group key
+    uint32_t key_epoch;
+    uint64_t nonce;
+
+    char username[USERNAME_SIZE];
+
+    uint8_t is_file;
+    uint8_t codec;
+    uint8_t symbol_bits;         // per RSA symbol; fills alignment padding, the header size is unchanged
+    char file_name[256];
+    uint64_t file_size;
+    uint32_t chunk_index;
+    uint32_t total_chunks;
+
+    // CMD_FILE_TRANSFER: file_data holds len bytes of the chunk
+    union {
+        uint8_t encrypted_payload[MAX_ENCRYPTED_PAYLOAD * sizeof(uint32_t)];
+        uint8_t sealed_payload[MAX_SEALED_PAYLOAD];
+        uint8_t file_data[4096];
+    };
+};
+
+#endif
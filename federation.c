@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "federation.h"
+#include "link_auth.h"
+#include "siphash.h"
+#include "utility.h"
+
+struct fed_peer {
+    char host[64];
+    int port;
+    int fd;                 // outgoing link, -1 while down
+    uint8_t session[SIPHASH_KEY_SIZE];
+    uint64_t seq;           // next sequence number on the outgoing link
+    pthread_mutex_t lock;   // one sender at a time per link
+    int in_fd;              // the incoming link this node dialed to us, -1 while down
+};
+
+// an authenticated incoming link and the node at its other end
+struct fed_link {
+    int fd;
+    int node;
+    uint8_t session[SIPHASH_KEY_SIZE];
+};
+
+struct ring_point {
+    uint64_t hash;
+    int node;
+};
+
+static struct fed_peer peers[FED_MAX_NODES];
+static int node_count = 0;
+static int self_node = 0;
+static struct ring_point ring[FED_MAX_NODES * FED_VNODES];
+static int ring_size = 0;
+static void (*on_message)(struct fed_msg *m);
+static uint8_t fed_key[SIPHASH_KEY_SIZE];
+static pthread_mutex_t in_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the ring must come out the same on every node, so the hash key is fixed
+static const uint8_t ring_key[SIPHASH_KEY_SIZE] = "rms-fed-ring-v1";
+
+int fed_enabled(void) {
+    return node_count > 1;
+}
+
+int fed_self(void) {
+    return self_node;
+}
+
+int fed_node_count(void) {
+    return node_count;
+}
+
+static int cmp_point(const void *a, const void *b) {
+    uint64_t x = ((const struct ring_point *)a)->hash, y = ((const struct ring_point *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+static int ring_owner(uint64_t hash) {
+    if (!fed_enabled())
+        return self_node;
+
+    // first point at or after the hash, wrapping past the end
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return ring[lo % ring_size].node;
+}
+
+int fed_owner_of_id(uint64_t channel_id) {
+    return ring_owner(siphash24(ring_key, &channel_id, sizeof(channel_id)));
+}
+
+int fed_owner_of_name(const char *name) {
+    return ring_owner(siphash24(ring_key, name, strlen(name)));
+}
+
+int fed_owner_of_user(uint64_t user_id) {
+    unsigned shard = (unsigned)(user_id >> ID_SEQ_BITS) & ((1u << ID_SHARD_BITS) - 1);
+    return (int)(shard / ((1u << ID_SHARD_BITS) / FED_MAX_NODES));
+}
+
+static int link_connect(struct fed_peer *p) {
+    char port[16];
+    snprintf(port, sizeof(port), "%d", p->port);
+
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(p->host, port, &hints, &res) != 0)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+        return -1;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static uint64_t link_mac(const uint8_t session[SIPHASH_KEY_SIZE], struct fed_msg *m) {
+    uint64_t mac = m->mac;
+    m->mac = 0;
+    uint64_t h = siphash24(session, m, FED_HEADER_SIZE + m->len);
+    m->mac = mac;
+    return h;
+}
+
+// called with p->lock held
+static int link_write(struct fed_peer *p, struct fed_msg *m) {
+    m->seq = p->seq++;
+    m->mac = link_mac(p->session, m);
+
+    size_t size = FED_HEADER_SIZE + m->len;
+    const uint8_t *buf = (const uint8_t *)m;
+    while (size > 0) {
+        ssize_t n = send(p->fd, buf, size, MSG_NOSIGNAL);
+        if (n <= 0)
+            return -1;
+        buf += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * Only the dialer brings links up. connect() and the handshake can take
+ * seconds against a node that is down, so they run without p->lock; the
+ * link is installed, and opened with HELLO, only once it is ready.
+ */
+static void link_up(struct fed_peer *p) {
+    pthread_mutex_lock(&p->lock);
+    int up = p->fd >= 0;
+    pthread_mutex_unlock(&p->lock);
+    if (up)
+        return;
+
+    uint8_t session[SIPHASH_KEY_SIZE];
+    int fd = link_connect(p);
+    if (fd < 0)
+        return;
+    if (link_auth_dial(fd, fed_key, (uint32_t)self_node, (uint32_t)(p - peers), session) < 0) {
+        close(fd);
+        return;
+    }
+
+    struct fed_msg hello = { .type = FED_HELLO, .from = (uint32_t)self_node };
+    pthread_mutex_lock(&p->lock);
+    p->fd = fd;
+    p->seq = 0;
+    memcpy(p->session, session, sizeof(session));
+    up = link_write(p, &hello) == 0;
+    if (!up) {
+        close(p->fd);
+        p->fd = -1;
+    }
+    pthread_mutex_unlock(&p->lock);
+    memset(session, 0, sizeof(session));
+
+    if (up)
+        printf("• Federation link to node %d (%s:%d) up.\n", (int)(p - peers), p->host, p->port);
+}
+
+int fed_send(int node, struct fed_msg *m, const char *text) {
+    if (node < 0 || node >= node_count || node == self_node)
+        return -1;
+
+    m->from = (uint32_t)self_node;
+    m->len = 0;
+    if (text) {
+        size_t len = strlen(text);
+        m->len = (uint32_t)(len < FED_TEXT_MAX - 1 ? len : FED_TEXT_MAX - 1);
+        memmove(m->text, text, m->len);
+    }
+
+    // a link that is down fails at once; waiting on it would stall the caller's worker
+    struct fed_peer *p = &peers[node];
+    pthread_mutex_lock(&p->lock);
+    int r = p->fd < 0 ? -1 : link_write(p, m);
+    if (r < 0 && p->fd >= 0) {
+        // the peer went away; the dialer brings the link back
+        close(p->fd);
+        p->fd = -1;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return r;
+}
+
+void fed_broadcast(struct fed_msg *m, const char *text) {
+    for (int i = 0; i < node_count; i++) {
+        if (i != self_node && fed_send(i, m, text) < 0)
+            printf("[ERROR] Node %d unreachable, message type %u not forwarded\n", i, m->type);
+    }
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    return len == 0 || recv(fd, buf, len, MSG_WAITALL) == (ssize_t)len ? 0 : -1;
+}
+
+static void *link_reader(void *arg) {
+    struct fed_link *l = arg;
+    struct fed_msg *m = malloc(sizeof(*m));
+    uint64_t seq = 0;
+
+    while (m && read_full(l->fd, m, FED_HEADER_SIZE) == 0) {
+        if (m->len >= FED_TEXT_MAX || m->member_count > MAX_PARTICIPANTS)
+            break;
+        if (read_full(l->fd, m->text, m->len) < 0)
+            break;
+        if (m->seq != seq++ || m->mac != link_mac(l->session, m) || m->from != (uint32_t)l->node) {
+            printf("[ERROR] Federation link from node %d sent a message that fails authentication, dropping it.\n",
+                   l->node);
+            break;
+        }
+        m->text[m->len] = '\0';
+        m->username[USERNAME_SIZE - 1] = '\0';
+        m->channel_name[CHANNEL_NAME_SIZE - 1] = '\0';
+        on_message(m);
+    }
+
+    pthread_mutex_lock(&in_lock);
+    if (peers[l->node].in_fd == l->fd)
+        peers[l->node].in_fd = -1;
+    pthread_mutex_unlock(&in_lock);
+
+    free(m);
+    close(l->fd);
+    free(l);
+    return NULL;
+}
+
+static int known_peer(uint32_t node) {
+    return node < (uint32_t)node_count && node != (uint32_t)self_node;
+}
+
+/*
+ * Only configured nodes that know the secret get a link, and only one each:
+ * a node that reconnects replaces its old link, so the threads here never
+ * outnumber the nodes. The handshake runs before any thread is started.
+ */
+static void *link_acceptor(void *arg) {
+    int listen_fd = (int)(intptr_t)arg;
+
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct fed_link *l = malloc(sizeof(*l));
+        if (!l || (l->node = link_auth_accept(fd, fed_key, (uint32_t)self_node, known_peer, l->session)) < 0) {
+            printf("[ERROR] Rejected a federation link that failed authentication.\n");
+            free(l);
+            close(fd);
+            continue;
+        }
+        l->fd = fd;
+
+        pthread_mutex_lock(&in_lock);
+        if (peers[l->node].in_fd >= 0)
+            shutdown(peers[l->node].in_fd, SHUT_RDWR);
+        peers[l->node].in_fd = fd;
+        pthread_mutex_unlock(&in_lock);
+
+        pthread_t t;
+        if (pthread_create(&t, NULL, link_reader, l) != 0) {
+            pthread_mutex_lock(&in_lock);
+            if (peers[l->node].in_fd == fd)
+                peers[l->node].in_fd = -1;
+            pthread_mutex_unlock(&in_lock);
+            close(fd);
+            free(l);
+            continue;
+        }
+        pthread_detach(t);
+    }
+    return NULL;
+}
+
+// keeps trying peers that are down, so a restarted node is picked up again
+static void *link_dialer(void *arg) {
+    (void)arg;
+    for (;;) {
+        for (int i = 0; i < node_count; i++) {
+            if (i != self_node)
+                link_up(&peers[i]);
+        }
+        usleep(FED_RETRY_MS * 1000);
+    }
+    return NULL;
+}
+
+// listens on this node's own address from the node list, not on every interface
+static int link_listen(const struct fed_peer *p) {
+    char port[16];
+    snprintf(port, sizeof(port), "%d", p->port);
+
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(p->host, port, &hints, &res) != 0)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(fd, res->ai_addr, res->ai_addrlen) < 0 || listen(fd, FED_MAX_NODES) < 0) {
+        freeaddrinfo(res);
+        close(fd);
+        return -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int fed_init(int self, const char *nodes, const char *secret, void (*handler)(struct fed_msg *m)) {
+    if (link_secret_key(secret, fed_key) < 0)
+        return -1;
+
+    char *list = strdup(nodes);
+    if (!list)
+        return -1;
+
+    char *save = NULL;
+    for (char *tok = strtok_r(list, ",", &save); tok && node_count < FED_MAX_NODES; tok = strtok_r(NULL, ",", &save)) {
+        struct fed_peer *p = &peers[node_count];
+        char *colon = strrchr(tok, ':');
+        if (!colon)
+            break;
+        *colon = '\0';
+        snprintf(p->host, sizeof(p->host), "%s", tok);
+        p->port = atoi(colon + 1);
+        p->fd = -1;
+        p->in_fd = -1;
+        pthread_mutex_init(&p->lock, NULL);
+        node_count++;
+    }
+    free(list);
+
+    if (node_count < 2 || self < 0 || self >= node_count) {
+        node_count = 0;
+        return -1;
+    }
+    self_node = self;
+    on_message = handler;
+
+    for (int n = 0; n < node_count; n++) {
+        for (int v = 0; v < FED_VNODES; v++) {
+            uint32_t point[2] = { (uint32_t)n, (uint32_t)v };
+            ring[ring_size].hash = siphash24(ring_key, point, sizeof(point));
+            ring[ring_size++].node = n;
+        }
+    }
+    qsort(ring, (size_t)ring_size, sizeof(ring[0]), cmp_point);
+
+    int listen_fd = link_listen(&peers[self]);
+    if (listen_fd < 0) {
+        node_count = 0;
+        return -1;
+    }
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, link_acceptor, (void *)(intptr_t)listen_fd) != 0 ||
+        pthread_create(&t, NULL, link_dialer, NULL) != 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef RMS_FEDERATION_H
+#define RMS_FEDERATION_H
+#include <stdint.h>
+#include <stddef.h>
+#include "channel.h"
+#include "encrypted_packet.h"
+
+#define FED_MAX_NODES 16
+#define FED_VNODES 64          // points per node on the hash ring
+#define FED_TEXT_MAX (MSG_CONTENT_MAX + 1)
+#define FED_RETRY_MS 1000      // how often a missing peer link is retried
+
+/*
+ * Several server processes share the channel space. Each channel has one
+ * owner node, picked by consistent hashing: names and ids both hash onto
+ * the same ring, and an owner only hands out ids that hash back to itself,
+ * so either one finds the owner without asking anybody.
+ *
+ * The owner keeps the channel (members, ring, files, history). Other nodes
+ * forward their users' create/join/post requests to it and keep a stub of
+ * the channel (name and members, no messages) so they can key and fan out
+ * to their own connected members. A post is stored once on the owner and
+ * forwarded once per node, never once per member.
+ *
+ * Nodes are linked pairwise over TCP. Every node dials every peer for its
+ * outgoing messages and reads incoming ones on the connections it accepts.
+ * A link only carries messages once both ends have proved they know the
+ * deployment's secret (see link_auth.h); after that each message is MAC'd
+ * and numbered, and the receiver takes `from` to be the node that dialed.
+ */
+enum {
+    FED_HELLO = 1,  // first message on a new link; the peer answers with its channels
+    FED_CHANNEL,    // owner -> all: name and members of one of its channels
+    FED_CREATE,     // user's node -> owner of the name
+    FED_JOIN,       // user's node -> owner; text is the id or name
+    FED_POST,       // user's node -> owner; text is the message
+    FED_DELIVER,    // owner -> all: a stored message to fan out locally
+    FED_REPLY,      // owner -> user's node: text for one user
+};
+
+struct fed_msg {
+    uint32_t type;
+    uint32_t len;                       // bytes of text
+    uint32_t from;                      // sending node, set by fed_send
+    uint32_t member_count;
+    uint64_t seq;                       // per link, from 0; set by fed_send
+    uint64_t mac;                       // over header and text under the link key, set by fed_send
+    uint64_t channel_id;
+    uint64_t user_id;                   // the user acting or being answered
+    uint64_t msg_id;
+    char username[USERNAME_SIZE];
+    char channel_name[CHANNEL_NAME_SIZE];
+    uint64_t members[MAX_PARTICIPANTS];
+    char text[FED_TEXT_MAX];
+};
+
+#define FED_HEADER_SIZE offsetof(struct fed_msg, text)
+
+/*
+ * nodes is "host:port,host:port,..." (the link addresses, in the same order
+ * on every node) and self is this node's index in it; links are accepted
+ * on our own address only. secret is shared by all nodes. handler runs on
+ * a link thread for every message received.
+ */
+int fed_init(int self, const char *nodes, const char *secret, void (*handler)(struct fed_msg *m));
+int fed_enabled(void);
+int fed_self(void);
+int fed_node_count(void);
+
+int fed_owner_of_id(uint64_t channel_id);
+int fed_owner_of_name(const char *name);
+// the node that registered a user: ids are minted in the minting node's shard range
+int fed_owner_of_user(uint64_t user_id);
+
+// copies text into m and sends it; returns -1 at once while the link to the peer is down
+int fed_send(int node, struct fed_msg *m, const char *text);
+// sends to every peer once
+void fed_broadcast(struct fed_msg *m, const char *text);
+
+#endif //RMS_FEDERATION_H
@@ -0,0 +1,55 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "frame.h"
+
+// released frames wait here for reuse; nearly all frames are one packet in size
+static struct frame *spare_frames;
+static int spare_count;
+static pthread_mutex_t spare_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct frame *frame_alloc(size_t len) {
+    pthread_mutex_lock(&spare_lock);
+    struct frame *f = spare_frames;
+    if (f) {
+        spare_frames = f->next_spare;
+        spare_count--;
+    }
+    pthread_mutex_unlock(&spare_lock);
+
+    if (f && f->cap < len) {
+        free(f);
+        f = NULL;
+    }
+    if (!f) {
+        f = malloc(sizeof(*f) + len);
+        if (!f)
+            return NULL;
+        f->cap = len;
+    }
+
+    atomic_init(&f->refs, 1);
+    f->len = len;
+    memset(f->data, 0, len);
+    return f;
+}
+
+struct frame *frame_ref(struct frame *f) {
+    atomic_fetch_add_explicit(&f->refs, 1, memory_order_relaxed);
+    return f;
+}
+
+void frame_unref(struct frame *f) {
+    if (!f || atomic_fetch_sub_explicit(&f->refs, 1, memory_order_acq_rel) != 1)
+        return;
+
+    pthread_mutex_lock(&spare_lock);
+    if (spare_count < FRAME_SPARES) {
+        f->next_spare = spare_frames;
+        spare_frames = f;
+        spare_count++;
+        f = NULL;
+    }
+    pthread_mutex_unlock(&spare_lock);
+    free(f);
+}
@@ -0,0 +1,26 @@
+#ifndef RMS_FRAME_H
+#define RMS_FRAME_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define FRAME_SPARES 256 // released frames kept for reuse
+
+/*
+ * Reference-counted wire buffer. A broadcast encodes its packet into one
+ * frame and every queued send holds a reference to the same bytes; the
+ * buffer is recycled when the last send lets go.
+ */
+struct frame {
+    atomic_int refs;
+    size_t len;
+    size_t cap;                 // bytes data can hold
+    struct frame *next_spare;   // link while on the spare list
+    uint8_t data[];
+};
+
+struct frame *frame_alloc(size_t len);
+struct frame *frame_ref(struct frame *f);
+void frame_unref(struct frame *f);
+
+#endif //RMS_FRAME_H
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#include "channel.h"
+#include "group_key.h"
+
+struct group_key_slot {
+    uint64_t channel_id;
+    struct group_key current;
+    struct group_key next;
+    int has_current;
+    int has_next;
+    // nonces handed out under each key; the superseded key keeps its count
+    // for frames sealed just before it was replaced
+    uint64_t current_sent, next_sent, previous_sent;
+    uint32_t previous_epoch;
+    int has_previous;
+};
+
+static struct group_key_slot slots[MAX_CHANNELS];
+static int slot_count = 0;
+static pthread_mutex_t key_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct group_key_slot *find_slot(uint64_t channel_id, int create) {
+    for (int i = 0; i < slot_count; i++) {
+        if (slots[i].channel_id == channel_id)
+            return &slots[i];
+    }
+    if (!create || slot_count >= MAX_CHANNELS)
+        return NULL;
+
+    struct group_key_slot *s = &slots[slot_count++];
+    memset(s, 0, sizeof(*s));
+    s->channel_id = channel_id;
+    return s;
+}
+
+static int fill_random(uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t r = getrandom(buf, len, 0);
+        if (r <= 0)
+            return -1;
+        buf += r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+// returns 0 with the active key, -1 if the channel has none yet
+int group_key_current(uint64_t channel_id, struct group_key *out) {
+    pthread_mutex_lock(&key_lock);
+    struct group_key_slot *s = find_slot(channel_id, 0);
+    int rc = -1;
+    if (s && s->has_current) {
+        *out = s->current;
+        rc = 0;
+    }
+    pthread_mutex_unlock(&key_lock);
+    return rc;
+}
+
+int group_key_prepare(uint64_t channel_id, struct group_key *out) {
+    pthread_mutex_lock(&key_lock);
+    struct group_key_slot *s = find_slot(channel_id, 1);
+    if (!s) {
+        pthread_mutex_unlock(&key_lock);
+        return -1;
+    }
+
+    uint32_t epoch = s->has_next ? s->next.epoch : (s->has_current ? s->current.epoch : 0);
+    s->next.channel_id = channel_id;
+    s->next.epoch = epoch + 1;
+    if (fill_random(s->next.key, sizeof(s->next.key)) < 0) {
+        pthread_mutex_unlock(&key_lock);
+        return -1;
+    }
+    s->has_next = 1;
+    s->next_sent = 0;
+    *out = s->next;
+    pthread_mutex_unlock(&key_lock);
+    return 0;
+}
+
+void group_key_activate(uint64_t channel_id, uint32_t epoch) {
+    pthread_mutex_lock(&key_lock);
+    struct group_key_slot *s = find_slot(channel_id, 0);
+    // a later prepare may have superseded this one; only its owner activates
+    if (s && s->has_next && s->next.epoch == epoch) {
+        s->previous_epoch = s->current.epoch;
+        s->previous_sent = s->current_sent;
+        s->has_previous = s->has_current;
+        s->current = s->next;
+        s->current_sent = s->next_sent;
+        s->has_current = 1;
+        s->has_next = 0;
+    }
+    pthread_mutex_unlock(&key_lock);
+}
+
+int group_key_next_nonce(uint64_t channel_id, uint32_t epoch, uint64_t *nonce) {
+    pthread_mutex_lock(&key_lock);
+    struct group_key_slot *s = find_slot(channel_id, 0);
+    uint64_t *sent = NULL;
+    if (s && s->has_current && s->current.epoch == epoch)
+        sent = &s->current_sent;
+    else if (s && s->has_next && s->next.epoch == epoch)
+        sent = &s->next_sent;
+    else if (s && s->has_previous && s->previous_epoch == epoch)
+        sent = &s->previous_sent;
+    if (sent)
+        *nonce = (*sent)++;
+    pthread_mutex_unlock(&key_lock);
+    return sent ? 0 : -1;
+}
+
+void group_key_nonce(uint64_t nonce, uint32_t epoch, uint8_t out[CHACHA20_NONCE_SIZE]) {
+    for (int i = 0; i < 8; i++)
+        out[i] = (uint8_t)(nonce >> (8 * i));
+    for (int i = 0; i < 4; i++)
+        out[8 + i] = (uint8_t)(epoch >> (8 * i));
+}
+
+void group_key_hex(const struct group_key *k, char out[2 * CHACHA20_KEY_SIZE + 1]) {
+    for (int i = 0; i < CHACHA20_KEY_SIZE; i++)
+        snprintf(out + 2 * i, 3, "%02x", k->key[i]);
+}
+
+int group_key_parse_hex(const char *hex, uint8_t key[CHACHA20_KEY_SIZE]) {
+    if (strlen(hex) < 2 * CHACHA20_KEY_SIZE)
+        return -1;
+
+    for (int i = 0; i < CHACHA20_KEY_SIZE; i++) {
+        unsigned v;
+        if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+            return -1;
+        key[i] = (uint8_t)v;
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef RMS_GROUP_KEY_H
+#define RMS_GROUP_KEY_H
+#include <stdint.h>
+#include "chacha20.h"
+
+/*
+ * Per-channel symmetric keys. Broadcasts are encrypted once with the
+ * channel's current key instead of once per recipient. A membership change
+ * rotates the key: the new epoch is prepared, handed to every member, and
+ * only then activated, so no member sees a frame under a key it lacks.
+ */
+struct group_key {
+    uint64_t channel_id;
+    uint32_t epoch;
+    uint8_t key[CHACHA20_KEY_SIZE];
+};
+
+int group_key_current(uint64_t channel_id, struct group_key *out);
+int group_key_prepare(uint64_t channel_id, struct group_key *out);
+void group_key_activate(uint64_t channel_id, uint32_t epoch);
+
+// never repeats under one key: -1 once the key has been dropped
+int group_key_next_nonce(uint64_t channel_id, uint32_t epoch, uint64_t *nonce);
+void group_key_nonce(uint64_t nonce, uint32_t epoch, uint8_t out[CHACHA20_NONCE_SIZE]);
+void group_key_hex(const struct group_key *k, char out[2 * CHACHA20_KEY_SIZE + 1]);
+int group_key_parse_hex(const char *hex, uint8_t key[CHACHA20_KEY_SIZE]);
+
+#endif //RMS_GROUP_KEY_H
@@ -0,0 +1,460 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.h"
+#include "arena.h"
+#include "utility.h"
+
+#define HISTORY_MAX_SEGMENTS 4096
+#define HISTORY_RECORD_MAX (sizeof(struct history_record) + sizeof(((struct msg *)0)->content) + 8)
+
+struct history_writer {
+    uint64_t channel_id;
+    int seg_fd;
+    int idx_fd;
+    uint64_t seg_first_id;
+    uint32_t seg_size;
+    uint32_t records;
+};
+
+static struct history_writer writers[MAX_CHANNELS];
+static int writer_count = 0;
+static pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t record_size(uint16_t len) {
+    return (sizeof(struct history_record) + len + 7) & ~(size_t)7;
+}
+
+static void channel_dir(char *buf, size_t size, uint64_t channel_id) {
+    snprintf(buf, size, "%s/%" PRIu64, HISTORY_DIR, channel_id);
+}
+
+static void segment_path(char *buf, size_t size, uint64_t channel_id, uint64_t first_id, const char *ext) {
+    snprintf(buf, size, "%s/%" PRIu64 "/%020" PRIu64 ".%s", HISTORY_DIR, channel_id, first_id, ext);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// first ids of every segment of a channel, ascending
+static int list_segments(uint64_t channel_id, uint64_t *out, int max) {
+    char dir[128];
+    channel_dir(dir, sizeof(dir), channel_id);
+
+    DIR *d = opendir(dir);
+    if (!d)
+        return 0;
+
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) && n < max) {
+        size_t len = strlen(e->d_name);
+        if (len < 5 || strcmp(e->d_name + len - 4, ".seg") != 0)
+            continue;
+        out[n++] = strtoull(e->d_name, NULL, 10);
+    }
+    closedir(d);
+
+    qsort(out, n, sizeof(*out), cmp_u64);
+    return n;
+}
+
+struct mapping {
+    uint8_t *data;
+    size_t size;
+};
+
+static int map_file(const char *path, struct mapping *m) {
+    m->data = NULL;
+    m->size = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return st.st_size == 0 ? 0 : -1;
+    }
+
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return -1;
+
+    m->data = p;
+    m->size = (size_t)st.st_size;
+    return 0;
+}
+
+static void unmap_file(struct mapping *m) {
+    if (m->data)
+        munmap(m->data, m->size);
+}
+
+static uint32_t record_crc(const struct history_record *r, const uint8_t *content) {
+    struct history_record h = *r;
+    h.crc = 0;
+    return crc32c(crc32c(0, &h, sizeof(h)), content, h.len);
+}
+
+// size of the intact record at off, or 0 if it is cut short or fails its checksum
+static size_t check_record(const uint8_t *data, size_t size, size_t off) {
+    if (off + sizeof(struct history_record) > size)
+        return 0;
+    const struct history_record *r = (const void *)(data + off);
+    size_t rec = record_size(r->len);
+    if (off + rec > size || r->crc != record_crc(r, data + off + sizeof(*r)))
+        return 0;
+    return rec;
+}
+
+/*
+ * Finds where the intact records of a segment end: from the last index
+ * entry that points at a good record, walk forward to the first bad one.
+ * Both files are cut back to that point, so appends land right after the
+ * last good record. Returns the records left, or -1.
+ */
+static long recover_segment(const char *seg_path, int seg_fd, int idx_fd) {
+    struct mapping seg;
+    if (map_file(seg_path, &seg) < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(idx_fd, &st) < 0) {
+        unmap_file(&seg);
+        return -1;
+    }
+    size_t entries = (size_t)st.st_size / sizeof(struct history_index_entry);
+
+    // the index is written first, so its tail may point past what reached the segment
+    size_t kept = entries, off = 0;
+    for (; kept > 0; kept--) {
+        struct history_index_entry e;
+        if (pread(idx_fd, &e, sizeof(e), (off_t)((kept - 1) * sizeof(e))) == (ssize_t)sizeof(e) &&
+            check_record(seg.data, seg.size, e.offset) > 0) {
+            off = e.offset;
+            break;
+        }
+    }
+
+    long records = kept > 0 ? (long)(kept - 1) * HISTORY_INDEX_STRIDE : 0;
+    size_t rec;
+    while ((rec = check_record(seg.data, seg.size, off)) > 0) {
+        off += rec;
+        records++;
+    }
+    size_t seg_size = seg.size;
+    unmap_file(&seg);
+
+    if (off < seg_size) {
+        printf("[ERROR] %s: dropping %zu damaged byte(s) at offset %zu\n", seg_path, seg_size - off, off);
+        if (ftruncate(seg_fd, (off_t)off) < 0)
+            return -1;
+    }
+    if ((kept < entries || (size_t)st.st_size % sizeof(struct history_index_entry)) &&
+        ftruncate(idx_fd, (off_t)(kept * sizeof(struct history_index_entry))) < 0)
+        return -1;
+    return records;
+}
+
+static int open_segment(struct history_writer *w, uint64_t first_id) {
+    char seg_path[256], path[256];
+
+    segment_path(seg_path, sizeof(seg_path), w->channel_id, first_id, "seg");
+    w->seg_fd = open(seg_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    segment_path(path, sizeof(path), w->channel_id, first_id, "idx");
+    w->idx_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (w->seg_fd < 0 || w->idx_fd < 0)
+        return -1;
+
+    long records = recover_segment(seg_path, w->seg_fd, w->idx_fd);
+    struct stat st;
+    if (records < 0 || fstat(w->seg_fd, &st) < 0)
+        return -1;
+    w->seg_first_id = first_id;
+    w->seg_size = (uint32_t)st.st_size;
+    w->records = (uint32_t)records;
+    return 0;
+}
+
+static struct history_writer *find_writer(uint64_t channel_id, uint64_t next_id) {
+    for (int i = 0; i < writer_count; i++) {
+        if (writers[i].channel_id == channel_id)
+            return &writers[i];
+    }
+    if (writer_count >= MAX_CHANNELS)
+        return NULL;
+
+    char dir[128];
+    mkdir(HISTORY_DIR, 0755);
+    channel_dir(dir, sizeof(dir), channel_id);
+    mkdir(dir, 0755);
+
+    struct history_writer *w = &writers[writer_count];
+    memset(w, 0, sizeof(*w));
+    w->channel_id = channel_id;
+
+    uint64_t *segs = malloc(HISTORY_MAX_SEGMENTS * sizeof(*segs));
+    if (!segs)
+        return NULL;
+    int n = list_segments(channel_id, segs, HISTORY_MAX_SEGMENTS);
+    uint64_t first = n > 0 ? segs[n - 1] : next_id;
+    free(segs);
+
+    if (open_segment(w, first) < 0)
+        return NULL;
+
+    writer_count++;
+    return w;
+}
+
+// encodes m at buf, padding included, and returns its size
+static size_t encode_record(uint8_t *buf, const struct msg *m) {
+    struct history_record *r = (struct history_record *)buf;
+    memset(r, 0, sizeof(*r));
+    r->msg_id = m->msg_id;
+    r->sender_id = m->sender_id;
+    r->timestamp = m->timestamp;
+    r->msg_type = (uint16_t)m->msg_type;
+    r->len = (uint16_t)strnlen(m->content, sizeof(m->content));
+    memcpy(buf + sizeof(*r), m->content, r->len);
+
+    size_t size = record_size(r->len);
+    memset(buf + sizeof(*r) + r->len, 0, size - sizeof(*r) - r->len);
+    r->crc = record_crc(r, buf + sizeof(*r));
+    return size;
+}
+
+int history_append(uint64_t channel_id, const struct msg *m) {
+    return history_append_many(channel_id, &m, 1);
+}
+
+int history_append_many(uint64_t channel_id, const struct msg *const *msgs, int count) {
+    if (count <= 0)
+        return 0;
+
+    size_t mark = arena_mark();
+    uint8_t *buf = arena_alloc((size_t)count * HISTORY_RECORD_MAX);
+    struct history_index_entry *idx = arena_alloc(((size_t)count / HISTORY_INDEX_STRIDE + 1) * sizeof(*idx));
+    if (!buf || !idx) {
+        arena_release(mark);
+        return -1;
+    }
+
+    pthread_mutex_lock(&history_lock);
+    struct history_writer *w = find_writer(channel_id, msgs[0]->msg_id);
+    if (w && w->seg_size >= HISTORY_SEGMENT_SIZE) {
+        close(w->seg_fd);
+        close(w->idx_fd);
+        w->records = 0;
+        if (open_segment(w, msgs[0]->msg_id) < 0)
+            w = NULL;
+    }
+
+    int rc = -1;
+    if (w) {
+        size_t size = 0, entries = 0;
+        for (int i = 0; i < count; i++) {
+            if ((w->records + (uint32_t)i) % HISTORY_INDEX_STRIDE == 0)
+                idx[entries++] = (struct history_index_entry){ msgs[i]->msg_id, msgs[i]->timestamp,
+                                                               w->seg_size + (uint32_t)size };
+            size += encode_record(buf + size, msgs[i]);
+        }
+
+        size_t idx_size = entries * sizeof(*idx);
+        if ((idx_size == 0 || write(w->idx_fd, idx, idx_size) == (ssize_t)idx_size) &&
+            write(w->seg_fd, buf, size) == (ssize_t)size) {
+            w->seg_size += (uint32_t)size;
+            w->records += (uint32_t)count;
+            rc = 0;
+        }
+    }
+    pthread_mutex_unlock(&history_lock);
+    arena_release(mark);
+    return rc;
+}
+
+/*
+ * Collects up to `limit` records with id < before_id from one segment,
+ * keeping the newest ones. Results land at the end of out[0..limit) so
+ * older segments can be prepended. Returns how many were collected.
+ */
+static int read_segment(uint64_t channel_id, uint64_t first_id, uint64_t before_id,
+                        struct msg *out, int limit) {
+    char path[256];
+    struct mapping seg, idx;
+
+    segment_path(path, sizeof(path), channel_id, first_id, "seg");
+    if (map_file(path, &seg) < 0 || !seg.data)
+        return 0;
+    segment_path(path, sizeof(path), channel_id, first_id, "idx");
+    map_file(path, &idx);
+
+    // the sparse index tells us where to start so we only scan about `limit` records
+    size_t start = 0;
+    if (idx.data) {
+        const struct history_index_entry *e = (const void *)idx.data;
+        size_t entries = idx.size / sizeof(*e);
+        size_t lo = 0, hi = entries;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (e[mid].msg_id < before_id)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        size_t back = (size_t)(limit + HISTORY_INDEX_STRIDE - 1) / HISTORY_INDEX_STRIDE + 1;
+        if (lo > back && e[lo - back].offset < seg.size)
+            start = e[lo - back].offset;
+    }
+
+    int count = 0;
+    size_t off = start;
+    size_t size;
+    while ((size = check_record(seg.data, seg.size, off)) > 0) {
+        const struct history_record *r = (const void *)(seg.data + off);
+        if (r->msg_id >= before_id)
+            break;
+
+        struct msg *m = &out[count % limit];
+        memset(m, 0, sizeof(*m));
+        m->msg_id = r->msg_id;
+        m->sender_id = r->sender_id;
+        m->timestamp = r->timestamp;
+        m->msg_type = r->msg_type;
+        memcpy(m->content, seg.data + off + sizeof(*r),
+               r->len < sizeof(m->content) - 1 ? r->len : sizeof(m->content) - 1);
+        count++;
+        off += size;
+    }
+
+    unmap_file(&idx);
+    unmap_file(&seg);
+
+    // out was used as a ring; rotate so the newest `kept` sit at the end in order
+    int kept = count < limit ? count : limit;
+    if (count > limit) {
+        int head = count % limit;
+        struct msg *tmp = malloc((size_t)limit * sizeof(*tmp));
+        if (!tmp)
+            return 0;
+        for (int i = 0; i < limit; i++)
+            tmp[i] = out[(head + i) % limit];
+        memcpy(out, tmp, (size_t)limit * sizeof(*tmp));
+        free(tmp);
+    } else if (kept < limit) {
+        memmove(out + (limit - kept), out, (size_t)kept * sizeof(*out));
+    }
+    return kept;
+}
+
+/*
+ * Reads the newest `limit` messages older than before_id (0 = newest overall)
+ * into out, oldest first. Returns the number read.
+ */
+int history_read(uint64_t channel_id, uint64_t before_id, struct msg *out, int limit) {
+    if (limit <= 0)
+        return 0;
+    if (limit > HISTORY_MAX_LIMIT)
+        limit = HISTORY_MAX_LIMIT;
+    if (before_id == 0)
+        before_id = UINT64_MAX;
+
+    uint64_t *segs = malloc(HISTORY_MAX_SEGMENTS * sizeof(*segs));
+    struct msg *tmp = malloc((size_t)limit * sizeof(*tmp));
+    if (!segs || !tmp) {
+        free(segs);
+        free(tmp);
+        return 0;
+    }
+
+    int n = list_segments(channel_id, segs, HISTORY_MAX_SEGMENTS);
+    int have = 0;
+    for (int s = n - 1; s >= 0 && have < limit; s--) {
+        if (segs[s] >= before_id)
+            continue;
+
+        int want = limit - have;
+        int got = read_segment(channel_id, segs[s], before_id, tmp, want);
+        // prepend: older segments go in front of what we already have
+        memmove(out + got, out, (size_t)have * sizeof(*out));
+        memcpy(out, tmp + (want - got), (size_t)got * sizeof(*out));
+        have += got;
+        before_id = segs[s];
+    }
+
+    free(segs);
+    free(tmp);
+    return have;
+}
+
+int history_channels(uint64_t *out, int max) {
+    DIR *d = opendir(HISTORY_DIR);
+    if (!d)
+        return 0;
+
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) && n < max) {
+        char *end;
+        uint64_t id = strtoull(e->d_name, &end, 10);
+        if (end != e->d_name && *end == '\0')
+            out[n++] = id;
+    }
+    closedir(d);
+    return n;
+}
+
+int history_scan(uint64_t channel_id, int (*fn)(const struct msg *m, void *arg), void *arg) {
+    uint64_t *segs = malloc(HISTORY_MAX_SEGMENTS * sizeof(*segs));
+    struct msg *m = malloc(sizeof(*m));
+    if (!segs || !m) {
+        free(segs);
+        free(m);
+        return -1;
+    }
+
+    int stop = 0;
+    int n = list_segments(channel_id, segs, HISTORY_MAX_SEGMENTS);
+    for (int s = 0; s < n && !stop; s++) {
+        char path[256];
+        struct mapping seg;
+        segment_path(path, sizeof(path), channel_id, segs[s], "seg");
+        if (map_file(path, &seg) < 0 || !seg.data)
+            continue;
+
+        size_t off = 0, size;
+        while (!stop && (size = check_record(seg.data, seg.size, off)) > 0) {
+            const struct history_record *r = (const void *)(seg.data + off);
+
+            memset(m, 0, sizeof(*m));
+            m->msg_id = r->msg_id;
+            m->sender_id = r->sender_id;
+            m->timestamp = r->timestamp;
+            m->msg_type = r->msg_type;
+            memcpy(m->content, seg.data + off + sizeof(*r),
+                   r->len < sizeof(m->content) - 1 ? r->len : sizeof(m->content) - 1);
+            stop = fn(m, arg);
+            off += size;
+        }
+        unmap_file(&seg);
+    }
+
+    free(segs);
+    free(m);
+    return 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+#include "channel.h"
+
+#ifndef RMS_HISTORY_H
+#define RMS_HISTORY_H
+
+#define HISTORY_DIR "history"
+#define HISTORY_SEGMENT_SIZE (4 * 1024 * 1024) // roll to a new segment past 4MB
+#define HISTORY_INDEX_STRIDE 32                // one sparse index entry per 32 records
+#define HISTORY_MAX_LIMIT 200
+
+/*
+ * Long-term scrollback, independent of the in-memory ring buffer:
+ *
+ * history/<channel_id>/<first_msg_id>.seg   append-only message records
+ * history/<channel_id>/<first_msg_id>.idx   sparse index into the segment
+ *
+ * Segment names are zero-padded so lexical order is id (and time) order.
+ * Readers mmap a segment only for the duration of a query and stop at the
+ * first record whose checksum fails. When a writer reopens a segment it
+ * cuts off such a tail, left by a write torn in a crash, before appending.
+ */
+
+struct history_record {
+    uint64_t msg_id;
+    uint64_t sender_id;
+    uint32_t timestamp;
+    uint16_t msg_type;
+    uint16_t len;       // content bytes following the header, padded to 8
+    uint32_t crc;       // CRC-32C of the header (crc as 0) and the content
+    uint32_t reserved;
+};
+
+struct history_index_entry {
+    uint64_t msg_id;
+    uint32_t timestamp;
+    uint32_t offset;
+};
+
+int history_append(uint64_t channel_id, const struct msg *m);
+// the same for count messages of one channel, in id order, as one segment write
+int history_append_many(uint64_t channel_id, const struct msg *const *msgs, int count);
+int history_read(uint64_t channel_id, uint64_t before_id, struct msg *out, int limit);
+
+// channel ids that have history on disk
+int history_channels(uint64_t *out, int max);
+// calls fn on every record of a channel in id order until fn returns non-zero
+int history_scan(uint64_t channel_id, int (*fn)(const struct msg *m, void *arg), void *arg);
+
+#endif //RMS_HISTORY_H
@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "io_backend.h"
+
+/*
+ * io_uring is driven through the raw syscalls so there is no liburing
+ * dependency. Every thread that submits I/O gets its own ring, which keeps
+ * the submission path lock-free. Each ring registers one staging buffer
+ * (for WRITE_FIXED) and a one-slot sparse file table, so a file write is a
+ * linked OPENAT -> WRITE -> CLOSE chain on a direct descriptor that costs a
+ * single io_uring_enter(). If the kernel has no io_uring, or it is disabled
+ * with RMS_IO=sync, everything falls back to plain send()/write().
+ */
+
+struct uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    uint8_t *buf;
+    int direct_files;
+};
+
+static int backend = IO_BACKEND_SYNC;
+static _Thread_local struct uring *ring;
+static _Thread_local int ring_failed;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned op, void *arg, unsigned n) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+static void uring_destroy(struct uring *r) {
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+    if (r->sq_ptr)
+        munmap(r->sq_ptr, r->sq_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    free(r->buf);
+    free(r);
+}
+
+static struct uring *uring_create(void) {
+    struct uring *r = calloc(1, sizeof(*r));
+    if (!r)
+        return NULL;
+
+    struct io_uring_params p = {0};
+    r->fd = sys_io_uring_setup(IO_BATCH_MAX, &p);
+    if (r->fd < 0) {
+        free(r);
+        return NULL;
+    }
+
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_size > r->sq_size)
+            r->sq_size = r->cq_size;
+        r->cq_size = r->sq_size;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        r->sq_ptr = NULL;
+        uring_destroy(r);
+        return NULL;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            r->cq_ptr = NULL;
+            uring_destroy(r);
+            return NULL;
+        }
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        uring_destroy(r);
+        return NULL;
+    }
+
+    uint8_t *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // optional extras: without them file writes just take the sync path
+    if (posix_memalign((void **)&r->buf, 4096, IO_BUF_SIZE) == 0) {
+        struct iovec iov = { .iov_base = r->buf, .iov_len = IO_BUF_SIZE };
+        int sparse = -1;
+        if (sys_io_uring_register(r->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0 &&
+            sys_io_uring_register(r->fd, IORING_REGISTER_FILES, &sparse, 1) == 0)
+            r->direct_files = 1;
+    }
+
+    return r;
+}
+
+static struct uring *thread_ring(void) {
+    if (backend != IO_BACKEND_URING || ring_failed)
+        return NULL;
+    if (!ring) {
+        ring = uring_create();
+        if (!ring)
+            ring_failed = 1;
+    }
+    return ring;
+}
+
+static struct io_uring_sqe *uring_sqe(struct uring *r) {
+    unsigned tail = *r->sq_tail;
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= IO_BATCH_MAX)
+        return NULL;
+
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+// cqe->res is an int the kernel never sets to this, so it marks an op with no completion
+#define IO_NO_COMPLETION ((ssize_t)INT32_MIN)
+
+/*
+ * Submits everything queued and waits for `count` completions, storing each
+ * result at results[user_data]; ops that never complete keep
+ * IO_NO_COMPLETION. Returns -1 if the ring itself failed, with *submitted
+ * saying how many SQEs (always the first ones queued) the kernel took.
+ */
+static int uring_run(struct uring *r, unsigned count, ssize_t *results, unsigned *submitted_out) {
+    unsigned submitted = 0, reaped = 0;
+    for (unsigned i = 0; i < count; i++)
+        results[i] = IO_NO_COMPLETION;
+    *submitted_out = 0;
+    while (reaped < count) {
+        int rc = sys_io_uring_enter(r->fd, count - submitted, 1, IORING_ENTER_GETEVENTS);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        submitted += (unsigned)rc;
+        *submitted_out = submitted;
+
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, reaped++) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            results[cqe->user_data] = cqe->res;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static ssize_t send_all(int fd, const uint8_t *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = send(fd, buf + done, len - done, MSG_NOSIGNAL);
+        if (w <= 0) {
+            if (w < 0 && errno == EINTR)
+                continue;
+            return done ? (ssize_t)done : -1;
+        }
+        done += (size_t)w;
+    }
+    return (ssize_t)done;
+}
+
+int io_init(void) {
+    const char *mode = getenv("RMS_IO");
+    if (mode && strcmp(mode, "sync") == 0) {
+        backend = IO_BACKEND_SYNC;
+        return backend;
+    }
+
+    backend = IO_BACKEND_URING;
+    if (!thread_ring())
+        backend = IO_BACKEND_SYNC;
+    return backend;
+}
+
+const char *io_backend_name(void) {
+    return backend == IO_BACKEND_URING ? "io_uring" : "sync";
+}
+
+void io_batch_init(struct io_batch *b) {
+    b->count = 0;
+}
+
+int io_batch_send(struct io_batch *b, int fd, const void *buf, size_t len) {
+    if (b->count >= IO_BATCH_MAX)
+        return -1;
+
+    struct io_op *op = &b->ops[b->count++];
+    op->fd = fd;
+    op->buf = buf;
+    op->len = len;
+    op->res = 0;
+    return 0;
+}
+
+/*
+ * Sends every queued buffer. Short sends are finished synchronously so a
+ * packet is never left half-written. Returns the number of ops that
+ * delivered their full buffer.
+ */
+int io_batch_submit(struct io_batch *b) {
+    struct uring *r = thread_ring();
+    int ok = 0;
+
+    if (r) {
+        ssize_t results[IO_BATCH_MAX];
+        for (int i = 0; i < b->count; i++) {
+            struct io_uring_sqe *sqe = uring_sqe(r);
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = b->ops[i].fd;
+            sqe->addr = (uintptr_t)b->ops[i].buf;
+            sqe->len = (uint32_t)b->ops[i].len;
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            sqe->user_data = (uint64_t)i;
+        }
+        unsigned submitted;
+        if (uring_run(r, (unsigned)b->count, results, &submitted) < 0)
+            ring_failed = 1;
+        /*
+         * Only ops the kernel never took go out again synchronously. One
+         * that was submitted but not reaped may still be sent, so it counts
+         * as failed rather than risk the recipient getting the frame twice.
+         */
+        for (int i = 0; i < b->count; i++) {
+            if ((unsigned)i >= submitted)
+                b->ops[i].res = IO_NO_COMPLETION;
+            else
+                b->ops[i].res = results[i] == IO_NO_COMPLETION ? -EIO : results[i];
+        }
+    }
+
+    for (int i = 0; i < b->count; i++) {
+        struct io_op *op = &b->ops[i];
+        if (!r || op->res == IO_NO_COMPLETION) {
+            op->res = send_all(op->fd, op->buf, op->len);
+        } else if (op->res >= 0 && (size_t)op->res < op->len) {
+            ssize_t rest = send_all(op->fd, (const uint8_t *)op->buf + op->res, op->len - (size_t)op->res);
+            op->res = rest < 0 ? op->res : op->res + rest;
+        }
+        if (op->res == (ssize_t)op->len)
+            ok++;
+    }
+
+    b->count = 0;
+    return ok;
+}
+
+static int write_file_sync(const char *path, const void *buf, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+
+    const uint8_t *p = buf;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = write(fd, p + done, len - done);
+        if (w <= 0) {
+            if (w < 0 && errno == EINTR)
+                continue;
+            close(fd);
+            return -1;
+        }
+        done += (size_t)w;
+    }
+    return close(fd);
+}
+
+/*
+ * Creates/truncates `path` and writes `buf` into it. On io_uring this is one
+ * linked open/write/close chain; small buffers are staged through the
+ * registered buffer so the kernel can skip pinning pages per write.
+ */
+int io_write_file(const char *path, const void *buf, size_t len) {
+    struct uring *r = thread_ring();
+    if (!r || !r->direct_files || len > UINT32_MAX)
+        return write_file_sync(path, buf, len);
+
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)path;
+    sqe->len = 0644;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC; // O_CLOEXEC is invalid for direct descriptors
+    sqe->file_index = 1; // slot 0, 1-based
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = 0;
+
+    sqe = uring_sqe(r);
+    if (len <= IO_BUF_SIZE) {
+        memcpy(r->buf, buf, len);
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = (uintptr_t)r->buf;
+        sqe->buf_index = 0;
+    } else {
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->addr = (uintptr_t)buf;
+    }
+    sqe->fd = 0;
+    sqe->len = (uint32_t)len;
+    sqe->off = 0;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    sqe->user_data = 1;
+
+    sqe = uring_sqe(r);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = 1;
+    sqe->user_data = 2;
+
+    ssize_t results[3];
+    unsigned submitted;
+    if (uring_run(r, 3, results, &submitted) < 0) {
+        ring_failed = 1;
+        return write_file_sync(path, buf, len);
+    }
+
+    if (results[0] == -EINVAL || results[0] == -EOPNOTSUPP) {
+        // kernel predates direct descriptors; stop trying on this thread
+        r->direct_files = 0;
+        return write_file_sync(path, buf, len);
+    }
+    if (results[0] < 0 || results[1] != (ssize_t)len || results[2] < 0)
+        return write_file_sync(path, buf, len);
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifndef RMS_IO_BACKEND_H
+#define RMS_IO_BACKEND_H
+
+#define IO_BACKEND_SYNC 0
+#define IO_BACKEND_URING 1
+
+#define IO_BATCH_MAX 64       // also the per-thread ring size
+#define IO_BUF_SIZE 8192      // registered staging buffer, fits one upload chunk
+
+struct io_op {
+    int fd;
+    const void *buf;
+    size_t len;
+    ssize_t res;
+};
+
+/*
+ * A batch of socket sends that is handed to the kernel in one go. With
+ * io_uring that is a single io_uring_enter() for the whole batch; the
+ * sync backend just loops over send().
+ */
+struct io_batch {
+    struct io_op ops[IO_BATCH_MAX];
+    int count;
+};
+
+int io_init(void);
+const char *io_backend_name(void);
+
+void io_batch_init(struct io_batch *b);
+int io_batch_send(struct io_batch *b, int fd, const void *buf, size_t len);
+int io_batch_submit(struct io_batch *b);
+
+int io_write_file(const char *path, const void *buf, size_t len);
+
+#endif //RMS_IO_BACKEND_H
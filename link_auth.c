@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "link_auth.h"
+
+#define LINK_SECRET_MIN 16
+
+// fixed only so every server derives the same key from the same secret
+static const uint8_t derive_key[SIPHASH_KEY_SIZE] = "rms-link-key-v1";
+
+enum { MAC_ACCEPTOR = 'A', MAC_DIALER = 'D', MAC_SESSION = 'K' };
+
+struct transcript {
+    uint64_t dialer_nonce, acceptor_nonce;
+    uint32_t dialer_id, acceptor_id;
+    uint64_t role;
+};
+
+int link_secret_key(const char *secret, uint8_t key[SIPHASH_KEY_SIZE]) {
+    if (!secret || strlen(secret) < LINK_SECRET_MIN)
+        return -1;
+
+    for (uint64_t half = 0; half < 2; half++) {
+        uint8_t k[SIPHASH_KEY_SIZE];
+        memcpy(k, derive_key, sizeof(k));
+        k[0] ^= (uint8_t)half;
+        uint64_t h = siphash24(k, secret, strlen(secret));
+        memcpy(key + 8 * half, &h, sizeof(h));
+    }
+    return 0;
+}
+
+static uint64_t transcript_mac(const uint8_t key[SIPHASH_KEY_SIZE], struct transcript t, uint64_t role) {
+    t.role = role;
+    return siphash24(key, &t, sizeof(t));
+}
+
+static void session_key(const uint8_t key[SIPHASH_KEY_SIZE], struct transcript t, uint8_t session[SIPHASH_KEY_SIZE]) {
+    for (uint64_t half = 0; half < 2; half++) {
+        uint64_t h = transcript_mac(key, t, ((uint64_t)MAC_SESSION << 8) | half);
+        memcpy(session + 8 * half, &h, sizeof(h));
+    }
+}
+
+static int set_timeout(int fd, int ms) {
+    struct timeval tv = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+    return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static int exchange(int fd, const struct link_auth *out, struct link_auth *in) {
+    if (out && send(fd, out, sizeof(*out), MSG_NOSIGNAL) != (ssize_t)sizeof(*out))
+        return -1;
+    if (in && (recv(fd, in, sizeof(*in), MSG_WAITALL) != (ssize_t)sizeof(*in) || in->magic != LINK_AUTH_MAGIC))
+        return -1;
+    return 0;
+}
+
+// constant time, so a forger learns nothing from how quickly a guess was refused
+static int mac_equal(uint64_t a, uint64_t b) {
+    return (a ^ b) == 0;
+}
+
+int link_auth_dial(int fd, const uint8_t key[SIPHASH_KEY_SIZE], uint32_t self_id, uint32_t peer_id,
+                   uint8_t session[SIPHASH_KEY_SIZE]) {
+    struct transcript t = { .dialer_id = self_id, .acceptor_id = peer_id };
+    if (getrandom(&t.dialer_nonce, sizeof(t.dialer_nonce), 0) != (ssize_t)sizeof(t.dialer_nonce))
+        return -1;
+
+    struct link_auth hello = { .magic = LINK_AUTH_MAGIC, .id = self_id, .nonce = t.dialer_nonce };
+    struct link_auth reply;
+    set_timeout(fd, LINK_AUTH_TIMEOUT_MS);
+    if (exchange(fd, &hello, &reply) < 0 || reply.id != peer_id)
+        return -1;
+
+    t.acceptor_nonce = reply.nonce;
+    if (!mac_equal(reply.mac, transcript_mac(key, t, MAC_ACCEPTOR)))
+        return -1;
+
+    struct link_auth proof = { .magic = LINK_AUTH_MAGIC, .id = self_id, .mac = transcript_mac(key, t, MAC_DIALER) };
+    if (exchange(fd, &proof, NULL) < 0)
+        return -1;
+
+    set_timeout(fd, 0);
+    session_key(key, t, session);
+    return 0;
+}
+
+int link_auth_accept(int fd, const uint8_t key[SIPHASH_KEY_SIZE], uint32_t self_id,
+                     int (*accept)(uint32_t peer_id), uint8_t session[SIPHASH_KEY_SIZE]) {
+    struct link_auth hello, proof;
+    set_timeout(fd, LINK_AUTH_TIMEOUT_MS);
+    if (exchange(fd, NULL, &hello) < 0 || !accept(hello.id))
+        return -1;
+
+    struct transcript t = { .dialer_nonce = hello.nonce, .dialer_id = hello.id, .acceptor_id = self_id };
+    if (getrandom(&t.acceptor_nonce, sizeof(t.acceptor_nonce), 0) != (ssize_t)sizeof(t.acceptor_nonce))
+        return -1;
+
+    struct link_auth reply = { .magic = LINK_AUTH_MAGIC, .id = self_id, .nonce = t.acceptor_nonce,
+                               .mac = transcript_mac(key, t, MAC_ACCEPTOR) };
+    if (exchange(fd, &reply, &proof) < 0 || proof.id != hello.id ||
+        !mac_equal(proof.mac, transcript_mac(key, t, MAC_DIALER)))
+        return -1;
+
+    set_timeout(fd, 0);
+    session_key(key, t, session);
+    return (int)hello.id;
+}
@@ -0,0 +1,38 @@
+#ifndef RMS_LINK_AUTH_H
+#define RMS_LINK_AUTH_H
+#include <stdint.h>
+#include "siphash.h"
+
+#define LINK_AUTH_MAGIC 0x48414c52u  // "RLAH"
+#define LINK_AUTH_TIMEOUT_MS 2000    // a peer that hasn't finished the handshake by then is dropped
+
+/*
+ * Mutual authentication for server-to-server links (federation, replica
+ * stream), from a secret every server in the deployment is configured
+ * with. The dialing side sends its id and a fresh nonce; the accepting
+ * side answers with its own id and nonce and a MAC over both, which the
+ * dialer checks and answers with a MAC of its own. Neither side learns
+ * anything it could replay on another link.
+ *
+ * Both ends come out with a session key unique to the link. Every message
+ * after the handshake carries a sequence number and a SipHash MAC under
+ * that key, so frames can't be forged, replayed or reordered.
+ */
+struct link_auth {
+    uint32_t magic;
+    uint32_t id;        // sender's node id
+    uint64_t nonce;
+    uint64_t mac;
+};
+
+// derives the long-term key from the configured secret; -1 if it is too short to be one
+int link_secret_key(const char *secret, uint8_t key[SIPHASH_KEY_SIZE]);
+
+// dialer: proves itself to peer `peer_id`; fills the link's session key
+int link_auth_dial(int fd, const uint8_t key[SIPHASH_KEY_SIZE], uint32_t self_id, uint32_t peer_id,
+                   uint8_t session[SIPHASH_KEY_SIZE]);
+// acceptor: returns the peer's id, which accept() approved, or -1
+int link_auth_accept(int fd, const uint8_t key[SIPHASH_KEY_SIZE], uint32_t self_id,
+                     int (*accept)(uint32_t peer_id), uint8_t session[SIPHASH_KEY_SIZE]);
+
+#endif //RMS_LINK_AUTH_H
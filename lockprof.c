@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include "lockprof.h"
+
+#define LOCKPROF_MAX_SITES 256 // reported; more are still counted
+
+struct held {
+    pthread_mutex_t *mutex;
+    struct lock_site *site;
+    uint64_t acquired_ns;
+};
+
+static atomic_uint sample_every;
+static _Atomic(struct lock_site *) sites;
+
+static _Thread_local unsigned countdown;
+static _Thread_local struct held held[LOCKPROF_DEPTH];
+static _Thread_local int held_count;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void raise_max(atomic_uint_fast64_t *max, uint64_t v) {
+    uint_fast64_t cur = atomic_load_explicit(max, memory_order_relaxed);
+    while (v > cur && !atomic_compare_exchange_weak_explicit(max, &cur, v, memory_order_relaxed,
+                                                              memory_order_relaxed))
+        ;
+}
+
+// sites join the report list the first time they are sampled
+static void site_list(struct lock_site *site, pthread_mutex_t *m) {
+    if (atomic_exchange(&site->listed, 1))
+        return;
+
+    site->mutex = m;
+    struct lock_site *head = atomic_load(&sites);
+    do {
+        site->next = head;
+    } while (!atomic_compare_exchange_weak(&sites, &head, site));
+}
+
+void lockprof_acquire(pthread_mutex_t *m, struct lock_site *site) {
+    unsigned every = atomic_load_explicit(&sample_every, memory_order_relaxed);
+    if (every == 0 || ++countdown < every || held_count == LOCKPROF_DEPTH) {
+        pthread_mutex_lock(m);
+        return;
+    }
+    countdown = 0;
+
+    uint64_t start = now_ns();
+    int contended = pthread_mutex_trylock(m) != 0;
+    if (contended)
+        pthread_mutex_lock(m);
+    uint64_t got = now_ns();
+
+    site_list(site, m);
+    atomic_fetch_add_explicit(&site->samples, 1, memory_order_relaxed);
+    if (contended) {
+        atomic_fetch_add_explicit(&site->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&site->wait_ns, got - start, memory_order_relaxed);
+        raise_max(&site->max_wait_ns, got - start);
+    }
+
+    held[held_count++] = (struct held){ m, site, got };
+}
+
+void lockprof_unlock(pthread_mutex_t *m) {
+    for (int i = held_count - 1; i >= 0; i--) {
+        if (held[i].mutex != m)
+            continue;
+
+        uint64_t hold = now_ns() - held[i].acquired_ns;
+        struct lock_site *site = held[i].site;
+        atomic_fetch_add_explicit(&site->hold_ns, hold, memory_order_relaxed);
+        raise_max(&site->max_hold_ns, hold);
+        held[i] = held[--held_count];
+        break;
+    }
+    pthread_mutex_unlock(m);
+}
+
+void lockprof_enable(unsigned every) {
+    atomic_store(&sample_every, every);
+}
+
+unsigned lockprof_every(void) {
+    return atomic_load(&sample_every);
+}
+
+struct site_row {
+    const struct lock_site *site;
+    uint64_t samples, contended, wait_ns, max_wait_ns, hold_ns, max_hold_ns;
+};
+
+static int by_wait(const void *a, const void *b) {
+    const struct site_row *x = a, *y = b;
+    if (x->wait_ns != y->wait_ns)
+        return x->wait_ns < y->wait_ns ? 1 : -1;
+    if (x->hold_ns != y->hold_ns)
+        return x->hold_ns < y->hold_ns ? 1 : -1;
+    return 0;
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+void lockprof_report(FILE *out, int top) {
+    struct site_row *rows = malloc(LOCKPROF_MAX_SITES * sizeof(*rows));
+    if (!rows)
+        return;
+
+    int n = 0;
+    for (struct lock_site *s = atomic_load(&sites); s && n < LOCKPROF_MAX_SITES; s = s->next) {
+        struct site_row *r = &rows[n];
+        r->site = s;
+        r->samples = atomic_load_explicit(&s->samples, memory_order_relaxed);
+        r->contended = atomic_load_explicit(&s->contended, memory_order_relaxed);
+        r->wait_ns = atomic_load_explicit(&s->wait_ns, memory_order_relaxed);
+        r->max_wait_ns = atomic_load_explicit(&s->max_wait_ns, memory_order_relaxed);
+        r->hold_ns = atomic_load_explicit(&s->hold_ns, memory_order_relaxed);
+        r->max_hold_ns = atomic_load_explicit(&s->max_hold_ns, memory_order_relaxed);
+        if (r->samples)
+            n++;
+    }
+    qsort(rows, n, sizeof(*rows), by_wait);
+
+    unsigned every = lockprof_every();
+    if (every)
+        fprintf(out, "• Lock profile (1 in %u acquisitions sampled per thread), %d critical section(s):\n", every, n);
+    else
+        fprintf(out, "• Lock profile (sampling off), %d critical section(s):\n", n);
+
+    if (n > 0)
+        fprintf(out, "  %10s %10s %8s %6s %9s %9s %9s %9s  %s\n", "wait ms", "hold ms", "samples", "cont%",
+                "avg w us", "max w us", "avg h us", "max h us", "site");
+    for (int i = 0; i < n && i < top; i++) {
+        const struct site_row *r = &rows[i];
+        fprintf(out, "  %10.3f %10.3f %8" PRIu64 " %5.1f%% %9.1f %9.1f %9.1f %9.1f  %s @ %s:%d\n",
+                r->wait_ns / 1e6, r->hold_ns / 1e6, r->samples, 100.0 * r->contended / r->samples,
+                r->contended ? r->wait_ns / 1e3 / r->contended : 0.0, r->max_wait_ns / 1e3,
+                r->hold_ns / 1e3 / r->samples, r->max_hold_ns / 1e3,
+                r->site->lock, base_name(r->site->file), r->site->line);
+    }
+
+    // the same mutex is reached through different expressions; total by address
+    for (int i = 0; i < n; i++) {
+        int first = 1;
+        for (int j = 0; j < i && first; j++)
+            first = rows[j].site->mutex != rows[i].site->mutex;
+        if (!first)
+            continue;
+
+        uint64_t samples = 0, contended = 0, wait_ns = 0, hold_ns = 0;
+        int count = 0;
+        for (int j = i; j < n; j++) {
+            if (rows[j].site->mutex != rows[i].site->mutex)
+                continue;
+            samples += rows[j].samples;
+            contended += rows[j].contended;
+            wait_ns += rows[j].wait_ns;
+            hold_ns += rows[j].hold_ns;
+            count++;
+        }
+        fprintf(out, "• %s: %.3f ms waited, %.3f ms held over %" PRIu64 " samples (%.1f%% contended) at %d site(s)\n",
+                rows[i].site->lock, wait_ns / 1e6, hold_ns / 1e6, samples, 100.0 * contended / samples, count);
+    }
+    free(rows);
+}
+
+void lockprof_reset(void) {
+    for (struct lock_site *s = atomic_load(&sites); s; s = s->next) {
+        atomic_store(&s->samples, 0);
+        atomic_store(&s->contended, 0);
+        atomic_store(&s->wait_ns, 0);
+        atomic_store(&s->max_wait_ns, 0);
+        atomic_store(&s->hold_ns, 0);
+        atomic_store(&s->max_hold_ns, 0);
+    }
+}
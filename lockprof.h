@@ -0,0 +1,57 @@
+#ifndef RMS_LOCKPROF_H
+#define RMS_LOCKPROF_H
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define LOCKPROF_DEPTH 8            // sampled locks one thread can hold at once
+#define LOCKPROF_DEFAULT_EVERY 16   // sampling rate when switched on without one
+
+/*
+ * Contention profiler for the server's global mutexes (cm->lock, u_lock).
+ * Call sites use lockprof_lock/lockprof_unlock instead of
+ * pthread_mutex_lock/unlock, and each lockprof_lock expansion owns a static
+ * lock_site that collects that critical section's numbers.
+ *
+ * Nothing is measured until lockprof_enable(n). After that each thread
+ * times one acquisition in n: how long it waited for the mutex and, at the
+ * matching unlock, how long it held it. With profiling off an acquisition
+ * costs one relaxed load over the bare mutex, so the wrapper stays in
+ * production builds.
+ */
+struct lock_site {
+    const char *lock;       // the locked expression, as written at the site
+    const char *file;
+    int line;
+
+    pthread_mutex_t *mutex; // set when the site is first sampled
+    struct lock_site *next;
+    atomic_int listed;
+
+    atomic_uint_fast64_t samples, contended;
+    atomic_uint_fast64_t wait_ns, max_wait_ns;
+    atomic_uint_fast64_t hold_ns, max_hold_ns;
+};
+
+#define lockprof_lock(m) do { \
+        static struct lock_site lockprof_site_ = { .lock = #m, .file = __FILE__, .line = __LINE__ }; \
+        lockprof_acquire((m), &lockprof_site_); \
+    } while (0)
+
+void lockprof_acquire(pthread_mutex_t *m, struct lock_site *site);
+void lockprof_unlock(pthread_mutex_t *m);
+
+// sample one acquisition in `every` per thread; 0 switches profiling off
+void lockprof_enable(unsigned every);
+unsigned lockprof_every(void);
+
+/*
+ * Ranks critical sections by the time threads spent waiting to enter
+ * them, then totals by mutex. Figures cover sampled acquisitions only.
+ * Reset clears the counters but keeps the sampling rate.
+ */
+void lockprof_report(FILE *out, int top);
+void lockprof_reset(void);
+
+#endif //RMS_LOCKPROF_H
@@ -0,0 +1,213 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+/*
+ * Preset dictionary. Both ends treat it as if it preceded every block, so
+ * its contents are fixed by the protocol: append only, never edit.
+ */
+static const char lz_dict[] =
+    " has joined the channel. Channel created by . Welcome! "
+    "[FILE]  uploaded:  bytes) FILE_METADATA: .jpg .png .txt .pdf .zip .log "
+    "Successfully joined channel  (ID: )\nMembers: "
+    "Use '/msg <message>' https://www. http:// .com/ .org/ .html "
+    "Traceback (most recent call last):\n  File \"\", line  in <module>\n"
+    "Exception: Error: error: warning: note: undefined reference to  at "
+    " ERROR  WARN  INFO  DEBUG  FATAL  failed  success  timeout  connection "
+    "2025-01-01T00:00:00Z 2026-01-01 00:00:00.000 "
+    "#include <stdio.h>\n#include <string.h>\nint main(void) {\n    return 0;\n}\n"
+    "    if (\n        } else {\n    for (int i = 0; i < ; i++) {\n"
+    " = NULL; != NULL) == 0) return -1;\n"
+    "function const let var def self. import from class public static void "
+    "null true false undefined NaN \"\": \"\", \"id\": \"name\": \"type\": "
+    "the and that this with you for have not are was but what just can will "
+    "would there about from like know think they your when then thanks "
+    "please could should been sure yeah okay sorry really going "
+    "I'm I'll I don't it's that's can't didn't doesn't isn't won't "
+    "Hello Hi hey Thanks Yes No OK lol. ? !\n\n";
+
+#define LZ_DICT_SIZE (sizeof(lz_dict) - 1)
+
+static uint32_t lz_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// hash table pre-filled with the dictionary's positions, copied into every compress call
+static uint16_t lz_dict_table[1 << LZ_HASH_BITS];
+static pthread_once_t lz_dict_once = PTHREAD_ONCE_INIT;
+
+static void lz_dict_index(void) {
+    for (size_t i = 0; i + LZ_MIN_MATCH <= LZ_DICT_SIZE; i++)
+        lz_dict_table[lz_hash(lz_read32((const uint8_t *)lz_dict + i))] = (uint16_t)(i + 1);
+}
+
+static uint8_t *lz_put_length(uint8_t *op, size_t n) {
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+// one sequence: token, literal run, then (unless it is the last) offset and match length
+static uint8_t *lz_emit(uint8_t *op, const uint8_t *lit, size_t lit_len, size_t offset, size_t match_len) {
+    uint8_t *token = op++;
+    size_t m = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+    *token = (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) | (m < 15 ? m : 15));
+    if (lit_len >= 15)
+        op = lz_put_length(op, lit_len - 15);
+
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len) {
+        *op++ = (uint8_t)(offset & 0xff);
+        *op++ = (uint8_t)(offset >> 8);
+        if (m >= 15)
+            op = lz_put_length(op, m - 15);
+    }
+    return op;
+}
+
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+    if (len < LZ_MIN_INPUT || len > LZ_MAX_INPUT)
+        return 0;
+
+    // dictionary and input side by side, so offsets can point into either
+    uint8_t win[LZ_DICT_SIZE + LZ_MAX_INPUT];
+    uint8_t out[LZ_MAX_INPUT + LZ_MAX_INPUT / 255 + 16];
+    uint16_t table[1 << LZ_HASH_BITS]; // window position + 1, 0 = empty
+
+    pthread_once(&lz_dict_once, lz_dict_index);
+    memcpy(table, lz_dict_table, sizeof(table));
+    memcpy(win, lz_dict, LZ_DICT_SIZE);
+    memcpy(win + LZ_DICT_SIZE, src, len);
+    size_t end = LZ_DICT_SIZE + len;
+
+    uint8_t *op = out;
+    size_t anchor = LZ_DICT_SIZE;
+    size_t ip = LZ_DICT_SIZE;
+    while (ip + LZ_MIN_MATCH <= end) {
+        uint32_t h = lz_hash(lz_read32(win + ip));
+        size_t cand = table[h];
+        table[h] = (uint16_t)(ip + 1);
+
+        if (cand == 0 || lz_read32(win + cand - 1) != lz_read32(win + ip)) {
+            ip++;
+            continue;
+        }
+        cand--;
+
+        size_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < end && win[cand + match_len] == win[ip + match_len])
+            match_len++;
+
+        op = lz_emit(op, win + anchor, ip - anchor, ip - cand, match_len);
+        ip += match_len;
+        anchor = ip;
+    }
+    op = lz_emit(op, win + anchor, end - anchor, 0, 0);
+
+    size_t n = (size_t)(op - out);
+    if (n >= len || n > cap)
+        return 0;
+
+    memcpy(dst, out, n);
+    return n;
+}
+
+static int lz_get_length(const uint8_t *src, size_t len, size_t *ip, size_t *n) {
+    uint8_t b;
+    do {
+        if (*ip >= len)
+            return -1;
+        b = src[(*ip)++];
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+long lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < len) {
+        uint8_t token = src[ip++];
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && lz_get_length(src, len, &ip, &lit_len) < 0)
+            return -1;
+        if (lit_len > len - ip || lit_len > cap - op)
+            return -1;
+
+        memcpy(dst + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        // the last sequence carries literals only
+        if (ip == len)
+            break;
+
+        if (len - ip < 2)
+            return -1;
+        size_t offset = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && lz_get_length(src, len, &ip, &match_len) < 0)
+            return -1;
+        match_len += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > LZ_DICT_SIZE + op || match_len > cap - op)
+            return -1;
+
+        // byte at a time: matches may overlap their own output or start in the dictionary
+        size_t from = LZ_DICT_SIZE + op - offset;
+        for (size_t k = 0; k < match_len; k++, from++)
+            dst[op++] = from < LZ_DICT_SIZE ? (uint8_t)lz_dict[from] : dst[from - LZ_DICT_SIZE];
+    }
+
+    return (long)op;
+}
+
+int lz_is_compressed_media(const uint8_t *buf, size_t len) {
+    static const struct {
+        size_t offset;
+        size_t len;
+        const char *magic;
+    } formats[] = {
+        {0, 3, "\xff\xd8\xff"},         // JPEG
+        {0, 8, "\x89PNG\r\n\x1a\n"},    // PNG
+        {0, 4, "GIF8"},                 // GIF
+        {0, 4, "PK\x03\x04"},           // ZIP, docx, jar, apk
+        {0, 2, "\x1f\x8b"},             // gzip
+        {0, 4, "\x28\xb5\x2f\xfd"},     // zstd
+        {0, 6, "\xfd" "7zXZ\x00"},      // xz
+        {0, 6, "7z\xbc\xaf\x27\x1c"},   // 7z
+        {0, 3, "BZh"},                  // bzip2
+        {0, 4, "OggS"},                 // Ogg
+        {0, 3, "ID3"},                  // MP3
+        {4, 4, "ftyp"},                 // MP4, MOV, HEIC
+        {8, 4, "WEBP"},                 // WebP
+        {0, 4, "\x1a\x45\xdf\xa3"},     // Matroska, WebM
+    };
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (len >= formats[i].offset + formats[i].len &&
+            memcmp(buf + formats[i].offset, formats[i].magic, formats[i].len) == 0)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef RMS_LZ_H
+#define RMS_LZ_H
+#include <stdint.h>
+#include <stddef.h>
+
+// largest input lz_compress accepts (a file chunk)
+#define LZ_MAX_INPUT 4096
+
+// inputs shorter than this are sent as-is, the header costs more than it saves
+#define LZ_MIN_INPUT 64
+
+/*
+ * Small LZ77 block codec (LZ4-style sequences: token, literals, 16-bit
+ * offset). Matches may reach back into a fixed dictionary of common chat
+ * text, so even short messages find something to reference. The codec is
+ * stateless: one frame encoded for a broadcast decodes the same for every
+ * recipient.
+ *
+ * lz_compress returns the compressed size, or 0 if the result would not be
+ * smaller than the input. lz_decompress returns the decoded size, or -1 if
+ * src is malformed or does not fit in cap.
+ */
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+long lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+// recognises formats that are already compressed (JPEG, PNG, ZIP, ...)
+int lz_is_compressed_media(const uint8_t *buf, size_t len);
+
+#endif //RMS_LZ_H
@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "msg_cache.h"
+#include "channel.h"
+
+#define CACHE_MAGIC 0x48434d52u // "RMCH"
+#define CACHE_VERSION 1
+#define CACHE_FILE_SIZE (sizeof(struct cache_header) + CACHE_SLOTS * sizeof(struct cache_entry))
+
+struct cache_map {
+    uint64_t channel_id;
+    struct cache_header *h;
+    struct cache_entry *ring;
+};
+
+// the client is single-threaded (one poll loop), so no locking
+static struct cache_map maps[MAX_CHANNELS];
+static int map_count = 0;
+static char cache_dir[128];
+
+// anything but [A-Za-z0-9.-] becomes '_', so a socket path or odd username can't leave CACHE_DIR
+static void append_safe(char *buf, size_t size, const char *s) {
+    size_t n = strlen(buf);
+    for (; *s && n + 1 < size; s++)
+        buf[n++] = (*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || (*s >= '0' && *s <= '9') ||
+                   *s == '.' || *s == '-' ? *s : '_';
+    buf[n] = '\0';
+}
+
+void cache_set_owner(const char *ip, int port, const char *user) {
+    char port_s[16];
+    snprintf(port_s, sizeof(port_s), "_%d_", port);
+    snprintf(cache_dir, sizeof(cache_dir), "%s/", CACHE_DIR);
+    append_safe(cache_dir, sizeof(cache_dir), ip);
+    strncat(cache_dir, port_s, sizeof(cache_dir) - strlen(cache_dir) - 1);
+    append_safe(cache_dir, sizeof(cache_dir), user);
+}
+
+static void cache_path(char *buf, size_t size, uint64_t channel_id) {
+    snprintf(buf, size, "%s/%" PRIu64 ".cache", cache_dir, channel_id);
+}
+
+static int make_cache_dir(void) {
+    mkdir(CACHE_DIR, 0700);
+    return mkdir(cache_dir, 0700) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+// maps (and if needed creates or resets) the cache file of a channel
+static struct cache_map *cache_map(uint64_t channel_id, int create) {
+    for (int i = 0; i < map_count; i++) {
+        if (maps[i].channel_id == channel_id)
+            return &maps[i];
+    }
+    if (map_count >= MAX_CHANNELS || !cache_dir[0])
+        return NULL;
+
+    char path[192];
+    cache_path(path, sizeof(path), channel_id);
+    if (create && make_cache_dir() < 0)
+        return NULL;
+
+    int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0600);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    int fresh = fstat(fd, &st) < 0 || (size_t)st.st_size != CACHE_FILE_SIZE;
+    if (fresh && ftruncate(fd, 0) == 0 && ftruncate(fd, CACHE_FILE_SIZE) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *p = mmap(NULL, CACHE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    struct cache_header *h = p;
+    if (fresh || h->magic != CACHE_MAGIC || h->version != CACHE_VERSION ||
+        h->slots != CACHE_SLOTS || h->channel_id != channel_id) {
+        // an unknown layout is only a cache: start over
+        memset(p, 0, CACHE_FILE_SIZE);
+        h->magic = CACHE_MAGIC;
+        h->version = CACHE_VERSION;
+        h->slots = CACHE_SLOTS;
+        h->channel_id = channel_id;
+    }
+
+    struct cache_map *m = &maps[map_count++];
+    m->channel_id = channel_id;
+    m->h = h;
+    m->ring = (struct cache_entry *)(h + 1);
+    return m;
+}
+
+int cache_open_all(void (*fn)(uint64_t channel_id, uint64_t last_id, uint64_t lines, void *arg), void *arg) {
+    DIR *d = cache_dir[0] ? opendir(cache_dir) : NULL;
+    if (!d)
+        return 0;
+
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        char *end;
+        uint64_t id = strtoull(e->d_name, &end, 10);
+        if (end == e->d_name || strcmp(end, ".cache") != 0)
+            continue;
+
+        struct cache_map *m = cache_map(id, 0);
+        if (!m)
+            continue;
+        if (fn)
+            fn(id, m->h->last_id, m->h->written, arg);
+        n++;
+    }
+    closedir(d);
+    return n;
+}
+
+void cache_append(uint64_t channel_id, uint64_t msg_id, uint32_t timestamp, const char *line) {
+    struct cache_map *m = cache_map(channel_id, 1);
+    if (!m || (msg_id && msg_id <= m->h->last_id))
+        return;
+
+    struct cache_entry *e = &m->ring[m->h->written % CACHE_SLOTS];
+    size_t len = strnlen(line, CACHE_TEXT_SIZE - 1);
+    e->msg_id = msg_id;
+    e->timestamp = timestamp;
+    e->len = (uint16_t)len;
+    memcpy(e->text, line, len);
+    e->text[len] = '\0';
+
+    m->h->written++;
+    if (msg_id > m->h->last_id)
+        m->h->last_id = msg_id;
+}
+
+void cache_set_cursor(uint64_t channel_id, uint64_t last_id) {
+    struct cache_map *m = cache_map(channel_id, 1);
+    if (m && last_id > m->h->last_id)
+        m->h->last_id = last_id;
+}
+
+int cache_has_own_line(uint64_t channel_id, const char *line) {
+    struct cache_map *m = cache_map(channel_id, 0);
+    if (!m)
+        return 0;
+
+    uint64_t written = m->h->written;
+    uint64_t first = written > CACHE_SLOTS ? written - CACHE_SLOTS : 0;
+    for (uint64_t i = first; i < written; i++) {
+        const struct cache_entry *e = &m->ring[i % CACHE_SLOTS];
+        if (e->msg_id == 0 && strcmp(e->text, line) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+void cache_set_name(uint64_t channel_id, const char *name) {
+    struct cache_map *m = cache_map(channel_id, 1);
+    if (!m)
+        return;
+    strncpy(m->h->name, name, sizeof(m->h->name) - 1);
+    m->h->name[sizeof(m->h->name) - 1] = '\0';
+}
+
+const char *cache_name(uint64_t channel_id) {
+    struct cache_map *m = cache_map(channel_id, 0);
+    return m && m->h->name[0] ? m->h->name : NULL;
+}
+
+uint64_t cache_find_channel(const char *name) {
+    for (int i = 0; i < map_count; i++) {
+        if (strcmp(maps[i].h->name, name) == 0)
+            return maps[i].channel_id;
+    }
+    return 0;
+}
+
+int cache_tail(uint64_t channel_id, int n, void (*fn)(const struct cache_entry *e, void *arg), void *arg) {
+    struct cache_map *m = cache_map(channel_id, 0);
+    if (!m)
+        return 0;
+
+    uint64_t written = m->h->written;
+    uint64_t kept = written < CACHE_SLOTS ? written : CACHE_SLOTS;
+    if ((uint64_t)n > kept)
+        n = (int)kept;
+
+    for (uint64_t i = written - (uint64_t)n; i < written; i++)
+        fn(&m->ring[i % CACHE_SLOTS], arg);
+    return n;
+}
+
+uint64_t cache_active_channel(void) {
+    char path[192];
+    snprintf(path, sizeof(path), "%s/active", cache_dir);
+    FILE *f = cache_dir[0] ? fopen(path, "r") : NULL;
+    if (!f)
+        return 0;
+
+    uint64_t id = 0;
+    if (fscanf(f, "%" SCNu64, &id) != 1)
+        id = 0;
+    fclose(f);
+    return id;
+}
+
+void cache_set_active_channel(uint64_t channel_id) {
+    char path[192];
+    snprintf(path, sizeof(path), "%s/active", cache_dir);
+    FILE *f = cache_dir[0] && make_cache_dir() == 0 ? fopen(path, "w") : NULL;
+    if (!f)
+        return;
+    fprintf(f, "%" PRIu64 "\n", channel_id);
+    fclose(f);
+}
@@ -0,0 +1,58 @@
+#ifndef RMS_MSG_CACHE_H
+#define RMS_MSG_CACHE_H
+#include <stdint.h>
+
+#define CACHE_DIR "cache"
+#define CACHE_SLOTS 256        // messages kept per channel
+#define CACHE_TEXT_SIZE 496    // display line, truncated to fit a 512-byte slot
+
+/*
+ * Client-side message cache, one directory per server and account, one
+ * file per joined channel:
+ *
+ * cache/<ip>_<port>_<user>/<channel_id>.cache   header (sync cursor) + ring of CACHE_SLOTS lines
+ * cache/<ip>_<port>_<user>/active               id of the channel plain input goes to
+ *
+ * Files are mmap'd for the life of the process and written in place, so
+ * opening them at start-up costs a few page faults, not a read of the
+ * whole history, and the cursor is current even after a crash.
+ */
+struct cache_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slots;
+    uint64_t channel_id;
+    uint64_t last_id;       // sync cursor: newest message id seen
+    uint64_t written;       // lines appended ever; the ring holds the last `slots`
+    char name[32];
+};
+
+struct cache_entry {
+    uint64_t msg_id;        // 0 when the line arrived inside a batched reply
+    uint32_t timestamp;
+    uint16_t len;
+    uint16_t reserved;
+    char text[CACHE_TEXT_SIZE];
+};
+
+// picks the directory for this server and account; nothing is cached before this
+void cache_set_owner(const char *ip, int port, const char *user);
+// maps every cache file; calls fn for each with its cursor. Returns the count.
+int cache_open_all(void (*fn)(uint64_t channel_id, uint64_t last_id, uint64_t lines, void *arg), void *arg);
+
+// appends a display line; lines with an id at or below the cursor are already cached
+void cache_append(uint64_t channel_id, uint64_t msg_id, uint32_t timestamp, const char *line);
+void cache_set_cursor(uint64_t channel_id, uint64_t last_id);
+// whether an id-less line (one we sent ourselves) with this text is cached
+int cache_has_own_line(uint64_t channel_id, const char *line);
+void cache_set_name(uint64_t channel_id, const char *name);
+const char *cache_name(uint64_t channel_id);
+uint64_t cache_find_channel(const char *name);
+
+// calls fn on the newest n lines of a channel, oldest first
+int cache_tail(uint64_t channel_id, int n, void (*fn)(const struct cache_entry *e, void *arg), void *arg);
+
+uint64_t cache_active_channel(void);
+void cache_set_active_channel(uint64_t channel_id);
+
+#endif //RMS_MSG_CACHE_H
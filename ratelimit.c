@@ -0,0 +1,73 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "ratelimit.h"
+
+struct channel_bucket {
+    uint64_t channel_id;    // 0 = free slot
+    struct token_bucket bucket;
+};
+
+static struct channel_bucket channel_buckets[RATE_CHANNEL_SLOTS];
+static pthread_mutex_t channel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t rate_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t bucket_take(struct token_bucket *b, const struct rate *r, uint64_t now_ns) {
+    if (r->per_sec <= 0)
+        return 0;
+
+    if (b->last_ns == 0) {
+        b->tokens = r->burst;
+    } else if (now_ns > b->last_ns) {
+        b->tokens += (double)(now_ns - b->last_ns) * r->per_sec / 1e9;
+        if (b->tokens > r->burst)
+            b->tokens = r->burst;
+    }
+    b->last_ns = now_ns;
+
+    if (b->tokens >= 1.0) {
+        b->tokens -= 1.0;
+        return 0;
+    }
+    return (uint64_t)((1.0 - b->tokens) * 1e9 / r->per_sec) + 1;
+}
+
+uint64_t channel_bucket_take(uint64_t channel_id, const struct rate *r, uint64_t now_ns) {
+    if (r->per_sec <= 0 || channel_id == 0)
+        return 0;
+
+    pthread_mutex_lock(&channel_lock);
+    size_t i = (size_t)(channel_id * 0x9E3779B97F4A7C15ull >> 56) % RATE_CHANNEL_SLOTS;
+    size_t probes = 0;
+    while (channel_buckets[i].channel_id != 0 && channel_buckets[i].channel_id != channel_id &&
+           probes++ < RATE_CHANNEL_SLOTS)
+        i = (i + 1) % RATE_CHANNEL_SLOTS;
+
+    uint64_t wait = 0;
+    if (probes < RATE_CHANNEL_SLOTS) {
+        channel_buckets[i].channel_id = channel_id;
+        wait = bucket_take(&channel_buckets[i].bucket, r, now_ns);
+    }
+    pthread_mutex_unlock(&channel_lock);
+    return wait;
+}
+
+int rate_parse(const char *s, struct rate *r) {
+    char *end;
+    double per_sec = strtod(s, &end);
+    double burst = per_sec * 2;
+    if (*end == '/')
+        burst = strtod(end + 1, &end);
+    if (end == s || *end != '\0' || per_sec < 0 || (per_sec > 0 && burst < 1))
+        return -1;
+
+    r->per_sec = per_sec;
+    r->burst = burst;
+    return 0;
+}
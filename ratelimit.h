@@ -0,0 +1,45 @@
+#ifndef RMS_RATELIMIT_H
+#define RMS_RATELIMIT_H
+#include <stdint.h>
+#include <pthread.h>
+
+#define RATE_CHANNEL_SLOTS 256 // channel buckets, open addressing; well above MAX_CHANNELS
+
+/*
+ * Token buckets for admission control. A bucket holds up to `burst`
+ * tokens and refills at `per_sec`; every admitted unit of work takes one.
+ * A rate of 0 per second means unlimited.
+ *
+ * Buckets keyed by connection are only touched by that connection's reader
+ * and need no lock. Channel buckets are shared by every sender, so they
+ * live in a locked table here.
+ */
+enum {
+    RATE_MESSAGE,   // CMD_MESSAGE
+    RATE_FILE,      // CMD_FILE_TRANSFER, per chunk
+    RATE_COMMAND,   // everything else
+    RATE_CLASSES
+};
+
+struct rate {
+    double per_sec;
+    double burst;
+};
+
+struct token_bucket {
+    double tokens;
+    uint64_t last_ns;   // 0 until first use, when the bucket starts full
+};
+
+uint64_t rate_now_ns(void);
+
+// takes a token and returns 0, or returns the nanoseconds until one is due
+uint64_t bucket_take(struct token_bucket *b, const struct rate *r, uint64_t now_ns);
+
+// the same against channel_id's shared bucket
+uint64_t channel_bucket_take(uint64_t channel_id, const struct rate *r, uint64_t now_ns);
+
+// "per_sec/burst" or "per_sec" (burst = twice the rate); returns -1 if malformed
+int rate_parse(const char *s, struct rate *r);
+
+#endif //RMS_RATELIMIT_H
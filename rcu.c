@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "rcu.h"
+
+struct retired {
+    struct retired *next;
+    void *p;
+    void (*free_fn)(void *);
+    uint64_t epoch;
+};
+
+// one cache line per slot so readers on different cores don't share one
+struct reader_slot {
+    _Atomic uint64_t epoch; // 0 = not reading
+    char pad[64 - sizeof(uint64_t)];
+};
+
+static _Atomic uint64_t global_epoch = 1;
+static struct reader_slot readers[RCU_MAX_READERS];
+static atomic_int slots_used;
+static atomic_int overflow_readers; // readers without a slot hold back every retirement
+
+static struct retired *retired_list = NULL;
+static pthread_mutex_t retire_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local int slot = -1;
+static _Thread_local int depth = 0;
+
+void rcu_read_lock(void) {
+    if (depth++ > 0)
+        return;
+
+    if (slot == -1) {
+        int s = atomic_fetch_add(&slots_used, 1);
+        slot = s < RCU_MAX_READERS ? s : RCU_MAX_READERS;
+    }
+
+    if (slot == RCU_MAX_READERS)
+        atomic_fetch_add(&overflow_readers, 1);
+    else
+        atomic_store(&readers[slot].epoch, atomic_load(&global_epoch));
+}
+
+void rcu_read_unlock(void) {
+    if (--depth > 0)
+        return;
+
+    if (slot == RCU_MAX_READERS)
+        atomic_fetch_sub(&overflow_readers, 1);
+    else
+        atomic_store_explicit(&readers[slot].epoch, 0, memory_order_release);
+}
+
+/*
+ * The caller has already unpublished p. Readers that could have loaded it
+ * started at or before the epoch we bump past here, so p is safe to free
+ * once every active reader started later than that.
+ */
+void rcu_retire(void *p, void (*free_fn)(void *)) {
+    struct retired *r = malloc(sizeof(*r));
+    uint64_t epoch = atomic_fetch_add(&global_epoch, 1);
+
+    pthread_mutex_lock(&retire_lock);
+    // no memory for the list entry: leaking p beats freeing it under a reader
+    if (r) {
+        r->p = p;
+        r->free_fn = free_fn;
+        r->epoch = epoch;
+        r->next = retired_list;
+        retired_list = r;
+    }
+
+    uint64_t oldest = UINT64_MAX;
+    int used = atomic_load(&slots_used);
+    for (int i = 0; i < used && i < RCU_MAX_READERS; i++) {
+        uint64_t e = atomic_load(&readers[i].epoch);
+        if (e != 0 && e < oldest)
+            oldest = e;
+    }
+    if (atomic_load(&overflow_readers) > 0)
+        oldest = 0;
+
+    struct retired **link = &retired_list;
+    while (*link) {
+        struct retired *cur = *link;
+        if (cur->epoch < oldest) {
+            *link = cur->next;
+            cur->free_fn(cur->p);
+            free(cur);
+        } else {
+            link = &cur->next;
+        }
+    }
+    pthread_mutex_unlock(&retire_lock);
+}
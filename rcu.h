@@ -0,0 +1,17 @@
+#ifndef RMS_RCU_H
+#define RMS_RCU_H
+
+#define RCU_MAX_READERS 256 // threads with a reader slot; any beyond share a counter
+
+/*
+ * Epoch-based read-copy-update. Readers bracket their access with
+ * rcu_read_lock/unlock, which only publish the epoch they started in and
+ * never block. A writer swaps in a new version of the data and hands the
+ * old one to rcu_retire, which frees it once every reader that could
+ * still be looking at it has left.
+ */
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void rcu_retire(void *p, void (*free_fn)(void *));
+
+#endif //RMS_RCU_H
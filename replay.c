@@ -0,0 +1,884 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+
+#include "rsa.h"
+#include "encrypted_packet.h"
+#include "session.h"
+#include "wire.h"
+#include "bitpack.h"
+#include "channel.h"
+#include "history.h"
+#include "siphash.h"
+#include "trace.h"
+#include "shm_ring.h"
+
+#define REPLAY_PASSWORD "replay"        // every traced user logs in with it; replay against a fresh directory
+#define PROBE_DEFAULT 10                // commands between latency probes, per connection
+#define PING_WINDOW 4096                // probes a connection may have in flight
+#define PING_TIMEOUT_MS 30000           // for a connection's last probe before it logs out
+#define MAP_TIMEOUT_MS 5000             // for the reply that names a channel's new id
+#define LOGIN_ATTEMPTS 50               // the server may still be closing the user's previous login
+#define LOGIN_RETRY_MS 20
+#define CRED_FILE "client_credentials"
+
+/*
+ * Replays a capture made with RMS_CAPTURE against a fresh server. Every
+ * traced login becomes a connection with its own thread that sends the
+ * login's commands at their recorded offsets (divided by --speed), or
+ * back to back with --fast. Channel ids differ between runs, so ids the
+ * trace learned from TRACE_CHANNEL records are swapped for the ids this
+ * server hands out for the same names, in the header and in the text.
+ *
+ * Latency comes from CMD_PING probes: the server answers one only after
+ * the connection's earlier commands are done, so its round trip is what
+ * the command before it waited. Each connection ends with a probe, which
+ * also means every command has been handled when the replay reports.
+ *
+ * Given a socket path instead of an ip the replay connects to the
+ * server's Unix socket (RMS_UNIX_SOCKET), and with --shm every connection
+ * then moves onto shared memory, to compare the transports on one trace.
+ */
+
+struct item {
+    struct trace_record rec;
+    uint8_t *payload;
+};
+
+struct session {
+    uint32_t conn;
+    char username[USERNAME_SIZE];
+    struct item **items;
+    int count, cap;
+
+    int fd;
+    struct shm_link shm;        // set once logged in with --shm
+    long s_n, s_e;
+    pthread_t thread, reader;
+    pthread_mutex_t send_lock;  // the reader answers heartbeats while the session thread sends
+    struct encrypted_packet in, out, beat;
+
+    pthread_mutex_t lock;
+    pthread_cond_t acked;
+    uint64_t pings, pongs;
+    uint64_t ping_sent_ns[PING_WINDOW];
+    uint64_t *rtt_ns;
+    size_t rtt_count, rtt_cap;
+
+    uint64_t commands, unmapped, skipped;
+    uint64_t first_ns, last_ns;
+    int failed;
+};
+
+struct old_channel {
+    uint64_t id;
+    char name[CHANNEL_NAME_SIZE];
+    int missing;    // waited for once in vain, so later commands don't wait again
+};
+
+struct new_channel {
+    char name[CHANNEL_NAME_SIZE];
+    uint64_t id;
+};
+
+static const char *server_ip;
+static int server_port;
+static double speed = 1.0;       // 0: as fast as possible
+static int probe_every = PROBE_DEFAULT;
+static int use_shm;
+static long c_n, c_e, c_d;
+static uint64_t base_ns, trace_start_us;
+
+static struct old_channel *old_channels;
+static int old_count, old_cap;
+
+static struct new_channel *new_channels;
+static int new_count, new_cap;
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t map_changed = PTHREAD_COND_INITIALIZER;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void deadline_in(struct timespec *ts, int ms) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+static void *grow(void *array, int *cap, size_t size) {
+    int n = *cap ? *cap * 2 : 64;
+    void *p = realloc(array, (size_t)n * size);
+    if (!p) {
+        fprintf(stderr, "[ERROR] Out of memory\n");
+        exit(1);
+    }
+    *cap = n;
+    return p;
+}
+
+// the toy key generator can pick p == q; a key that does not round-trip every byte is drawn again
+static void client_keys(void) {
+    for (;;) {
+        generate_rsa_keys(&c_n, &c_e, &c_d);
+        int ok = c_d > 0;
+        for (long b = 1; ok && b < 256; b++)
+            ok = modexp(modexp(b, c_e, c_n), c_d, c_n) == b;
+        if (ok)
+            return;
+    }
+}
+
+/* --- channel ids ------------------------------------------------------- */
+
+static struct old_channel *old_channel(uint64_t id) {
+    for (int i = 0; i < old_count; i++)
+        if (old_channels[i].id == id)
+            return &old_channels[i];
+    return NULL;
+}
+
+static void learn_channel(const char *name, uint64_t id) {
+    pthread_mutex_lock(&map_lock);
+    for (int i = 0; i < new_count; i++) {
+        if (strcmp(new_channels[i].name, name) == 0) {
+            new_channels[i].id = id;
+            pthread_mutex_unlock(&map_lock);
+            return;
+        }
+    }
+    if (new_count == new_cap)
+        new_channels = grow(new_channels, &new_cap, sizeof(*new_channels));
+    struct new_channel *c = &new_channels[new_count++];
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->id = id;
+    pthread_cond_broadcast(&map_changed);
+    pthread_mutex_unlock(&map_lock);
+}
+
+/*
+ * The id this run uses for a traced channel id. Ids the trace never named
+ * pass through unchanged; named ones wait for the create reply that maps
+ * them, since in a fast replay another connection may still be creating
+ * the channel. Sets *unmapped if that never came.
+ */
+static uint64_t map_channel(uint64_t id, int *unmapped) {
+    struct old_channel *old = id ? old_channel(id) : NULL;
+    if (!old)
+        return id;
+
+    struct timespec deadline;
+    deadline_in(&deadline, MAP_TIMEOUT_MS);
+    pthread_mutex_lock(&map_lock);
+    while (!old->missing) {
+        for (int i = 0; i < new_count; i++) {
+            if (strcmp(new_channels[i].name, old->name) == 0) {
+                uint64_t mapped = new_channels[i].id;
+                pthread_mutex_unlock(&map_lock);
+                return mapped;
+            }
+        }
+        if (pthread_cond_timedwait(&map_changed, &map_lock, &deadline) != 0)
+            old->missing = 1;
+    }
+    pthread_mutex_unlock(&map_lock);
+    *unmapped = 1;
+    return id;
+}
+
+// rewrites every decimal token of text that is a traced channel id
+static void map_text(const char *text, char *out, size_t cap, int *unmapped) {
+    size_t o = 0;
+    for (const char *s = text; *s && o + 1 < cap;) {
+        if (!isdigit((unsigned char)*s) || (s > text && isalnum((unsigned char)s[-1]))) {
+            out[o++] = *s++;
+            continue;
+        }
+
+        const char *end = s;
+        while (isdigit((unsigned char)*end))
+            end++;
+        if (isalpha((unsigned char)*end)) {
+            while (s < end && o + 1 < cap)
+                out[o++] = *s++;
+            continue;
+        }
+
+        uint64_t id = strtoull(s, NULL, 10);
+        if (old_channel(id)) {
+            int n = snprintf(out + o, cap - o, "%" PRIu64, map_channel(id, unmapped));
+            o = n < 0 || (size_t)n >= cap - o ? cap - 1 : o + (size_t)n;
+            s = end;
+        } else {
+            while (s < end && o + 1 < cap)
+                out[o++] = *s++;
+        }
+    }
+    out[o] = '\0';
+}
+
+/* --- connections -------------------------------------------------------- */
+
+// callers hold send_lock
+static ssize_t session_send(struct session *s, const struct encrypted_packet *p) {
+    if (!s->shm.region)
+        return packet_send(s->fd, p);
+    size_t len = packet_wire_size(p);
+    return shm_send(&s->shm, p, len) == 0 ? (ssize_t)len : -1;
+}
+
+static int send_text(struct session *s, uint32_t type, uint64_t channel_id, uint64_t msg_id, const char *text) {
+    struct encrypted_packet *p = &s->out;
+    memset(p, 0, PACKET_HEADER_SIZE);
+    p->command_type = type;
+    p->channel_id = channel_id;
+    p->msg_id = msg_id;
+    p->timestamp = (uint32_t)time(NULL);
+    if (packet_encrypt(p, text, s->s_e, s->s_n) < 0)
+        return -1;
+    pthread_mutex_lock(&s->send_lock);
+    ssize_t sent = session_send(s, p);
+    pthread_mutex_unlock(&s->send_lock);
+    return sent < 0 ? -1 : 0;
+}
+
+static void send_ping(struct session *s) {
+    pthread_mutex_lock(&s->lock);
+    uint64_t seq = ++s->pings;
+    s->ping_sent_ns[seq % PING_WINDOW] = now_ns();
+    pthread_mutex_unlock(&s->lock);
+    send_text(s, CMD_PING, 0, seq, "");
+}
+
+static void *session_reader(void *arg) {
+    struct session *s = arg;
+    char text[MAX_ENCRYPTED_PAYLOAD + 1];
+
+    while ((s->shm.region ? shm_packet_recv(&s->shm, &s->in) : packet_recv(s->fd, &s->in)) > 0) {
+        struct encrypted_packet *p = &s->in;
+
+        if (p->command_type == CMD_PING) {
+            uint64_t now = now_ns();
+            pthread_mutex_lock(&s->lock);
+            if (p->msg_id > s->pongs && p->msg_id <= s->pings) {
+                if (s->rtt_count == s->rtt_cap) {
+                    int cap = (int)s->rtt_cap;
+                    s->rtt_ns = grow(s->rtt_ns, &cap, sizeof(*s->rtt_ns));
+                    s->rtt_cap = (size_t)cap;
+                }
+                s->rtt_ns[s->rtt_count++] = now - s->ping_sent_ns[p->msg_id % PING_WINDOW];
+                s->pongs = p->msg_id;
+                s->last_ns = now;
+            }
+            pthread_cond_broadcast(&s->acked);
+            pthread_mutex_unlock(&s->lock);
+            continue;
+        }
+
+        // a connection that is quiet in the trace stays quiet here, and must not be reaped for it
+        if (p->command_type == CMD_HEARTBEAT) {
+            memset(&s->beat, 0, PACKET_HEADER_SIZE);
+            s->beat.command_type = CMD_HEARTBEAT;
+            packet_encrypt(&s->beat, "", s->s_e, s->s_n);
+            pthread_mutex_lock(&s->send_lock);
+            session_send(s, &s->beat);
+            pthread_mutex_unlock(&s->send_lock);
+            continue;
+        }
+
+        if (p->command_type == CMD_FILE_TRANSFER || packet_is_sealed(p) || p->len == 0 ||
+            packet_decrypt(p, c_d, c_n, text, sizeof(text)) < 0)
+            continue;
+
+        char name[CHANNEL_NAME_SIZE];
+        uint64_t id;
+        if (sscanf(text, "Channel '%31[^']' created successfully! ID: %" SCNu64, name, &id) == 2 ||
+            sscanf(text, "Channel '%31[^']' already exists (ID: %" SCNu64, name, &id) == 2)
+            learn_channel(name, id);
+    }
+    return NULL;
+}
+
+static int connect_once(struct session *s) {
+    int local = server_ip[0] == '/';
+    struct sockaddr_storage addr = {0};
+    socklen_t addr_len;
+    if (local) {
+        struct sockaddr_un *un = (struct sockaddr_un *)&addr;
+        un->sun_family = AF_UNIX;
+        strncpy(un->sun_path, server_ip, sizeof(un->sun_path) - 1);
+        addr_len = sizeof(*un);
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(server_port);
+        inet_pton(AF_INET, server_ip, &in->sin_addr);
+        addr_len = sizeof(*in);
+    }
+
+    int fd = socket(local ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, addr_len) < 0) {
+        close(fd);
+        return -1;
+    }
+    s->fd = fd;
+    // a probe right behind a command must not sit out a delayed ACK
+    int one = 1;
+    if (!local)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // the link only carries traffic once the credentials have gone over the socket
+    struct shm_link link = {0};
+    struct session_hello hello = {0};
+    hello.magic = SESSION_MAGIC;
+    hello.mode = SESSION_MODE_FULL;
+    hello.features = use_shm ? SESSION_FEATURE_SHM : 0;
+    struct session_reply reply;
+    if (send(fd, &hello, sizeof(hello), MSG_NOSIGNAL) != (ssize_t)sizeof(hello) ||
+        (use_shm && shm_link_offer(&link, fd) < 0) ||
+        recv(fd, &reply, sizeof(reply), MSG_WAITALL) != (ssize_t)sizeof(reply) ||
+        bitpack_width(reply.server_n) == 0)
+        goto fail;
+    s->s_n = reply.server_n;
+    s->s_e = reply.server_e;
+    if (!(reply.features & SESSION_FEATURE_SHM))
+        shm_link_close(&link);
+
+    if (send(fd, &c_n, sizeof(c_n), MSG_NOSIGNAL) != (ssize_t)sizeof(c_n) ||
+        send(fd, &c_e, sizeof(c_e), MSG_NOSIGNAL) != (ssize_t)sizeof(c_e) ||
+        send_text(s, 0, 0, 0, s->username) < 0 || send_text(s, 0, 0, 0, REPLAY_PASSWORD) < 0)
+        goto fail;
+
+    // the user id, then the resumption ticket and its secret, which a replay has no use for
+    struct session_ticket ticket;
+    if (link.region) {
+        if (shm_packet_recv(&link, &s->in) <= 0 || shm_recv(&link, &ticket, sizeof(ticket)) != (ssize_t)sizeof(ticket) ||
+            shm_packet_recv(&link, &s->in) <= 0)
+            goto fail;
+        s->shm = link;
+    } else if (packet_recv(fd, &s->in) <= 0 ||
+               recv(fd, &ticket, sizeof(ticket), MSG_WAITALL) != (ssize_t)sizeof(ticket) ||
+               packet_recv(fd, &s->in) <= 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    shm_link_close(&link);
+    close(fd);
+    s->fd = -1;
+    return -1;
+}
+
+static int session_login(struct session *s) {
+    for (int i = 0; i < LOGIN_ATTEMPTS; i++) {
+        if (connect_once(s) == 0)
+            return pthread_create(&s->reader, NULL, session_reader, s) == 0 ? 0 : -1;
+        sleep_ms(LOGIN_RETRY_MS);
+    }
+    return -1;
+}
+
+// waits for a final probe, so everything the connection sent has been handled
+static void session_logout(struct session *s) {
+    if (s->fd < 0)
+        return;
+
+    send_ping(s);
+    struct timespec deadline;
+    deadline_in(&deadline, PING_TIMEOUT_MS);
+    pthread_mutex_lock(&s->lock);
+    while (s->pongs < s->pings)
+        if (pthread_cond_timedwait(&s->acked, &s->lock, &deadline) != 0)
+            break;
+    if (s->pongs < s->pings)
+        s->failed = 1;
+    pthread_mutex_unlock(&s->lock);
+
+    shutdown(s->fd, SHUT_RDWR);
+    pthread_join(s->reader, NULL);
+    shm_link_close(&s->shm);
+    close(s->fd);
+    s->fd = -1;
+}
+
+static void wait_for(const struct trace_record *rec) {
+    if (speed <= 0)
+        return;
+
+    uint64_t at = base_ns + (uint64_t)((double)(rec->t_us - trace_start_us) * 1000.0 / speed);
+    struct timespec ts = { .tv_sec = (time_t)(at / 1000000000), .tv_nsec = (long)(at % 1000000000) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+static void send_item(struct session *s, const struct item *it) {
+    int unmapped = 0;
+    uint64_t channel_id = map_channel(it->rec.channel_id, &unmapped);
+
+    if (it->rec.kind == TRACE_FILE) {
+        const struct trace_file_chunk *meta = (const struct trace_file_chunk *)it->payload;
+        size_t len = it->rec.len - sizeof(*meta);
+        struct encrypted_packet *p = &s->out;
+        memset(p, 0, PACKET_HEADER_SIZE);
+        p->command_type = CMD_FILE_TRANSFER;
+        p->channel_id = channel_id;
+        p->msg_id = it->rec.msg_id;
+        p->timestamp = (uint32_t)time(NULL);
+        p->is_file = 1;
+        p->codec = meta->codec;
+        memcpy(p->file_name, meta->file_name, sizeof(p->file_name));
+        p->file_size = meta->file_size;
+        p->chunk_index = meta->chunk_index;
+        p->total_chunks = meta->total_chunks;
+        p->len = (uint32_t)len;
+        memcpy(p->file_data, it->payload + sizeof(*meta), len);
+        pthread_mutex_lock(&s->send_lock);
+        session_send(s, p);
+        pthread_mutex_unlock(&s->send_lock);
+    } else {
+        char text[MAX_ENCRYPTED_PAYLOAD + 1];
+        map_text((const char *)it->payload, text, sizeof(text), &unmapped);
+        send_text(s, it->rec.command_type, channel_id, it->rec.msg_id, text);
+    }
+
+    if (s->commands++ == 0)
+        s->first_ns = now_ns();
+    s->unmapped += unmapped;
+    if (probe_every && s->commands % (uint64_t)probe_every == 0)
+        send_ping(s);
+}
+
+static void *session_run(void *arg) {
+    struct session *s = arg;
+
+    for (int i = 0; i < s->count; i++) {
+        const struct item *it = s->items[i];
+        wait_for(&it->rec);
+
+        switch (it->rec.kind) {
+            case TRACE_LOGIN:
+                if (s->fd < 0 && session_login(s) < 0) {
+                    fprintf(stderr, "[ERROR] Could not log in as %s (connection %u)\n", s->username, s->conn);
+                    s->failed = 1;
+                    for (; i < s->count; i++)
+                        s->skipped += s->items[i]->rec.kind == TRACE_COMMAND || s->items[i]->rec.kind == TRACE_FILE;
+                    return NULL;
+                }
+                break;
+            case TRACE_COMMAND:
+            case TRACE_FILE:
+                if (s->fd < 0)
+                    s->skipped++;
+                else
+                    send_item(s, it);
+                break;
+            case TRACE_LOGOUT:
+                session_logout(s);
+                break;
+        }
+    }
+
+    // the capture stopped before this login ended
+    session_logout(s);
+    return NULL;
+}
+
+/* --- loading ------------------------------------------------------------ */
+
+static struct item *items;
+static int item_count, item_cap;
+static struct session **sessions;
+static int session_count, session_cap;
+
+static struct session *session_for(uint32_t conn) {
+    for (int i = session_count - 1; i >= 0; i--)
+        if (sessions[i]->conn == conn)
+            return sessions[i];
+    return NULL;
+}
+
+static int by_time(const void *a, const void *b) {
+    const struct item *x = a, *y = b;
+    if (x->rec.t_us != y->rec.t_us)
+        return x->rec.t_us < y->rec.t_us ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+static int load_trace(const char *path) {
+    struct trace_reader r;
+    if (trace_read_open(&r, path) < 0) {
+        fprintf(stderr, "[ERROR] %s is not a readable trace\n", path);
+        return -1;
+    }
+
+    struct trace_record rec;
+    uint8_t *payload;
+    int rc;
+    while ((rc = trace_next(&r, &rec, &payload)) == 1) {
+        if (rec.kind == TRACE_CHANNEL) {
+            if (old_count == old_cap)
+                old_channels = grow(old_channels, &old_cap, sizeof(*old_channels));
+            old_channels[old_count].id = rec.channel_id;
+            snprintf(old_channels[old_count].name, CHANNEL_NAME_SIZE, "%s", (char *)payload);
+            old_count++;
+            free(payload);
+            continue;
+        }
+        if (rec.kind == TRACE_FILE && rec.len < sizeof(struct trace_file_chunk)) {
+            free(payload);
+            continue;
+        }
+        if (item_count == item_cap)
+            items = grow(items, &item_cap, sizeof(*items));
+        items[item_count++] = (struct item){ rec, payload };
+    }
+    trace_read_close(&r);
+    if (rc < 0)
+        fprintf(stderr, "• Trace is damaged after %d record(s); replaying those.\n", item_count + old_count);
+
+    // a capture writes connections' records slightly out of order
+    qsort(items, item_count, sizeof(*items), by_time);
+
+    for (int i = 0; i < item_count; i++) {
+        struct item *it = &items[i];
+        struct session *s = session_for(it->rec.conn);
+        if (!s) {
+            if (it->rec.kind != TRACE_LOGIN)
+                continue; // logged in before the capture started
+            s = calloc(1, sizeof(*s));
+            if (!s)
+                return -1;
+            s->conn = it->rec.conn;
+            s->fd = -1;
+            snprintf(s->username, sizeof(s->username), "%s", (char *)it->payload);
+            pthread_mutex_init(&s->lock, NULL);
+            pthread_mutex_init(&s->send_lock, NULL);
+            pthread_cond_init(&s->acked, NULL);
+            if (session_count == session_cap)
+                sessions = grow(sessions, &session_cap, sizeof(*sessions));
+            sessions[session_count++] = s;
+        }
+        if (s->count == s->cap)
+            s->items = grow(s->items, &s->cap, sizeof(*s->items));
+        s->items[s->count++] = it;
+    }
+
+    trace_start_us = item_count ? items[0].rec.t_us : 0;
+    return 0;
+}
+
+/* --- results ------------------------------------------------------------ */
+
+static int by_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const uint64_t *sorted, size_t n, double q) {
+    if (n == 0)
+        return 0;
+    size_t i = (size_t)(q * (double)(n - 1) + 0.5);
+    return sorted[i] / 1e6;
+}
+
+static void report(void) {
+    uint64_t commands = 0, unmapped = 0, skipped = 0, first = UINT64_MAX, last = 0;
+    size_t probes = 0;
+    int failed = 0;
+    for (int i = 0; i < session_count; i++) {
+        struct session *s = sessions[i];
+        commands += s->commands;
+        unmapped += s->unmapped;
+        skipped += s->skipped;
+        probes += s->rtt_count;
+        failed += s->failed;
+        if (s->commands && s->first_ns < first)
+            first = s->first_ns;
+        if (s->last_ns > last)
+            last = s->last_ns;
+    }
+
+    uint64_t *rtt = malloc((probes ? probes : 1) * sizeof(*rtt));
+    size_t n = 0;
+    for (int i = 0; rtt && i < session_count; i++)
+        for (size_t j = 0; j < sessions[i]->rtt_count; j++)
+            rtt[n++] = sessions[i]->rtt_ns[j];
+    if (rtt)
+        qsort(rtt, n, sizeof(*rtt), by_u64);
+
+    double secs = commands && last > first ? (last - first) / 1e9 : 0;
+    printf("• Replayed %" PRIu64 " command(s) over %d connection(s) in %.3f s", commands, session_count, secs);
+    if (secs > 0)
+        printf(": %.1f cmd/s", commands / secs);
+    printf(".\n");
+    if (n)
+        printf("• Latency over %zu probe(s): p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms.\n",
+               n, percentile_ms(rtt, n, 0.5), percentile_ms(rtt, n, 0.9), percentile_ms(rtt, n, 0.99),
+               rtt[n - 1] / 1e6);
+    if (skipped)
+        printf("• %" PRIu64 " command(s) skipped: their connection could not log in.\n", skipped);
+    if (unmapped)
+        printf("• %" PRIu64 " command(s) named a channel this run never created.\n", unmapped);
+    if (failed)
+        printf("• %d connection(s) failed or did not drain.\n", failed);
+    free(rtt);
+}
+
+/*
+ * Final state, independent of the ids and times of a run: per channel,
+ * its member names and a hash of its stored messages as (sender name,
+ * content) pairs. Messages are summed rather than chained, since
+ * concurrent connections interleave differently on every run.
+ */
+struct known_user {
+    uint64_t id;
+    char name[USERNAME_SIZE];
+};
+
+struct digest_state {
+    const struct known_user *users;
+    int user_count;
+    uint64_t messages, sum;
+};
+
+static const uint8_t digest_key[SIPHASH_KEY_SIZE] = "rms-replay-state";
+
+static const char *user_name(const struct known_user *users, int n, uint64_t id) {
+    for (int i = 0; i < n; i++)
+        if (users[i].id == id)
+            return users[i].name;
+    return "?";
+}
+
+static int digest_message(const struct msg *m, void *arg) {
+    struct digest_state *d = arg;
+    char buf[USERNAME_SIZE + sizeof(m->content) + 1];
+    int len = snprintf(buf, sizeof(buf), "%s%c%.*s", user_name(d->users, d->user_count, m->sender_id), 0,
+                       (int)sizeof(m->content), m->content);
+    d->messages++;
+    d->sum += siphash24(digest_key, buf, len < (int)sizeof(buf) ? (size_t)len : sizeof(buf) - 1);
+    return 0;
+}
+
+static int by_string(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static struct channel_manager state_cm;
+
+static int state_digest(const char *dir, FILE *out) {
+    if (chdir(dir) != 0) {
+        fprintf(stderr, "[ERROR] Cannot enter server directory %s\n", dir);
+        return -1;
+    }
+
+    struct known_user *users = NULL;
+    int user_count = 0, user_cap = 0;
+    FILE *cred = fopen(CRED_FILE, "r");
+    char line[256];
+    while (cred && fgets(line, sizeof(line), cred)) {
+        struct known_user u = {0};
+        char password[PASSWORD_SIZE];
+        if (sscanf(line, "%31s %31s %" SCNu64, u.name, password, &u.id) < 3)
+            continue;
+        if (user_count == user_cap)
+            users = grow(users, &user_cap, sizeof(*users));
+        users[user_count++] = u;
+    }
+    if (cred)
+        fclose(cred);
+
+    struct channel_recovery rec;
+    channel_manager_init(&state_cm);
+    if (channel_recover(&state_cm, 0, &rec) < 0) {
+        free(users);
+        return -1;
+    }
+
+    const char *names[MAX_CHANNELS];
+    int n = 0;
+    for (int i = 0; i < state_cm.channel_count; i++)
+        names[n++] = state_cm.channels[i].channel_name;
+    qsort(names, n, sizeof(*names), by_string);
+
+    for (int i = 0; i < n; i++) {
+        struct channel *ch = channel_find_by_name(&state_cm, names[i]);
+        const char *members[MAX_PARTICIPANTS];
+        for (int j = 0; j < ch->participant_count; j++)
+            members[j] = user_name(users, user_count, ch->participant_ids[j]);
+        qsort(members, ch->participant_count, sizeof(*members), by_string);
+
+        struct digest_state d = { users, user_count, 0, 0 };
+        history_scan(ch->channel_id, digest_message, &d);
+        for (int j = 0; j < ch->participant_count; j++)
+            d.sum += siphash24(digest_key, members[j], strlen(members[j]) + 1) * 31;
+
+        fprintf(out, "%s members=%d messages=%" PRIu64 " digest=%016" PRIx64 "\n",
+                ch->channel_name, ch->participant_count, d.messages, d.sum);
+    }
+    free(users);
+    return 0;
+}
+
+// line-by-line; both files are sorted by channel name
+static int compare_state(const char *expect, const char *actual) {
+    FILE *a = fopen(expect, "r"), *b = fopen(actual, "r");
+    if (!a || !b) {
+        fprintf(stderr, "[ERROR] Cannot open %s to compare\n", a ? actual : expect);
+        if (a) fclose(a);
+        if (b) fclose(b);
+        return -1;
+    }
+
+    char la[256], lb[256];
+    int differ = 0;
+    for (;;) {
+        char *ra = fgets(la, sizeof(la), a), *rb = fgets(lb, sizeof(lb), b);
+        if (!ra && !rb)
+            break;
+        if (ra && rb && strcmp(la, lb) == 0)
+            continue;
+        differ++;
+        printf("• State differs:\n    expected %s    got      %s", ra ? la : "(nothing)\n", rb ? lb : "(nothing)\n");
+    }
+    fclose(a);
+    fclose(b);
+    printf("• Final state %s %s.\n", differ ? "does not match" : "matches", expect);
+    return differ ? 1 : 0;
+}
+
+static void absolute_path(const char *path, char *out, size_t cap) {
+    char cwd[2048];
+    if (path[0] == '/' || !getcwd(cwd, sizeof(cwd)))
+        snprintf(out, cap, "%s", path);
+    else
+        snprintf(out, cap, "%s/%s", cwd, path);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s <trace> <ip | socket path> <port> [--fast | --speed X] [--probe N] [--shm]\n"
+            "          [--dir server_dir [--state out] [--expect file]]\n"
+            "  --speed X   replay X times faster than recorded (default 1)\n"
+            "  --fast      send every connection's commands back to back\n"
+            "  --probe N   latency probe every N commands per connection, 0 = only at logout (default %d)\n"
+            "  --shm       over a Unix socket, move each connection onto shared memory after login\n"
+            "  --dir D     the server's working directory, read for the final state digest\n"
+            "  --state F   write the digest to F\n"
+            "  --expect F  compare the digest with F (from an earlier run) and exit 1 on a difference\n",
+            argv0, PROBE_DEFAULT);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    const char *trace_path = argv[1], *dir = NULL, *state_path = NULL, *expect_path = NULL;
+    server_ip = argv[2];
+    server_port = atoi(argv[3]);
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--fast") == 0)
+            speed = 0;
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+            speed = atof(argv[++i]);
+        else if (strcmp(argv[i], "--probe") == 0 && i + 1 < argc)
+            probe_every = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--shm") == 0)
+            use_shm = 1;
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if (strcmp(argv[i], "--state") == 0 && i + 1 < argc)
+            state_path = argv[++i];
+        else if (strcmp(argv[i], "--expect") == 0 && i + 1 < argc)
+            expect_path = argv[++i];
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (server_port <= 0 || server_port > 65535 || probe_every < 0 || speed < 0 ||
+        ((state_path || expect_path) && !dir) || (use_shm && server_ip[0] != '/')) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (load_trace(trace_path) < 0)
+        return 1;
+    printf("• Trace: %d record(s), %d connection(s), %d channel(s) named.\n", item_count, session_count, old_count);
+
+    srand((unsigned)time(NULL));
+    client_keys();
+
+    base_ns = now_ns();
+    for (int i = 0; i < session_count; i++) {
+        if (pthread_create(&sessions[i]->thread, NULL, session_run, sessions[i]) != 0) {
+            fprintf(stderr, "[ERROR] Failed to start connection %d\n", i);
+            return 1;
+        }
+    }
+    for (int i = 0; i < session_count; i++)
+        pthread_join(sessions[i]->thread, NULL);
+
+    report();
+
+    if (!dir)
+        return 0;
+
+    // the digest is taken inside the server directory, so output paths are resolved first
+    char tmp_state[] = "/tmp/rms_state_XXXXXX", state_abs[4096], expect_abs[4096];
+    if (!state_path && expect_path) {
+        int fd = mkstemp(tmp_state);
+        if (fd < 0)
+            return 1;
+        close(fd);
+        state_path = tmp_state;
+    }
+    if (state_path)
+        absolute_path(state_path, state_abs, sizeof(state_abs));
+    if (expect_path)
+        absolute_path(expect_path, expect_abs, sizeof(expect_abs));
+
+    FILE *out = state_path ? fopen(state_abs, "w") : stdout;
+    if (!out || state_digest(dir, out) < 0) {
+        fprintf(stderr, "[ERROR] Could not take the final state of %s\n", dir);
+        return 1;
+    }
+    if (out != stdout) {
+        fclose(out);
+        if (state_path != tmp_state)
+            printf("• Final state of %d channel(s) written to %s.\n", state_cm.channel_count, state_abs);
+    }
+
+    int rc = expect_path ? compare_state(expect_abs, state_abs) : 0;
+    if (state_path == tmp_state)
+        unlink(tmp_state);
+    return rc < 0 ? 1 : rc;
+}
@@ -0,0 +1,585 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "replica.h"
+#include "link_auth.h"
+#include "lockprof.h"
+#include "utility.h"
+
+#define REPLICA_SEND_CHUNK (64 * 1024)
+#define REPLICA_LAG_SLOTS 4096  // enqueue times kept for measuring lag
+#define REPLICA_LEADER_ID 0
+#define REPLICA_FOLLOWER_ID 1
+
+static struct channel_manager *repl_cm;
+static uint8_t repl_key[SIPHASH_KEY_SIZE];
+
+// leader: the log queue, a byte ring drained by the sender thread
+static pthread_mutex_t q_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t q_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t q_acked = PTHREAD_COND_INITIALIZER;
+static uint8_t *queue;
+static size_t q_head, q_used;
+static int follower_fd = -1;
+static uint64_t logged_seq, acked_seq, lag_ms, sync_timeouts;
+static uint64_t enqueued_at[REPLICA_LAG_SLOTS];
+static uint8_t link_session[SIPHASH_KEY_SIZE];   // the attached follower's link key
+static uint64_t link_seq;
+static int sync_timeout_ms;
+static void (*dump_credentials)(void);
+static _Thread_local uint64_t my_seq; // last record this thread logged, for replica_commit
+
+// follower
+static int following;
+static uint64_t applied;
+static double apply_rate;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int send_all(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len) {
+    return len == 0 || recv(fd, buf, len, MSG_WAITALL) == (ssize_t)len ? 0 : -1;
+}
+
+static uint64_t record_mac(const uint8_t session[SIPHASH_KEY_SIZE], struct repl_record *r) {
+    uint64_t mac = r->mac;
+    r->mac = 0;
+    uint64_t h = siphash24(session, r, REPL_HEADER_SIZE + r->len);
+    r->mac = mac;
+    return h;
+}
+
+// with q_lock held: the record's place on the follower's link
+static void seal_record(struct repl_record *r) {
+    r->link_seq = link_seq++;
+    r->mac = record_mac(link_session, r);
+}
+
+// with q_lock held; the threads serving the follower notice and exit
+static void drop_follower(void) {
+    if (follower_fd < 0)
+        return;
+    shutdown(follower_fd, SHUT_RDWR);
+    follower_fd = -1;
+    pthread_cond_broadcast(&q_ready);
+    pthread_cond_broadcast(&q_acked);
+}
+
+static void repl_append(struct repl_record *r, const char *text) {
+    r->len = 0;
+    if (text) {
+        size_t len = strlen(text);
+        r->len = (uint32_t)(len < sizeof(r->text) - 1 ? len : sizeof(r->text) - 1);
+        memcpy(r->text, text, r->len);
+    }
+    size_t size = REPL_HEADER_SIZE + r->len;
+
+    pthread_mutex_lock(&q_lock);
+    // nobody to send to: a follower that attaches later starts from a snapshot
+    if (follower_fd < 0) {
+        pthread_mutex_unlock(&q_lock);
+        return;
+    }
+    if (q_used + size > REPLICA_QUEUE_SIZE) {
+        printf("[ERROR] Follower fell %u bytes behind; dropping it until it reconnects\n", REPLICA_QUEUE_SIZE);
+        drop_follower();
+        pthread_mutex_unlock(&q_lock);
+        return;
+    }
+
+    r->seq = ++logged_seq;
+    seal_record(r);
+    size_t tail = (q_head + q_used) % REPLICA_QUEUE_SIZE;
+    size_t first = size < REPLICA_QUEUE_SIZE - tail ? size : REPLICA_QUEUE_SIZE - tail;
+    memcpy(queue + tail, r, first);
+    memcpy(queue, (const uint8_t *)r + first, size - first);
+    q_used += size;
+
+    enqueued_at[r->seq % REPLICA_LAG_SLOTS] = monotonic_ms();
+    my_seq = r->seq;
+    pthread_cond_signal(&q_ready);
+    pthread_mutex_unlock(&q_lock);
+}
+
+void replica_log_create(uint64_t channel_id, const char *name, uint64_t creator_id) {
+    if (!queue)
+        return;
+    struct repl_record r = { .type = REPL_CREATE, .channel_id = channel_id, .user_id = creator_id };
+    snprintf(r.name, sizeof(r.name), "%s", name);
+    repl_append(&r, NULL);
+}
+
+void replica_log_join(uint64_t channel_id, uint64_t user_id) {
+    if (!queue)
+        return;
+    struct repl_record r = { .type = REPL_JOIN, .channel_id = channel_id, .user_id = user_id };
+    repl_append(&r, NULL);
+}
+
+void replica_log_message(uint64_t channel_id, const struct msg *m) {
+    if (!queue)
+        return;
+    struct repl_record r = {
+        .type = REPL_MESSAGE, .channel_id = channel_id, .user_id = m->sender_id,
+        .msg_id = m->msg_id, .timestamp = m->timestamp, .msg_type = m->msg_type,
+    };
+    repl_append(&r, m->content);
+}
+
+void replica_log_credential(uint64_t user_id, const char *username, const char *password) {
+    if (!queue)
+        return;
+    // a follower that took over already holds hashes; those go on as they are
+    char hashed[PASSWORD_HASH_LEN + 1];
+    if (password_is_hashed(password))
+        snprintf(hashed, sizeof(hashed), "%s", password);
+    else if (password_hash(password, hashed, sizeof(hashed)) < 0)
+        return;
+
+    struct repl_record r = { .type = REPL_CREDENTIAL, .user_id = user_id };
+    snprintf(r.name, sizeof(r.name), "%s", username);
+    repl_append(&r, hashed);
+}
+
+void replica_commit(void) {
+    uint64_t seq = my_seq;
+    my_seq = 0;
+    if (sync_timeout_ms <= 0 || seq == 0)
+        return;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += sync_timeout_ms / 1000;
+    deadline.tv_nsec += (long)(sync_timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&q_lock);
+    while (follower_fd >= 0 && acked_seq < seq) {
+        if (pthread_cond_timedwait(&q_acked, &q_lock, &deadline) == ETIMEDOUT) {
+            sync_timeouts++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&q_lock);
+}
+
+static void report(uint64_t *last_report, uint64_t *last_count, uint64_t count) {
+    uint64_t now = monotonic_ms();
+    if (now - *last_report < REPLICA_REPORT_S * 1000)
+        return;
+
+    struct replica_stats s;
+    replica_stats(&s);
+    if (count != *last_count) {
+        if (s.following)
+            printf("• Replica: %" PRIu64 " record(s) applied, %.0f/s.\n", s.applied, s.apply_rate);
+        else
+            printf("• Replication: %" PRIu64 " logged, %" PRIu64 " acked (%" PRIu64 " behind, lag %" PRIu64 " ms, %" PRIu64 " sync timeout(s)).\n",
+                   s.logged, s.acked, s.logged - s.acked, s.lag_ms, s.sync_timeouts);
+    }
+    *last_report = now;
+    *last_count = count;
+}
+
+// copies whole chunks of the queue out and onto the follower's socket
+static void *sender_thread(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    uint8_t *buf = malloc(REPLICA_SEND_CHUNK);
+    uint64_t last_report = monotonic_ms(), last_logged = 0;
+
+    pthread_mutex_lock(&q_lock);
+    while (buf && follower_fd == fd) {
+        if (q_used == 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)REPLICA_HEARTBEAT_MS * 1000000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            int rc = pthread_cond_timedwait(&q_ready, &q_lock, &deadline);
+            if (follower_fd != fd)
+                break;
+            if (q_used == 0 && rc == ETIMEDOUT) {
+                // idle: let the follower know the leader is still here
+                struct repl_record hb = { .type = REPL_HEARTBEAT };
+                seal_record(&hb);
+                pthread_mutex_unlock(&q_lock);
+                int ok = send_all(fd, &hb, REPL_HEADER_SIZE) == 0;
+                report(&last_report, &last_logged, logged_seq);
+                pthread_mutex_lock(&q_lock);
+                if (!ok && follower_fd == fd)
+                    drop_follower();
+            }
+            continue;
+        }
+
+        size_t n = q_used < REPLICA_SEND_CHUNK ? q_used : REPLICA_SEND_CHUNK;
+        size_t first = n < REPLICA_QUEUE_SIZE - q_head ? n : REPLICA_QUEUE_SIZE - q_head;
+        memcpy(buf, queue + q_head, first);
+        memcpy(buf + first, queue, n - first);
+        q_head = (q_head + n) % REPLICA_QUEUE_SIZE;
+        q_used -= n;
+        pthread_mutex_unlock(&q_lock);
+
+        int ok = send_all(fd, buf, n) == 0;
+        report(&last_report, &last_logged, logged_seq);
+
+        pthread_mutex_lock(&q_lock);
+        if (!ok && follower_fd == fd)
+            drop_follower();
+    }
+    pthread_mutex_unlock(&q_lock);
+    free(buf);
+    return NULL;
+}
+
+// the follower starts from everything the leader holds right now
+static void send_snapshot(void) {
+    uint64_t *ids = malloc(MAX_CHANNELS * sizeof(*ids));
+    struct msg *ring = malloc(MSG_BUFFER_LIMIT * sizeof(*ring));
+    if (!ids || !ring) {
+        free(ids);
+        free(ring);
+        return;
+    }
+
+    int n = 0;
+    lockprof_lock(&repl_cm->lock);
+    for (int i = 0; i < repl_cm->channel_count; i++) {
+        if (!repl_cm->channels[i].remote)
+            ids[n++] = repl_cm->channels[i].channel_id;
+    }
+    lockprof_unlock(&repl_cm->lock);
+
+    int records = 0;
+    for (int i = 0; i < n; i++) {
+        char name[CHANNEL_NAME_SIZE] = {0};
+        uint64_t members[MAX_PARTICIPANTS];
+        int count = 0;
+
+        lockprof_lock(&repl_cm->lock);
+        struct channel *ch = channel_find(repl_cm, ids[i]);
+        if (ch) {
+            memcpy(name, ch->channel_name, sizeof(name) - 1);
+            count = ch->participant_count;
+            memcpy(members, ch->participant_ids, (size_t)count * sizeof(members[0]));
+        }
+        lockprof_unlock(&repl_cm->lock);
+        if (count == 0)
+            continue;
+
+        replica_log_create(ids[i], name, members[0]);
+        for (int k = 1; k < count; k++)
+            replica_log_join(ids[i], members[k]);
+
+        int gap = 0;
+        int m = channel_messages_since(repl_cm, ids[i], 0, ring, MSG_BUFFER_LIMIT, &gap);
+        for (int k = 0; k < m; k++)
+            replica_log_message(ids[i], &ring[k]);
+        records += count + (m > 0 ? m : 0);
+    }
+
+    if (dump_credentials)
+        dump_credentials();
+    printf("• Sent the follower a snapshot of %d channel(s), %d record(s).\n", n, records);
+    free(ids);
+    free(ring);
+}
+
+static int is_follower(uint32_t id) {
+    return id == REPLICA_FOLLOWER_ID;
+}
+
+// one follower at a time, and only one that knows the secret; this thread also reads its acks
+static void *follower_acceptor(void *arg) {
+    int listen_fd = (int)(intptr_t)arg;
+
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        uint8_t session[SIPHASH_KEY_SIZE];
+        if (link_auth_accept(fd, repl_key, REPLICA_LEADER_ID, is_follower, session) < 0) {
+            printf("[ERROR] Rejected a follower that failed authentication\n");
+            close(fd);
+            continue;
+        }
+
+        pthread_mutex_lock(&q_lock);
+        if (follower_fd >= 0) {
+            pthread_mutex_unlock(&q_lock);
+            printf("[ERROR] A follower is already attached; refusing another\n");
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        follower_fd = fd;
+        q_head = q_used = 0;
+        acked_seq = logged_seq;
+        memcpy(link_session, session, sizeof(link_session));
+        link_seq = 0;
+        pthread_mutex_unlock(&q_lock);
+
+        pthread_t sender;
+        if (pthread_create(&sender, NULL, sender_thread, (void *)(intptr_t)fd) != 0) {
+            pthread_mutex_lock(&q_lock);
+            drop_follower();
+            pthread_mutex_unlock(&q_lock);
+            close(fd);
+            continue;
+        }
+        printf("• Follower attached.\n");
+        send_snapshot();
+
+        uint64_t ack;
+        while (recv_all(fd, &ack, sizeof(ack)) == 0) {
+            pthread_mutex_lock(&q_lock);
+            if (ack > acked_seq && ack <= logged_seq) {
+                acked_seq = ack;
+                lag_ms = monotonic_ms() - enqueued_at[ack % REPLICA_LAG_SLOTS];
+                pthread_cond_broadcast(&q_acked);
+            }
+            pthread_mutex_unlock(&q_lock);
+        }
+
+        pthread_mutex_lock(&q_lock);
+        if (follower_fd == fd)
+            drop_follower();
+        pthread_mutex_unlock(&q_lock);
+        pthread_join(sender, NULL);
+        close(fd);
+        printf("• Follower detached.\n");
+    }
+    return NULL;
+}
+
+int replica_serve(struct channel_manager *cm, const char *host, int port, const char *secret, int sync_ms,
+                  void (*dump)(void)) {
+    if (link_secret_key(secret, repl_key) < 0)
+        return -1;
+
+    char port_s[16];
+    snprintf(port_s, sizeof(port_s), "%d", port);
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port_s, &hints, &res) != 0)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(fd, res->ai_addr, res->ai_addrlen) < 0 || listen(fd, 1) < 0) {
+        freeaddrinfo(res);
+        close(fd);
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    queue = malloc(REPLICA_QUEUE_SIZE);
+    if (!queue) {
+        close(fd);
+        return -1;
+    }
+    repl_cm = cm;
+    sync_timeout_ms = sync_ms;
+    dump_credentials = dump;
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, follower_acceptor, (void *)(intptr_t)fd) != 0)
+        return -1;
+    pthread_detach(t);
+    return 0;
+}
+
+static int apply(struct repl_record *r,
+                 void (*on_credential)(uint64_t user_id, const char *username, const char *password)) {
+    switch (r->type) {
+        case REPL_CREATE:
+            if (!channel_find(repl_cm, r->channel_id) &&
+                channel_create_with_id(repl_cm, r->channel_id, r->name, r->user_id) == 0)
+                return -1;
+            return 0;
+        case REPL_JOIN:
+            // -3: already a member, which a snapshot overlapping the stream repeats
+            return channel_join(repl_cm, r->channel_id, r->user_id) == -1 ? -1 : 0;
+        case REPL_MESSAGE: {
+            struct msg m = {0};
+            m.msg_id = r->msg_id;
+            m.sender_id = r->user_id;
+            m.timestamp = r->timestamp;
+            m.msg_type = r->msg_type;
+            memcpy(m.content, r->text, r->len);
+            return channel_apply_message(repl_cm, r->channel_id, &m) < 0 ? -1 : 0;
+        }
+        case REPL_CREDENTIAL:
+            if (!password_is_hashed(r->text))
+                return -1;
+            if (on_credential)
+                on_credential(r->user_id, r->name, r->text);
+            return 0;
+        case REPL_HEARTBEAT:
+            return 0;
+    }
+    return -1;
+}
+
+static int leader_connect(const char *host, const char *port) {
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+        return -1;
+
+    uint8_t session[SIPHASH_KEY_SIZE];
+    if (link_auth_dial(fd, repl_key, REPLICA_FOLLOWER_ID, REPLICA_LEADER_ID, session) < 0) {
+        printf("[ERROR] The leader at %s:%s failed authentication\n", host, port);
+        close(fd);
+        return -1;
+    }
+    memcpy(link_session, session, sizeof(link_session));
+
+    // heartbeats come every REPLICA_HEARTBEAT_MS, so a longer silence means trouble
+    struct timeval tv = { .tv_sec = REPLICA_TAKEOVER_MS / 1000, .tv_usec = (REPLICA_TAKEOVER_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// applies the stream until the leader goes away
+static void follow_stream(int fd, void (*on_credential)(uint64_t, const char *, const char *)) {
+    struct repl_record *r = malloc(sizeof(*r));
+    uint64_t done = 0, unacked = 0, expect = 0;
+    uint64_t last_report = monotonic_ms(), last_applied = applied;
+
+    while (r && recv_all(fd, r, REPL_HEADER_SIZE) == 0) {
+        if (r->len >= sizeof(r->text) || recv_all(fd, r->text, r->len) < 0)
+            break;
+        if (r->link_seq != expect++ || r->mac != record_mac(link_session, r)) {
+            printf("[ERROR] Record %" PRIu64 " from the leader fails authentication; dropping the link\n", r->seq);
+            break;
+        }
+        r->text[r->len] = '\0';
+        r->name[sizeof(r->name) - 1] = '\0';
+
+        if (apply(r, on_credential) < 0)
+            printf("[ERROR] Could not apply record %" PRIu64 " (type %u, channel %" PRIu64 ")\n",
+                   r->seq, r->type, r->channel_id);
+        if (r->seq) {
+            done = r->seq;
+            unacked++;
+            applied++;
+        }
+
+        // ack once the burst is drained, or every so often while it lasts
+        uint8_t peek;
+        if (unacked && (unacked >= REPLICA_ACK_EVERY || recv(fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT) < 0)) {
+            if (send_all(fd, &done, sizeof(done)) < 0)
+                break;
+            unacked = 0;
+        }
+
+        uint64_t now = monotonic_ms();
+        if (now - last_report >= REPLICA_REPORT_S * 1000)
+            apply_rate = (double)(applied - last_applied) * 1000.0 / (double)(now - last_report);
+        report(&last_report, &last_applied, applied);
+    }
+    free(r);
+}
+
+int replica_follow(struct channel_manager *cm, const char *leader, const char *secret,
+                   void (*on_credential)(uint64_t user_id, const char *username, const char *password)) {
+    if (link_secret_key(secret, repl_key) < 0)
+        return -1;
+
+    char host[256];
+    snprintf(host, sizeof(host), "%s", leader);
+    char *port = strrchr(host, ':');
+    if (!port)
+        return -1;
+    *port++ = '\0';
+
+    repl_cm = cm;
+    following = 1;
+    int attached = 0;
+    uint64_t last_contact = monotonic_ms();
+
+    // a standby that never saw the leader has nothing to take over with
+    while (!attached || monotonic_ms() - last_contact < REPLICA_TAKEOVER_MS) {
+        int fd = leader_connect(host, port);
+        if (fd < 0) {
+            usleep(100 * 1000);
+            continue;
+        }
+
+        printf("• Following the leader at %s:%s.\n", host, port);
+        attached = 1;
+        follow_stream(fd, on_credential);
+        close(fd);
+        last_contact = monotonic_ms();
+        printf("• Lost the leader after %" PRIu64 " applied record(s); retrying for %d ms.\n", applied, REPLICA_TAKEOVER_MS);
+    }
+
+    following = 0;
+    printf("• Leader gone for %d ms, taking over.\n", REPLICA_TAKEOVER_MS);
+    return 0;
+}
+
+void replica_stats(struct replica_stats *s) {
+    pthread_mutex_lock(&q_lock);
+    s->following = following;
+    s->attached = follower_fd >= 0;
+    s->logged = logged_seq;
+    s->acked = acked_seq;
+    s->lag_ms = lag_ms;
+    s->sync_timeouts = sync_timeouts;
+    s->applied = applied;
+    s->apply_rate = apply_rate;
+    pthread_mutex_unlock(&q_lock);
+}
@@ -0,0 +1,89 @@
+#ifndef RMS_REPLICA_H
+#define RMS_REPLICA_H
+#include <stdint.h>
+#include <stddef.h>
+#include "channel.h"
+
+#define REPLICA_QUEUE_SIZE (4u << 20)   // bytes of log held for a slow follower
+#define REPLICA_HEARTBEAT_MS 500
+#define REPLICA_TAKEOVER_MS 3000        // leader silence before the follower takes over
+#define REPLICA_ACK_EVERY 64            // records a follower applies between acks under load
+#define REPLICA_REPORT_S 10
+
+/*
+ * Hot standby. The leader logs every channel mutation (create, join,
+ * message) and every new credential, and a sender thread streams the log to
+ * one follower process. Uploaded files are not replicated: the follower
+ * keeps the [FILE] message announcing one, but not its contents, which
+ * stay in the leader's channel_<id>_files directory. A follower that attaches first gets the current
+ * state as a burst of the same records, then the live stream. Applying is
+ * idempotent (ids travel with the records), so where the two overlap
+ * nothing is applied twice.
+ *
+ * Replication is asynchronous unless a sync timeout is given. Then
+ * replica_commit blocks, up to that timeout, until the follower has
+ * applied everything the calling thread logged, so a message the sender
+ * saw go out survives the leader.
+ *
+ * A follower that has been attached once and then hears nothing from the
+ * leader for REPLICA_TAKEOVER_MS returns from replica_follow; the caller
+ * then opens the client port and carries on as the leader.
+ *
+ * Leader and follower prove to each other that they hold the same secret
+ * before anything is streamed (see link_auth.h), and every record carries
+ * a sequence number and a MAC under the link's key; the follower stops at
+ * the first record that fails either. Credentials travel as salted hashes,
+ * never as the password itself.
+ */
+enum {
+    REPL_CREATE = 1,
+    REPL_JOIN,
+    REPL_MESSAGE,
+    REPL_CREDENTIAL,    // name is the username, text the salted password hash
+    REPL_HEARTBEAT,
+};
+
+struct repl_record {
+    uint32_t type;
+    uint32_t len;                   // bytes of text
+    uint64_t seq;                   // 0 for heartbeats
+    uint64_t link_seq;              // every record on the link, heartbeats included, from 0
+    uint64_t mac;                   // over header and text under the link key
+    uint64_t channel_id;
+    uint64_t user_id;               // creator, joiner, sender or new user
+    uint64_t msg_id;
+    uint32_t timestamp;
+    int32_t msg_type;
+    char name[CHANNEL_NAME_SIZE];   // channel name or username
+    char text[MSG_CONTENT_MAX + 1];
+};
+
+#define REPL_HEADER_SIZE offsetof(struct repl_record, text)
+
+struct replica_stats {
+    int following;              // 1 on a follower that has not taken over
+    int attached;               // leader: a follower is connected
+    uint64_t logged;            // leader: last sequence number handed out
+    uint64_t acked;             // leader: last one the follower confirmed
+    uint64_t lag_ms;            // leader: age of that record when its ack came in
+    uint64_t sync_timeouts;     // leader: commits that stopped waiting
+    uint64_t applied;           // follower: records applied
+    double apply_rate;          // follower: records per second over the last report
+};
+
+// leader side, listening on host:port; dump_credentials should replica_log_credential every known user
+int replica_serve(struct channel_manager *cm, const char *host, int port, const char *secret, int sync_timeout_ms,
+                  void (*dump_credentials)(void));
+void replica_log_create(uint64_t channel_id, const char *name, uint64_t creator_id);
+void replica_log_join(uint64_t channel_id, uint64_t user_id);
+void replica_log_message(uint64_t channel_id, const struct msg *m);
+void replica_log_credential(uint64_t user_id, const char *username, const char *password);
+void replica_commit(void);
+
+// follower side; leader is "host:port"
+int replica_follow(struct channel_manager *cm, const char *leader, const char *secret,
+                   void (*on_credential)(uint64_t user_id, const char *username, const char *password));
+
+void replica_stats(struct replica_stats *s);
+
+#endif //RMS_REPLICA_H
@@ -1,104 +1,116 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include "rsa.h"
-
-long extended_gcd(long a, long b, long *x, long *y) {
-    if (b == 0) {
-        *x = 1;
-        *y = 0;
-        return a;
-    }
-
-    long x1, y1;
-    long gcd = extended_gcd(b, a % b, &x1, &y1);
-
-    *x = y1;
-    *y = x1 - (a / b) * y1;
-
-    return gcd;
-}
-
-long mod_inverse(long e, long phi) {
-    long x, y;
-    long g = extended_gcd(e, phi, &x, &y);
-    if (g != 1) return -1;
-    return (x % phi + phi) % phi;
-}
-
-int is_prime(long n) {
-    if (n <= 1) return 0;
-    for (long i = 2; i * i <= n; i++) {
-        if (n % i == 0) return 0;
-    }
-    return 1;
-}
-
-long gen_prime(long min, long max) {
-    while (1) {
-        long candidate = min + rand() % (max - min);
-        if (is_prime(candidate)) return candidate;
-    }
-}
-
-long gcd(long a, long b) {
-    while (b != 0) {
-        long t = b;
-        b = a % b;
-        a = t;
-    }
-    return a;
-}
-
-long modexp(long base, long exp, long mod) {
-    long result = 1;
-    base %= mod;
-    while (exp > 0) {
-        if (exp & 1) result = (result * base) % mod;
-        exp >>= 1;
-        base = (base * base) % mod;
-    }
-    return result;
-}
-
-extern long *encrypt(const char *plaintext, long e, long n, size_t *out_len) {
-    size_t len = strlen(plaintext);
-    *out_len = len;
-
-    long *cipher = malloc(len * sizeof(long));
-    if (!cipher) return NULL;
-
-    for (size_t i = 0; i < len; i++) {
-        cipher[i] = modexp((unsigned char)plaintext[i], e, n);
-    }
-
-    return cipher;
-}
-
-extern char *decrypt(const long *cipher, size_t len, long d, long n) {
-    char *plain = malloc(len + 1);
-    if (!plain) return NULL;
-
-    for (size_t i = 0; i < len; i++) {
-        plain[i] = (char)modexp(cipher[i], d, n);
-    }
-
-    plain[len] = '\0';
-    return plain;
-}
-
-extern void generate_rsa_keys(long *n, long *e, long *d) {
-    long p = gen_prime(100, 300);
-    long q = gen_prime(100, 300);
-
-    *n = p * q;
-    long phi = (p - 1) * (q - 1);
-
-    long e_candidate = 3;
-    while (gcd(e_candidate, phi) != 1) {
-        e_candidate++;
-    }
-    *e = e_candidate;
-
-    *d = mod_inverse(*e, phi);
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rsa.h"
+
+long extended_gcd(long a, long b, long *x, long *y) {
+    if (b == 0) {
+        *x = 1;
+        *y = 0;
+        return a;
+    }
+
+    long x1, y1;
+    long gcd = extended_gcd(b, a % b, &x1, &y1);
+
+    *x = y1;
+    *y = x1 - (a / b) * y1;
+
+    return gcd;
+}
+
+long mod_inverse(long e, long phi) {
+    long x, y;
+    long g = extended_gcd(e, phi, &x, &y);
+    if (g != 1) return -1;
+    return (x % phi + phi) % phi;
+}
+
+int is_prime(long n) {
+    if (n <= 1) return 0;
+    for (long i = 2; i * i <= n; i++) {
+        if (n % i == 0) return 0;
+    }
+    return 1;
+}
+
+long gen_prime(long min, long max) {
+    while (1) {
+        long candidate = min + rand() % (max - min);
+        if (is_prime(candidate)) return candidate;
+    }
+}
+
+long gcd(long a, long b) {
+    while (b != 0) {
+        long t = b;
+        b = a % b;
+        a = t;
+    }
+    return a;
+}
+
+long modexp(long base, long exp, long mod) {
+    long result = 1;
+    base %= mod;
+    while (exp > 0) {
+        if (exp & 1) result = (result * base) % mod;
+        exp >>= 1;
+        base = (base * base) % mod;
+    }
+    return result;
+}
+
+extern size_t encrypt_into(const char *plaintext, long e, long n, long *out, size_t cap) {
+    size_t len = 0;
+    for (; plaintext[len] && len < cap; len++) {
+        out[len] = modexp((unsigned char)plaintext[len], e, n);
+    }
+    return len;
+}
+
+extern size_t decrypt_into(const long *cipher, size_t len, long d, long n, char *out, size_t cap) {
+    if (cap == 0) return 0;
+    if (len > cap - 1) len = cap - 1;
+
+    for (size_t i = 0; i < len; i++) {
+        out[i] = (char)modexp(cipher[i], d, n);
+    }
+
+    out[len] = '\0';
+    return len;
+}
+
+extern long *encrypt(const char *plaintext, long e, long n, size_t *out_len) {
+    size_t len = strlen(plaintext);
+
+    long *cipher = malloc(len * sizeof(long));
+    if (!cipher) return NULL;
+
+    *out_len = encrypt_into(plaintext, e, n, cipher, len);
+    return cipher;
+}
+
+extern char *decrypt(const long *cipher, size_t len, long d, long n) {
+    char *plain = malloc(len + 1);
+    if (!plain) return NULL;
+
+    decrypt_into(cipher, len, d, n, plain, len + 1);
+    return plain;
+}
+
+extern void generate_rsa_keys(long *n, long *e, long *d) {
+    long p = gen_prime(100, 300);
+    long q = gen_prime(100, 300);
+
+    *n = p * q;
+    long phi = (p - 1) * (q - 1);
+
+    long e_candidate = 3;
+    while (gcd(e_candidate, phi) != 1) {
+        e_candidate++;
+    }
+    *e = e_candidate;
+
+    *d = mod_inverse(*e, phi);
 }
\ No newline at end of file
@@ -1,16 +1,20 @@
-#pragma once
-
-#ifndef RSA_H
-#define RSA_H
-
-int is_prime(long n);
-long gcd(long a, long b);
-long modexp(long base, long exp, long mod);
-long mod_inverse(long e, long phi);
-
-extern long *encrypt(const char *plaintext, long e, long n, size_t *out_len);
-extern char *decrypt(const long *cipher, size_t len, long d, long n);
-
-extern void generate_rsa_keys(long *n, long *e, long *d);
-
+#pragma once
+
+#ifndef RSA_H
+#define RSA_H
+
+int is_prime(long n);
+long gcd(long a, long b);
+long modexp(long base, long exp, long mod);
+long mod_inverse(long e, long phi);
+
+extern long *encrypt(const char *plaintext, long e, long n, size_t *out_len);
+extern char *decrypt(const long *cipher, size_t len, long d, long n);
+
+// caller-provided buffers: at most cap symbols out, or cap - 1 characters plus the terminator
+extern size_t encrypt_into(const char *plaintext, long e, long n, long *out, size_t cap);
+extern size_t decrypt_into(const long *cipher, size_t len, long d, long n, char *out, size_t cap);
+
+extern void generate_rsa_keys(long *n, long *e, long *d);
+
 #endif
\ No newline at end of file
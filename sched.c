@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "sched.h"
+#include "arena.h"
+
+/*
+ * Work-stealing scheduler. Every worker owns a deque of runnable strands:
+ * it pops its own work from the bottom (LIFO, cache warm) and steals from
+ * the top of other workers' deques (FIFO, oldest first) when it runs dry.
+ * Submissions from I/O threads are spread round-robin over the deques.
+ */
+
+struct deque {
+    pthread_mutex_t lock;
+    struct strand **items;
+    size_t cap;
+    size_t top;
+    size_t bottom;
+};
+
+static struct deque deques[SCHED_MAX_WORKERS];
+static int num_workers = 0;
+
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int runnable;
+static atomic_uint next_deque;
+static struct pool task_pool = POOL_INITIALIZER(sizeof(struct task), 4096);
+
+static _Thread_local int self_id = -1;
+
+static int deque_push(struct deque *d, struct strand *s) {
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom - d->top == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 64;
+        struct strand **items = malloc(cap * sizeof(*items));
+        if (!items) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        for (size_t i = d->top; i < d->bottom; i++)
+            items[i - d->top] = d->items[i % d->cap];
+        free(d->items);
+        d->items = items;
+        d->bottom -= d->top;
+        d->top = 0;
+        d->cap = cap;
+    }
+    d->items[d->bottom % d->cap] = s;
+    d->bottom++;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+static struct strand *deque_pop(struct deque *d) {
+    struct strand *s = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top) {
+        d->bottom--;
+        s = d->items[d->bottom % d->cap];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return s;
+}
+
+static struct strand *deque_steal(struct deque *d) {
+    struct strand *s = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top) {
+        s = d->items[d->top % d->cap];
+        d->top++;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return s;
+}
+
+static void make_runnable(struct strand *s) {
+    int target = self_id;
+    if (target < 0)
+        target = (int)(atomic_fetch_add(&next_deque, 1) % (unsigned)num_workers);
+
+    while (deque_push(&deques[target], s) < 0) {
+        printf("[ERROR] Scheduler out of memory, retrying\n");
+        sleep(1);
+    }
+
+    atomic_fetch_add(&runnable, 1);
+    pthread_mutex_lock(&idle_lock);
+    pthread_cond_signal(&idle_cond);
+    pthread_mutex_unlock(&idle_lock);
+}
+
+static struct strand *find_work(void) {
+    struct strand *s = deque_pop(&deques[self_id]);
+    for (int i = 1; !s && i < num_workers; i++)
+        s = deque_steal(&deques[(self_id + i) % num_workers]);
+
+    if (s)
+        atomic_fetch_sub(&runnable, 1);
+    return s;
+}
+
+static void run_strand(struct strand *s) {
+    for (int n = 0; n < SCHED_STRAND_BATCH; n++) {
+        pthread_mutex_lock(&s->lock);
+        struct task *t = s->head;
+        if (!t) {
+            s->scheduled = 0;
+            pthread_mutex_unlock(&s->lock);
+            return;
+        }
+        s->head = t->next;
+        if (!s->head)
+            s->tail = NULL;
+        pthread_mutex_unlock(&s->lock);
+
+        t->fn(t->arg);
+        pool_put(&task_pool, t);
+    }
+
+    // batch exhausted: requeue so one busy connection can't starve the rest
+    pthread_mutex_lock(&s->lock);
+    int more = s->head != NULL;
+    if (!more)
+        s->scheduled = 0;
+    pthread_mutex_unlock(&s->lock);
+
+    if (more)
+        make_runnable(s);
+}
+
+static void *sched_worker(void *arg) {
+    self_id = (int)(long)arg;
+
+    for (;;) {
+        struct strand *s = find_work();
+        if (s) {
+            run_strand(s);
+            continue;
+        }
+
+        pthread_mutex_lock(&idle_lock);
+        while (atomic_load(&runnable) == 0)
+            pthread_cond_wait(&idle_cond, &idle_lock);
+        pthread_mutex_unlock(&idle_lock);
+    }
+    return NULL;
+}
+
+int sched_init(int workers) {
+    if (workers <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (int)cpus : 1;
+    }
+    if (workers > SCHED_MAX_WORKERS)
+        workers = SCHED_MAX_WORKERS;
+
+    for (int i = 0; i < workers; i++)
+        pthread_mutex_init(&deques[i].lock, NULL);
+    num_workers = workers;
+
+    for (int i = 0; i < workers; i++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, sched_worker, (void *)(long)i) != 0)
+            return -1;
+        pthread_detach(t);
+    }
+    return workers;
+}
+
+void strand_init(struct strand *s) {
+    pthread_mutex_init(&s->lock, NULL);
+    s->head = NULL;
+    s->tail = NULL;
+    s->scheduled = 0;
+}
+
+int sched_submit(struct strand *s, void (*fn)(void *arg), void *arg) {
+    struct task *t = pool_get(&task_pool);
+    if (!t)
+        return -1;
+    t->fn = fn;
+    t->arg = arg;
+    t->next = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->tail)
+        s->tail->next = t;
+    else
+        s->head = t;
+    s->tail = t;
+
+    int wake = !s->scheduled;
+    s->scheduled = 1;
+    pthread_mutex_unlock(&s->lock);
+
+    if (wake)
+        make_runnable(s);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <pthread.h>
+
+#ifndef RMS_SCHED_H
+#define RMS_SCHED_H
+
+#define SCHED_MAX_WORKERS 64
+#define SCHED_STRAND_BATCH 16 // tasks a worker runs from one strand before yielding it
+
+struct task {
+    void (*fn)(void *arg);
+    void *arg;
+    struct task *next;
+};
+
+/*
+ * A strand is a FIFO of tasks that must run one at a time and in order,
+ * e.g. every command read from one connection. Different strands run in
+ * parallel on whichever worker picks them up.
+ */
+struct strand {
+    pthread_mutex_t lock;
+    struct task *head;
+    struct task *tail;
+    int scheduled;
+};
+
+int sched_init(int workers);
+void strand_init(struct strand *s);
+int sched_submit(struct strand *s, void (*fn)(void *arg), void *arg);
+
+#endif //RMS_SCHED_H
@@ -0,0 +1,471 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <inttypes.h>
+
+#include "search.h"
+#include "history.h"
+#include "arena.h"
+
+#define SEARCH_BLOCK 128 // postings per skip entry
+
+/*
+ * Where a block of SEARCH_BLOCK postings starts in the varint stream, and
+ * the id its first delta is relative to. Lets a query decode any block on
+ * its own instead of the list from the start.
+ */
+struct skip {
+    uint64_t base_id;
+    uint32_t offset;
+};
+
+struct posting_list {
+    char term[SEARCH_TERM_MAX + 1];
+    uint8_t term_len;   // 0 marks an empty slot
+    uint32_t count;
+    uint64_t last_id;
+    uint8_t *data;      // varint deltas between ascending msg ids
+    uint32_t len;
+    uint32_t cap;
+    struct skip *skips;
+    uint32_t skip_cap;
+};
+
+/*
+ * One channel's vocabulary: an open-addressing table of posting lists.
+ * The indexer takes the write lock per message, queries the read lock.
+ */
+struct channel_index {
+    uint64_t channel_id;
+    uint64_t indexed_upto;
+    pthread_rwlock_t lock;
+    struct posting_list *slots;
+    uint32_t used;
+    uint32_t cap;
+};
+
+struct index_job {
+    struct index_job *next;
+    uint64_t channel_id;
+    uint64_t msg_id;
+    char content[sizeof(((struct msg *)0)->content) + 1];
+};
+
+// allocated once and never moved, so a query can hold one while others are added
+static struct channel_index *indexes[MAX_CHANNELS];
+static int index_count = 0;
+static pthread_mutex_t indexes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct index_job *queue_head = NULL;
+static struct index_job *queue_tail = NULL;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static int running = 0;
+static struct pool job_pool = POOL_INITIALIZER(sizeof(struct index_job), 1024);
+
+static uint32_t term_hash(const char *term, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t)term[i]) * 16777619u;
+    return h;
+}
+
+/*
+ * Terms are runs of ASCII letters and digits, lowercased, plus any non-ASCII
+ * bytes so UTF-8 words stay whole. Runs longer than SEARCH_TERM_MAX are cut.
+ */
+static void tokenize(const char *text, void (*emit)(const char *term, size_t len, void *arg), void *arg) {
+    char term[SEARCH_TERM_MAX];
+    size_t len = 0;
+
+    for (const unsigned char *p = (const unsigned char *)text; ; p++) {
+        unsigned char c = *p;
+        int word = (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+        if (word) {
+            if (len < sizeof(term))
+                term[len++] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : (char)c;
+            continue;
+        }
+
+        if (len >= SEARCH_TERM_MIN)
+            emit(term, len, arg);
+        len = 0;
+        if (c == '\0')
+            break;
+    }
+}
+
+static struct channel_index *find_index(uint64_t channel_id, int create) {
+    pthread_mutex_lock(&indexes_lock);
+    for (int i = 0; i < index_count; i++) {
+        if (indexes[i]->channel_id == channel_id) {
+            pthread_mutex_unlock(&indexes_lock);
+            return indexes[i];
+        }
+    }
+
+    struct channel_index *idx = NULL;
+    if (create && index_count < MAX_CHANNELS && (idx = calloc(1, sizeof(*idx)))) {
+        idx->channel_id = channel_id;
+        pthread_rwlock_init(&idx->lock, NULL);
+        indexes[index_count++] = idx;
+    }
+    pthread_mutex_unlock(&indexes_lock);
+    return idx;
+}
+
+static struct posting_list *lookup(struct channel_index *idx, const char *term, size_t len) {
+    if (idx->cap == 0)
+        return NULL;
+
+    uint32_t mask = idx->cap - 1;
+    for (uint32_t i = term_hash(term, len) & mask; ; i = (i + 1) & mask) {
+        struct posting_list *pl = &idx->slots[i];
+        if (pl->term_len == 0)
+            return NULL;
+        if (pl->term_len == len && memcmp(pl->term, term, len) == 0)
+            return pl;
+    }
+}
+
+static int grow(struct channel_index *idx) {
+    uint32_t cap = idx->cap ? idx->cap * 2 : 256;
+    struct posting_list *slots = calloc(cap, sizeof(*slots));
+    if (!slots)
+        return -1;
+
+    for (uint32_t i = 0; i < idx->cap; i++) {
+        struct posting_list *pl = &idx->slots[i];
+        if (pl->term_len == 0)
+            continue;
+        uint32_t j = term_hash(pl->term, pl->term_len) & (cap - 1);
+        while (slots[j].term_len)
+            j = (j + 1) & (cap - 1);
+        slots[j] = *pl;
+    }
+
+    free(idx->slots);
+    idx->slots = slots;
+    idx->cap = cap;
+    return 0;
+}
+
+static struct posting_list *lookup_or_insert(struct channel_index *idx, const char *term, size_t len) {
+    struct posting_list *pl = lookup(idx, term, len);
+    if (pl)
+        return pl;
+
+    // keep the table at most 70% full
+    if ((idx->used + 1) * 10 > idx->cap * 7 && grow(idx) < 0)
+        return NULL;
+
+    uint32_t mask = idx->cap - 1;
+    uint32_t i = term_hash(term, len) & mask;
+    while (idx->slots[i].term_len)
+        i = (i + 1) & mask;
+
+    pl = &idx->slots[i];
+    memcpy(pl->term, term, len);
+    pl->term_len = (uint8_t)len;
+    idx->used++;
+    return pl;
+}
+
+struct add_ctx {
+    struct channel_index *idx;
+    uint64_t msg_id;
+};
+
+static void posting_add(const char *term, size_t len, void *arg) {
+    struct add_ctx *ctx = arg;
+    struct posting_list *pl = lookup_or_insert(ctx->idx, term, len);
+    // the same term twice in one message is one posting
+    if (!pl || ctx->msg_id <= pl->last_id)
+        return;
+
+    if (pl->count % SEARCH_BLOCK == 0) {
+        uint32_t b = pl->count / SEARCH_BLOCK;
+        if (b == pl->skip_cap) {
+            uint32_t cap = pl->skip_cap ? pl->skip_cap * 2 : 4;
+            struct skip *skips = realloc(pl->skips, cap * sizeof(*skips));
+            if (!skips)
+                return;
+            pl->skips = skips;
+            pl->skip_cap = cap;
+        }
+        pl->skips[b].base_id = pl->last_id;
+        pl->skips[b].offset = pl->len;
+    }
+
+    if (pl->len + 10 > pl->cap) {
+        uint32_t cap = pl->cap ? pl->cap * 2 : 16;
+        uint8_t *data = realloc(pl->data, cap);
+        if (!data)
+            return;
+        pl->data = data;
+        pl->cap = cap;
+    }
+
+    uint64_t delta = ctx->msg_id - pl->last_id;
+    while (delta >= 0x80) {
+        pl->data[pl->len++] = (uint8_t)(delta | 0x80);
+        delta >>= 7;
+    }
+    pl->data[pl->len++] = (uint8_t)delta;
+    pl->last_id = ctx->msg_id;
+    pl->count++;
+}
+
+static void index_message(struct channel_index *idx, uint64_t msg_id, const char *content) {
+    pthread_rwlock_wrlock(&idx->lock);
+    // history replay and the live queue overlap at start-up; ids are monotonic per channel
+    if (msg_id > idx->indexed_upto) {
+        struct add_ctx ctx = { idx, msg_id };
+        tokenize(content, posting_add, &ctx);
+        idx->indexed_upto = msg_id;
+    }
+    pthread_rwlock_unlock(&idx->lock);
+}
+
+static int replay_message(const struct msg *m, void *arg) {
+    index_message(arg, m->msg_id, m->content);
+    return 0;
+}
+
+static void *indexer_thread(void *arg) {
+    (void)arg;
+
+    uint64_t channels[MAX_CHANNELS];
+    int n = history_channels(channels, MAX_CHANNELS);
+    for (int i = 0; i < n; i++) {
+        struct channel_index *idx = find_index(channels[i], 1);
+        if (idx)
+            history_scan(channels[i], replay_message, idx);
+    }
+    printf("• Search index loaded for %d channel(s).\n", n);
+
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (!queue_head)
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        struct index_job *job = queue_head;
+        queue_head = queue_tail = NULL;
+        pthread_mutex_unlock(&queue_lock);
+
+        while (job) {
+            struct index_job *next = job->next;
+            struct channel_index *idx = find_index(job->channel_id, 1);
+            if (idx)
+                index_message(idx, job->msg_id, job->content);
+            pool_put(&job_pool, job);
+            job = next;
+        }
+    }
+    return NULL;
+}
+
+int search_init(void) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, indexer_thread, NULL) != 0)
+        return -1;
+    pthread_detach(t);
+
+    pthread_mutex_lock(&queue_lock);
+    running = 1;
+    pthread_mutex_unlock(&queue_lock);
+    return 0;
+}
+
+void search_submit(uint64_t channel_id, const struct msg *m) {
+    size_t len = strnlen(m->content, sizeof(m->content));
+    struct index_job *job = pool_get(&job_pool);
+    if (!job)
+        return;
+
+    job->next = NULL;
+    job->channel_id = channel_id;
+    job->msg_id = m->msg_id;
+    memcpy(job->content, m->content, len);
+    job->content[len] = '\0';
+
+    pthread_mutex_lock(&queue_lock);
+    if (!running) {
+        pthread_mutex_unlock(&queue_lock);
+        pool_put(&job_pool, job);
+        return;
+    }
+    if (queue_tail)
+        queue_tail->next = job;
+    else
+        queue_head = job;
+    queue_tail = job;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+struct terms_ctx {
+    char (*terms)[SEARCH_TERM_MAX + 1];
+    int max;
+    int n;
+};
+
+static void collect_term(const char *term, size_t len, void *arg) {
+    struct terms_ctx *ctx = arg;
+    if (ctx->n >= ctx->max)
+        return;
+    for (int i = 0; i < ctx->n; i++) {
+        if (strlen(ctx->terms[i]) == len && memcmp(ctx->terms[i], term, len) == 0)
+            return;
+    }
+    memcpy(ctx->terms[ctx->n], term, len);
+    ctx->terms[ctx->n][len] = '\0';
+    ctx->n++;
+}
+
+int search_terms(const char *text, char terms[][SEARCH_TERM_MAX + 1], int max) {
+    struct terms_ctx ctx = { terms, max, 0 };
+    tokenize(text, collect_term, &ctx);
+    return ctx.n;
+}
+
+static uint64_t read_varint(const uint8_t *data, uint32_t *off) {
+    uint64_t v = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = data[(*off)++];
+        v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+static uint32_t block_count(const struct posting_list *pl) {
+    return (pl->count + SEARCH_BLOCK - 1) / SEARCH_BLOCK;
+}
+
+static int decode_block(const struct posting_list *pl, uint32_t b, uint64_t out[SEARCH_BLOCK]) {
+    uint32_t off = pl->skips[b].offset;
+    uint32_t end = b + 1 < block_count(pl) ? pl->skips[b + 1].offset : pl->len;
+    uint64_t id = pl->skips[b].base_id;
+    int n = 0;
+    while (off < end) {
+        id += read_varint(pl->data, &off);
+        out[n++] = id;
+    }
+    return n;
+}
+
+// one decoded block of a list that is being probed with descending ids
+struct cursor {
+    const struct posting_list *pl;
+    int64_t block;
+    int n;
+    uint64_t ids[SEARCH_BLOCK];
+};
+
+static int cursor_contains(struct cursor *c, uint64_t id) {
+    if (c->block < 0 || c->n == 0 || id < c->ids[0] || id > c->ids[c->n - 1]) {
+        // last block whose base lies below id; only that one can hold it
+        uint32_t lo = 0, hi = block_count(c->pl);
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (c->pl->skips[mid].base_id < id)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == 0)
+            return 0;
+        if ((int64_t)lo - 1 != c->block) {
+            c->block = lo - 1;
+            c->n = decode_block(c->pl, lo - 1, c->ids);
+        }
+    }
+
+    int lo = 0, hi = c->n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (c->ids[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < c->n && c->ids[lo] == id;
+}
+
+/*
+ * Walks the rarest term's list newest first and probes the others for each
+ * id, stopping once `limit` matches are found, so the cost follows the page
+ * size rather than the lengths of the lists.
+ */
+int search_query(uint64_t channel_id, const char *query, uint64_t *ids, int limit, int *total) {
+    char terms[SEARCH_MAX_TERMS][SEARCH_TERM_MAX + 1];
+    int nt = search_terms(query, terms, SEARCH_MAX_TERMS);
+    *total = 0;
+    if (nt == 0)
+        return -1;
+
+    struct channel_index *idx = find_index(channel_id, 0);
+    if (!idx)
+        return 0;
+
+    struct cursor *cursors = calloc((size_t)nt, sizeof(*cursors));
+    if (!cursors)
+        return 0;
+
+    pthread_rwlock_rdlock(&idx->lock);
+
+    for (int i = 0; i < nt; i++) {
+        const struct posting_list *pl = lookup(idx, terms[i], strlen(terms[i]));
+        if (!pl) {
+            pthread_rwlock_unlock(&idx->lock);
+            free(cursors);
+            return 0;
+        }
+
+        // rarest term first: its list drives the walk, the others are probed
+        int j = i;
+        while (j > 0 && cursors[j - 1].pl->count > pl->count) {
+            cursors[j] = cursors[j - 1];
+            j--;
+        }
+        cursors[j].pl = pl;
+        cursors[j].block = -1;
+        cursors[j].n = 0;
+    }
+
+    const struct posting_list *driver = cursors[0].pl;
+    int found = 0;
+    int more = 0;
+    for (int64_t b = (int64_t)block_count(driver) - 1; b >= 0 && !more; b--) {
+        uint64_t block[SEARCH_BLOCK];
+        int n = decode_block(driver, (uint32_t)b, block);
+        for (int k = n - 1; k >= 0; k--) {
+            int match = 1;
+            for (int t = 1; t < nt && match; t++)
+                match = cursor_contains(&cursors[t], block[k]);
+            if (!match)
+                continue;
+            if (found == limit) {
+                // at least one more than we can return
+                more = 1;
+                break;
+            }
+            ids[found++] = block[k];
+        }
+    }
+
+    // exact when the driver was walked to the end, otherwise "more than shown"
+    if (nt == 1)
+        *total = (int)driver->count;
+    else
+        *total = more ? -1 : found;
+
+    pthread_rwlock_unlock(&idx->lock);
+    free(cursors);
+    return found;
+}
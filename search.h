@@ -0,0 +1,34 @@
+#ifndef RMS_SEARCH_H
+#define RMS_SEARCH_H
+#include <stdint.h>
+#include "channel.h"
+
+#define SEARCH_TERM_MIN 2
+#define SEARCH_TERM_MAX 32
+#define SEARCH_MAX_TERMS 8
+#define SEARCH_MAX_RESULTS 50
+
+/*
+ * Per-channel inverted index over message text. Every term maps to a
+ * posting list of message ids, stored as varint deltas in ascending order.
+ *
+ * Indexing happens on a background thread: search_submit only queues a
+ * copy of the message. At start-up the indexer first replays the history
+ * segments, so the index covers everything on disk, not just this run.
+ */
+int search_init(void);
+void search_submit(uint64_t channel_id, const struct msg *m);
+
+/*
+ * Finds messages containing every term in `query`. Writes up to `limit`
+ * ids, newest first, to ids and returns how many were written. *total gets
+ * the number of matches overall, or -1 when the search stopped early and
+ * only knows there are more than `limit`. Returns -1 if the query has no
+ * usable terms.
+ */
+int search_query(uint64_t channel_id, const char *query, uint64_t *ids, int limit, int *total);
+
+// splits text into lowercase terms, the same way the indexer does
+int search_terms(const char *text, char terms[][SEARCH_TERM_MAX + 1], int max);
+
+#endif //RMS_SEARCH_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -5,22 +6,106 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <time.h>
 #include <inttypes.h>
 #include <sys/sendfile.h>
 #include <sys/stat.h> 
+#include <signal.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "utility.h"
 #include "rsa.h"
 #include "client_info.h"
 #include "encrypted_packet.h"
 #include "channel.h"
+#include "session.h"
+#include "sched.h"
+#include "io_backend.h"
+#include "history.h"
+#include "chacha20.h"
+#include "group_key.h"
+#include "frame.h"
+#include "wire.h"
+#include "bitpack.h"
+#include "lz.h"
+#include "search.h"
+#include "federation.h"
+#include "replica.h"
+#include "ratelimit.h"
+#include "arena.h"
+#include "lockprof.h"
+#include "trace.h"
+#include "timer_wheel.h"
+#include "shm_ring.h"
+#ifdef RMS_ALLOC_HOOK
+#include "alloc_hook.h"
+#endif
 
 #define CLIENTS_LIMIT 10
+#define LIST_PAGE_SIZE 20 // lines per /channels or /members page
+#define RESIDENT_CHANNELS_DEFAULT 32 // channels with their message ring in memory
+#define CHANNEL_IDLE_DEFAULT 600     // seconds before an idle ring is evicted
 #define CRED_FILE "client_credentials"
 
-// Server File Descriptor
-int server_fd;
+// Listening sockets, one per acceptor thread (overridable via RMS_ACCEPTORS / RMS_BACKLOG)
+#define ACCEPTORS_DEFAULT 4
+#define ACCEPTORS_MAX 64
+#define LISTEN_BACKLOG_DEFAULT 1024
+#define RATE_DELAY_DEFAULT_MS 200 // longest a packet over its user's budget is held before it is dropped
+#define LOCKPROF_REPORT_TOP 20     // critical sections listed per lock profile report
+
+// Timeouts in seconds, 0 = off (RMS_HEARTBEAT, RMS_IDLE_TIMEOUT, RMS_LOGIN_TIMEOUT, RMS_UPLOAD_TIMEOUT)
+#define HEARTBEAT_DEFAULT 30       // quiet this long: the server sends a heartbeat
+#define IDLE_TIMEOUT_DEFAULT 90    // nothing read for this long: the connection is dropped
+#define LOGIN_TIMEOUT_DEFAULT 10   // to finish the handshake and send credentials
+#define UPLOAD_TIMEOUT_DEFAULT 120 // an unfinished upload with no new chunk is discarded
+#define UPLOADS_MAX 64             // unfinished uploads tracked at once
+
+int listen_fds[ACCEPTORS_MAX];
+int num_acceptors = 0;
+int unix_listen_fd = -1; // RMS_UNIX_SOCKET, for clients on this host
+
+/*
+ * Per-slot connection state, parallel to users[]. Commands read from a
+ * connection run on its strand so they stay in order, and send_lock keeps
+ * packets from different handler threads from interleaving on the socket.
+ */
+struct connection {
+    struct strand strand;
+    pthread_mutex_t send_lock;
+    uint32_t features; // SESSION_FEATURE_* agreed in the hello
+    struct shm_link *shm; // set while a local client talks through shared memory; under send_lock
+    struct token_bucket buckets[RATE_CLASSES]; // kept across reconnects, so reconnecting refills nothing
+    time_t last_rate_notice;
+    uint32_t trace_conn; // capture id of the current login (RMS_CAPTURE)
+
+    struct timer idle;                  // heartbeat and reaping, see conn_timer
+    atomic_uint_fast64_t last_active;   // timer_wheel_ms() when the last packet was read
+    uint64_t probed_at;                 // timer_wheel_ms() of the last heartbeat; the wheel thread's alone
+};
+
+// a file arriving in chunks, so the parts of one that stops can be cleaned up
+struct upload {
+    int in_use;
+    uint64_t channel_id;
+    uint64_t user_id;
+    char file_name[256];
+    uint32_t last_index;                // highest chunk stored
+    atomic_uint_fast64_t last_chunk;    // timer_wheel_ms()
+    struct timer timer;
+};
+
+struct job {
+    struct client *u;
+    uint64_t arrived_us; // for the capture, which records arrival rather than handling time
+    struct encrypted_packet p;
+};
+
+// jobs cross from a connection's reader to a scheduler worker, so they recycle through a pool
+struct pool job_pool = POOL_INITIALIZER(sizeof(struct job), CLIENTS_LIMIT * 16);
 
 // RSA Keys
 long s_n, s_e, s_d;
@@ -29,54 +114,256 @@ long s_n, s_e, s_d;
 pthread_mutex_t u_lock = PTHREAD_MUTEX_INITIALIZER;
 struct channel_manager cm;
 struct client users[CLIENTS_LIMIT];
+struct connection conns[CLIENTS_LIMIT];
+pthread_mutex_t rekey_lock = PTHREAD_MUTEX_INITIALIZER;
+uint32_t server_features = SESSION_FEATURE_LZ | SESSION_FEATURE_SHM;
+struct rate rates[RATE_CLASSES] = {
+    [RATE_MESSAGE] = {10, 20},
+    [RATE_FILE] = {512, 1024}, // chunks: 2 MB/s
+    [RATE_COMMAND] = {5, 20},
+};
+struct rate channel_rate = {50, 100};
+int rate_delay_ms = RATE_DELAY_DEFAULT_MS;
+
+unsigned heartbeat_ms, idle_ms, login_ms, upload_ms;
+struct upload uploads[UPLOADS_MAX];
+pthread_mutex_t upload_lock = PTHREAD_MUTEX_INITIALIZER;
+struct strand upload_strand; // expired uploads are removed here, off the wheel thread
+
+// SIGUSR1 toggles lock profiling at this rate (RMS_LOCKPROF), SIGUSR2 reports
+unsigned lockprof_rate = LOCKPROF_DEFAULT_EVERY;
+sigset_t control_signals;
 int num_users = 0;
 FILE *cred_file = NULL;
 
 int insert_user(struct client *new_user) {
-    pthread_mutex_lock(&u_lock);
+    lockprof_lock(&u_lock);
+    // acceptors run in parallel, so re-check the name under the lock
+    for (int i = 0; i < CLIENTS_LIMIT; i++) {
+        if (users[i].username[0] != '\0' && strcmp(users[i].username, new_user->username) == 0) {
+            lockprof_unlock(&u_lock);
+            return -2;
+        }
+    }
+
     for (int i = 0; i < CLIENTS_LIMIT; i++) {
         if (users[i].socket_fd == -1 && users[i].username[0] == '\0') {
             users[i] = *new_user;
             users[i].socket_fd = new_user->socket_fd;
             num_users++;
-            pthread_mutex_unlock(&u_lock);
+            lockprof_unlock(&u_lock);
             return 0;
         }
     }
-    pthread_mutex_unlock(&u_lock);
+    lockprof_unlock(&u_lock);
     return -1;
 }
 
 int find_user_index_by_username(const char *username) {
     if (!username) return -1;
-    pthread_mutex_lock(&u_lock);
+    lockprof_lock(&u_lock);
     for (int i = 0; i < CLIENTS_LIMIT; i++) {
         if (users[i].username[0] != '\0' && strcmp(users[i].username, username) == 0) {
-            pthread_mutex_unlock(&u_lock);
+            lockprof_unlock(&u_lock);
             return i;
         }
     }
-    pthread_mutex_unlock(&u_lock);
+    lockprof_unlock(&u_lock);
     return -1;
 }
 
 int find_user_index_by_user_id(uint64_t user_id) {
-    pthread_mutex_lock(&u_lock);
+    lockprof_lock(&u_lock);
     for (int i = 0; i < CLIENTS_LIMIT; i++) {
         if (users[i].username[0] != '\0' && users[i].user_id == user_id) {
-            pthread_mutex_unlock(&u_lock);
+            lockprof_unlock(&u_lock);
             return i;
         }
     }
-    pthread_mutex_unlock(&u_lock);
+    lockprof_unlock(&u_lock);
     return -1;
 }
 
-void broadcast_to_channel(const char *msg, uint64_t sender_id, uint64_t channel_id, int exclude_fd) {
-    if (!msg) 
+struct connection *client_conn(struct client *u) {
+    return &conns[u - users];
+}
+
+int client_send(struct client *u, const void *buf, size_t len) {
+    struct connection *c = client_conn(u);
+    const uint8_t *p = buf;
+
+    pthread_mutex_lock(&c->send_lock);
+    if (c->shm) {
+        int rc = shm_send(c->shm, buf, len);
+        pthread_mutex_unlock(&c->send_lock);
+        return rc;
+    }
+    while (len > 0) {
+        ssize_t w = send(u->socket_fd, p, len, MSG_NOSIGNAL);
+        if (w <= 0) {
+            pthread_mutex_unlock(&c->send_lock);
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    pthread_mutex_unlock(&c->send_lock);
+    return 0;
+}
+
+// encrypts payload for u into p (whose header the caller has filled in) and sends it
+void send_encrypted_packet(struct client *u, struct encrypted_packet *p, const char *payload) {
+    if (packet_encrypt(p, payload, u->public_key_e, u->public_key_n) < 0) {
+        printf("[ERROR] No usable public key for user %" PRIu64 ", reply not sent\n", u->user_id);
         return;
+    }
+    client_send(u, p, packet_wire_size(p));
+}
 
-    struct encrypted_packet p = {0};
+// the packet comes from the arena with only its header cleared; the payload is written over
+void send_encrypted(struct client *u, const char *payload) {
+    size_t mark = arena_mark();
+    struct encrypted_packet *p = arena_alloc(sizeof(*p));
+    if (p) {
+        memset(p, 0, PACKET_HEADER_SIZE);
+        send_encrypted_packet(u, p, payload);
+    }
+    arena_release(mark);
+}
+
+/*
+ * Queues the same frame to every recipient as a single I/O batch; each send
+ * holds its own reference. Recipients on shared memory get their copy
+ * straight into their ring instead. Send locks are taken in slot order so
+ * concurrent broadcasts can't deadlock each other.
+ */
+void client_send_frame(struct client **rcpts, int n, struct frame *f) {
+    int order[MAX_PARTICIPANTS];
+    for (int i = 0; i < n; i++) {
+        int j = i;
+        while (j > 0 && rcpts[order[j - 1]] > rcpts[i]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    for (int i = 0; i < n; i++)
+        pthread_mutex_lock(&client_conn(rcpts[order[i]])->send_lock);
+
+    struct io_batch batch;
+    io_batch_init(&batch);
+    int queued = 0;
+    for (int i = 0; i < n; i++) {
+        struct shm_link *shm = client_conn(rcpts[i])->shm;
+        if (shm)
+            shm_send(shm, f->data, f->len);
+        else if (rcpts[i]->socket_fd != -1 &&
+            io_batch_send(&batch, rcpts[i]->socket_fd, frame_ref(f)->data, f->len) == 0)
+            queued++;
+        else if (rcpts[i]->socket_fd != -1)
+            frame_unref(f);
+    }
+    io_batch_submit(&batch);
+
+    for (int i = n - 1; i >= 0; i--)
+        pthread_mutex_unlock(&client_conn(rcpts[order[i]])->send_lock);
+
+    for (int i = 0; i < queued; i++)
+        frame_unref(f);
+}
+
+void send_group_key(struct client *u, const struct group_key *key) {
+    char hex[2 * CHACHA20_KEY_SIZE + 1];
+    group_key_hex(key, hex);
+
+    size_t mark = arena_mark();
+    struct encrypted_packet *p = arena_alloc(sizeof(*p));
+    if (p) {
+        memset(p, 0, PACKET_HEADER_SIZE);
+        p->command_type = CMD_GROUP_KEY;
+        p->channel_id = key->channel_id;
+        p->key_epoch = key->epoch;
+        p->timestamp = (uint32_t)time(NULL);
+        send_encrypted_packet(u, p, hex);
+    }
+    arena_release(mark);
+    memset(hex, 0, sizeof(hex));
+}
+
+/*
+ * Rotates a channel's group key: the new key goes to every connected
+ * member (RSA-wrapped, once per member) before it becomes the key that
+ * broadcasts use. Members who are offline get it when they log back in.
+ */
+void rotate_group_key(uint64_t channel_id) {
+    pthread_mutex_lock(&rekey_lock);
+
+    struct group_key key;
+    if (group_key_prepare(channel_id, &key) < 0) {
+        pthread_mutex_unlock(&rekey_lock);
+        return;
+    }
+
+    struct channel *ch = channel_find(&cm, channel_id);
+    for (int i = 0; ch && i < ch->participant_count; i++) {
+        int idx = find_user_index_by_user_id(ch->participant_ids[i]);
+        if (idx != -1 && users[idx].socket_fd != -1)
+            send_group_key(&users[idx], &key);
+    }
+
+    group_key_activate(channel_id, key.epoch);
+    pthread_mutex_unlock(&rekey_lock);
+    memset(&key, 0, sizeof(key));
+}
+
+// at login: hand over the current key of every channel the user belongs to
+void send_group_keys(struct client *u) {
+    for (int i = 0; i < cm.channel_count; i++) {
+        uint64_t channel_id = cm.channels[i].channel_id;
+        struct group_key key;
+        if (channel_is_member(&cm, channel_id, u->user_id) && group_key_current(channel_id, &key) == 0)
+            send_group_key(u, &key);
+    }
+}
+
+// header from hdr, payload sealed under key with the key's next unused nonce
+struct frame *seal_frame(const struct encrypted_packet *hdr, const struct group_key *key,
+                         const uint8_t *data, size_t len, uint8_t codec) {
+    uint64_t counter;
+    if (group_key_next_nonce(key->channel_id, key->epoch, &counter) < 0)
+        return NULL;
+
+    struct frame *f = frame_alloc(sizeof(struct encrypted_packet));
+    if (!f)
+        return NULL;
+
+    struct encrypted_packet *out = (struct encrypted_packet *)f->data;
+    memcpy(out, hdr, PACKET_HEADER_SIZE);
+    memcpy(out->sealed_payload, data, len);
+    out->len = (uint32_t)len;
+    out->codec = codec;
+    out->key_epoch = key->epoch;
+    out->nonce = counter;
+
+    uint8_t nonce[CHACHA20_NONCE_SIZE];
+    group_key_nonce(out->nonce, key->epoch, nonce);
+    chacha20_xor(key->key, nonce, 0, out->sealed_payload, len);
+
+    f->len = packet_wire_size(out);
+    return f;
+}
+
+/*
+ * Encrypts msg once under the channel's group key and fans the frame out to
+ * every connected member. Members that negotiated compression share a
+ * second, LZ-packed frame when packing actually saves bytes. p comes from
+ * the caller's arena with only its header zeroed; it is filled in here and
+ * copied as the header of each sealed frame, so its payload is never read.
+ * username is the sender's name, or NULL to look it up among the local users.
+ */
+static void broadcast_packet(struct encrypted_packet *p, const char *username, const char *msg, uint64_t sender_id,
+                             uint64_t channel_id, uint64_t msg_id, int exclude_fd) {
     struct channel *ch = channel_find(&cm, channel_id);
     if (!ch){
         printf("[ERROR] Channel %" PRIu64 " not found for broadcast\n", channel_id);
@@ -84,26 +371,29 @@ void broadcast_to_channel(const char *msg, uint64_t sender_id, uint64_t channel_
     } 
     
     // retrieve user id
-    int sender_idx = find_user_index_by_user_id(sender_id);
-    if (sender_idx != -1) {
-        pthread_mutex_lock(&u_lock);
-        strncpy(p.username, users[sender_idx].username, USERNAME_SIZE - 1);
-        pthread_mutex_unlock(&u_lock);
+    int sender_idx = username ? -1 : find_user_index_by_user_id(sender_id);
+    if (username) {
+        strncpy(p->username, username, USERNAME_SIZE - 1);
+    } else if (sender_idx != -1) {
+        lockprof_lock(&u_lock);
+        strncpy(p->username, users[sender_idx].username, USERNAME_SIZE - 1);
+        lockprof_unlock(&u_lock);
     }
     
     // set the packet vars for the message
-    p.sender_id = sender_id;
-    p.channel_id = channel_id;
-    p.timestamp = (uint32_t)time(NULL);
+    p->sender_id = sender_id;
+    p->channel_id = channel_id;
+    p->msg_id = msg_id;
+    p->timestamp = (uint32_t)time(NULL);
 
     // file handling logic (if file is sent)
     if (strncmp(msg, "FILE_METADATA:", 14) == 0){    
-        p.is_file = 1;
+        p->is_file = 1;
         const char *src = msg + 14;
         size_t src_len = strlen(src);
-        char *metadata = malloc(src_len + 1);
+        char *metadata = arena_alloc(src_len + 1);
 
-        if (metadata != NULL) 
+        if (metadata == NULL) 
             return;
 
         memcpy(metadata, src, src_len + 1); 
@@ -111,16 +401,26 @@ void broadcast_to_channel(const char *msg, uint64_t sender_id, uint64_t channel_
         char *filesize_str = strtok(NULL, ":");
         char *channel_id_str = strtok(NULL, ":");
 
-        if (!filename && !filesize_str && !channel_id_str)
+        if (!filename || !filesize_str || !channel_id_str) {
             return;
+        }
         
-        strncpy(p.file_name, filename, sizeof(p.file_name) - 1);
-        p.file_name[sizeof(p.file_name) - 1] = '\0';
-        p.file_size = (unsigned long) atol(filesize_str);
-        p.channel_id = (uint64_t) atol(channel_id_str);
-        free(metadata);
-}
-    
+        strncpy(p->file_name, filename, sizeof(p->file_name) - 1);
+        p->file_name[sizeof(p->file_name) - 1] = '\0';
+        p->file_size = (unsigned long) atol(filesize_str);
+        p->channel_id = (uint64_t) atol(channel_id_str);
+    }
+
+    struct group_key key;
+    if (group_key_current(channel_id, &key) < 0) {
+        // channels loaded from disk have no key until someone talks
+        rotate_group_key(channel_id);
+        if (group_key_current(channel_id, &key) < 0)
+            return;
+    }
+
+    struct client *plain[MAX_PARTICIPANTS], *packed[MAX_PARTICIPANTS];
+    int n_plain = 0, n_packed = 0;
     for (int i = 0; i < ch->participant_count; i++){
         uint64_t participant_id = ch->participant_ids[i];
         if (exclude_fd != -1 && participant_id == sender_id) 
@@ -131,61 +431,242 @@ void broadcast_to_channel(const char *msg, uint64_t sender_id, uint64_t channel_
         if (user_id == -1 || users[user_id].socket_fd == -1) 
             continue;
         
-        struct client *recipient = &users[user_id];
-        size_t enc_len;
-        long *enc = encrypt(msg, recipient->public_key_e, recipient->public_key_n, &enc_len);
-        if (!enc) 
-            continue;
+        if (client_conn(&users[user_id])->features & SESSION_FEATURE_LZ)
+            packed[n_packed++] = &users[user_id];
+        else
+            plain[n_plain++] = &users[user_id];
+    }
 
-        if (enc_len > MAX_ENCRYPTED_PAYLOAD) 
-            enc_len = MAX_ENCRYPTED_PAYLOAD;
+    size_t len = strlen(msg);
+    if (len > sizeof(p->sealed_payload))
+        len = sizeof(p->sealed_payload);
+
+    // at most two encodings per broadcast, whatever the member count
+    uint8_t lz_buf[LZ_MAX_INPUT];
+    size_t lz_len = n_packed ? lz_compress((const uint8_t *)msg, len, lz_buf, sizeof(lz_buf)) : 0;
+    if (lz_len == 0) {
+        memcpy(plain + n_plain, packed, n_packed * sizeof(*packed));
+        n_plain += n_packed;
+        n_packed = 0;
+    }
 
-        p.len = enc_len;
-        for (size_t j = 0; j < enc_len; j++){
-            p.encrypted_payload[j] = enc[j];
+    if (n_plain) {
+        struct frame *f = seal_frame(p, &key, (const uint8_t *)msg, len, PACKET_CODEC_NONE);
+        if (f) {
+            client_send_frame(plain, n_plain, f);
+            frame_unref(f);
         }
+    }
+    if (n_packed) {
+        struct frame *f = seal_frame(p, &key, lz_buf, lz_len, PACKET_CODEC_LZ);
+        if (f) {
+            client_send_frame(packed, n_packed, f);
+            frame_unref(f);
+        }
+    }
+    memset(&key, 0, sizeof(key));
+}
 
-        send(recipient->socket_fd, &p, sizeof(p), 0);
-        free(enc);
+void broadcast_as(const char *username, const char *msg, uint64_t sender_id, uint64_t channel_id,
+                  uint64_t msg_id, int exclude_fd) {
+    if (!msg) 
+        return;
+
+    size_t mark = arena_mark();
+    struct encrypted_packet *p = arena_alloc(sizeof(*p));
+    if (p) {
+        memset(p, 0, PACKET_HEADER_SIZE);
+        broadcast_packet(p, username, msg, sender_id, channel_id, msg_id, exclude_fd);
+    }
+    arena_release(mark);
+}
+
+void broadcast_to_channel(const char *msg, uint64_t sender_id, uint64_t channel_id, uint64_t msg_id, int exclude_fd) {
+    broadcast_as(NULL, msg, sender_id, channel_id, msg_id, exclude_fd);
+}
+
+// hands a connection its shared-memory link, or takes it back with NULL
+void conn_set_shm(struct connection *c, struct shm_link *shm) {
+    pthread_mutex_lock(&c->send_lock);
+    c->shm = shm;
+    pthread_mutex_unlock(&c->send_lock);
+}
+
+void shm_release(struct shm_link *shm) {
+    if (shm) {
+        shm_link_close(shm);
+        free(shm);
+    }
+}
+
+/*
+ * Ticket resumption: admit a returning user in one round trip, without
+ * any key generation, asymmetric crypto or credential lookup, once the
+ * hello proves it holds the ticket's secret. The slot is claimed and the
+ * reply sent under u_lock so no broadcast can reach the socket ahead of
+ * the reply. A shared-memory link moves to the slot along with the socket.
+ */
+int session_resume(int fd, const struct session_hello *hello, struct session_reply *reply, struct shm_link **shm) {
+    const struct session_ticket *ticket = &hello->ticket;
+    if (session_resume_check(hello) != 0)
+        return -1;
+
+    int idx = find_user_index_by_user_id(ticket->user_id);
+    if (idx == -1)
+        return -1;
+
+    lockprof_lock(&u_lock);
+    if (users[idx].socket_fd != -1) {
+        lockprof_unlock(&u_lock);
+        return -1;
     }
+
+    // the refreshed ticket's secret goes back sealed under the one just proven
+    uint8_t old_secret[SESSION_SECRET_SIZE], new_secret[SESSION_SECRET_SIZE];
+    reply->status = SESSION_STATUS_RESUMED;
+    reply->user_id = ticket->user_id;
+    session_ticket_issue(&reply->ticket, ticket->user_id, ticket->public_key_n, ticket->public_key_e);
+    session_ticket_secret(ticket, old_secret);
+    session_ticket_secret(&reply->ticket, new_secret);
+    session_secret_seal(old_secret, hello->client_nonce, new_secret, reply->secret_box);
+    memset(old_secret, 0, sizeof(old_secret));
+    memset(new_secret, 0, sizeof(new_secret));
+    send(fd, reply, sizeof(*reply), 0);
+
+    users[idx].socket_fd = fd;
+    users[idx].public_key_n = ticket->public_key_n;
+    users[idx].public_key_e = ticket->public_key_e;
+    conns[idx].features = reply->features;
+    conn_set_shm(&conns[idx], *shm);
+    *shm = NULL;
+    lockprof_unlock(&u_lock);
+    return idx;
 }
 
-void rsa_handshake(int fd, struct client *u) {
-    send(fd, &s_n, sizeof(long), 0);
-    send(fd, &s_e, sizeof(long), 0);
+/*
+ * Returns the index of the resumed user, -1 when the client still needs
+ * to send credentials, or -2 on a malformed hello. The negotiated features
+ * are stored in *features, and the client's shared-memory link in *shm if
+ * it offered one and it was accepted.
+ */
+int rsa_handshake(int fd, struct client *u, uint32_t *features, struct shm_link **shm) {
+    struct session_hello hello = {0};
+    if (recv(fd, &hello, sizeof(hello), MSG_WAITALL) != (ssize_t)sizeof(hello) || hello.magic != SESSION_MAGIC)
+        return -2;
+
+    struct session_reply reply = {0};
+    reply.status = SESSION_STATUS_FULL;
+    reply.server_n = s_n;
+    reply.server_e = s_e;
+    reply.features = hello.features & server_features;
+
+    // the offer follows the hello either way; only fd passing over a Unix socket can carry it
+    if (hello.features & SESSION_FEATURE_SHM) {
+        struct shm_link *link = malloc(sizeof(*link));
+        if (!link || shm_link_accept(link, fd) < 0) {
+            free(link);
+            return -2;
+        }
+        if (reply.features & SESSION_FEATURE_SHM)
+            *shm = link;
+        else
+            shm_release(link);
+    }
+    *features = reply.features;
+
+    if (hello.mode == SESSION_MODE_RESUME) {
+        int idx = session_resume(fd, &hello, &reply, shm);
+        if (idx != -1) {
+            printf("• Session resumed for user %" PRIu64 " on [%d]\n", hello.ticket.user_id, fd);
+            return idx;
+        }
+    }
+
+    send(fd, &reply, sizeof(reply), 0);
 
-    recv(fd, &u->public_key_n, sizeof(long), 0);
-    recv(fd, &u->public_key_e, sizeof(long), 0);
+    // nothing could be encrypted for a modulus the packing can't size
+    if (recv(fd, &u->public_key_n, sizeof(long), MSG_WAITALL) != (ssize_t)sizeof(long) ||
+        recv(fd, &u->public_key_e, sizeof(long), MSG_WAITALL) != (ssize_t)sizeof(long) ||
+        bitpack_width(u->public_key_n) == 0)
+        return -2;
 
     printf("• RSA Handshake with User [%d] | Public Key (n, e): (%ld, %ld)\n",
            fd, u->public_key_n, u->public_key_e);
+    return -1;
+}
+
+/*
+ * Packs multi-line replies (sync, history, listings) into as few frames as
+ * the payload allows. Each frame's msg_id is the id of the last line it
+ * carries, so a client can advance its cursor frame by frame.
+ */
+struct reply_stream {
+    struct client *u;
+    uint32_t command_type;
+    uint64_t channel_id;
+    uint64_t last_id;
+    char text[MAX_ENCRYPTED_PAYLOAD + 1];
+    size_t used;
+};
+
+void stream_begin(struct reply_stream *s, struct client *u, uint32_t command_type, uint64_t channel_id) {
+    s->u = u;
+    s->command_type = command_type;
+    s->channel_id = channel_id;
+    s->last_id = 0;
+    s->text[0] = '\0';
+    s->used = 0;
 }
 
-void send_encrypted(int fd, char *payload, long e, long n) {
-    size_t enc_len;
-    long *cipher = encrypt(payload, e, n, &enc_len);
-    if (!cipher)
+void stream_flush(struct reply_stream *s) {
+    if (s->used == 0)
         return;
 
-    if (enc_len > MAX_ENCRYPTED_PAYLOAD)
-        enc_len = MAX_ENCRYPTED_PAYLOAD;
+    size_t mark = arena_mark();
+    struct encrypted_packet *p = arena_alloc(sizeof(*p));
+    if (p) {
+        memset(p, 0, PACKET_HEADER_SIZE);
+        p->command_type = s->command_type;
+        p->channel_id = s->channel_id;
+        p->msg_id = s->last_id;
+        p->timestamp = (uint32_t)time(NULL);
+        send_encrypted_packet(s->u, p, s->text);
+    }
+    arena_release(mark);
 
-    struct encrypted_packet p = {0};
-    for (size_t i = 0; i < enc_len; i++)
-        p.encrypted_payload[i] = cipher[i];
+    s->text[0] = '\0';
+    s->used = 0;
+}
 
-    p.len = enc_len;
-    send(fd, &p, sizeof(p), 0);
-    free(cipher);
+void stream_line(struct reply_stream *s, const char *line, uint64_t msg_id) {
+    size_t len = strlen(line);
+    if (len > MAX_ENCRYPTED_PAYLOAD - 1)
+        len = MAX_ENCRYPTED_PAYLOAD - 1;
+
+    if (s->used + len + 1 > MAX_ENCRYPTED_PAYLOAD)
+        stream_flush(s);
+
+    if (s->used > 0)
+        s->text[s->used++] = '\n';
+    memcpy(s->text + s->used, line, len);
+    s->used += len;
+    s->text[s->used] = '\0';
+
+    if (msg_id > s->last_id)
+        s->last_id = msg_id;
 }
 
 char *recv_decrypted(int fd, long d, long n) {
     struct encrypted_packet p = {0};
-    ssize_t r = recv(fd, &p, sizeof(p), 0);
-    if (r <= 0 || p.len == 0 || p.len > MAX_ENCRYPTED_PAYLOAD)
+    ssize_t r = packet_recv(fd, &p);
+    if (r <= 0 || packet_is_sealed(&p) || p.len == 0 || p.len > MAX_ENCRYPTED_PAYLOAD)
         return NULL;
 
-    char *plaintext = decrypt(p.encrypted_payload, p.len, d, n);
+    char *plaintext = malloc(p.len + 1);
+    if (plaintext && packet_decrypt(&p, d, n, plaintext, p.len + 1) < 0) {
+        free(plaintext);
+        return NULL;
+    }
     return plaintext;
 }
 
@@ -216,6 +697,171 @@ void combine_file_chunks(const char *dir, const char *filename, uint32_t total_c
     fclose(output);
 }
 
+int rate_class(uint32_t command_type) {
+    switch (command_type) {
+        case CMD_MESSAGE: return RATE_MESSAGE;
+        case CMD_BATCH: return RATE_COMMAND;   // its posts are charged one by one in handle_batch
+        case CMD_FILE_TRANSFER: return RATE_FILE;
+        default: return RATE_COMMAND;
+    }
+}
+
+// an over-limit sender hears about it at most once a second; everything else is dropped silently
+void rate_notice(struct client *u, const char *what) {
+    struct connection *c = client_conn(u);
+    time_t now = time(NULL);
+    if (c->last_rate_notice == now)
+        return;
+    c->last_rate_notice = now;
+
+    char notice[128];
+    snprintf(notice, sizeof(notice), "Slow down: %s over the rate limit were dropped.", what);
+    send_encrypted(u, notice);
+}
+
+/*
+ * Whoever asked for a channel operation: a user connected here or, on the
+ * channel's owner, a user on another node. Answers go back the way the
+ * request came in.
+ */
+struct requester {
+    uint64_t user_id;
+    char username[USERNAME_SIZE];
+    int node;
+};
+
+// names of users on other nodes, learned from their requests, so history shows who wrote what
+#define REMOTE_USERS_LIMIT 256
+struct remote_user {
+    uint64_t user_id;
+    char username[USERNAME_SIZE];
+};
+
+struct remote_user remote_users[REMOTE_USERS_LIMIT];
+int num_remote_users = 0;
+pthread_mutex_t remote_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void remember_remote_user(uint64_t user_id, const char *username) {
+    if (user_id == 0 || username[0] == '\0')
+        return;
+
+    pthread_mutex_lock(&remote_lock);
+    int i = 0;
+    while (i < num_remote_users && remote_users[i].user_id != user_id)
+        i++;
+    if (i == num_remote_users) {
+        // full: the id picks which entry to overwrite
+        if (num_remote_users == REMOTE_USERS_LIMIT)
+            i = (int)(user_id % REMOTE_USERS_LIMIT);
+        else
+            num_remote_users++;
+        remote_users[i].user_id = user_id;
+    }
+    snprintf(remote_users[i].username, USERNAME_SIZE, "%s", username);
+    pthread_mutex_unlock(&remote_lock);
+}
+
+// leaves name alone if the user has not been seen
+void remote_username(uint64_t user_id, char name[USERNAME_SIZE]) {
+    pthread_mutex_lock(&remote_lock);
+    for (int i = 0; i < num_remote_users; i++) {
+        if (remote_users[i].user_id == user_id) {
+            memcpy(name, remote_users[i].username, USERNAME_SIZE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&remote_lock);
+}
+
+void requester_local(struct requester *r, struct client *u) {
+    memset(r, 0, sizeof(*r));
+    r->user_id = u->user_id;
+    snprintf(r->username, sizeof(r->username), "%s", u->username);
+    r->node = fed_self();
+}
+
+void reply_to(const struct requester *r, const char *text) {
+    if (r->node != fed_self()) {
+        struct fed_msg m = { .type = FED_REPLY, .user_id = r->user_id };
+        fed_send(r->node, &m, text);
+        return;
+    }
+
+    int idx = find_user_index_by_user_id(r->user_id);
+    if (idx != -1 && users[idx].socket_fd != -1)
+        send_encrypted(&users[idx], text);
+}
+
+// the node keeping a channel: this one for channels stored here, else the stub's owner or the id's hash
+int channel_home(uint64_t channel_id) {
+    struct channel *ch = channel_find(&cm, channel_id);
+    if (ch)
+        return ch->remote ? ch->home : fed_self();
+    return fed_owner_of_id(channel_id);
+}
+
+// name and members of a channel kept here, to one node or (node -1) all of them
+void fed_publish_channel(uint64_t channel_id, int node) {
+    if (!fed_enabled())
+        return;
+
+    struct fed_msg m = { .type = FED_CHANNEL, .channel_id = channel_id };
+    lockprof_lock(&cm.lock);
+    struct channel *ch = channel_find(&cm, channel_id);
+    int found = ch && !ch->remote;
+    if (found) {
+        snprintf(m.channel_name, sizeof(m.channel_name), "%s", ch->channel_name);
+        m.member_count = (uint32_t)ch->participant_count;
+        memcpy(m.members, ch->participant_ids, (size_t)ch->participant_count * sizeof(m.members[0]));
+    }
+    lockprof_unlock(&cm.lock);
+
+    if (!found)
+        return;
+    if (node < 0)
+        fed_broadcast(&m, NULL);
+    else
+        fed_send(node, &m, NULL);
+}
+
+// a message stored here goes once to every other node, which fans it out to its own members
+void fed_deliver(const struct requester *r, const char *msg, uint64_t channel_id, uint64_t msg_id) {
+    if (!fed_enabled())
+        return;
+
+    struct fed_msg m = { .type = FED_DELIVER, .channel_id = channel_id, .user_id = r->user_id, .msg_id = msg_id };
+    snprintf(m.username, sizeof(m.username), "%s", r->username);
+    fed_broadcast(&m, msg);
+}
+
+// hands a request for a channel kept elsewhere to its owner
+void fed_forward(struct client *u, int node, uint32_t type, uint64_t channel_id, const char *name, const char *text) {
+    struct fed_msg m = { .type = type, .channel_id = channel_id, .user_id = u->user_id };
+    snprintf(m.username, sizeof(m.username), "%s", u->username);
+    if (name)
+        snprintf(m.channel_name, sizeof(m.channel_name), "%s", name);
+
+    if (fed_send(node, &m, text) < 0) {
+        char error[128];
+        snprintf(error, sizeof(error), "Node %d, which hosts this channel, is unreachable. Try again later.", node);
+        send_encrypted(u, error);
+    }
+}
+
+// only the owner runs this; the sender is left out of the fan-out on every node
+void channel_post(const struct requester *r, uint64_t channel_id, const char *text) {
+    if (!channel_is_member(&cm, channel_id, r->user_id)) {
+        reply_to(r, "You are not a member of this channel");
+        return;
+    }
+
+    uint64_t msg_id = 0;
+    channel_add_message(&cm, channel_id, r->user_id, text, MSG_TYPE_TEXT, &msg_id);
+    replica_commit();
+    broadcast_as(r->username, text, r->user_id, channel_id, msg_id, 0);
+    fed_deliver(r, text, channel_id, msg_id);
+}
+
 void handle_message(struct client *u, struct encrypted_packet *p, char *msg){
     uint64_t actual_channel_id = p->channel_id;
     char *message_content = msg;
@@ -243,34 +889,145 @@ void handle_message(struct client *u, struct encrypted_packet *p, char *msg){
         } else{
             char error[128];
             snprintf(error, sizeof(error), "Channel '%s' not found", name);
-            send_encrypted(u->socket_fd, error, u->public_key_e, u->public_key_n);
+            send_encrypted(u, error);
             printf("[ERROR] Channel '%s' not found\n", name);
             return;
         }
     } else if (actual_channel_id == 0) {
         char *error = "Please specify channel with /msg <channel> <message>";
-        send_encrypted(u->socket_fd, error, u->public_key_e, u->public_key_n);
+        send_encrypted(u, error);
         printf("[ERROR] No channel specified in message\n");
         return;
     }
     
+    // the packet carries more than a stored message holds; cutting it short would keep a different post
+    size_t content_len = strlen(message_content);
+    if (content_len > MSG_CONTENT_MAX) {
+        char error[128];
+        snprintf(error, sizeof(error), "Message too long (%zu characters, at most %d), not sent",
+                 content_len, MSG_CONTENT_MAX);
+        send_encrypted(u, error);
+        return;
+    }
+
     printf("• User [%s | %" PRIu64 "] in channel %" PRIu64 ":\n%s\n",
            u->username, u->user_id, actual_channel_id, message_content);
-    
-    if (!channel_is_member(&cm, actual_channel_id, u->user_id)) {
-        char *error = "You are not a member of this channel";
-        send_encrypted(u->socket_fd, error, u->public_key_e, u->public_key_n);
+
+    // the channel's owner charges its bucket, so a forwarded post is not charged twice
+    int home = channel_home(actual_channel_id);
+    if (home != fed_self()) {
+        fed_forward(u, home, FED_POST, actual_channel_id, NULL, message_content);
+        return;
+    }
+
+    // one busy channel must not crowd out the rest
+    if (channel_bucket_take(actual_channel_id, &channel_rate, rate_now_ns()) != 0) {
+        rate_notice(u, "messages to this channel");
+        return;
+    }
+
+    struct requester r;
+    requester_local(&r, u);
+    channel_post(&r, actual_channel_id, message_content);
+}
+
+void remove_parts(uint64_t channel_id, const char *file_name, uint32_t last_index) {
+    uint32_t max = MAX_MEDIA_SIZE / sizeof(((struct encrypted_packet *)0)->file_data);
+    for (uint32_t i = 0; i <= last_index && i <= max; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "channel_%" PRIu64 "_files/%s.part%u", channel_id, file_name, i);
+        unlink(path);
+    }
+}
+
+// a task on upload_strand; the slot may have been finished or reused since the timer fired
+void upload_expire(void *arg) {
+    struct upload *up = arg;
+
+    pthread_mutex_lock(&upload_lock);
+    uint64_t quiet = timer_wheel_ms() - atomic_load(&up->last_chunk);
+    if (up->in_use && quiet >= upload_ms) {
+        printf("• Upload of %s to channel %" PRIu64 " stalled, discarding %u part(s).\n",
+               up->file_name, up->channel_id, up->last_index + 1);
+        remove_parts(up->channel_id, up->file_name, up->last_index);
+        up->in_use = 0;
+    } else if (up->in_use && !timer_pending(&up->timer)) {
+        timer_arm(&up->timer, upload_ms - (unsigned)quiet);
+    }
+    pthread_mutex_unlock(&upload_lock);
+}
+
+unsigned upload_timer(struct timer *t) {
+    struct upload *up = (struct upload *)((char *)t - offsetof(struct upload, timer));
+    uint64_t quiet = timer_wheel_ms() - atomic_load(&up->last_chunk);
+    if (quiet < upload_ms)
+        return upload_ms - (unsigned)quiet;
+
+    sched_submit(&upload_strand, upload_expire, up);
+    return 0;
+}
+
+static struct upload *upload_find(uint64_t channel_id, uint64_t user_id, const char *file_name) {
+    for (int i = 0; i < UPLOADS_MAX; i++)
+        if (uploads[i].in_use && uploads[i].channel_id == channel_id && uploads[i].user_id == user_id &&
+            strcmp(uploads[i].file_name, file_name) == 0)
+            return &uploads[i];
+    return NULL;
+}
+
+// a stored chunk that is not the last; only the first of an upload touches the wheel
+void upload_touch(struct client *u, const struct encrypted_packet *p) {
+    if (!upload_ms)
         return;
+
+    pthread_mutex_lock(&upload_lock);
+    struct upload *up = upload_find(p->channel_id, u->user_id, p->file_name);
+    for (int i = 0; !up && i < UPLOADS_MAX; i++) {
+        if (uploads[i].in_use)
+            continue;
+        up = &uploads[i];
+        up->in_use = 1;
+        up->channel_id = p->channel_id;
+        up->user_id = u->user_id;
+        snprintf(up->file_name, sizeof(up->file_name), "%.*s", (int)sizeof(up->file_name) - 1, p->file_name);
+        up->last_index = 0;
+        atomic_store(&up->last_chunk, timer_wheel_ms());
+        timer_init(&up->timer, upload_timer);
+        timer_arm(&up->timer, upload_ms);
+    }
+    if (up) {
+        if (p->chunk_index > up->last_index)
+            up->last_index = p->chunk_index;
+        atomic_store(&up->last_chunk, timer_wheel_ms());
     }
+    pthread_mutex_unlock(&upload_lock);
+}
 
-    channel_add_message(&cm, actual_channel_id, u->user_id, message_content, MSG_TYPE_TEXT);
-    broadcast_to_channel(message_content, u->user_id, actual_channel_id, u->socket_fd);
+void upload_done(struct client *u, const struct encrypted_packet *p) {
+    pthread_mutex_lock(&upload_lock);
+    struct upload *up = upload_find(p->channel_id, u->user_id, p->file_name);
+    if (up) {
+        timer_cancel(&up->timer);
+        up->in_use = 0;
+    }
+    pthread_mutex_unlock(&upload_lock);
 }
 
 void handle_file_transfer(struct client *u, struct encrypted_packet *p) {
     if (!channel_is_member(&cm, p->channel_id, u->user_id)) {
         char *error = "You are not a member of this channel";
-        send_encrypted(u->socket_fd, error, u->public_key_e, u->public_key_n);
+        send_encrypted(u, error);
+        return;
+    }
+
+    // chunks are stored where they arrive, so only the channel's own node can take them
+    int home = channel_home(p->channel_id);
+    if (home != fed_self()) {
+        if (p->chunk_index == 0) {
+            char error[128];
+            snprintf(error, sizeof(error), "Files for this channel can only be sent through node %d", home);
+            send_encrypted(u, error);
+        }
         return;
     }
     
@@ -282,59 +1039,145 @@ void handle_file_transfer(struct client *u, struct encrypted_packet *p) {
     snprintf(file_path, sizeof(file_path), "%s/%s.part%u", 
              channel_dir, p->file_name, p->chunk_index);
     
-    FILE *file = fopen(file_path, "wb");
-    if (file){
-        fwrite(p->file_data, 1, p->len, file);
-        fclose(file);
-        
+    uint8_t *chunk = p->file_data;
+    uint32_t chunk_len = p->len > sizeof(p->file_data) ? sizeof(p->file_data) : p->len;
+
+    uint8_t unpacked[sizeof(p->file_data)];
+    if (p->codec == PACKET_CODEC_LZ) {
+        long n = lz_decompress(p->file_data, chunk_len, unpacked, sizeof(unpacked));
+        if (n < 0) {
+            printf("[ERROR] Corrupt compressed chunk %u of %s from %s\n", p->chunk_index, p->file_name, u->username);
+            return;
+        }
+        chunk = unpacked;
+        chunk_len = (uint32_t)n;
+    }
+
+    if (io_write_file(file_path, chunk, chunk_len) == 0){
+        if (p->chunk_index != p->total_chunks - 1)
+            upload_touch(u, p);
         if (p->chunk_index == p->total_chunks - 1){
+            upload_done(u, p);
             combine_file_chunks(channel_dir, p->file_name, p->total_chunks);
  
             char file_message[512];
             snprintf(file_message, sizeof(file_message),
                     "[FILE] %s (%lu bytes)", p->file_name, p->file_size);
-            channel_add_message(&cm, p->channel_id, u->user_id, file_message, MSG_TYPE_FILE);
+            // the notice is replicated, the file itself is not (see replica.h)
+            uint64_t msg_id = 0;
+            channel_add_message(&cm, p->channel_id, u->user_id, file_message, MSG_TYPE_FILE, &msg_id);
+            replica_commit();
 
             char notification[512];
             snprintf(notification, sizeof(notification),
                     "[FILE] %s uploaded: %s (%lu bytes)", 
                     u->username, p->file_name, p->file_size);
-            broadcast_to_channel(notification, u->user_id, p->channel_id, u->socket_fd);
+            broadcast_to_channel(notification, u->user_id, p->channel_id, msg_id, u->socket_fd);
+
+            // other nodes get the notice only; the file stays here
+            struct requester r;
+            requester_local(&r, u);
+            fed_deliver(&r, notification, p->channel_id, msg_id);
             
             char file_metadata[512];
             snprintf(file_metadata, sizeof(file_metadata),
                     "FILE_METADATA:%s:%lu:%lu", 
                     p->file_name, p->file_size, p->channel_id);
-            broadcast_to_channel(file_metadata, u->user_id, p->channel_id, u->socket_fd);
+            broadcast_to_channel(file_metadata, u->user_id, p->channel_id, 0, u->socket_fd);
         }
     }
 }
 
-void handle_channel_create(struct client *u, const char *channel_info) {
-    char channel_name[CHANNEL_NAME_SIZE] = {0};
-    
-    sscanf(channel_info, "%31s", channel_name);   
-    if (strlen(channel_name) == 0) {
-        char *error = "Usage: /create <channel_name>";
-        send_encrypted(u->socket_fd, error, u->public_key_e, u->public_key_n);
+/*
+ * Traffic capture (RMS_CAPTURE): what each login sent, decoded, for the
+ * replay tool. Pings and heartbeats are left out; they are liveness traffic, not commands.
+ */
+void capture_login(struct client *u) {
+    if (!trace_enabled())
+        return;
+
+    struct connection *c = client_conn(u);
+    c->trace_conn = trace_conn_id();
+    struct trace_record rec = { .t_us = trace_now_us(), .conn = c->trace_conn, .kind = TRACE_LOGIN };
+    trace_write(&rec, u->username, strlen(u->username), NULL, 0);
+}
+
+void capture_logout(struct client *u) {
+    if (!trace_enabled())
+        return;
+
+    struct trace_record rec = { .t_us = trace_now_us(), .conn = client_conn(u)->trace_conn, .kind = TRACE_LOGOUT };
+    trace_write(&rec, NULL, 0, NULL, 0);
+}
+
+void capture_packet(const struct job *job, const char *text) {
+    const struct encrypted_packet *p = &job->p;
+    if (!trace_enabled() || p->command_type == CMD_PING || p->command_type == CMD_HEARTBEAT)
+        return;
+
+    struct trace_record rec = {
+        .t_us = job->arrived_us,
+        .channel_id = p->channel_id,
+        .msg_id = p->msg_id,
+        .conn = client_conn(job->u)->trace_conn,
+        .command_type = (uint16_t)p->command_type,
+        .kind = TRACE_COMMAND,
+    };
+    if (p->command_type != CMD_FILE_TRANSFER) {
+        trace_write(&rec, text, strlen(text), NULL, 0);
         return;
     }
-    
+
+    struct trace_file_chunk meta = {
+        .file_size = p->file_size,
+        .chunk_index = p->chunk_index,
+        .total_chunks = p->total_chunks,
+        .codec = p->codec,
+    };
+    memcpy(meta.file_name, p->file_name, sizeof(meta.file_name));
+    meta.file_name[sizeof(meta.file_name) - 1] = '\0';
+    rec.kind = TRACE_FILE;
+    trace_write(&rec, &meta, sizeof(meta), p->file_data, p->len > sizeof(p->file_data) ? sizeof(p->file_data) : p->len);
+}
+
+// the replay maps the ids it sees in commands back to channels by name
+void capture_channel(uint64_t channel_id, const char *name) {
+    if (!trace_enabled())
+        return;
+
+    struct trace_record rec = { .t_us = trace_now_us(), .channel_id = channel_id, .kind = TRACE_CHANNEL };
+    trace_write(&rec, name, strlen(name), NULL, 0);
+}
+
+// runs on the node that owns the name
+void channel_create_for(const struct requester *r, const char *channel_name) {
     struct channel *existing = channel_find_by_name(&cm, channel_name);
     if (existing) {
         char error[128];
         snprintf(error, sizeof(error), "Channel '%s' already exists (ID: %" PRIu64 ")\n", 
                 channel_name, existing->channel_id);
-        send_encrypted(u->socket_fd, error, u->public_key_e, u->public_key_n);
+        reply_to(r, error);
         return;
     }   
-    
-    uint64_t channel_id = channel_create(&cm, channel_name, u->user_id);  
+
+    // only ids that hash back here, so every node finds the owner from the id alone
+    uint64_t channel_id;
+    do {
+        channel_id = generate_id();
+    } while (fed_owner_of_id(channel_id) != fed_self());
+
+    channel_id = channel_create_with_id(&cm, channel_id, channel_name, r->user_id);
     if (channel_id == 0){
         char *error = "Failed to create channel (max channels reached?)";
-        send_encrypted(u->socket_fd, error, u->public_key_e, u->public_key_n);
+        reply_to(r, error);
         return;
     }
+
+    capture_channel(channel_id, channel_name);
+
+    // peers learn of the channel before the creator hears back, so posting works at once
+    replica_commit();
+    fed_publish_channel(channel_id, -1);
     
     char success_msg[256];
     snprintf(success_msg, sizeof(success_msg),
@@ -342,15 +1185,39 @@ void handle_channel_create(struct client *u, const char *channel_info) {
             "You have been automatically joined to this channel.\n"
             "Use '/join %lu' or '/join %s' to join from other sessions.",
             channel_name, channel_id, channel_id, channel_name);
-    send_encrypted(u->socket_fd, success_msg, u->public_key_e, u->public_key_n);
+    reply_to(r, success_msg);
     
     char system_msg[256];
     snprintf(system_msg, sizeof(system_msg),
-            "Channel created by %s. Welcome!", u->username);
-    channel_add_message(&cm, channel_id, u->user_id, system_msg, MSG_TYPE_TEXT);
+            "Channel created by %s. Welcome!", r->username);
+    channel_add_message(&cm, channel_id, r->user_id, system_msg, MSG_TYPE_TEXT, NULL);
+    replica_commit();
+    rotate_group_key(channel_id);
 }
 
-void handle_channel_join(struct client *u, const char *channel_input){
+void handle_channel_create(struct client *u, const char *channel_info) {
+    char channel_name[CHANNEL_NAME_SIZE] = {0};
+    
+    sscanf(channel_info, "%31s", channel_name);   
+    if (strlen(channel_name) == 0) {
+        char *error = "Usage: /create <channel_name>";
+        send_encrypted(u, error);
+        return;
+    }
+
+    int owner = fed_owner_of_name(channel_name);
+    if (owner != fed_self() && !channel_find_by_name(&cm, channel_name)) {
+        fed_forward(u, owner, FED_CREATE, 0, channel_name, NULL);
+        return;
+    }
+
+    struct requester r;
+    requester_local(&r, u);
+    channel_create_for(&r, channel_name);
+}
+
+// runs on the channel's owner
+void channel_join_for(const struct requester *r, const char *channel_input){
     uint64_t channel_id = 0;
     char channel_name[CHANNEL_NAME_SIZE] = {0};
     struct channel *ch =  NULL;
@@ -368,7 +1235,7 @@ void handle_channel_join(struct client *u, const char *channel_input){
             snprintf(error, sizeof(error), 
                     "Channel '%s' not found. Use /channels to see available channels.",
                     channel_input);
-            send_encrypted(u->socket_fd, error, u->public_key_e, u->public_key_n);
+            reply_to(r, error);
             return;
         }
     } else{
@@ -378,15 +1245,18 @@ void handle_channel_join(struct client *u, const char *channel_input){
         }
     }
     
-    if (!ch) {
+    if (!ch || ch->remote) {
         char error[128];
         snprintf(error, sizeof(error), "Channel %lu not found", channel_id);
-        send_encrypted(u->socket_fd, error, u->public_key_e, u->public_key_n);
+        reply_to(r, error);
         return;
     }  
     
-    int result = channel_join(&cm, channel_id, u->user_id);
+    int result = channel_join(&cm, channel_id, r->user_id);
     if (result == 0){
+        replica_commit();
+        fed_publish_channel(channel_id, -1);
+
         char success_msg[512];
         
         if (strlen(channel_name) > 0){
@@ -401,64 +1271,984 @@ void handle_channel_join(struct client *u, const char *channel_input){
                     "Members: %d",
                     channel_id, ch->participant_count);
         }     
-        send_encrypted(u->socket_fd, success_msg, u->public_key_e, u->public_key_n);
+        reply_to(r, success_msg);
 
         char join_msg[256];
         snprintf(join_msg, sizeof(join_msg),
-                "%s has joined the channel.", u->username);
+                "%s has joined the channel.", r->username);
         
-        broadcast_to_channel(join_msg, u->user_id, channel_id, u->socket_fd);
-        channel_add_message(&cm, channel_id, u->user_id, join_msg, MSG_TYPE_TEXT);
+        // new member gets a fresh key; earlier frames stay unreadable to them
+        rotate_group_key(channel_id);
+
+        uint64_t msg_id = 0;
+        channel_add_message(&cm, channel_id, r->user_id, join_msg, MSG_TYPE_TEXT, &msg_id);
+        broadcast_as(r->username, join_msg, r->user_id, channel_id, msg_id, 0);
+        fed_deliver(r, join_msg, channel_id, msg_id);
     }
 }
 
-void *worker(void *arg) {
-    struct client *u = arg;
-    if (!u) 
-        return NULL;
+void handle_channel_join(struct client *u, const char *channel_input){
+    char *endptr;
+    uint64_t channel_id = strtoull(channel_input, &endptr, 10);
+    struct channel *ch = *endptr == '\0' ? channel_find(&cm, channel_id) : channel_find_by_name(&cm, channel_input);
+
+    // a channel not heard of yet lives wherever its id or name hashes
+    int home;
+    if (ch)
+        home = channel_home(ch->channel_id);
+    else
+        home = *endptr == '\0' ? fed_owner_of_id(channel_id) : fed_owner_of_name(channel_input);
+
+    if (home != fed_self()) {
+        fed_forward(u, home, FED_JOIN, 0, NULL, channel_input);
+        return;
+    }
 
-    for (;;){
-        struct encrypted_packet p = {0};
-        ssize_t rec = recv(u->socket_fd, &p, sizeof(p), 0);
-        printf("sizeof(encrypted_packet) = %zu\n", sizeof(struct encrypted_packet));
+    struct requester r;
+    requester_local(&r, u);
+    channel_join_for(&r, channel_input);
+}
 
-        if (rec <= 0) {
-            printf("• User %s disconnected.\n", u->username);
-            close(u->socket_fd);
-            pthread_mutex_lock(&u_lock);
-            u->socket_fd = -1;
-            pthread_mutex_unlock(&u_lock);
-            return NULL;
-        }
+/*
+ * Batch frames carry up to CHANNEL_BATCH_MAX sub-commands, one per line:
+ * "M <channel> <text>" posts, "J <channel>" joins. Items for channels kept
+ * here are grouped by channel and each group goes through channel_apply,
+ * so it costs one lock acquisition and one persistence write however many
+ * items it holds. Items for channels on other nodes take the single-command
+ * path. The sender gets one multi-status reply.
+ */
+struct batch_item {
+    int type;               // CHANNEL_OP_*
+    char code;              // the sub-command letter, as sent
+    const char *target;     // channel id or name, as sent
+    const char *text;
+    uint64_t channel_id;
+    const char *error;      // NULL once applied or forwarded
+    int forwarded;
+};
+
+static const char *batch_error(int status) {
+    switch (status) {
+        case -2: return "not a member";
+        case -3: return "already a member";
+        case -4: return "channel is full";
+        default: return "failed";
+    }
+}
 
-        char *msg = decrypt(p.encrypted_payload, p.len, s_d, s_n);
-        if (!msg) {
+void handle_batch(struct client *u, char *msg) {
+    struct batch_item items[CHANNEL_BATCH_MAX];
+    int n = 0;
+
+    char *save = NULL;
+    for (char *line = strtok_r(msg, "\n", &save); line && n < CHANNEL_BATCH_MAX; line = strtok_r(NULL, "\n", &save)) {
+        struct batch_item *it = &items[n++];
+        memset(it, 0, sizeof(*it));
+
+        it->code = line[0];
+        char *target = line + 1;
+        while (*target == ' ')
+            target++;
+        char *text = strchr(target, ' ');
+        if (text)
+            *text++ = '\0';
+        it->target = target;
+        it->text = text;
+
+        if (line[0] == 'M' && line[1] == ' ' && text && *text)
+            it->type = CHANNEL_OP_POST;
+        else if (line[0] == 'J' && line[1] == ' ' && *target && !text)
+            it->type = CHANNEL_OP_JOIN;
+        else {
+            it->error = "malformed";
+            continue;
+        }
+        if (it->type == CHANNEL_OP_POST && strlen(text) > MSG_CONTENT_MAX) {
+            it->error = "too long";
             continue;
         }
 
-        printf("\n• Received from [%s | %lu] (cmd=%d, channel=%lu): %s\n",
-               u->username, u->user_id,
-               p.command_type, p.channel_id,
-               msg);
-
-        switch (p.command_type) {
-            case CMD_MESSAGE:
-                handle_message(u, &p, msg);
-                break;
-            case CMD_FILE_TRANSFER:
-                handle_file_transfer(u, &p);
-                break;
-            case CMD_CHANNEL_CREATE:
-                handle_channel_create(u, msg);
-                break;
-            case CMD_CHANNEL_JOIN:
-                handle_channel_join(u, msg);
+        // every post costs what it would sent alone, wherever it is headed
+        if (it->type == CHANNEL_OP_POST &&
+            bucket_take(&client_conn(u)->buckets[RATE_MESSAGE], &rates[RATE_MESSAGE], rate_now_ns()) != 0) {
+            it->error = "rate limited";
+            continue;
+        }
+
+        char *end;
+        uint64_t id = strtoull(target, &end, 10);
+        struct channel *ch = *end == '\0' ? channel_find(&cm, id) : channel_find_by_name(&cm, target);
+        if (ch)
+            it->channel_id = ch->channel_id;
+
+        // a join may name a channel this node has not heard of; its owner decides
+        int home = ch ? channel_home(ch->channel_id)
+                      : it->type == CHANNEL_OP_JOIN ? (*end == '\0' ? fed_owner_of_id(id) : fed_owner_of_name(target))
+                                                    : fed_self();
+        if (home != fed_self()) {
+            if (it->type == CHANNEL_OP_JOIN)
+                fed_forward(u, home, FED_JOIN, 0, NULL, target);
+            else
+                fed_forward(u, home, FED_POST, it->channel_id, NULL, text);
+            it->forwarded = 1;
+        } else if (!ch || ch->remote) {
+            it->error = "channel not found";
+        } else if (it->type == CHANNEL_OP_POST &&
+                   channel_bucket_take(it->channel_id, &channel_rate, rate_now_ns()) != 0) {
+            it->error = "rate limited";
+        }
+    }
+
+    struct requester r;
+    requester_local(&r, u);
+    char join_msg[USERNAME_SIZE + 32];
+    snprintf(join_msg, sizeof(join_msg), "%s has joined the channel.", u->username);
+
+    // channels in order of first mention; ops[] holds each channel's items contiguously, in the order sent
+    uint64_t channels[CHANNEL_BATCH_MAX];
+    int group_of[CHANNEL_BATCH_MAX], first[CHANNEL_BATCH_MAX + 1] = {0};
+    int groups = 0, applied = 0, forwarded = 0;
+    for (int i = 0; i < n; i++) {
+        struct batch_item *it = &items[i];
+        forwarded += it->forwarded;
+        group_of[i] = -1;
+        if (it->error || it->forwarded)
+            continue;
+
+        int g = 0;
+        while (g < groups && channels[g] != it->channel_id)
+            g++;
+        if (g == groups)
+            channels[groups++] = it->channel_id;
+        group_of[i] = g;
+        first[g + 1]++;
+    }
+    for (int g = 0; g < groups; g++)
+        first[g + 1] += first[g];
+
+    struct channel_op ops[CHANNEL_BATCH_MAX];
+    int op_item[CHANNEL_BATCH_MAX], fill[CHANNEL_BATCH_MAX] = {0};
+    for (int i = 0; i < n; i++) {
+        if (group_of[i] < 0)
+            continue;
+        int k = first[group_of[i]] + fill[group_of[i]]++;
+        memset(&ops[k], 0, sizeof(ops[k]));
+        ops[k].type = items[i].type;
+        ops[k].user_id = u->user_id;
+        ops[k].content = items[i].type == CHANNEL_OP_POST ? items[i].text : join_msg;
+        ops[k].msg_type = MSG_TYPE_TEXT;
+        op_item[k] = i;
+    }
+
+    for (int g = 0; g < groups; g++) {
+        int ok = channel_apply(&cm, channels[g], ops + first[g], first[g + 1] - first[g]) >= 0;
+        for (int k = first[g]; k < first[g + 1]; k++) {
+            if (!ok)
+                ops[k].status = -1;
+            if (ops[k].status != 0)
+                items[op_item[k]].error = ok ? batch_error(ops[k].status) : "channel not found";
+            else
+                applied++;
+        }
+    }
+    replica_commit();
+
+    // fan out only once everything is stored; a channel someone joined gets a fresh key first
+    for (int g = 0; g < groups; g++) {
+        int joined = 0;
+        for (int k = first[g]; k < first[g + 1]; k++)
+            joined |= ops[k].type == CHANNEL_OP_JOIN && ops[k].status == 0;
+        if (joined) {
+            fed_publish_channel(channels[g], -1);
+            rotate_group_key(channels[g]);
+        }
+
+        for (int k = first[g]; k < first[g + 1]; k++) {
+            if (ops[k].status != 0 || !ops[k].msg_id)
+                continue;
+            broadcast_as(u->username, ops[k].content, u->user_id, channels[g], ops[k].msg_id, 0);
+            fed_deliver(&r, ops[k].content, channels[g], ops[k].msg_id);
+        }
+    }
+
+    printf("• Batch from [%s | %" PRIu64 "]: %d item(s) over %d channel(s), %d applied, %d forwarded\n",
+           u->username, u->user_id, n, groups, applied, forwarded);
+
+    struct reply_stream st;
+    stream_begin(&st, u, CMD_BATCH, 0);
+    char line[160];
+    snprintf(line, sizeof(line), "Batch: %d item(s), %d applied, %d forwarded, %d failed",
+             n, applied, forwarded, n - applied - forwarded);
+    stream_line(&st, line, 0);
+    for (int i = 0; i < n; i++) {
+        if (!items[i].error)
+            continue;
+        snprintf(line, sizeof(line), "  #%d %c %.64s: %s", i + 1, items[i].code, items[i].target, items[i].error);
+        stream_line(&st, line, 0);
+    }
+    stream_flush(&st);
+}
+
+/*
+ * Delta sync: the client sends its last seen message id for a channel and
+ * gets back only the buffered messages after it, then a summary line whose
+ * frame carries the new cursor.
+ */
+void handle_sync(struct client *u, struct encrypted_packet *p) {
+    if (!channel_is_member(&cm, p->channel_id, u->user_id)) {
+        char *error = "You are not a member of this channel";
+        send_encrypted(u, error);
+        return;
+    }
+
+    struct msg *missed = malloc(MSG_BUFFER_LIMIT * sizeof(*missed));
+    if (!missed)
+        return;
+
+    int gap = 0;
+    int n = channel_messages_since(&cm, p->channel_id, p->msg_id, missed, MSG_BUFFER_LIMIT, &gap);
+    if (n < 0) {
+        free(missed);
+        return;
+    }
+
+    struct reply_stream s;
+    stream_begin(&s, u, CMD_SYNC, p->channel_id);
+    if (gap)
+        stream_line(&s, "[sync] some older messages are no longer buffered", 0);
+
+    uint64_t cursor = p->msg_id;
+    for (int i = 0; i < n; i++) {
+        char name[USERNAME_SIZE] = "?";
+        int idx = find_user_index_by_user_id(missed[i].sender_id);
+        if (idx != -1) {
+            lockprof_lock(&u_lock);
+            strncpy(name, users[idx].username, sizeof(name) - 1);
+            lockprof_unlock(&u_lock);
+        } else {
+            remote_username(missed[i].sender_id, name);
+        }
+
+        char line[MAX_ENCRYPTED_PAYLOAD];
+        snprintf(line, sizeof(line), "[%s] %s", name, missed[i].content);
+        stream_line(&s, line, missed[i].msg_id);
+        cursor = missed[i].msg_id;
+    }
+
+    char summary[128];
+    snprintf(summary, sizeof(summary), "[sync] %d new message(s) in channel %" PRIu64, n, p->channel_id);
+    stream_line(&s, summary, cursor);
+    stream_flush(&s);
+    free(missed);
+}
+
+/*
+ * /history <channel> [before] [limit]: pages backwards through the on-disk
+ * scrollback. `before` is a message id, or a unix timestamp in seconds,
+ * which is turned into the smallest id of that instant.
+ */
+void handle_history(struct client *u, const char *args) {
+    char channel_str[64] = {0};
+    unsigned long long before = 0;
+    int limit = 20;
+
+    if (sscanf(args, "%63s %llu %d", channel_str, &before, &limit) < 1) {
+        send_encrypted(u, "Usage: /history <channel> [before_id|unix_time] [limit]");
+        return;
+    }
+
+    char *endptr;
+    uint64_t channel_id = strtoull(channel_str, &endptr, 10);
+    struct channel *ch = *endptr == '\0' ? channel_find(&cm, channel_id) : channel_find_by_name(&cm, channel_str);
+    if (!ch) {
+        char error[128];
+        snprintf(error, sizeof(error), "Channel '%s' not found", channel_str);
+        send_encrypted(u, error);
+        return;
+    }
+    channel_id = ch->channel_id;
+
+    if (!channel_is_member(&cm, channel_id, u->user_id)) {
+        send_encrypted(u, "You are not a member of this channel");
+        return;
+    }
+
+    if (ch->remote) {
+        char error[128];
+        snprintf(error, sizeof(error), "Channel '%s' is stored on node %d; connect there to read back through it",
+                 ch->channel_name, ch->home);
+        send_encrypted(u, error);
+        return;
+    }
+
+    if (before > 0 && before < 100000000000ULL && before * 1000 > ID_EPOCH_MS)
+        before = (before * 1000 - ID_EPOCH_MS) << (ID_SHARD_BITS + ID_SEQ_BITS);
+    if (limit <= 0 || limit > HISTORY_MAX_LIMIT)
+        limit = HISTORY_MAX_LIMIT;
+
+    struct msg *page = malloc((size_t)limit * sizeof(*page));
+    if (!page)
+        return;
+    int n = history_read(channel_id, before, page, limit);
+
+    struct reply_stream s;
+    stream_begin(&s, u, CMD_HISTORY, channel_id);
+    for (int i = 0; i < n; i++) {
+        char name[USERNAME_SIZE] = "?";
+        int idx = find_user_index_by_user_id(page[i].sender_id);
+        if (idx != -1) {
+            lockprof_lock(&u_lock);
+            strncpy(name, users[idx].username, sizeof(name) - 1);
+            lockprof_unlock(&u_lock);
+        } else {
+            remote_username(page[i].sender_id, name);
+        }
+
+        time_t ts = page[i].timestamp;
+        struct tm tm;
+        char when[32];
+        localtime_r(&ts, &tm);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+
+        char line[MAX_ENCRYPTED_PAYLOAD];
+        snprintf(line, sizeof(line), "%s [%s] %s", when, name, page[i].content);
+        stream_line(&s, line, 0);
+    }
+
+    char footer[128];
+    if (n > 0)
+        snprintf(footer, sizeof(footer), "[history] %d message(s). Older: /history %" PRIu64 " %" PRIu64 " %d",
+                 n, channel_id, page[0].msg_id, limit);
+    else
+        snprintf(footer, sizeof(footer), "[history] no older messages");
+    stream_line(&s, footer, 0);
+    stream_flush(&s);
+    free(page);
+}
+
+/*
+ * Cuts a window of the message around the first query term it contains,
+ * marking elided text with "...".
+ */
+void search_snippet(const char *content, char terms[][SEARCH_TERM_MAX + 1], int nt, char *out, size_t size) {
+    const size_t before = 40, width = 120;
+    size_t len = strlen(content);
+
+    const char *hit = NULL;
+    for (int i = 0; i < nt && !hit; i++)
+        hit = strcasestr(content, terms[i]);
+
+    size_t start = hit && (size_t)(hit - content) > before ? (size_t)(hit - content) - before : 0;
+    size_t n = len - start < width ? len - start : width;
+    snprintf(out, size, "%s%.*s%s", start ? "..." : "", (int)n, content + start, start + n < len ? "..." : "");
+    for (char *c = out; *c; c++) {
+        if (*c == '\n')
+            *c = ' ';
+    }
+}
+
+void handle_search(struct client *u, const char *args) {
+    char channel_str[64] = {0};
+    int consumed = 0;
+
+    if (sscanf(args, "%63s %n", channel_str, &consumed) < 1 || args[consumed] == '\0') {
+        send_encrypted(u, "Usage: /search <channel> <terms>");
+        return;
+    }
+    const char *query = args + consumed;
+
+    char *endptr;
+    uint64_t channel_id = strtoull(channel_str, &endptr, 10);
+    struct channel *ch = *endptr == '\0' ? channel_find(&cm, channel_id) : channel_find_by_name(&cm, channel_str);
+    if (!ch) {
+        char error[128];
+        snprintf(error, sizeof(error), "Channel '%s' not found", channel_str);
+        send_encrypted(u, error);
+        return;
+    }
+    channel_id = ch->channel_id;
+
+    if (!channel_is_member(&cm, channel_id, u->user_id)) {
+        send_encrypted(u, "You are not a member of this channel");
+        return;
+    }
+
+    if (ch->remote) {
+        char error[128];
+        snprintf(error, sizeof(error), "Channel '%s' is stored on node %d; connect there to read back through it",
+                 ch->channel_name, ch->home);
+        send_encrypted(u, error);
+        return;
+    }
+
+    uint64_t ids[SEARCH_MAX_RESULTS];
+    int total = 0;
+    int n = search_query(channel_id, query, ids, SEARCH_MAX_RESULTS, &total);
+    if (n < 0) {
+        send_encrypted(u, "[search] no searchable terms (words need at least 2 letters or digits)");
+        return;
+    }
+
+    char terms[SEARCH_MAX_TERMS][SEARCH_TERM_MAX + 1];
+    int nt = search_terms(query, terms, SEARCH_MAX_TERMS);
+
+    struct reply_stream s;
+    stream_begin(&s, u, CMD_SEARCH, channel_id);
+    for (int i = 0; i < n; i++) {
+        // the sparse history index turns each id into a short scan
+        struct msg m;
+        if (history_read(channel_id, ids[i] + 1, &m, 1) != 1 || m.msg_id != ids[i])
+            continue;
+
+        char name[USERNAME_SIZE] = "?";
+        int idx = find_user_index_by_user_id(m.sender_id);
+        if (idx != -1) {
+            lockprof_lock(&u_lock);
+            strncpy(name, users[idx].username, sizeof(name) - 1);
+            lockprof_unlock(&u_lock);
+        } else {
+            remote_username(m.sender_id, name);
+        }
+
+        char snippet[MAX_ENCRYPTED_PAYLOAD - 64]; // room for the id and name in front
+        search_snippet(m.content, terms, nt, snippet, sizeof(snippet));
+
+        char line[MAX_ENCRYPTED_PAYLOAD];
+        snprintf(line, sizeof(line), "#%" PRIu64 " [%s] %s", m.msg_id, name, snippet);
+        stream_line(&s, line, 0);
+    }
+
+    char footer[128];
+    if (total < 0)
+        snprintf(footer, sizeof(footer), "[search] newest %d matches shown, there are more", n);
+    else if (total > n)
+        snprintf(footer, sizeof(footer), "[search] %d match(es), newest %d shown", total, n);
+    else
+        snprintf(footer, sizeof(footer), "[search] %d match(es)", total);
+    stream_line(&s, footer, 0);
+    stream_flush(&s);
+}
+
+// copies the username (or "?") and reports whether the user is connected
+int lookup_username(uint64_t user_id, char name[USERNAME_SIZE]) {
+    int online = 0;
+    strcpy(name, "?");
+    lockprof_lock(&u_lock);
+    for (int i = 0; i < CLIENTS_LIMIT; i++) {
+        if (users[i].username[0] != '\0' && users[i].user_id == user_id) {
+            strncpy(name, users[i].username, USERNAME_SIZE - 1);
+            name[USERNAME_SIZE - 1] = '\0';
+            online = users[i].socket_fd != -1;
+            break;
+        }
+    }
+    lockprof_unlock(&u_lock);
+    if (name[0] == '?')
+        remote_username(user_id, name);
+    return online;
+}
+
+int view_has_member(const struct channel_view *v, uint64_t user_id) {
+    for (int i = 0; i < v->participant_count; i++) {
+        if (v->participant_ids[i] == user_id)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * The listing handlers below read only the RCU snapshot of the channel
+ * directory, never cm->lock, and copy out what they need before sending
+ * so a slow client doesn't hold the read side open.
+ */
+void handle_list_channels(struct client *u, const char *args) {
+    int page = 1;
+    sscanf(args, "%d", &page);
+    if (page < 1)
+        page = 1;
+
+    struct channel_view *views = malloc(LIST_PAGE_SIZE * sizeof(*views));
+    if (!views)
+        return;
+
+    const struct channel_snapshot *snap = channel_snapshot_begin(&cm);
+    int total = snap->channel_count;
+    int first = (page - 1) * LIST_PAGE_SIZE;
+    int n = 0;
+    for (int i = first; i < total && n < LIST_PAGE_SIZE; i++)
+        views[n++] = snap->channels[i];
+    channel_snapshot_end();
+
+    int pages = total > 0 ? (total + LIST_PAGE_SIZE - 1) / LIST_PAGE_SIZE : 1;
+
+    struct reply_stream s;
+    stream_begin(&s, u, CMD_LIST_CHANNELS, 0);
+    for (int i = 0; i < n; i++) {
+        char line[MAX_ENCRYPTED_PAYLOAD];
+        snprintf(line, sizeof(line), "%c %s (ID: %" PRIu64 ") %d member(s)",
+                 view_has_member(&views[i], u->user_id) ? '*' : ' ',
+                 views[i].channel_name, views[i].channel_id, views[i].participant_count);
+        stream_line(&s, line, 0);
+    }
+
+    char footer[128];
+    if (page < pages)
+        snprintf(footer, sizeof(footer), "[channels] page %d/%d, %d channel(s). Next: /channels %d", page, pages, total, page + 1);
+    else
+        snprintf(footer, sizeof(footer), "[channels] page %d/%d, %d channel(s)", page, pages, total);
+    stream_line(&s, footer, 0);
+    stream_flush(&s);
+    free(views);
+}
+
+void handle_list_members(struct client *u, const char *args) {
+    char channel_str[64] = {0};
+    int page = 1;
+    if (sscanf(args, "%63s %d", channel_str, &page) < 1) {
+        send_encrypted(u, "Usage: /members <channel> [page]");
+        return;
+    }
+    if (page < 1)
+        page = 1;
+
+    struct channel_view view;
+    const struct channel_snapshot *snap = channel_snapshot_begin(&cm);
+    const struct channel_view *v = channel_view_find(snap, channel_str);
+    if (v)
+        view = *v;
+    channel_snapshot_end();
+
+    if (!v) {
+        char error[128];
+        snprintf(error, sizeof(error), "Channel '%s' not found", channel_str);
+        send_encrypted(u, error);
+        return;
+    }
+
+    int total = view.participant_count;
+    int pages = total > 0 ? (total + LIST_PAGE_SIZE - 1) / LIST_PAGE_SIZE : 1;
+
+    struct reply_stream s;
+    stream_begin(&s, u, CMD_LIST_MEMBERS, view.channel_id);
+    for (int i = (page - 1) * LIST_PAGE_SIZE; i < total && i < page * LIST_PAGE_SIZE; i++) {
+        char name[USERNAME_SIZE];
+        int online = lookup_username(view.participant_ids[i], name);
+
+        char since[32] = "";
+        if (view.joined_at[i]) {
+            struct tm tm;
+            localtime_r(&view.joined_at[i], &tm);
+            strftime(since, sizeof(since), ", joined %Y-%m-%d", &tm);
+        }
+
+        char line[MAX_ENCRYPTED_PAYLOAD];
+        snprintf(line, sizeof(line), "%c %s%s", online ? '+' : ' ', name, since);
+        stream_line(&s, line, 0);
+    }
+
+    char footer[160];
+    if (page < pages)
+        snprintf(footer, sizeof(footer), "[members] %s: page %d/%d, %d member(s). Next: /members %s %d",
+                 view.channel_name, page, pages, total, channel_str, page + 1);
+    else
+        snprintf(footer, sizeof(footer), "[members] %s: page %d/%d, %d member(s)", view.channel_name, page, pages, total);
+    stream_line(&s, footer, 0);
+    stream_flush(&s);
+}
+
+void handle_channel_info(struct client *u, const char *args) {
+    char channel_str[64] = {0};
+    if (sscanf(args, "%63s", channel_str) < 1) {
+        send_encrypted(u, "Usage: /info <channel>");
+        return;
+    }
+
+    struct channel_view view;
+    uint64_t version = 0;
+    const struct channel_snapshot *snap = channel_snapshot_begin(&cm);
+    const struct channel_view *v = channel_view_find(snap, channel_str);
+    if (v) {
+        view = *v;
+        version = snap->version;
+    }
+    channel_snapshot_end();
+
+    if (!v) {
+        char error[128];
+        snprintf(error, sizeof(error), "Channel '%s' not found", channel_str);
+        send_encrypted(u, error);
+        return;
+    }
+
+    int online = 0;
+    for (int i = 0; i < view.participant_count; i++) {
+        char name[USERNAME_SIZE];
+        online += lookup_username(view.participant_ids[i], name);
+    }
+
+    // channel ids are time-ordered, so the id says when it was created
+    time_t created = (time_t)(id_timestamp_ms(view.channel_id) / 1000);
+    struct tm tm;
+    char when[32];
+    localtime_r(&created, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+
+    char info[MAX_ENCRYPTED_PAYLOAD];
+    snprintf(info, sizeof(info),
+             "Channel '%s' (ID: %" PRIu64 ")\n"
+             "Created: %s\n"
+             "Members: %d (%d online)%s\n"
+             "Directory version: %" PRIu64,
+             view.channel_name, view.channel_id, when, view.participant_count, online,
+             view_has_member(&view, u->user_id) ? ", including you" : "", version);
+
+    struct reply_stream s;
+    stream_begin(&s, u, CMD_CHANNEL_INFO, view.channel_id);
+    stream_line(&s, info, 0);
+    stream_flush(&s);
+}
+
+// a client that missed a rotation asks for the channel's current key
+void handle_group_key(struct client *u, struct encrypted_packet *p) {
+    if (!channel_is_member(&cm, p->channel_id, u->user_id))
+        return;
+
+    struct group_key key;
+    if (group_key_current(p->channel_id, &key) == 0)
+        send_group_key(u, &key);
+    else
+        rotate_group_key(p->channel_id);
+    memset(&key, 0, sizeof(key));
+}
+
+/*
+ * Messages from the other nodes, on a federation link thread. Requests
+ * from their users run the same code as local ones; the answer goes back
+ * as FED_REPLY. The link already vouches for m->from, but a node may only
+ * act for users registered on it and speak for channels it keeps.
+ */
+void fed_handle(struct fed_msg *m) {
+    struct requester r = { .user_id = m->user_id, .node = (int)m->from };
+    snprintf(r.username, sizeof(r.username), "%s", m->username);
+
+    int allowed = 1;
+    switch (m->type) {
+        case FED_CREATE:
+        case FED_JOIN:
+        case FED_POST:
+            allowed = fed_owner_of_user(m->user_id) == (int)m->from;
+            break;
+        case FED_CHANNEL:
+            allowed = fed_owner_of_id(m->channel_id) == (int)m->from;
+            break;
+        case FED_DELIVER:
+            allowed = channel_home(m->channel_id) == (int)m->from;
+            break;
+    }
+    if (!allowed) {
+        printf("[ERROR] Node %u sent federation message %u for user %" PRIu64 " / channel %" PRIu64
+               " it does not own, ignoring it.\n", m->from, m->type, m->user_id, m->channel_id);
+        return;
+    }
+
+    if (m->type != FED_REPLY)
+        remember_remote_user(m->user_id, m->username);
+
+    switch (m->type) {
+        case FED_HELLO: {
+            // a node that just came up learns about every channel kept here
+            uint64_t *ids = malloc(MAX_CHANNELS * sizeof(*ids));
+            if (!ids)
                 break;
-            default:
-                printf("• Unknown command %d\n", p.command_type);
+            int n = 0;
+            lockprof_lock(&cm.lock);
+            for (int i = 0; i < cm.channel_count; i++) {
+                if (!cm.channels[i].remote)
+                    ids[n++] = cm.channels[i].channel_id;
+            }
+            lockprof_unlock(&cm.lock);
+            for (int i = 0; i < n; i++)
+                fed_publish_channel(ids[i], (int)m->from);
+            free(ids);
+            break;
         }
+        case FED_CHANNEL:
+            // membership changed, so local members get a new key just as on the owner
+            if (channel_mirror(&cm, m->channel_id, m->channel_name, (int)m->from, m->members, (int)m->member_count) == 0)
+                rotate_group_key(m->channel_id);
+            break;
+        case FED_CREATE:
+            channel_create_for(&r, m->channel_name);
+            break;
+        case FED_JOIN:
+            channel_join_for(&r, m->text);
+            break;
+        case FED_POST:
+            if (channel_home(m->channel_id) != fed_self())
+                reply_to(&r, "Channel not found");
+            else if (channel_bucket_take(m->channel_id, &channel_rate, rate_now_ns()) != 0)
+                reply_to(&r, "Slow down: messages to this channel over the rate limit were dropped.");
+            else
+                channel_post(&r, m->channel_id, m->text);
+            break;
+        case FED_DELIVER:
+            broadcast_as(m->username, m->text, m->user_id, m->channel_id, m->msg_id, 0);
+            break;
+        case FED_REPLY:
+            r.node = fed_self();
+            reply_to(&r, m->text);
+            break;
+        default:
+            printf("• Unknown federation message %u from node %u\n", m->type, m->from);
+    }
+}
+
+// a packet with nothing but its type and msg_id
+void send_control(struct client *u, uint32_t command_type, uint64_t msg_id) {
+    size_t mark = arena_mark();
+    struct encrypted_packet *p = arena_alloc(sizeof(*p));
+    if (p) {
+        memset(p, 0, PACKET_HEADER_SIZE);
+        p->command_type = command_type;
+        p->msg_id = msg_id;
+        p->timestamp = (uint32_t)time(NULL);
+        send_encrypted_packet(u, p, "");
+    }
+    arena_release(mark);
+}
+
+// answered in turn with the connection's other commands, so the round trip covers the work queued ahead
+void handle_ping(struct client *u, struct encrypted_packet *p) {
+    send_control(u, CMD_PING, p->msg_id);
+}
 
-        free(msg);
+void process_packet(void *arg) {
+    struct job *job = arg;
+    struct client *u = job->u;
+    struct encrypted_packet *p = &job->p;
+
+    // file chunks reuse len for the size of file_data, there is no text to decrypt
+    if (p->command_type == CMD_FILE_TRANSFER) {
+        capture_packet(job, NULL);
+        handle_file_transfer(u, p);
+        pool_put(&job_pool, job);
+        return;
+    }
+
+    // clients only ever RSA-encrypt to the server; a sealed payload here is bogus
+    if (p->len > MAX_ENCRYPTED_PAYLOAD || packet_is_sealed(p)) {
+        pool_put(&job_pool, job);
+        return;
+    }
+
+    char *msg = arena_alloc(p->len + 1);
+    if (!msg || packet_decrypt(p, s_d, s_n, msg, p->len + 1) < 0) {
+        arena_reset();
+        pool_put(&job_pool, job);
+        return;
+    }
+
+#ifdef RMS_ALLOC_HOOK
+    uint64_t allocs = alloc_hook_count();
+#endif
+
+    capture_packet(job, msg);
+    printf("\n• Received from [%s | %lu] (cmd=%d, channel=%lu): %s\n",
+           u->username, u->user_id,
+           p->command_type, p->channel_id,
+           msg);
+
+    switch (p->command_type) {
+        case CMD_MESSAGE:
+            handle_message(u, p, msg);
+            break;
+        case CMD_CHANNEL_CREATE:
+            handle_channel_create(u, msg);
+            break;
+        case CMD_CHANNEL_JOIN:
+            handle_channel_join(u, msg);
+            break;
+        case CMD_SYNC:
+            handle_sync(u, p);
+            break;
+        case CMD_HISTORY:
+            handle_history(u, msg);
+            break;
+        case CMD_GROUP_KEY:
+            handle_group_key(u, p);
+            break;
+        case CMD_SEARCH:
+            handle_search(u, msg);
+            break;
+        case CMD_LIST_CHANNELS:
+            handle_list_channels(u, msg);
+            break;
+        case CMD_LIST_MEMBERS:
+            handle_list_members(u, msg);
+            break;
+        case CMD_CHANNEL_INFO:
+            handle_channel_info(u, msg);
+            break;
+        case CMD_BATCH:
+            handle_batch(u, msg);
+            break;
+        case CMD_PING:
+            handle_ping(u, p);
+            break;
+        case CMD_HEARTBEAT:
+            break; // the read already counted as activity
+        default:
+            printf("• Unknown command %d\n", p->command_type);
+    }
+
+#ifdef RMS_ALLOC_HOOK
+    // the message path is meant to run entirely on the arena and the pools
+    if (p->command_type == CMD_MESSAGE && alloc_hook_count() != allocs)
+        printf("[ALLOC] %" PRIu64 " heap call(s) while handling a message\n", alloc_hook_count() - allocs);
+#endif
+
+    arena_reset();
+    pool_put(&job_pool, job);
+}
+
+// queued behind the connection's pending commands so their replies go out first
+void close_connection(void *arg) {
+    struct client *u = arg;
+
+    capture_logout(u);
+    timer_cancel(&client_conn(u)->idle);
+    struct shm_link *shm = client_conn(u)->shm;
+    conn_set_shm(client_conn(u), NULL);
+    shm_release(shm);
+    close(u->socket_fd);
+    lockprof_lock(&u_lock);
+    u->socket_fd = -1;
+    lockprof_unlock(&u_lock);
+}
+
+/*
+ * Admission at decode, before any RSA, disk or fan-out work. A packet over
+ * its user's budget waits up to rate_delay_ms; the reader stops meanwhile,
+ * so TCP pushes back on that client alone. File chunks wait as long as it
+ * takes, since dropping one would ruin the upload. Returns -1 to drop.
+ */
+int admit(struct client *u, const struct encrypted_packet *p) {
+    struct connection *c = client_conn(u);
+    int cls = rate_class(p->command_type);
+    uint64_t waited = 0;
+
+    // probes measure the queue; holding them back would measure the limiter
+    if (p->command_type == CMD_PING || p->command_type == CMD_HEARTBEAT)
+        return 0;
+
+    for (;;) {
+        uint64_t now = rate_now_ns();
+        uint64_t wait = bucket_take(&c->buckets[cls], &rates[cls], now);
+        // chunks name their channel in the header; messages are charged once resolved
+        if (wait == 0 && cls == RATE_FILE)
+            wait = channel_bucket_take(p->channel_id, &channel_rate, now);
+        if (wait == 0)
+            return 0;
+
+        if (cls != RATE_FILE && waited + wait > (uint64_t)rate_delay_ms * 1000000) {
+            rate_notice(u, cls == RATE_MESSAGE ? "messages" : "commands");
+            return -1;
+        }
+        struct timespec ts = { .tv_sec = (time_t)(wait / 1000000000), .tv_nsec = (long)(wait % 1000000000) };
+        nanosleep(&ts, NULL);
+        waited += wait;
+    }
+}
+
+void send_heartbeat(void *arg) {
+    send_control(arg, CMD_HEARTBEAT, 0);
+}
+
+/*
+ * A connection's one timer. Reads only stamp last_active; when the timer
+ * comes due it works out how long the connection has really been quiet
+ * and re-arms for the rest. Past heartbeat_ms it sends one heartbeat,
+ * which a live client answers; past idle_ms it shuts the socket down, so
+ * the reader's recv fails and the slot is released the usual way.
+ */
+unsigned conn_timer(struct timer *t) {
+    struct connection *c = (struct connection *)((char *)t - offsetof(struct connection, idle));
+    struct client *u = &users[c - conns];
+    uint64_t now = timer_wheel_ms(), last = atomic_load(&c->last_active);
+    uint64_t quiet = now - last;
+
+    if (quiet >= idle_ms) {
+        // close_connection cancels this timer before closing, so the fd is still the connection's
+        lockprof_lock(&u_lock);
+        int fd = u->socket_fd;
+        lockprof_unlock(&u_lock);
+        if (fd >= 0) {
+            printf("• %s sent nothing for %u s, disconnecting.\n", u->username, idle_ms / 1000);
+            shutdown(fd, SHUT_RDWR);
+        }
+        return 0;
+    }
+
+    // one heartbeat per quiet spell: anything read since the last one ends the spell
+    if (heartbeat_ms && quiet >= heartbeat_ms) {
+        if (last >= c->probed_at && sched_submit(&c->strand, send_heartbeat, u) == 0)
+            c->probed_at = now;
+        return idle_ms - (unsigned)quiet;
+    }
+
+    return (heartbeat_ms ? heartbeat_ms : idle_ms) - (unsigned)quiet;
+}
+
+/*
+ * I/O loop for one connection: it only reads packets and hands them to the
+ * handler pool, so decryption and broadcast fan-out never hold up reads.
+ */
+void *worker(void *arg) {
+    struct client *u = arg;
+    if (!u) 
+        return NULL;
+
+    struct connection *c = client_conn(u);
+    struct strand *strand = &c->strand;
+    atomic_store(&c->last_active, timer_wheel_ms());
+    c->probed_at = 0;
+    if (idle_ms)
+        timer_arm(&c->idle, heartbeat_ms ? heartbeat_ms : idle_ms);
+
+    for (;;){
+        struct job *job = pool_get(&job_pool);
+        if (!job) {
+            sleep(1);
+            continue;
+        }
+        job->u = u;
+
+        // the link is only taken back by close_connection, which runs after this loop ends
+        ssize_t rec = c->shm ? shm_packet_recv(c->shm, &job->p) : packet_recv(u->socket_fd, &job->p);
+        printf("sizeof(encrypted_packet) = %zu\n", sizeof(struct encrypted_packet));
+        if (rec > 0)
+            atomic_store_explicit(&c->last_active, timer_wheel_ms(), memory_order_relaxed);
+
+        if (rec <= 0) {
+            pool_put(&job_pool, job);
+            printf("• User %s disconnected.\n", u->username);
+            while (sched_submit(strand, close_connection, u) < 0)
+                sleep(1);
+            return NULL;
+        }
+
+        if (trace_enabled())
+            job->arrived_us = trace_now_us();
+
+        if (admit(u, &job->p) < 0) {
+            pool_put(&job_pool, job);
+            continue;
+        }
+
+        if (sched_submit(strand, process_packet, job) < 0) {
+            printf("[ERROR] Dropping packet from %s: scheduler out of memory\n", u->username);
+            pool_put(&job_pool, job);
+        }
     }
 }
 
@@ -505,24 +2295,129 @@ void load_credentials(){
     printf("• Finished loading credentials. Total users: %d...\n\n", num_users);
 }
 
-int s_init(int port) {
+// follower: a user registered on the leader
+void apply_credential(uint64_t user_id, const char *username, const char *password) {
+    struct client u = {0};
+    strncpy(u.username, username, sizeof(u.username) - 1);
+    strncpy(u.password, password, sizeof(u.password) - 1);
+    u.user_id = user_id;
+    u.socket_fd = -1;
+    if (u.username[0] == '\0' || u.password[0] == '\0' || insert_user(&u) != 0)
+        return;
+
+    lockprof_lock(&u_lock);
+    fprintf(cred_file, "%s %s %" PRIu64 "\n", u.username, u.password, u.user_id);
+    fflush(cred_file);
+    lockprof_unlock(&u_lock);
+}
+
+// leader: every known user, for a follower's snapshot
+void dump_credentials(void) {
+    struct client *known = malloc(sizeof(users));
+    if (!known)
+        return;
+    lockprof_lock(&u_lock);
+    memcpy(known, users, sizeof(users));
+    lockprof_unlock(&u_lock);
+
+    for (int i = 0; i < CLIENTS_LIMIT; i++) {
+        if (known[i].username[0] != '\0')
+            replica_log_credential(known[i].user_id, known[i].username, known[i].password);
+    }
+    free(known);
+}
+
+int env_int(const char *name, int fallback, int min, int max) {
+    const char *v = getenv(name);
+    if (!v || !*v)
+        return fallback;
+
+    char *end;
+    long n = strtol(v, &end, 10);
+    if (*end != '\0' || n < min || n > max) {
+        printf("[ERROR] Ignoring %s=%s (expected %d..%d)\n", name, v, min, max);
+        return fallback;
+    }
+    return (int)n;
+}
+
+void env_rate(const char *name, struct rate *r) {
+    const char *v = getenv(name);
+    if (v && *v && rate_parse(v, r) < 0)
+        printf("[ERROR] Ignoring %s=%s (expected per_second[/burst], 0 for no limit)\n", name, v);
+}
+
+void print_rate(const char *what, const struct rate *r) {
+    if (r->per_sec > 0)
+        printf("%s %g/s (burst %g)", what, r->per_sec, r->burst);
+    else
+        printf("%s unlimited", what);
+}
+
+/*
+ * Every acceptor binds its own SO_REUSEPORT socket so the kernel spreads
+ * incoming SYNs across them instead of queueing everything behind one
+ * accept() loop.
+ */
+int s_listen(int port, int backlog) {
     struct sockaddr_in serv = {0};
     serv.sin_family = AF_INET;
     serv.sin_port = htons(port);
     serv.sin_addr.s_addr = htonl(INADDR_ANY);
 
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (fd < 0) return -1;
 
     int opt = 1;
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        close(fd);
+        return -1;
+    }
 
-    if (bind(fd, (struct sockaddr *)&serv, sizeof(serv)) < 0) 
+    if (bind(fd, (struct sockaddr *)&serv, sizeof(serv)) < 0 || listen(fd, backlog) < 0) {
+        close(fd);
         return -1;
-    if (listen(fd, CLIENTS_LIMIT) < 0) 
+    }
+
+    return fd;
+}
+
+int s_listen_unix(const char *path, int backlog) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
         return -1;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    // a socket left behind by an earlier run would fail the bind; anything else is not ours to remove
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int s_init(int port) {
+    // several nodes: each mints ids in its own shard range, so ids never collide across them
+    const char *nodes = getenv("RMS_NODES");
+    int node_id = env_int("RMS_NODE_ID", 0, 0, FED_MAX_NODES - 1);
+    if (nodes && *nodes)
+        id_set_shard_range((unsigned)node_id * ((1u << ID_SHARD_BITS) / FED_MAX_NODES),
+                           (1u << ID_SHARD_BITS) / FED_MAX_NODES);
 
     for (int i = 0; i < CLIENTS_LIMIT; i++){
+        strand_init(&conns[i].strand);
+        pthread_mutex_init(&conns[i].send_lock, NULL);
+        timer_init(&conns[i].idle, conn_timer);
         users[i].socket_fd = -1;
         users[i].username[0] = '\0';
         users[i].password[0] = '\0';
@@ -538,13 +2433,386 @@ int s_init(int port) {
     }
 
     load_credentials();
-    return fd;
+
+    int workers = sched_init(env_int("RMS_WORKERS", 0, 0, SCHED_MAX_WORKERS));
+    if (workers < 0) {
+        printf("• Failed to start handler pool.\n");
+        return -1;
+    }
+    printf("• Handler pool running on %d worker(s).\n", workers);
+
+    io_init();
+    printf("• I/O backend: %s\n", io_backend_name());
+
+    if (search_init() < 0) {
+        printf("• Failed to start search indexer.\n");
+        return -1;
+    }
+
+    struct channel_recovery rec;
+    if (channel_recover(&cm, env_int("RMS_LOAD_THREADS", 0, 0, 256), &rec) < 0) {
+        printf("• Failed to scan for channel files.\n");
+        return -1;
+    }
+    printf("• Loaded %d of %d channel file(s) in %.1f ms on %d thread(s)", rec.loaded, rec.files, rec.elapsed_ms, rec.threads);
+    if (rec.legacy || rec.repaired || rec.damaged || rec.skipped)
+        printf(" (%d converted, %d repaired, %d damaged, %d over the %d channel limit)",
+               rec.legacy, rec.repaired, rec.damaged, rec.skipped, MAX_CHANNELS);
+    printf(".\n");
+
+    int resident = env_int("RMS_RESIDENT_CHANNELS", RESIDENT_CHANNELS_DEFAULT, 0, MAX_CHANNELS);
+    int idle = env_int("RMS_CHANNEL_IDLE", CHANNEL_IDLE_DEFAULT, 0, 86400);
+    if (channel_set_residency(&cm, resident, idle) < 0) {
+        printf("• Failed to start channel sweeper.\n");
+        return -1;
+    }
+    printf("• Message history resident for up to %d channel(s)", resident ? resident : MAX_CHANNELS);
+    if (idle)
+        printf(", evicted after %ds idle", idle);
+    printf(".\n");
+
+    if (nodes && *nodes) {
+        if (fed_init(node_id, nodes, getenv("RMS_FED_SECRET"), fed_handle) < 0) {
+            printf("• Failed to join federation %s as node %d (RMS_FED_SECRET must be set, 16+ characters).\n",
+                   nodes, node_id);
+            return -1;
+        }
+        printf("• Federated as node %d of %d.\n", fed_self(), fed_node_count());
+    }
+
+    env_rate("RMS_RATE_MESSAGE", &rates[RATE_MESSAGE]);
+    env_rate("RMS_RATE_FILE", &rates[RATE_FILE]);
+    env_rate("RMS_RATE_COMMAND", &rates[RATE_COMMAND]);
+    env_rate("RMS_RATE_CHANNEL", &channel_rate);
+    rate_delay_ms = env_int("RMS_RATE_DELAY_MS", RATE_DELAY_DEFAULT_MS, 0, 10000);
+    print_rate("• Rate limits per user: messages", &rates[RATE_MESSAGE]);
+    print_rate(", file chunks", &rates[RATE_FILE]);
+    print_rate(", commands", &rates[RATE_COMMAND]);
+    print_rate("; per channel", &channel_rate);
+    printf("; held up to %d ms before dropping.\n", rate_delay_ms);
+
+    int every = env_int("RMS_LOCKPROF", 0, 0, 1 << 20);
+    if (every)
+        lockprof_rate = (unsigned)every;
+    lockprof_enable((unsigned)every);
+    if (every)
+        printf("• Lock profiling on, 1 in %d acquisitions per thread (kill -USR2 %d to report).\n", every, (int)getpid());
+    else
+        printf("• Lock profiling off (kill -USR1 %d to start, -USR2 to report).\n", (int)getpid());
+
+    heartbeat_ms = (unsigned)env_int("RMS_HEARTBEAT", HEARTBEAT_DEFAULT, 0, 86400) * 1000;
+    idle_ms = (unsigned)env_int("RMS_IDLE_TIMEOUT", IDLE_TIMEOUT_DEFAULT, 0, 86400) * 1000;
+    login_ms = (unsigned)env_int("RMS_LOGIN_TIMEOUT", LOGIN_TIMEOUT_DEFAULT, 0, 3600) * 1000;
+    upload_ms = (unsigned)env_int("RMS_UPLOAD_TIMEOUT", UPLOAD_TIMEOUT_DEFAULT, 0, 86400) * 1000;
+    if (heartbeat_ms >= idle_ms)
+        heartbeat_ms = 0; // it would never come before the connection is dropped
+    strand_init(&upload_strand);
+    if (timer_wheel_start() < 0) {
+        printf("• Failed to start the timer wheel.\n");
+        return -1;
+    }
+    if (idle_ms && heartbeat_ms)
+        printf("• Heartbeat after %us quiet, connection dropped after %us", heartbeat_ms / 1000, idle_ms / 1000);
+    else if (idle_ms)
+        printf("• No heartbeats, connection dropped after %us quiet", idle_ms / 1000);
+    else
+        printf("• Idle connections kept");
+    printf("; login deadline %us, stalled uploads discarded after %us (0 = never).\n", login_ms / 1000, upload_ms / 1000);
+
+    const char *capture = getenv("RMS_CAPTURE");
+    if (capture && *capture) {
+        if (trace_open(capture) < 0) {
+            printf("• Failed to open capture file %s.\n", capture);
+            return -1;
+        }
+        // channels that predate the capture, so the replay can still place their ids
+        lockprof_lock(&cm.lock);
+        for (int i = 0; i < cm.channel_count; i++)
+            if (!cm.channels[i].remote)
+                capture_channel(cm.channels[i].channel_id, cm.channels[i].channel_name);
+        lockprof_unlock(&cm.lock);
+        printf("• Capturing inbound commands to %s.\n", capture);
+    }
+
+    if (!env_int("RMS_COMPRESS", 1, 0, 1))
+        server_features &= ~SESSION_FEATURE_LZ;
+    printf("• Payload compression: %s\n", (server_features & SESSION_FEATURE_LZ) ? "offered" : "off");
+
+    // a standby leaves the port to the leader until it takes over
+    const char *leader = getenv("RMS_FOLLOW");
+    if (leader && *leader) {
+        printf("• Standing by for %s.\n", leader);
+        if (replica_follow(&cm, leader, getenv("RMS_REPLICA_SECRET"), apply_credential) < 0) {
+            printf("• Invalid RMS_FOLLOW=%s (expected host:port, and RMS_REPLICA_SECRET of 16+ characters).\n",
+                   leader);
+            return -1;
+        }
+    }
+
+    int replica_port = env_int("RMS_REPLICA_PORT", 0, 0, 65535);
+    if (replica_port) {
+        int sync_ms = env_int("RMS_REPLICA_SYNC_MS", 0, 0, 60000);
+        // the standby is normally on this host; a remote one needs the address set explicitly
+        const char *bind_host = getenv("RMS_REPLICA_BIND");
+        if (!bind_host || !*bind_host)
+            bind_host = "127.0.0.1";
+        if (replica_serve(&cm, bind_host, replica_port, getenv("RMS_REPLICA_SECRET"), sync_ms, dump_credentials) < 0) {
+            printf("• Failed to listen for a follower on %s:%d (RMS_REPLICA_SECRET must be set, 16+ characters).\n",
+                   bind_host, replica_port);
+            return -1;
+        }
+        if (sync_ms)
+            printf("• Replicating to a follower on %s:%d, semi-synchronous (up to %d ms).\n", bind_host, replica_port, sync_ms);
+        else
+            printf("• Replicating to a follower on %s:%d, asynchronous.\n", bind_host, replica_port);
+    }
+
+    num_acceptors = env_int("RMS_ACCEPTORS", ACCEPTORS_DEFAULT, 1, ACCEPTORS_MAX);
+    int backlog = env_int("RMS_BACKLOG", LISTEN_BACKLOG_DEFAULT, 1, 65535);
+
+    for (int i = 0; i < num_acceptors; i++) {
+        listen_fds[i] = s_listen(port, backlog);
+        if (listen_fds[i] < 0) {
+            perror("listen");
+            return -1;
+        }
+    }
+
+    printf("• Listening with %d acceptor(s), backlog %d.\n", num_acceptors, backlog);
+
+    // same commands as over TCP; a client here may also offer shared memory with its hello
+    if (!env_int("RMS_SHM", 1, 0, 1))
+        server_features &= ~SESSION_FEATURE_SHM;
+    const char *unix_path = getenv("RMS_UNIX_SOCKET");
+    if (unix_path && *unix_path) {
+        unix_listen_fd = s_listen_unix(unix_path, backlog);
+        if (unix_listen_fd < 0) {
+            perror("listen");
+            return -1;
+        }
+        printf("• Local clients on %s, shared memory %s.\n", unix_path,
+               (server_features & SESSION_FEATURE_SHM) ? "offered" : "off");
+    }
+    return 0;
+}
+
+/*
+ * Runs the handshake and login for a freshly accepted connection and hands
+ * it to its worker thread. The login deadline is cancelled before the
+ * hand-off. On failure the caller closes fd, after cancelling the deadline
+ * itself, so the timer can never shut down a recycled descriptor; it also
+ * releases *shm, which is left set until the link belongs to a slot.
+ */
+int accept_client(int fd, struct timer *login, struct shm_link **shm) {
+    struct client t = {0};
+    t.socket_fd = fd;
+    t.public_key_e = 0;
+    t.public_key_n = 0;
+
+    uint32_t features = 0;
+    int resumed = rsa_handshake(fd, &t, &features, shm);
+    if (resumed == -2) {
+        printf("• Malformed hello or public key from [%d], disconnecting.\n", fd);
+        return -1;
+    }
+    if (resumed >= 0) {
+        timer_cancel(login);
+        capture_login(&users[resumed]);
+        send_group_keys(&users[resumed]);
+        create_worker_thread(&users[resumed]);
+        return 0;
+    }
+
+    char *username = recv_decrypted(fd, s_d, s_n);
+    char *password = recv_decrypted(fd, s_d, s_n);
+    printf("• Received credentials from [%d]: Username='%s', Password='%s'\n",
+           fd,
+           username ? username : "NULL",
+           password ? password : "NULL");
+
+    if (!username || !password || strlen(username) >= USERNAME_SIZE || strlen(password) >= PASSWORD_SIZE) {
+        printf("• Invalid username/password from [%d], disconnecting.\n", fd);
+        free(username);
+        free(password);
+        return -1;
+    }
+
+    int idx = find_user_index_by_username(username);
+    struct client *u = NULL;
+    if (idx != -1) {
+        lockprof_lock(&u_lock);
+        if (!password_matches(users[idx].password, password)) {
+            lockprof_unlock(&u_lock);
+            printf("• Incorrect password for '%s' from [%d], disconnecting.\n", username, fd);
+            free(username);
+            free(password);
+            return -1;
+        }
+
+        if (users[idx].socket_fd != -1) {
+            lockprof_unlock(&u_lock);
+            printf("• User '%s' already connected, rejecting new connection from [%d].\n", username, fd);
+            free(username);
+            free(password);
+            return -1;
+        }
+
+        users[idx].socket_fd = fd;
+        users[idx].public_key_e = t.public_key_e;
+        users[idx].public_key_n = t.public_key_n;
+        conns[idx].features = features;
+        conn_set_shm(&conns[idx], *shm);
+        *shm = NULL;
+        lockprof_unlock(&u_lock);
+        u = &users[idx];
+        printf("• User '%s' reconnected from [%d].\n", username, fd);
+    } else {
+        strncpy(t.username, username, USERNAME_SIZE - 1);
+        strncpy(t.password, password, PASSWORD_SIZE - 1);
+        t.user_id = generate_id();
+        t.socket_fd = fd;
+
+        int rc = insert_user(&t);
+        if (rc < 0) {
+            if (rc == -2)
+                printf("• Username '%s' registered concurrently, rejecting [%d]\n", username, fd);
+            else
+                printf("• Max users reached, rejecting [%d]\n", fd);
+            free(username);
+            free(password);
+            return -1;
+        }
+
+        idx = find_user_index_by_username(username);
+        if (idx == -1) {
+            printf("• Unexpected insertion error for '%s'.\n", username);
+            free(username);
+            free(password);
+            return -1;
+        }
+
+        u = &users[idx];
+        lockprof_lock(&u_lock);
+        conns[idx].features = features;
+        conn_set_shm(&conns[idx], *shm);
+        *shm = NULL;
+        fprintf(cred_file, "%s %s %" PRIu64 "\n", u->username, u->password, u->user_id);
+        fflush(cred_file);
+        lockprof_unlock(&u_lock);
+        replica_log_credential(u->user_id, u->username, u->password);
+        replica_commit();
+        printf("• New user '%s' registered from [%d].\n", username, fd);
+    }
+
+    free(username);
+    free(password);
+
+    char user_id_str[32];
+    snprintf(user_id_str, sizeof(user_id_str), "%lu", (unsigned long)u->user_id);
+
+    send_encrypted(u, user_id_str);
+
+    // the ticket in the clear, then its secret encrypted to the client's key
+    struct session_ticket ticket;
+    uint8_t secret[SESSION_SECRET_SIZE];
+    char secret_text[SESSION_SECRET_SIZE * 2 + 1];
+    session_ticket_issue(&ticket, u->user_id, u->public_key_n, u->public_key_e);
+    session_ticket_secret(&ticket, secret);
+    session_secret_format(secret, secret_text);
+    client_send(u, &ticket, sizeof(ticket));
+    send_encrypted(u, secret_text);
+    memset(secret, 0, sizeof(secret));
+    memset(secret_text, 0, sizeof(secret_text));
+
+    timer_cancel(login);
+    capture_login(u);
+    send_group_keys(u);
+    create_worker_thread(u);
+    return 0;
+}
+
+// a client that stalls mid-login would otherwise hold its acceptor thread forever
+struct login_deadline {
+    struct timer timer;
+    int fd;
+};
+
+unsigned login_expired(struct timer *t) {
+    struct login_deadline *d = (struct login_deadline *)t;
+    printf("• Login from [%d] took over %u s, disconnecting.\n", d->fd, login_ms / 1000);
+    shutdown(d->fd, SHUT_RDWR);
+    return 0;
+}
+
+void *acceptor_thread(void *arg) {
+    int listen_fd = *(int *)arg;
+
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0){
+            perror("accept");
+            continue;
+        }
+
+        // replies are small and often follow one another; don't hold them for a delayed ACK (TCP only)
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct login_deadline deadline = { .fd = fd };
+        struct shm_link *shm = NULL;
+        timer_init(&deadline.timer, login_expired);
+        if (login_ms)
+            timer_arm(&deadline.timer, login_ms);
+        if (accept_client(fd, &deadline.timer, &shm) < 0) {
+            timer_cancel(&deadline.timer);
+            shm_release(shm);
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Operator controls arrive as signals so they reach a running server:
+ * SIGUSR1 switches lock profiling on or off, SIGUSR2 prints the profile
+ * and starts a fresh one. main blocks both before any thread exists and
+ * this thread takes them with sigwait, so none of it runs in a handler.
+ */
+void *control_thread(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        int sig;
+        if (sigwait(&control_signals, &sig) != 0)
+            continue;
+
+        if (sig == SIGUSR1 && lockprof_every()) {
+            lockprof_enable(0);
+            printf("• Lock profiling off.\n");
+        } else if (sig == SIGUSR1) {
+            lockprof_reset();
+            lockprof_enable(lockprof_rate);
+            printf("• Lock profiling on, 1 in %u acquisitions per thread.\n", lockprof_rate);
+        } else if (sig == SIGUSR2) {
+            lockprof_report(stdout, LOCKPROF_REPORT_TOP);
+            lockprof_reset();
+        }
+        fflush(stdout);
+    }
+    return NULL;
 }
 
 int main() {
+    sigemptyset(&control_signals);
+    sigaddset(&control_signals, SIGUSR1);
+    sigaddset(&control_signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &control_signals, NULL);
+
     srand(time(NULL));
     generate_rsa_keys(&s_n, &s_e, &s_d);
     channel_manager_init(&cm);
+    if (session_keys_init(SESSION_KEY_FILE) < 0)
+        printf("[ERROR] Could not initialise session ticket key; resumption disabled.\n");
 
     printf("• Generated RSA keys:\n");
     printf("• Public Key (n, e): (%ld, %ld)\n", s_n, s_e);
@@ -563,108 +2831,38 @@ int main() {
         return 1;
     }
 
-    server_fd = s_init(port);
-    if (server_fd < 0) {
+    if (s_init(port) < 0) {
         printf("\n• Server failed to start.\n");
         return 1;
     }
 
     printf("• Server started on port %d.\n", port);
-    for (;;) {
-        int fd = accept(server_fd, NULL, NULL);
-        if (fd < 0){
-            perror("accept");
-            continue;
-        }
-
-        struct client t = {0};
-        t.socket_fd = fd;
-        t.public_key_e = 0;
-        t.public_key_n = 0;
-
-        rsa_handshake(fd, &t);
-
-        char *username = recv_decrypted(fd, s_d, s_n);
-        char *password = recv_decrypted(fd, s_d, s_n);
-        printf("• Received credentials from [%d]: Username='%s', Password='%s'\n",
-               fd,
-               username ? username : "NULL",
-               password ? password : "NULL");
 
-        if (!username || !password || strlen(username) >= USERNAME_SIZE || strlen(password) >= PASSWORD_SIZE) {
-            printf("• Invalid username/password from [%d], disconnecting.\n", fd);
-            close(fd);
-            free(username);
-            free(password);
-            continue;
+    pthread_t control;
+    if (pthread_create(&control, NULL, control_thread, NULL) == 0)
+        pthread_detach(control);
+    else
+        printf("[ERROR] Failed to start the control thread; SIGUSR1/SIGUSR2 are ignored.\n");
+
+    pthread_t acceptors[ACCEPTORS_MAX];
+    for (int i = 0; i < num_acceptors; i++) {
+        if (pthread_create(&acceptors[i], NULL, acceptor_thread, &listen_fds[i]) != 0) {
+            printf("[ERROR] Failed to start acceptor %d\n", i);
+            return 1;
         }
+    }
 
-        int idx = find_user_index_by_username(username);
-        struct client *u = NULL;
-        if (idx != -1) {
-            pthread_mutex_lock(&u_lock);
-            if (strcmp(users[idx].password, password) != 0) {
-                pthread_mutex_unlock(&u_lock);
-                printf("• Incorrect password for '%s' from [%d], disconnecting.\n", username, fd);
-                close(fd);
-                free(username);
-                free(password);
-                continue;
-            }
-
-            if (users[idx].socket_fd != -1) {
-                pthread_mutex_unlock(&u_lock);
-                printf("• User '%s' already connected, rejecting new connection from [%d].\n", username, fd);
-                close(fd);
-                free(username);
-                free(password);
-                continue;
-            }
-
-            users[idx].socket_fd = fd;
-            users[idx].public_key_e = t.public_key_e;
-            users[idx].public_key_n = t.public_key_n;
-            pthread_mutex_unlock(&u_lock);
-            u = &users[idx];
-            printf("• User '%s' reconnected from [%d].\n", username, fd);
-        } else {
-            strncpy(t.username, username, USERNAME_SIZE - 1);
-            strncpy(t.password, password, PASSWORD_SIZE - 1);
-            t.user_id = generate_uuid(8);
-            t.socket_fd = fd;
-
-            if (insert_user(&t) < 0) {
-                printf("• Max users reached, rejecting [%d]\n", fd);
-                close(fd);
-                free(username);
-                free(password);
-                continue;
-            }
-
-            idx = find_user_index_by_username(username);
-            if (idx == -1) {
-                printf("• Unexpected insertion error for '%s'.\n", username);
-                close(fd);
-                free(username);
-                free(password);
-                continue;
-            }
-
-            u = &users[idx];
-            pthread_mutex_lock(&u_lock);
-            fprintf(cred_file, "%s %s %" PRIu64 "\n", u->username, u->password, u->user_id);
-            fflush(cred_file);
-            pthread_mutex_unlock(&u_lock);
-            printf("• New user '%s' registered from [%d].\n", username, fd);
+    pthread_t local;
+    if (unix_listen_fd >= 0) {
+        if (pthread_create(&local, NULL, acceptor_thread, &unix_listen_fd) != 0) {
+            printf("[ERROR] Failed to start the local acceptor\n");
+            return 1;
         }
+        pthread_detach(local);
+    }
 
-        free(username);
-        free(password);
-
-        char user_id_str[32];
-        snprintf(user_id_str, sizeof(user_id_str), "%lu", (unsigned long)u->user_id);
+    for (int i = 0; i < num_acceptors; i++)
+        pthread_join(acceptors[i], NULL);
 
-        send_encrypted(u->socket_fd, user_id_str, u->public_key_e, u->public_key_n);
-        create_worker_thread(u);
-    }
-}
\ No newline at end of file
+    return 0;
+}
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+
+#include "siphash.h"
+#include "session.h"
+
+static uint8_t ticket_key[SIPHASH_KEY_SIZE];
+static atomic_uint_fast64_t ticket_counter;
+
+// labels keeping the PRF's uses apart
+enum { DERIVE_SECRET = 'S', DERIVE_SEAL = 'W' };
+
+// RESUME hellos already taken; one stops mattering once its clock falls out of the window
+struct seen_hello {
+    uint64_t ticket_nonce;
+    uint64_t client_nonce;
+    uint64_t sent_at;
+};
+
+static struct seen_hello seen[SESSION_REPLAY_SLOTS];
+static pthread_mutex_t seen_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int read_exact(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t r = read(fd, p, len);
+        if (r <= 0)
+            return -1;
+        p += r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+/*
+ * The ticket key is persisted so tickets survive a server restart,
+ * which is exactly when every client reconnects at once.
+ */
+int session_keys_init(const char *key_path) {
+    int fd = open(key_path, O_RDONLY);
+    if (fd >= 0) {
+        int rc = read_exact(fd, ticket_key, sizeof(ticket_key));
+        close(fd);
+        if (rc == 0)
+            goto seeded;
+    }
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read_exact(fd, ticket_key, sizeof(ticket_key)) < 0) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    close(fd);
+
+    fd = open(key_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0) {
+        if (write(fd, ticket_key, sizeof(ticket_key)) != (ssize_t)sizeof(ticket_key))
+            printf("[ERROR] Could not persist ticket key to %s\n", key_path);
+        close(fd);
+    }
+
+seeded:
+    atomic_store(&ticket_counter, (uint64_t)time(NULL) << 20);
+    return 0;
+}
+
+static uint64_t ticket_mac(const struct session_ticket *t) {
+    return siphash24(ticket_key, t, offsetof(struct session_ticket, mac));
+}
+
+void session_ticket_issue(struct session_ticket *t, uint64_t user_id, long n, long e) {
+    memset(t, 0, sizeof(*t));
+    t->user_id = user_id;
+    t->public_key_n = n;
+    t->public_key_e = e;
+    t->issued_at = (uint64_t)time(NULL);
+    t->expires_at = t->issued_at + SESSION_TICKET_LIFETIME;
+    t->nonce = atomic_fetch_add(&ticket_counter, 1);
+    t->mac = ticket_mac(t);
+}
+
+int session_ticket_verify(const struct session_ticket *t) {
+    if (t->mac != ticket_mac(t))
+        return -1;
+    if ((uint64_t)time(NULL) >= t->expires_at)
+        return -2;
+    if (t->public_key_n <= 0 || t->public_key_e <= 0)
+        return -3;
+    return 0;
+}
+
+void session_ticket_secret(const struct session_ticket *t, uint8_t secret[SESSION_SECRET_SIZE]) {
+    for (uint64_t half = 0; half < 2; half++) {
+        struct { struct session_ticket t; uint64_t label; } in = { *t, ((uint64_t)DERIVE_SECRET << 8) | half };
+        uint64_t h = siphash24(ticket_key, &in, sizeof(in));
+        memcpy(secret + 8 * half, &h, sizeof(h));
+    }
+}
+
+// covers everything in the hello but the proof itself
+static uint64_t resume_proof(const uint8_t secret[SESSION_SECRET_SIZE], const struct session_hello *h) {
+    struct {
+        struct session_ticket ticket;
+        uint64_t client_nonce, sent_at, mode, features;
+    } in = { h->ticket, h->client_nonce, h->sent_at, h->mode, h->features };
+    return siphash24(secret, &in, sizeof(in));
+}
+
+int session_resume_sign(struct session_hello *h, const uint8_t secret[SESSION_SECRET_SIZE]) {
+    if (getrandom(&h->client_nonce, sizeof(h->client_nonce), 0) != (ssize_t)sizeof(h->client_nonce))
+        return -1;
+    h->sent_at = (uint64_t)time(NULL);
+    h->proof = resume_proof(secret, h);
+    return 0;
+}
+
+// 0 the first time a hello is offered, -1 for a replay or while the table is full of live ones
+static int take_hello(const struct session_hello *h, uint64_t now) {
+    pthread_mutex_lock(&seen_lock);
+    struct seen_hello *oldest = &seen[0];
+    for (int i = 0; i < SESSION_REPLAY_SLOTS; i++) {
+        struct seen_hello *e = &seen[i];
+        if (e->sent_at && e->ticket_nonce == h->ticket.nonce && e->client_nonce == h->client_nonce) {
+            pthread_mutex_unlock(&seen_lock);
+            return -1;
+        }
+        if (e->sent_at < oldest->sent_at)
+            oldest = e;
+    }
+
+    int rc = -1;
+    if (oldest->sent_at + SESSION_RESUME_WINDOW < now) {
+        *oldest = (struct seen_hello){ h->ticket.nonce, h->client_nonce, h->sent_at };
+        rc = 0;
+    }
+    pthread_mutex_unlock(&seen_lock);
+    return rc;
+}
+
+int session_resume_check(const struct session_hello *h) {
+    if (session_ticket_verify(&h->ticket) != 0)
+        return -1;
+
+    uint64_t now = (uint64_t)time(NULL);
+    if (h->sent_at + SESSION_RESUME_WINDOW < now || h->sent_at > now + SESSION_RESUME_WINDOW)
+        return -1;
+
+    uint8_t secret[SESSION_SECRET_SIZE];
+    session_ticket_secret(&h->ticket, secret);
+    // compared without branching on where they differ
+    int ok = (resume_proof(secret, h) ^ h->proof) == 0;
+    memset(secret, 0, sizeof(secret));
+    return ok ? take_hello(h, now) : -1;
+}
+
+void session_secret_seal(const uint8_t key[SESSION_SECRET_SIZE], uint64_t client_nonce,
+                         const uint8_t in[SESSION_SECRET_SIZE], uint8_t out[SESSION_SECRET_SIZE]) {
+    for (uint64_t half = 0; half < 2; half++) {
+        struct { uint64_t nonce, label; } pad_in = { client_nonce, ((uint64_t)DERIVE_SEAL << 8) | half };
+        uint64_t pad = siphash24(key, &pad_in, sizeof(pad_in));
+        for (int i = 0; i < 8; i++)
+            out[8 * half + i] = in[8 * half + i] ^ (uint8_t)(pad >> (8 * i));
+    }
+}
+
+void session_secret_format(const uint8_t secret[SESSION_SECRET_SIZE], char out[SESSION_SECRET_SIZE * 2 + 1]) {
+    for (int i = 0; i < SESSION_SECRET_SIZE; i++)
+        snprintf(out + 2 * i, 3, "%02x", secret[i]);
+}
+
+int session_secret_parse(const char *text, uint8_t secret[SESSION_SECRET_SIZE]) {
+    if (strlen(text) != SESSION_SECRET_SIZE * 2)
+        return -1;
+    for (int i = 0; i < SESSION_SECRET_SIZE; i++) {
+        unsigned byte;
+        if (sscanf(text + 2 * i, "%2x", &byte) != 1)
+            return -1;
+        secret[i] = (uint8_t)byte;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <stdint.h>
+
+#ifndef RMS_SESSION_H
+#define RMS_SESSION_H
+
+#define SESSION_MAGIC 0x524d5331 // "RMS1"
+#define SESSION_TICKET_LIFETIME (12 * 60 * 60) // 12 hours
+#define SESSION_KEY_FILE "ticket_key"
+#define SESSION_SECRET_SIZE 16
+#define SESSION_RESUME_WINDOW 60    // seconds either side of the server's clock a RESUME hello is good for
+#define SESSION_REPLAY_SLOTS 1024   // RESUME hellos remembered, so none is accepted twice
+
+// hello.mode
+#define SESSION_MODE_FULL 0
+#define SESSION_MODE_RESUME 1
+
+// hello.features / reply.features: optional wire features, the server
+// answers with the subset of the client's offer it will use
+#define SESSION_FEATURE_LZ (1u << 0)
+// the hello is followed by a shared-memory offer (shm_ring.h); Unix socket only
+#define SESSION_FEATURE_SHM (1u << 1)
+
+// reply.status
+#define SESSION_STATUS_FULL 0
+#define SESSION_STATUS_RESUMED 1
+
+/*
+ * Resumption ticket handed to a client after a successful login.
+ * It binds the user id to the client's public key and carries an
+ * expiry; the mac is SipHash over every other field keyed with a
+ * server-held secret, so the client can store it but not forge it.
+ *
+ * The ticket travels in the clear, so holding one proves nothing. Each
+ * ticket also has a resumption secret, derived from it with the server's
+ * key (the server keeps no state per ticket). The client gets the secret
+ * RSA-encrypted at login, right behind the ticket, and proves it holds
+ * the secret with a MAC in the RESUME hello.
+ */
+struct session_ticket {
+    uint64_t user_id;
+    long public_key_n;
+    long public_key_e;
+    uint64_t issued_at;
+    uint64_t expires_at;
+    uint64_t nonce;
+    uint64_t mac;
+};
+
+/*
+ * First thing a client sends after connect(). mode selects between the
+ * full RSA handshake + credential exchange and ticket resumption. For a
+ * RESUME, proof is a MAC under the ticket's secret over the ticket, a
+ * fresh client nonce and the client's clock; the server takes each proof
+ * once, and only within SESSION_RESUME_WINDOW, so a captured hello can't
+ * be played back.
+ */
+struct session_hello {
+    uint32_t magic;
+    uint32_t mode;
+    uint32_t features;
+    struct session_ticket ticket;
+    uint64_t client_nonce;
+    uint64_t sent_at;
+    uint64_t proof;
+};
+
+/*
+ * Server answer to a hello. The server's current public key is always
+ * included, so a client that falls back to a full login needs no extra
+ * round trip for it. On SESSION_STATUS_RESUMED, user_id and a refreshed
+ * ticket are valid, and secret_box holds the new ticket's secret sealed
+ * under the old one (see session_secret_seal).
+ */
+struct session_reply {
+    uint32_t status;
+    uint32_t features;
+    uint64_t user_id;
+    long server_n;
+    long server_e;
+    struct session_ticket ticket;
+    uint8_t secret_box[SESSION_SECRET_SIZE];
+};
+
+int session_keys_init(const char *key_path);
+void session_ticket_issue(struct session_ticket *t, uint64_t user_id, long n, long e);
+int session_ticket_verify(const struct session_ticket *t);
+// server side: the secret that goes with t
+void session_ticket_secret(const struct session_ticket *t, uint8_t secret[SESSION_SECRET_SIZE]);
+
+// client side: fills in the hello's nonce, clock and proof for its ticket
+int session_resume_sign(struct session_hello *h, const uint8_t secret[SESSION_SECRET_SIZE]);
+// server side: 0 if the ticket is good and the proof fresh, correct and not seen before
+int session_resume_check(const struct session_hello *h);
+
+// the secret as it is sent at login: SESSION_SECRET_SIZE * 2 hex digits, RSA-encrypted like any text
+void session_secret_format(const uint8_t secret[SESSION_SECRET_SIZE], char out[SESSION_SECRET_SIZE * 2 + 1]);
+int session_secret_parse(const char *text, uint8_t secret[SESSION_SECRET_SIZE]);
+
+// seals (or, run again, opens) a ticket secret under the previous one, for the hello with this nonce
+void session_secret_seal(const uint8_t key[SESSION_SECRET_SIZE], uint64_t client_nonce,
+                         const uint8_t in[SESSION_SECRET_SIZE], uint8_t out[SESSION_SECRET_SIZE]);
+
+#endif //RMS_SESSION_H
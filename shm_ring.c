@@ -0,0 +1,340 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include "shm_ring.h"
+#include "wire.h"
+
+#define SHM_MASK (SHM_RING_SIZE - 1)
+#define SHM_TAG 'S'          // the one byte the descriptors ride on
+#define SHM_FULL_WAIT_NS 20000 // a writer facing a full ring rechecks this often
+
+// spinning only pays while the peer runs on another CPU; on one it just burns the peer's time slice
+static int spin_limit(void) {
+    static atomic_int limit = -1;
+    int n = atomic_load_explicit(&limit, memory_order_relaxed);
+    if (n < 0) {
+        n = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN : 0;
+        atomic_store_explicit(&limit, n, memory_order_relaxed);
+    }
+    return n;
+}
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void close_fds(int *fds, int n) {
+    for (int i = 0; i < n; i++)
+        if (fds[i] >= 0)
+            close(fds[i]);
+}
+
+static void copy_in(struct shm_ring *r, uint64_t at, const void *buf, size_t len) {
+    size_t off = at & SHM_MASK, first = SHM_RING_SIZE - off;
+    if (first > len)
+        first = len;
+    memcpy(r->data + off, buf, first);
+    memcpy(r->data, (const uint8_t *)buf + first, len - first);
+}
+
+static void copy_out(const struct shm_ring *r, uint64_t at, void *buf, size_t len) {
+    size_t off = at & SHM_MASK, first = SHM_RING_SIZE - off;
+    if (first > len)
+        first = len;
+    memcpy(buf, r->data + off, first);
+    memcpy((uint8_t *)buf + first, r->data, len - first);
+}
+
+// 1 if need bytes are waiting, 0 if not yet, -1 if the peer's tail makes no sense
+static int readable(struct shm_link *l, size_t need) {
+    uint64_t avail = atomic_load_explicit(&l->rx->tail, memory_order_acquire) - l->rx_head;
+    if (avail > SHM_RING_SIZE)
+        return -1;
+    return avail >= need;
+}
+
+static void consume(struct shm_link *l, size_t len) {
+    l->rx_head += len;
+    atomic_store_explicit(&l->rx->head, l->rx_head, memory_order_release);
+}
+
+static void drain_event(struct shm_link *l) {
+    uint64_t v;
+    (void)!read(l->rx_event, &v, sizeof(v));
+}
+
+// the socket carries nothing after the switch, so anything on it means the peer is gone
+static int peer_gone(struct shm_link *l) {
+    struct pollfd pfd = { .fd = l->sock, .events = POLLIN };
+    return poll(&pfd, 1, 0) != 0;
+}
+
+int shm_link_offer(struct shm_link *l, int sock) {
+    memset(l, 0, sizeof(*l));
+    l->sock = sock;
+
+    int fds[3] = {
+        memfd_create("rms-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING),
+        eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK), // to the server
+        eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK), // to the client
+    };
+    // sealed, so the server can map it without fearing it shrinks under it
+    if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 || ftruncate(fds[0], sizeof(struct shm_region)) < 0 ||
+        fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        close_fds(fds, 3);
+        return -1;
+    }
+
+    struct shm_region *region = mmap(NULL, sizeof(*region), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (region == MAP_FAILED) {
+        close_fds(fds, 3);
+        return -1;
+    }
+    // a new memfd reads as zeros, so both rings start out empty
+    region->magic = SHM_MAGIC;
+    region->ring_size = SHM_RING_SIZE;
+
+    char tag = SHM_TAG;
+    struct iovec iov = { .iov_base = &tag, .iov_len = 1 };
+    union {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    struct msghdr m = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+    struct cmsghdr *c = CMSG_FIRSTHDR(&m);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+    if (sendmsg(sock, &m, MSG_NOSIGNAL) != 1) {
+        munmap(region, sizeof(*region));
+        close_fds(fds, 3);
+        return -1;
+    }
+    close(fds[0]);
+
+    l->region = region;
+    l->tx = &region->ring[SHM_TO_SERVER];
+    l->rx = &region->ring[SHM_TO_CLIENT];
+    l->tx_event = fds[1];
+    l->rx_event = fds[2];
+    return 0;
+}
+
+int shm_link_accept(struct shm_link *l, int sock) {
+    memset(l, 0, sizeof(*l));
+    l->sock = sock;
+
+    char tag = 0;
+    struct iovec iov = { .iov_base = &tag, .iov_len = 1 };
+    union {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } ctl;
+    struct msghdr m = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+    ssize_t r = recvmsg(sock, &m, MSG_CMSG_CLOEXEC);
+
+    int fds[3] = { -1, -1, -1 }, got = 0;
+    for (struct cmsghdr *c = r > 0 ? CMSG_FIRSTHDR(&m) : NULL; c; c = CMSG_NXTHDR(&m, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+            continue;
+        int n = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < n; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if (got < 3)
+                fds[got++] = fd;
+            else
+                close(fd);
+        }
+    }
+    if (r != 1 || tag != SHM_TAG || got != 3 || (m.msg_flags & MSG_CTRUNC)) {
+        close_fds(fds, 3);
+        return -1;
+    }
+
+    // the client keeps its own descriptor, so the mapping is only safe if it can't be shrunk
+    struct stat st;
+    int seals = fcntl(fds[0], F_GET_SEALS);
+    if (fstat(fds[0], &st) < 0 || st.st_size != (off_t)sizeof(struct shm_region) ||
+        seals < 0 || !(seals & F_SEAL_SHRINK) || !(seals & F_SEAL_SEAL)) {
+        close_fds(fds, 3);
+        return -1;
+    }
+
+    struct shm_region *region = mmap(NULL, sizeof(*region), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (region == MAP_FAILED) {
+        close_fds(fds + 1, 2);
+        return -1;
+    }
+    if (region->magic != SHM_MAGIC || region->ring_size != SHM_RING_SIZE) {
+        munmap(region, sizeof(*region));
+        close_fds(fds + 1, 2);
+        return -1;
+    }
+
+    // whatever the client passed as eventfds, a write to them must never block us
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    fcntl(fds[2], F_SETFL, O_NONBLOCK);
+
+    l->region = region;
+    l->rx = &region->ring[SHM_TO_SERVER];
+    l->tx = &region->ring[SHM_TO_CLIENT];
+    l->rx_event = fds[1];
+    l->tx_event = fds[2];
+    l->rx_head = atomic_load(&l->rx->head);
+    l->tx_tail = atomic_load(&l->tx->tail);
+    return 0;
+}
+
+void shm_link_close(struct shm_link *l) {
+    if (!l->region)
+        return;
+    munmap(l->region, sizeof(*l->region));
+    int fds[2] = { l->rx_event, l->tx_event };
+    close_fds(fds, 2);
+    memset(l, 0, sizeof(*l));
+}
+
+int shm_send(struct shm_link *l, const void *buf, size_t len) {
+    struct shm_ring *r = l->tx;
+    if (!r || len > SHM_RING_SIZE)
+        return -1;
+
+    for (int spins = 0;;) {
+        uint64_t used = l->tx_tail - atomic_load_explicit(&r->head, memory_order_acquire);
+        if (used > SHM_RING_SIZE)
+            return -1;
+        if (SHM_RING_SIZE - used >= len)
+            break;
+
+        // full: the reader is behind, stopped or gone
+        if (spins < spin_limit()) {
+            spins++;
+            cpu_relax();
+            continue;
+        }
+        if (peer_gone(l))
+            return -1;
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = SHM_FULL_WAIT_NS };
+        nanosleep(&ts, NULL);
+    }
+
+    copy_in(r, l->tx_tail, buf, len);
+    l->tx_tail += len;
+    atomic_store_explicit(&r->tail, l->tx_tail, memory_order_release);
+
+    // pairs with the fence in the reader's wait: it sees the new tail or we see it waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&r->waiting, memory_order_relaxed)) {
+        uint64_t one = 1;
+        (void)!write(l->tx_event, &one, sizeof(one));
+    }
+    return 0;
+}
+
+// announces a sleeping reader, unless need bytes turned up meanwhile (1)
+static int wait_begin(struct shm_link *l, size_t need) {
+    atomic_store_explicit(&l->rx->waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (readable(l, need) != 0) {
+        atomic_store_explicit(&l->rx->waiting, 0, memory_order_relaxed);
+        return 1;
+    }
+    return 0;
+}
+
+int shm_wait_begin(struct shm_link *l) {
+    return wait_begin(l, PACKET_HEADER_SIZE);
+}
+
+void shm_wait_end(struct shm_link *l) {
+    atomic_store_explicit(&l->rx->waiting, 0, memory_order_relaxed);
+    drain_event(l);
+}
+
+// blocks until need bytes are waiting: 1 once they are, 0 if the peer hung up first, -1 for a damaged ring
+static int wait_readable(struct shm_link *l, size_t need) {
+    for (int spins = 0;;) {
+        int r = readable(l, need);
+        if (r != 0)
+            return r;
+        if (spins < spin_limit()) {
+            spins++;
+            cpu_relax();
+            continue;
+        }
+
+        if (wait_begin(l, need) == 0) {
+            struct pollfd fds[2] = {
+                { .fd = l->rx_event, .events = POLLIN },
+                { .fd = l->sock, .events = POLLIN },
+            };
+            int n = poll(fds, 2, -1);
+            atomic_store_explicit(&l->rx->waiting, 0, memory_order_relaxed);
+            if (n > 0 && fds[0].revents)
+                drain_event(l);
+            // what the peer wrote before leaving is still delivered
+            if (n > 0 && fds[1].revents)
+                return readable(l, need);
+            spins = 0; // woken: more is likely to follow soon
+        }
+    }
+}
+
+ssize_t shm_recv(struct shm_link *l, void *buf, size_t len) {
+    if (len > SHM_RING_SIZE)
+        return -1;
+    int r = wait_readable(l, len);
+    if (r <= 0)
+        return r;
+    copy_out(l->rx, l->rx_head, buf, len);
+    consume(l, len);
+    return (ssize_t)len;
+}
+
+ssize_t shm_packet_recv(struct shm_link *l, struct encrypted_packet *p) {
+    int r = wait_readable(l, PACKET_HEADER_SIZE);
+    if (r <= 0)
+        return r;
+    copy_out(l->rx, l->rx_head, p, PACKET_HEADER_SIZE);
+
+    size_t n = packet_payload_size(p);
+    if (n > sizeof(p->file_data))
+        return -1;
+    // packets are published whole, so the payload is normally there already
+    if (n && wait_readable(l, PACKET_HEADER_SIZE + n) <= 0)
+        return -1;
+    copy_out(l->rx, l->rx_head + PACKET_HEADER_SIZE, (uint8_t *)p + PACKET_HEADER_SIZE, n);
+    consume(l, PACKET_HEADER_SIZE + n);
+    return (ssize_t)(PACKET_HEADER_SIZE + n);
+}
+
+int shm_packet_poll(struct shm_link *l, struct encrypted_packet *p) {
+    int r = readable(l, PACKET_HEADER_SIZE);
+    if (r <= 0)
+        return r;
+    copy_out(l->rx, l->rx_head, p, PACKET_HEADER_SIZE);
+
+    size_t n = packet_payload_size(p);
+    if (n > sizeof(p->file_data))
+        return -1;
+    r = readable(l, PACKET_HEADER_SIZE + n);
+    if (r <= 0)
+        return r;
+    copy_out(l->rx, l->rx_head + PACKET_HEADER_SIZE, (uint8_t *)p + PACKET_HEADER_SIZE, n);
+    consume(l, PACKET_HEADER_SIZE + n);
+    return 1;
+}
@@ -0,0 +1,81 @@
+#ifndef RMS_SHM_RING_H
+#define RMS_SHM_RING_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include "encrypted_packet.h"
+
+#define SHM_MAGIC 0x4d485352u   // "RSHM"
+#define SHM_RING_SIZE (1u << 20) // bytes per direction, a power of two
+#define SHM_SPIN 20000           // empty polls before a reader sleeps on its eventfd (none on one CPU)
+#define SHM_CACHELINE 64
+
+#define SHM_TO_SERVER 0
+#define SHM_TO_CLIENT 1
+
+/*
+ * Shared-memory transport for clients on the same host, offered with
+ * SESSION_FEATURE_SHM over the Unix socket. Straight after its hello the
+ * client creates a sealed memfd holding one ring per direction plus an
+ * eventfd for each, and passes all three over the socket. The server's
+ * reply and the client's key and credentials still use the socket;
+ * everything after them travels through the rings in exactly its wire
+ * format, and the socket stays open only so each side notices when the
+ * other goes away.
+ *
+ * Each ring is a single-producer single-consumer byte stream. A packet is
+ * published whole once there is room for all of it, so a reader never
+ * sees part of one. head and tail only grow and sit on their own cache
+ * lines; each side keeps its own index privately and only reads the
+ * peer's, so a misbehaving peer can garble the data but not our position.
+ * A reader that finds its ring empty spins a while, then sets `waiting`
+ * and sleeps on its eventfd. Writers ring the eventfd only for a waiting
+ * reader, so a busy link makes no system calls.
+ */
+struct shm_ring {
+    _Alignas(SHM_CACHELINE) atomic_uint_fast64_t head; // written by the reader
+    _Alignas(SHM_CACHELINE) atomic_uint_fast64_t tail; // written by the writer
+    _Alignas(SHM_CACHELINE) atomic_int waiting;
+    _Alignas(SHM_CACHELINE) uint8_t data[SHM_RING_SIZE];
+};
+
+struct shm_region {
+    uint32_t magic;
+    uint32_t ring_size;
+    struct shm_ring ring[2];
+};
+
+struct shm_link {
+    struct shm_region *region;
+    struct shm_ring *rx, *tx;
+    uint64_t rx_head, tx_tail;
+    int rx_event, tx_event;
+    int sock;
+};
+
+// client side: sets up the region and hands it to the server over sock
+int shm_link_offer(struct shm_link *l, int sock);
+// server side: takes it from sock, -1 if it is missing or not what it claims to be
+int shm_link_accept(struct shm_link *l, int sock);
+void shm_link_close(struct shm_link *l);
+
+// sends the whole buffer, waiting for room; -1 once the peer is gone or the ring is damaged
+int shm_send(struct shm_link *l, const void *buf, size_t len);
+
+// blocks for exactly len bytes: len, 0 once the peer hung up, -1 for a damaged ring
+ssize_t shm_recv(struct shm_link *l, void *buf, size_t len);
+// as packet_recv: bytes read, 0 once the peer hung up, -1 for a malformed packet
+ssize_t shm_packet_recv(struct shm_link *l, struct encrypted_packet *p);
+
+/*
+ * For event loops. shm_packet_poll never blocks: 1 with a packet in p, 0
+ * if none is ready, -1 as above. Before sleeping in poll() on rx_event,
+ * call shm_wait_begin; if it returns 1 a packet arrived meanwhile and the
+ * loop must not sleep. Call shm_wait_end after poll() either way.
+ */
+int shm_packet_poll(struct shm_link *l, struct encrypted_packet *p);
+int shm_wait_begin(struct shm_link *l);
+void shm_wait_end(struct shm_link *l);
+
+#endif //RMS_SHM_RING_H
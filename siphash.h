@@ -0,0 +1,14 @@
+#ifndef RMS_SIPHASH_H
+#define RMS_SIPHASH_H
+#include <stdint.h>
+#include <stddef.h>
+
+#define SIPHASH_KEY_SIZE 16
+
+/*
+ * SipHash-2-4 keyed PRF. Used wherever the server needs to authenticate
+ * data it hands out and later gets back (session tickets).
+ */
+uint64_t siphash24(const uint8_t key[SIPHASH_KEY_SIZE], const void *data, size_t len);
+
+#endif //RMS_SIPHASH_H
@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "timer_wheel.h"
+
+#define SLOTS (1u << TIMER_LEVEL_BITS)
+#define SLOT_MASK (SLOTS - 1)
+#define WHEEL_SPAN (1ull << (TIMER_LEVEL_BITS * TIMER_LEVELS)) // ticks the top level reaches
+
+// each slot is a circular list whose head is a bare timer
+static struct timer slots[TIMER_LEVELS][SLOTS];
+static uint64_t current; // the next tick to run
+static atomic_uint_fast64_t clock_ms;
+static pthread_mutex_t wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t wheel_once = PTHREAD_ONCE_INIT;
+
+static void wheel_init(void) {
+    for (int l = 0; l < TIMER_LEVELS; l++)
+        for (unsigned s = 0; s < SLOTS; s++)
+            slots[l][s].next = slots[l][s].prev = &slots[l][s];
+}
+
+static void unlink_timer(struct timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+    t->armed = 0;
+}
+
+// the level is picked by how far away the timer is, the slot by the matching bits of its expiry
+static void link_timer(struct timer *t) {
+    struct timer *head;
+    if (t->expires <= current) {
+        head = &slots[0][current & SLOT_MASK];
+    } else {
+        uint64_t delta = t->expires - current;
+        if (delta >= WHEEL_SPAN) {
+            t->expires = current + WHEEL_SPAN - 1;
+            delta = WHEEL_SPAN - 1;
+        }
+        int level = 0;
+        while (delta >= (1ull << (TIMER_LEVEL_BITS * (level + 1))))
+            level++;
+        head = &slots[level][(t->expires >> (TIMER_LEVEL_BITS * level)) & SLOT_MASK];
+    }
+
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+    t->armed = 1;
+}
+
+// moves a slot of an upper level down to where its timers now belong
+static unsigned cascade(int level) {
+    unsigned index = (unsigned)(current >> (TIMER_LEVEL_BITS * level)) & SLOT_MASK;
+    struct timer *head = &slots[level][index];
+
+    while (head->next != head) {
+        struct timer *t = head->next;
+        unlink_timer(t);
+        link_timer(t);
+    }
+    return index;
+}
+
+static void arm_locked(struct timer *t, unsigned ms) {
+    if (t->armed)
+        unlink_timer(t);
+    t->expires = current + (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    link_timer(t);
+}
+
+static void run_tick(void) {
+    unsigned index = (unsigned)current & SLOT_MASK;
+    for (int level = 1; index == 0 && level < TIMER_LEVELS; level++)
+        index = cascade(level);
+
+    // detached first: a callback re-armed 63 ticks out lands in this same slot
+    struct timer *slot = &slots[0][current & SLOT_MASK], due;
+    due.next = due.prev = &due;
+    if (slot->next != slot) {
+        due.next = slot->next;
+        due.prev = slot->prev;
+        due.next->prev = due.prev->next = &due;
+        slot->next = slot->prev = slot;
+    }
+    current++;
+    atomic_store_explicit(&clock_ms, current * TIMER_TICK_MS, memory_order_relaxed);
+
+    while (due.next != &due) {
+        struct timer *t = due.next;
+        unlink_timer(t);
+        unsigned again = t->fn(t);
+        if (again)
+            arm_locked(t, again);
+    }
+}
+
+static void *wheel_thread(void *arg) {
+    (void)arg;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint64_t tick = 1;; tick++) {
+        uint64_t ns = (uint64_t)start.tv_nsec + tick * TIMER_TICK_MS * 1000000ull;
+        struct timespec at = { .tv_sec = start.tv_sec + (time_t)(ns / 1000000000), .tv_nsec = (long)(ns % 1000000000) };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) != 0)
+            ;
+
+        // after a stall every missed tick still runs, in order
+        pthread_mutex_lock(&wheel_lock);
+        while (current < tick)
+            run_tick();
+        pthread_mutex_unlock(&wheel_lock);
+    }
+    return NULL;
+}
+
+int timer_wheel_start(void) {
+    pthread_once(&wheel_once, wheel_init);
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, wheel_thread, NULL) != 0)
+        return -1;
+    pthread_detach(t);
+    return 0;
+}
+
+uint64_t timer_wheel_ms(void) {
+    return atomic_load_explicit(&clock_ms, memory_order_relaxed);
+}
+
+void timer_init(struct timer *t, unsigned (*fn)(struct timer *t)) {
+    t->next = t->prev = NULL;
+    t->expires = 0;
+    t->fn = fn;
+    t->armed = 0;
+}
+
+void timer_arm(struct timer *t, unsigned ms) {
+    pthread_once(&wheel_once, wheel_init);
+    pthread_mutex_lock(&wheel_lock);
+    arm_locked(t, ms);
+    pthread_mutex_unlock(&wheel_lock);
+}
+
+void timer_cancel(struct timer *t) {
+    pthread_mutex_lock(&wheel_lock);
+    if (t->armed)
+        unlink_timer(t);
+    pthread_mutex_unlock(&wheel_lock);
+}
+
+int timer_pending(struct timer *t) {
+    pthread_mutex_lock(&wheel_lock);
+    int armed = t->armed;
+    pthread_mutex_unlock(&wheel_lock);
+    return armed;
+}
@@ -0,0 +1,43 @@
+#ifndef RMS_TIMER_WHEEL_H
+#define RMS_TIMER_WHEEL_H
+#include <stdint.h>
+
+#define TIMER_TICK_MS 100
+#define TIMER_LEVEL_BITS 6
+#define TIMER_LEVELS 4      // 64 slots each: 6.4 s, 6.8 min, 7.3 h, 19 days
+
+/*
+ * Hierarchical timer wheel shared by every connection. Level 0 has one
+ * slot per tick; each level above covers 64 slots of the one below and is
+ * cascaded down a slot at a time as the clock reaches it. Arming,
+ * re-arming and cancelling a timer are O(1), and a tick costs only the
+ * timers that expire in it, however many are pending.
+ *
+ * Callbacks run on the wheel's thread with the wheel locked, so once
+ * timer_cancel returns the callback is neither running nor due. They must
+ * be short and must not call back into the wheel: a callback returns the
+ * milliseconds until it wants to run again, or 0 to stay disarmed. Hand
+ * anything slow to the scheduler.
+ *
+ * Hot paths that only need to note activity store timer_wheel_ms() and
+ * let the timer work out at expiry whether it is really due, which keeps
+ * the wheel lock off the read path.
+ */
+struct timer {
+    struct timer *next, *prev;
+    uint64_t expires;                   // tick
+    unsigned (*fn)(struct timer *t);
+    int armed;
+};
+
+int timer_wheel_start(void);
+// the wheel's clock in ms, advanced every tick; a relaxed load
+uint64_t timer_wheel_ms(void);
+
+void timer_init(struct timer *t, unsigned (*fn)(struct timer *t));
+// (re)arms t to fire in ms, rounded up to whole ticks
+void timer_arm(struct timer *t, unsigned ms);
+void timer_cancel(struct timer *t);
+int timer_pending(struct timer *t);
+
+#endif //RMS_TIMER_WHEEL_H
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "trace.h"
+
+#define TRACE_BUFFER_SIZE (1 << 20)
+#define TRACE_PAYLOAD_MAX (1 << 20) // larger lengths mean a damaged record
+
+static FILE *trace_file;
+static char *trace_buffer;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t started_ns;
+static atomic_uint next_conn;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *flusher(void *arg) {
+    (void)arg;
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = TRACE_FLUSH_MS * 1000000L };
+
+    for (;;) {
+        nanosleep(&ts, NULL);
+        pthread_mutex_lock(&trace_lock);
+        fflush(trace_file);
+        pthread_mutex_unlock(&trace_lock);
+    }
+    return NULL;
+}
+
+int trace_open(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return -1;
+
+    trace_buffer = malloc(TRACE_BUFFER_SIZE);
+    if (trace_buffer)
+        setvbuf(f, trace_buffer, _IOFBF, TRACE_BUFFER_SIZE);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct trace_header h = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .header_size = sizeof(h),
+        .started_at = (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000,
+    };
+    if (fwrite(&h, sizeof(h), 1, f) != 1 || fflush(f) != 0) {
+        fclose(f);
+        return -1;
+    }
+
+    started_ns = monotonic_ns();
+    trace_file = f;
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, flusher, NULL) != 0) {
+        trace_file = NULL;
+        fclose(f);
+        return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
+
+int trace_enabled(void) {
+    return trace_file != NULL;
+}
+
+uint64_t trace_now_us(void) {
+    return (monotonic_ns() - started_ns) / 1000;
+}
+
+uint32_t trace_conn_id(void) {
+    return atomic_fetch_add(&next_conn, 1) + 1;
+}
+
+void trace_write(const struct trace_record *rec, const void *a, size_t alen, const void *b, size_t blen) {
+    if (!trace_file)
+        return;
+
+    static const uint8_t zeros[8];
+    struct trace_record r = *rec;
+    r.len = (uint32_t)(alen + blen);
+    r.reserved = 0;
+    r.pad = 0;
+    size_t padding = (8 - r.len % 8) % 8;
+
+    pthread_mutex_lock(&trace_lock);
+    fwrite(&r, sizeof(r), 1, trace_file);
+    if (alen)
+        fwrite(a, 1, alen, trace_file);
+    if (blen)
+        fwrite(b, 1, blen, trace_file);
+    if (padding)
+        fwrite(zeros, 1, padding, trace_file);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+int trace_read_open(struct trace_reader *r, const char *path) {
+    r->f = fopen(path, "rb");
+    if (!r->f)
+        return -1;
+
+    if (fread(&r->header, sizeof(r->header), 1, r->f) != 1 || r->header.magic != TRACE_MAGIC ||
+        r->header.version != TRACE_VERSION || r->header.header_size < sizeof(r->header) ||
+        fseek(r->f, r->header.header_size, SEEK_SET) != 0) {
+        fclose(r->f);
+        r->f = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int trace_next(struct trace_reader *r, struct trace_record *rec, uint8_t **payload) {
+    *payload = NULL;
+    size_t got = fread(rec, 1, sizeof(*rec), r->f);
+    if (got == 0)
+        return 0;
+    if (got != sizeof(*rec) || rec->len > TRACE_PAYLOAD_MAX)
+        return -1;
+
+    size_t padded = (rec->len + 7) & ~(size_t)7;
+    uint8_t *buf = malloc(padded + 1);
+    if (!buf)
+        return -1;
+    if (padded && fread(buf, 1, padded, r->f) != padded) {
+        free(buf);
+        return -1;
+    }
+    buf[rec->len] = '\0';
+    *payload = buf;
+    return 1;
+}
+
+void trace_read_close(struct trace_reader *r) {
+    if (r->f)
+        fclose(r->f);
+    r->f = NULL;
+}
@@ -0,0 +1,79 @@
+#ifndef RMS_TRACE_H
+#define RMS_TRACE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Capture file for replaying a server's inbound traffic (see replay.c).
+ *
+ * trace_header, then records back to back: a trace_record followed by len
+ * payload bytes padded to 8. Records hold what the server decoded, not
+ * what was on the wire, so a trace does not depend on the RSA keys of the
+ * run that produced it. Times are microseconds since the capture started;
+ * records of different connections may be slightly out of time order.
+ */
+#define TRACE_MAGIC 0x43525452u // "RTRC"
+#define TRACE_VERSION 1
+#define TRACE_FLUSH_MS 100      // buffered records reach the file at least this often
+
+#define TRACE_LOGIN 1       // payload: username
+#define TRACE_COMMAND 2     // payload: the decrypted command text
+#define TRACE_FILE 3        // payload: trace_file_chunk, then the chunk as received
+#define TRACE_LOGOUT 4
+#define TRACE_CHANNEL 5     // channel_id was created (or existed at start) under the name in the payload
+
+struct trace_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t started_at;    // unix time, microseconds
+};
+
+struct trace_record {
+    uint64_t t_us;
+    uint64_t channel_id;
+    uint64_t msg_id;
+    uint32_t conn;          // one id per login, so a reconnect is a new connection
+    uint32_t len;
+    uint16_t command_type;
+    uint8_t kind;
+    uint8_t reserved;
+    uint32_t pad;
+};
+
+struct trace_file_chunk {
+    uint64_t file_size;
+    uint32_t chunk_index;
+    uint32_t total_chunks;
+    uint8_t codec;
+    char file_name[256];
+};
+
+/*
+ * Writer: one trace per process. trace_write may be called from any
+ * thread; records are buffered and a background thread flushes them every
+ * TRACE_FLUSH_MS. The payload is given in two parts so a file chunk does
+ * not have to be copied behind its metadata.
+ */
+int trace_open(const char *path);
+int trace_enabled(void);
+uint64_t trace_now_us(void);
+uint32_t trace_conn_id(void);
+void trace_write(const struct trace_record *rec, const void *a, size_t alen, const void *b, size_t blen);
+
+/*
+ * Reader: trace_next returns 1 with the record and a malloc'd payload
+ * (NUL-terminated, so text can be used as is), 0 at the end and -1 for a
+ * damaged or truncated record.
+ */
+struct trace_reader {
+    FILE *f;
+    struct trace_header header;
+};
+
+int trace_read_open(struct trace_reader *r, const char *path);
+int trace_next(struct trace_reader *r, struct trace_record *rec, uint8_t **payload);
+void trace_read_close(struct trace_reader *r);
+
+#endif //RMS_TRACE_H
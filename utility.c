@@ -1,17 +1,169 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include "utility.h"
-
-void flush_buffer(void) {
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF);
-}
-
-uint64_t generate_uuid(int length) {
-    uint64_t uuid = 0;
-    for (int i = 0; i < length; i++) {
-        uuid = uuid * 10 + (rand() % 10);
-    }
-
-    return uuid;
-}
\ No newline at end of file
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "utility.h"
+#include "siphash.h"
+
+#define ID_SHARD_MASK ((1u << ID_SHARD_BITS) - 1)
+#define ID_SEQ_MASK ((1u << ID_SEQ_BITS) - 1)
+
+// kept per shard rather than per thread, so a reused shard carries on where it left off
+struct id_state {
+    int taken;
+    uint64_t last_ms;
+    uint32_t seq;
+};
+
+static pthread_mutex_t shard_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shard_key;
+static unsigned shard_base;
+static unsigned shard_count = ID_SHARD_MASK + 1;
+static int shard_base_set;
+static struct id_state shard_state[ID_SHARD_MASK + 1];
+static _Thread_local struct id_state *id_state;
+static _Thread_local unsigned id_shard;
+
+void flush_buffer(void) {
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Each thread that mints ids holds one shard from the process range until
+ * it exits, when the shard goes back to be reused. Without an explicit
+ * range the process gets all shards from a base derived from the pid, so
+ * that separate processes (clients, several servers) are unlikely to
+ * share shards.
+ */
+void id_set_shard_range(unsigned base, unsigned count) {
+    pthread_mutex_lock(&shard_lock);
+    shard_base = base & ID_SHARD_MASK;
+    shard_count = count == 0 || count > ID_SHARD_MASK + 1 ? ID_SHARD_MASK + 1 : count;
+    shard_base_set = 1;
+    pthread_mutex_unlock(&shard_lock);
+}
+
+static void release_shard(void *slot) {
+    pthread_mutex_lock(&shard_lock);
+    shard_state[(uintptr_t)slot - 1].taken = 0;
+    pthread_mutex_unlock(&shard_lock);
+}
+
+static void shard_key_init(void) {
+    pthread_key_create(&shard_key, release_shard);
+}
+
+static struct id_state *claim_shard(void) {
+    pthread_once(&shard_once, shard_key_init);
+    pthread_mutex_lock(&shard_lock);
+    if (!shard_base_set) {
+        shard_base = ((unsigned)getpid() * 37u) & ID_SHARD_MASK;
+        shard_base_set = 1;
+    }
+    unsigned slot = 0;
+    while (slot < shard_count && shard_state[slot].taken)
+        slot++;
+    if (slot == shard_count) {
+        // a second thread on a live shard would mint duplicate ids
+        fprintf(stderr, "[ERROR] All %u id shards are in use; refusing to share one\n", shard_count);
+        abort();
+    }
+    shard_state[slot].taken = 1;
+    id_shard = (shard_base + slot) & ID_SHARD_MASK;
+    pthread_mutex_unlock(&shard_lock);
+
+    pthread_setspecific(shard_key, (void *)(uintptr_t)(slot + 1));
+    return &shard_state[slot];
+}
+
+uint64_t generate_id(void) {
+    if (!id_state)
+        id_state = claim_shard();
+    struct id_state *s = id_state;
+
+    uint64_t ms = now_ms() - ID_EPOCH_MS;
+    if (ms > s->last_ms) {
+        s->last_ms = ms;
+        s->seq = 0;
+    } else if (++s->seq > ID_SEQ_MASK) {
+        // sequence exhausted (or clock stepped back): borrow the next ms
+        s->last_ms++;
+        s->seq = 0;
+    }
+
+    return (s->last_ms << (ID_SHARD_BITS + ID_SEQ_BITS)) |
+           ((uint64_t)id_shard << ID_SEQ_BITS) |
+           s->seq;
+}
+
+uint64_t id_timestamp_ms(uint64_t id) {
+    return (id >> (ID_SHARD_BITS + ID_SEQ_BITS)) + ID_EPOCH_MS;
+}
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ 0x82f63b78u : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *p = data;
+
+    pthread_once(&crc_once, crc_table_init);
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint64_t password_digest(uint64_t salt, const char *password) {
+    uint8_t key[SIPHASH_KEY_SIZE] = "rms-password-v1";
+    memcpy(key, &salt, 6);
+
+    // stretched, so each guess against a leaked hash costs thousands of rounds
+    uint64_t h = siphash24(key, password, strlen(password));
+    for (int i = 1; i < PASSWORD_HASH_ROUNDS; i++)
+        h = siphash24(key, &h, sizeof(h));
+    return h;
+}
+
+int password_hash(const char *password, char *out, size_t size) {
+    uint64_t salt = 0;
+    if (size <= PASSWORD_HASH_LEN || getrandom(&salt, 6, 0) != 6)
+        return -1;
+    snprintf(out, size, "$%012" PRIx64 "$%016" PRIx64, salt, password_digest(salt, password));
+    return 0;
+}
+
+int password_is_hashed(const char *stored) {
+    return strlen(stored) == PASSWORD_HASH_LEN && stored[0] == '$' && stored[13] == '$';
+}
+
+int password_matches(const char *stored, const char *password) {
+    if (!password_is_hashed(stored))
+        return strcmp(stored, password) == 0;
+
+    uint64_t salt = strtoull(stored + 1, NULL, 16);
+    uint64_t want = strtoull(stored + 14, NULL, 16);
+    return password_digest(salt, password) == want;
+}
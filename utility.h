@@ -1,8 +1,37 @@
-#ifndef RMS_UTILITY_H
-#define RMS_UTILITY_H
-#include <stdint.h>
-
-void flush_buffer(void);
-uint64_t generate_uuid(int length);
-
-#endif //RMS_UTILITY_H
\ No newline at end of file
+#ifndef RMS_UTILITY_H
+#define RMS_UTILITY_H
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * 64-bit time-ordered ids (Snowflake layout):
+ * [ 0 | 41 bits ms since ID_EPOCH_MS | 10 bits shard | 12 bits sequence ]
+ * Each thread owns a shard and its own sequence, so no locking is needed;
+ * the shard is returned for reuse when the thread exits.
+ */
+#define ID_EPOCH_MS 1735689600000ULL // 2025-01-01T00:00:00Z
+#define ID_SHARD_BITS 10
+#define ID_SEQ_BITS 12
+
+void flush_buffer(void);
+uint64_t generate_id(void);
+uint64_t id_timestamp_ms(uint64_t id);
+// limits this process to shards [base, base + count), mod the shard space
+void id_set_shard_range(unsigned base, unsigned count);
+
+// CRC-32C (Castagnoli); pass 0 as crc to start, or a previous result to continue
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/*
+ * Salted password hashes, "$<12 hex salt>$<16 hex hash>", short enough for
+ * a credential field and free of spaces for the credentials file. They are
+ * what a replica receives in place of the password; password_matches
+ * accepts either form as the stored one.
+ */
+#define PASSWORD_HASH_LEN 30
+#define PASSWORD_HASH_ROUNDS 4096
+int password_hash(const char *password, char *out, size_t size);
+int password_is_hashed(const char *stored);
+int password_matches(const char *stored, const char *password);
+
+#endif //RMS_UTILITY_H
@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "wire.h"
+#include "rsa.h"
+#include "bitpack.h"
+
+#define SYMBOL_CHUNK 64 // symbols per pass; a multiple of 8 keeps every chunk byte-aligned
+
+// CMD_GROUP_KEY names an epoch but its payload (the key) is RSA-wrapped
+int packet_is_sealed(const struct encrypted_packet *p) {
+    return p->key_epoch != 0 && p->command_type != CMD_GROUP_KEY;
+}
+
+size_t packet_payload_size(const struct encrypted_packet *p) {
+    if (p->command_type == CMD_FILE_TRANSFER || packet_is_sealed(p))
+        return p->len;
+    return bitpack_bytes(p->len, p->symbol_bits);
+}
+
+size_t packet_wire_size(const struct encrypted_packet *p) {
+    size_t n = packet_payload_size(p);
+    if (n > sizeof(p->file_data))
+        n = sizeof(p->file_data);
+    return PACKET_HEADER_SIZE + n;
+}
+
+ssize_t packet_send(int fd, const struct encrypted_packet *p) {
+    return send(fd, p, packet_wire_size(p), MSG_NOSIGNAL);
+}
+
+ssize_t packet_encrypt(struct encrypted_packet *p, const char *text, long e, long n) {
+    unsigned width = bitpack_width(n);
+    if (width == 0)
+        return -1;
+
+    size_t count = 0;
+    while (count < MAX_ENCRYPTED_PAYLOAD && text[count]) {
+        long chunk[SYMBOL_CHUNK];
+        size_t want = MAX_ENCRYPTED_PAYLOAD - count < SYMBOL_CHUNK ? MAX_ENCRYPTED_PAYLOAD - count : SYMBOL_CHUNK;
+        size_t k = encrypt_into(text + count, e, n, chunk, want);
+        bitpack_pack(chunk, k, width, p->encrypted_payload + bitpack_bytes(count, width));
+        count += k;
+    }
+
+    p->symbol_bits = (uint8_t)width;
+    p->len = (uint32_t)count;
+    return (ssize_t)count;
+}
+
+ssize_t packet_decrypt(const struct encrypted_packet *p, long d, long n, char *out, size_t cap) {
+    unsigned width = p->symbol_bits;
+    if (cap == 0 || p->len > MAX_ENCRYPTED_PAYLOAD || (p->len && (width == 0 || width > BITPACK_MAX_WIDTH)))
+        return -1;
+
+    size_t count = p->len < cap - 1 ? p->len : cap - 1;
+    out[0] = '\0';
+    for (size_t done = 0; done < count;) {
+        long chunk[SYMBOL_CHUNK];
+        size_t k = count - done < SYMBOL_CHUNK ? count - done : SYMBOL_CHUNK;
+        bitpack_unpack(p->encrypted_payload + bitpack_bytes(done, width), k, width, chunk);
+        decrypt_into(chunk, k, d, n, out + done, k + 1);
+        done += k;
+    }
+    return (ssize_t)count;
+}
+
+ssize_t packet_recv(int fd, struct encrypted_packet *p) {
+    ssize_t r = recv(fd, p, PACKET_HEADER_SIZE, MSG_WAITALL);
+    if (r <= 0)
+        return r;
+    if ((size_t)r != PACKET_HEADER_SIZE)
+        return -1;
+
+    size_t n = packet_payload_size(p);
+    if (n > sizeof(p->file_data))
+        return -1;
+    if (n == 0)
+        return r;
+
+    ssize_t b = recv(fd, (uint8_t *)p + PACKET_HEADER_SIZE, n, MSG_WAITALL);
+    if (b != (ssize_t)n)
+        return -1;
+    return r + b;
+}
+
+void packet_reader_reset(struct packet_reader *r) {
+    r->have = 0;
+}
+
+int packet_reader_fill(struct packet_reader *r, int fd) {
+    // a packet handed out by the previous call has been consumed by now
+    if (r->have >= PACKET_HEADER_SIZE && r->have == packet_wire_size(&r->p))
+        r->have = 0;
+
+    for (;;) {
+        size_t want = PACKET_HEADER_SIZE;
+        if (r->have >= PACKET_HEADER_SIZE) {
+            size_t n = packet_payload_size(&r->p);
+            if (n > sizeof(r->p.file_data))
+                return -1;
+            want += n;
+        }
+        if (r->have == want)
+            return 1;
+
+        ssize_t n = recv(fd, (uint8_t *)&r->p + r->have, want - r->have, MSG_DONTWAIT);
+        if (n == 0)
+            return -1;
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        r->have += (size_t)n;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef RMS_WIRE_H
+#define RMS_WIRE_H
+#include <stddef.h>
+#include <sys/types.h>
+#include "encrypted_packet.h"
+
+#define PACKET_HEADER_SIZE offsetof(struct encrypted_packet, encrypted_payload)
+
+/*
+ * Packets go on the wire as the fixed header followed by only the used part
+ * of the payload union, so a short chat line costs a few hundred bytes
+ * instead of the whole struct. The receiver sizes the payload from the
+ * header it has already read.
+ */
+int packet_is_sealed(const struct encrypted_packet *p);
+size_t packet_payload_size(const struct encrypted_packet *p);
+size_t packet_wire_size(const struct encrypted_packet *p);
+
+ssize_t packet_send(int fd, const struct encrypted_packet *p);
+
+/*
+ * RSA payloads: packet_encrypt encrypts text (up to MAX_ENCRYPTED_PAYLOAD
+ * characters) for the holder of (e, n) into p's payload, bit-packed at the
+ * width n needs, and sets len and symbol_bits. It returns the characters
+ * taken, or -1 for a modulus no symbol width fits (see bitpack_width), in
+ * which case p is left alone and must not be sent. packet_decrypt writes at most cap - 1 characters plus the
+ * terminator and returns their count, or -1 for a malformed payload. Both
+ * work through a small stack buffer and never allocate.
+ */
+ssize_t packet_encrypt(struct encrypted_packet *p, const char *text, long e, long n);
+ssize_t packet_decrypt(const struct encrypted_packet *p, long d, long n, char *out, size_t cap);
+
+// returns the bytes read, 0 on EOF, -1 on error or a malformed header
+ssize_t packet_recv(int fd, struct encrypted_packet *p);
+
+/*
+ * Incremental reader for event loops: packet_reader_fill takes whatever
+ * the socket has without blocking and returns 1 once r->p holds a whole
+ * packet, 0 if it needs more bytes, -1 on EOF, error or a malformed
+ * header. Reads never run past the current packet, so after a 1 the
+ * caller handles r->p and calls fill again for the next one.
+ */
+struct packet_reader {
+    struct encrypted_packet p;
+    size_t have;
+};
+
+void packet_reader_reset(struct packet_reader *r);
+int packet_reader_fill(struct packet_reader *r, int fd);
+
+#endif //RMS_WIRE_H